@@ -0,0 +1,18 @@
+#version 460
+
+// Writes the rendered corner of the input into the swapchain image, the attachment's format does the conversion.
+// At one input texel per pixel every sample lands on a texel centre and is an exact copy, otherwise it filters like the blit did.
+
+layout(set = 0, binding = 0) uniform sampler2D inputImage;
+
+layout(location = 0) out vec4 outColor;
+
+layout( push_constant ) uniform constants {
+    vec2 inputScale;    // Input texels per output pixel
+    vec2 inputLimit;    // Centre of the last valid texel
+} PushConstants;
+
+void main(){
+    vec2 texel = min(gl_FragCoord.xy * PushConstants.inputScale, PushConstants.inputLimit);
+    outColor = vec4(textureLod(inputImage, texel / vec2(textureSize(inputImage, 0)), 0.0).rgb, 1.0);
+}
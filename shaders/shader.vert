@@ -1,5 +1,6 @@
 #version 450
 #extension GL_EXT_buffer_reference : require
+#extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 
 layout (location = 0) out vec4 outColor;
 layout (location = 1) out vec2 outUV;
@@ -24,18 +25,65 @@ layout(buffer_reference, std430) readonly buffer VertexBuffer{
 	Vertex vertices[];
 };
 
+// CompactVertex: unorm16 position, octahedral snorm8 normal, half uv, unorm8 color
+layout(buffer_reference, std430) readonly buffer CompactVertexBuffer{
+	uvec4 vertices[];
+};
+
+// Per frame data the draws read through the address in the push constants, see FrameConstants in structs.h
+layout(buffer_reference, std430) readonly buffer FrameConstants{
+	mat4 viewProj;
+};
+
 layout(push_constant) uniform constants{
-	mat4 renderMatrix;
-	VertexBuffer vertexBuffer;
+	mat3x4 transformRows;	// First three rows of the draw's transform
+	uint64_t vertexBuffer;
+	uint64_t frameConstants;
+	uint vertexFormat;
+	uint padding[3];
+	vec4 positionMin;
+	vec4 positionExtent;
 } PushConstants;
 
+mat4 drawTransform(){
+	return transpose(mat4(PushConstants.transformRows[0], PushConstants.transformRows[1], PushConstants.transformRows[2], vec4(0.0, 0.0, 0.0, 1.0)));
+}
+
+vec3 octahedralDecode(vec2 e){
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = max(-n.z, 0.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+Vertex fetchVertex(uint index){
+	if(PushConstants.vertexFormat == 0)
+		return VertexBuffer(PushConstants.vertexBuffer).vertices[index];
+
+	uvec4 encoded = CompactVertexBuffer(PushConstants.vertexBuffer).vertices[index];
+
+	vec3 quantized = vec3(encoded.x & 0xffff, encoded.x >> 16, encoded.y & 0xffff) / 65535.0;
+	vec2 uv = unpackHalf2x16(encoded.z);
+
+	Vertex v;
+	v.position = PushConstants.positionMin.xyz + quantized * PushConstants.positionExtent.xyz;
+	v.normal = octahedralDecode(unpackSnorm4x8(encoded.y >> 16).xy);
+	v.uvX = uv.x;
+	v.uvY = uv.y;
+	v.color = unpackUnorm4x8(encoded.w);
+
+	return v;
+}
+
 void main() 
 {
 	//Vertices uploaded and called from teh address in PushConstants
-	Vertex v = PushConstants.vertexBuffer.vertices[gl_VertexIndex];
+	Vertex v = fetchVertex(gl_VertexIndex);
 
 	//Basically Proj * view * position
-	gl_Position = PushConstants.renderMatrix * modelMatrix * vec4(v.position, 1.0f);
+	mat4 viewProj = FrameConstants(PushConstants.frameConstants).viewProj;
+	gl_Position = viewProj * drawTransform() * modelMatrix * vec4(v.position, 1.0f);
 	outColor = v.color;
 	outUV = vec2(v.uvX, v.uvY);
 }
@@ -0,0 +1,44 @@
+#version 450
+
+// Samples the virtual texture through the indirection texture, see virtualTexture.h
+
+layout (location = 0) in vec4 inColor;
+layout (location = 1) in vec2 inUV;
+
+layout (location = 0) out vec4 outFragColor;
+
+layout(set = 1, binding = 0) uniform usampler2D indirection;
+layout(set = 1, binding = 1) uniform sampler2D pageCache;
+
+layout(set = 1, binding = 2) uniform VirtualTextureParams {
+	vec4 virtualSize;	// xy mip 0 size in texels, zw uv scale onto the source image
+	uvec4 pageGrid;		// xy pages at mip 0, z mip count, w page size
+	vec4 cache;			// x page stride, y border, z 1 / cache size, w feedback lod bias
+} vt;
+
+void main() 
+{
+	// Derivatives of the unwrapped uvs, fract() would spike them at the seams
+	vec2 texel = inUV * vt.virtualSize.zw * vt.virtualSize.xy;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+
+	uint mip = uint(clamp(lod, 0.0, float(vt.pageGrid.z - 1u)));
+	vec2 uv = fract(inUV) * vt.virtualSize.zw;
+
+	uvec2 pages = max(vt.pageGrid.xy >> mip, uvec2(1u));
+	uvec2 page = min(uvec2(uv * vec2(pages)), pages - 1u);
+
+	uint entry = texelFetch(indirection, ivec2(page), int(mip)).r;
+	uint residentMip = (entry >> 16) & 0xffu;
+	vec2 slot = vec2(entry & 0xffu, (entry >> 8) & 0xffu);
+
+	// Position inside the resident page, which may be an ancestor covering a larger area
+	vec2 mipSize = max(vt.virtualSize.xy / exp2(float(residentMip)), vec2(1.0));
+	vec2 mipTexel = uv * mipSize;
+	vec2 inPage = mipTexel - floor(mipTexel / float(vt.pageGrid.w)) * float(vt.pageGrid.w);
+
+	vec2 cacheTexel = slot * vt.cache.x + vt.cache.y + inPage;
+
+	outFragColor = textureLod(pageCache, cacheTexel * vt.cache.z, 0.0) * inColor;
+}
@@ -0,0 +1,30 @@
+#version 450
+
+// Writes the virtual texture page and mip every pixel needs, read back on the CPU by VirtualTexture::processFeedback
+
+layout (location = 0) in vec4 inColor;
+layout (location = 1) in vec2 inUV;
+
+layout (location = 0) out uint outRequest;
+
+layout(set = 1, binding = 2) uniform VirtualTextureParams {
+	vec4 virtualSize;
+	uvec4 pageGrid;
+	vec4 cache;
+} vt;
+
+void main() 
+{
+	// The target is smaller than the screen, the bias brings the lod back to what the main pass computes
+	vec2 texel = inUV * vt.virtualSize.zw * vt.virtualSize.xy;
+	vec2 dx = dFdx(texel), dy = dFdy(texel);
+	float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy))) + vt.cache.w;
+
+	uint mip = uint(clamp(lod, 0.0, float(vt.pageGrid.z - 1u)));
+	vec2 uv = fract(inUV) * vt.virtualSize.zw;
+
+	uvec2 pages = max(vt.pageGrid.xy >> mip, uvec2(1u));
+	uvec2 page = min(uvec2(uv * vec2(pages)), pages - 1u);
+
+	outRequest = page.x | (page.y << 12) | (mip << 24);
+}
@@ -0,0 +1,284 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "utility.h"
+#include "initializers.h"
+#include "transferQueue.h"
+#include "jobSystem.h"
+#include "gpuTasks.h"
+
+#include <mutex>
+
+struct StreamingStats{
+    size_t requested{0};
+    size_t resident{0};
+    size_t failed{0};
+    size_t uploadedBytes{0};
+    uint32_t batches{0};
+    uint32_t threadCount{0};
+    bool dedicatedTransferQueue{false};
+
+    double decodeMs{0.0};           // Summed over all jobs
+    double firstResidentMs{0.0};    // Since the first request
+    double lastResidentMs{0.0};
+};
+
+// What a decode job hands back: filled staging memory, the buffers it goes into and the copies between them.
+// Everything but makeResident and discarded is touched by its decode job only.
+struct StreamedAsset{
+    struct Copy{
+        uint32_t buffer;    // Into buffers
+        VkBufferCopy region;
+    };
+
+    std::string name;
+    std::string error;
+
+    AllocatedBuffer staging{};
+    std::vector<AllocatedBuffer> buffers;   // Owned by makeResident's target afterwards, destroyed here if that never happens
+    std::vector<Copy> copies;
+
+    // Runs on the render thread once the copies have landed, before anything recorded later in that frame
+    std::function<void()> makeResident;
+
+    // Runs instead when the asset is thrown away, for whatever the decode job created besides the buffers
+    std::function<void()> discarded;
+
+    size_t bytes{0};
+    double decodeMs{0.0};
+};
+
+// Loads assets while the render loop keeps going. Jobs read and decode their source on the job system straight into
+// staging buffers, update() then batches whatever is ready into one submission on the transfer queue.
+// Every batch is a GpuTask that makes its assets resident once the copies have landed, resumed from GpuScheduler::poll
+// after the queue family acquire has been recorded.
+class AssetStreamer{
+public:
+    StreamingStats stats;
+
+    void setup(VmaAllocator allocator, TransferQueue* transfer, JobSystem* jobs, GpuScheduler* gpu){
+        _allocator = allocator;
+        _transfer = transfer;
+        _jobs = jobs;
+        _gpu = gpu;
+
+        stats.threadCount = jobs->threadCount();
+        stats.dedicatedTransferQueue = transfer->dedicated();
+    }
+
+    // Jobs that are still decoding finish first, the ones that haven't started skip their decode. Their results are
+    // thrown away, batches in flight throw theirs away once GpuScheduler::cleanup resumes them.
+    void cleanup(){
+        _stopping = true;
+        _jobs->wait(_decoding);
+
+        for(StreamedAsset& asset: _decoded){
+            discard(asset, true);
+        }
+        _decoded.clear();
+    }
+
+    // decode runs as a job, it fills in the staging buffer, the destination buffers and the copies
+    void request(const std::string& name, std::function<void(StreamedAsset&)>&& decode){
+        if(stats.requested == 0){
+            _startTime = std::chrono::high_resolution_clock::now();
+        }
+
+        stats.requested++;
+        _reported = false;
+
+        _jobs->runBackground([this, name, decode = std::move(decode)](){
+            decodeJob(name, decode);
+        }, &_decoding);
+    }
+
+    // For decode jobs: a destination buffer whose first dataBytes come from the next range of the staging buffer
+    AllocatedBuffer addBuffer(StreamedAsset& asset, size_t size, VkBufferUsageFlags usage, size_t dataBytes){
+        AllocatedBuffer buffer = Utility::createBuffer(_allocator, std::max(size, dataBytes), usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        asset.buffers.push_back(buffer);
+
+        if(dataBytes > 0){
+            VkBufferCopy region{};
+            region.srcOffset = asset.bytes;
+            region.size = dataBytes;
+
+            asset.copies.push_back({static_cast<uint32_t>(asset.buffers.size() - 1), region});
+
+            // Ranges start 16 byte aligned, like everything the decode jobs write into them
+            asset.bytes += (dataBytes + 15) & ~size_t(15);
+        }
+
+        return buffer;
+    }
+
+    // For decode jobs, after the last addBuffer: mapped staging memory with every buffer's range in the order they were added
+    char* createStaging(StreamedAsset& asset){
+        if(asset.bytes == 0)
+            return nullptr;
+
+        asset.staging = Utility::createBuffer(_allocator, asset.bytes, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        return (char*)asset.staging.allocation->GetMappedData();
+    }
+
+    // Once a frame on the render thread, after GpuScheduler::poll
+    void update(){
+        submitDecoded();
+
+        if(!_reported && stats.requested > 0 && finished()){
+            printStats();
+            _reported = true;
+        }
+    }
+
+    // Nothing queued, decoding or in flight
+    bool finished() const {
+        return stats.resident + stats.failed == stats.requested;
+    }
+
+    void imguiInterface(){
+        if(ImGui::Begin("Streaming")){
+            ImGui::Text("%zu / %zu resident, %zu failed", stats.resident, stats.requested, stats.failed);
+            ImGui::Text("%.2fMB in %u batches on the %s queue", double(stats.uploadedBytes) / (1024.0 * 1024.0), stats.batches, stats.dedicatedTransferQueue ? "transfer" : "graphics");
+
+            if(stats.resident > 0){
+                ImGui::Text("First resident after %.2fms, last after %.2fms", stats.firstResidentMs, stats.lastResidentMs);
+            }
+        }
+        ImGui::End();
+    }
+
+    void printStats(){
+        fmt::println("Streaming: {} assets resident, {} failed, {:.2f}MB in {} batches on the {} queue", stats.resident, stats.failed,
+            double(stats.uploadedBytes) / (1024.0 * 1024.0), stats.batches, stats.dedicatedTransferQueue ? "dedicated transfer" : "graphics");
+        fmt::println("    first resident after {:.2f}ms, last after {:.2f}ms, {:.2f}ms decoding on {} threads", stats.firstResidentMs, stats.lastResidentMs, stats.decodeMs, stats.threadCount);
+    }
+
+private:
+    VmaAllocator _allocator;
+    TransferQueue* _transfer;
+    GpuScheduler* _gpu;
+
+    JobSystem* _jobs;
+    JobCounter _decoding;
+
+    std::mutex _mutex;
+    std::deque<StreamedAsset> _decoded;
+    std::atomic<bool> _stopping{false};
+    bool _reported{false};
+
+    std::chrono::high_resolution_clock::time_point _startTime;
+
+    void decodeJob(const std::string& name, const std::function<void(StreamedAsset&)>& decode){
+        if(_stopping)
+            return;
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        StreamedAsset asset;
+        asset.name = name;
+
+        try {
+            decode(asset);
+        } catch(const std::exception& e){
+            asset.error = e.what();
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        asset.decodeMs = elapsed.count();
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _decoded.push_back(std::move(asset));
+    }
+
+    // Records the copies of everything decoded so far into one command buffer for the transfer queue
+    void submitDecoded(){
+        std::vector<StreamedAsset> batch;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            while(!_decoded.empty()){
+                StreamedAsset asset = std::move(_decoded.front());
+                _decoded.pop_front();
+
+                stats.decodeMs += asset.decodeMs;
+
+                if(!asset.error.empty()){
+                    fmt::println("Failed to stream {}: {}", asset.name, asset.error);
+                    discard(asset, true);
+                    stats.failed++;
+                    continue;
+                }
+
+                batch.push_back(std::move(asset));
+            }
+        }
+
+        if(batch.empty())
+            return;
+
+        stats.batches++;
+        _gpu->spawn(uploadBatch(std::move(batch)));
+    }
+
+    GpuTask uploadBatch(std::vector<StreamedAsset> batch){
+        std::vector<VkBuffer> buffers = bufferHandles(batch);
+
+        bool completed = co_await _gpu->submit([&](VkCommandBuffer command){
+            for(StreamedAsset& asset: batch){
+                for(const StreamedAsset::Copy& copy: asset.copies){
+                    vkCmdCopyBuffer(command, asset.staging.buffer, asset.buffers[copy.buffer].buffer, 1, &copy.region);
+                }
+            }
+        }, buffers);
+
+        for(StreamedAsset& asset: batch){
+            discard(asset, !completed);
+        }
+
+        if(!completed)
+            co_return;
+
+        for(StreamedAsset& asset: batch){
+            asset.makeResident();
+
+            stats.resident++;
+            stats.uploadedBytes += asset.bytes;
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - _startTime;
+        stats.lastResidentMs = elapsed.count();
+        if(stats.firstResidentMs == 0.0){
+            stats.firstResidentMs = stats.lastResidentMs;
+        }
+    }
+
+    static std::vector<VkBuffer> bufferHandles(const std::vector<StreamedAsset>& assets){
+        std::vector<VkBuffer> buffers;
+        for(const StreamedAsset& asset: assets){
+            for(const AllocatedBuffer& buffer: asset.buffers){
+                buffers.push_back(buffer.buffer);
+            }
+        }
+        return buffers;
+    }
+
+    // Staging always goes, the destination buffers only when the asset won't become resident
+    void discard(StreamedAsset& asset, bool destroyBuffers){
+        if(asset.staging.buffer != VK_NULL_HANDLE){
+            Utility::destroyBuffer(_allocator, asset.staging);
+            asset.staging = {};
+        }
+
+        if(destroyBuffers){
+            for(AllocatedBuffer& buffer: asset.buffers){
+                Utility::destroyBuffer(_allocator, buffer);
+            }
+            asset.buffers.clear();
+
+            if(asset.discarded){
+                asset.discarded();
+            }
+        }
+    }
+};
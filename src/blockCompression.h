@@ -0,0 +1,418 @@
+#pragma once
+
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// CPU BC1/BC3/BC4/BC5 encoding for the offline KTX2 encoder, and decoding for devices without BC support.
+// The encoder fits the endpoints along the principal axis of each block, which is fast and good enough for
+// albedo and normal maps. BC7 and ASTC need a real encoder (e.g. bc7enc, astcenc), the loader accepts their output.
+namespace BlockCompression{
+    inline bool canEncode(VkFormat format){
+        switch(format){
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+            case VK_FORMAT_BC4_UNORM_BLOCK:
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    // The decoder handles everything the encoder writes, plus BC1 with punch through alpha
+    inline bool canDecode(VkFormat format){
+        return canEncode(format) || format == VK_FORMAT_BC1_RGBA_UNORM_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+    }
+
+    inline bool isSrgb(VkFormat format){
+        return format == VK_FORMAT_BC1_RGB_SRGB_BLOCK || format == VK_FORMAT_BC1_RGBA_SRGB_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK || format == VK_FORMAT_BC7_SRGB_BLOCK;
+    }
+
+    inline uint16_t packRgb565(const float color[3]){
+        uint32_t r = static_cast<uint32_t>(std::clamp(color[0], 0.f, 255.f) * 31.f / 255.f + 0.5f);
+        uint32_t g = static_cast<uint32_t>(std::clamp(color[1], 0.f, 255.f) * 63.f / 255.f + 0.5f);
+        uint32_t b = static_cast<uint32_t>(std::clamp(color[2], 0.f, 255.f) * 31.f / 255.f + 0.5f);
+
+        return static_cast<uint16_t>((r << 11) | (g << 5) | b);
+    }
+
+    inline void unpackRgb565(uint16_t packed, uint8_t color[3]){
+        uint32_t r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+
+        color[0] = static_cast<uint8_t>((r << 3) | (r >> 2));
+        color[1] = static_cast<uint8_t>((g << 2) | (g >> 4));
+        color[2] = static_cast<uint8_t>((b << 3) | (b >> 2));
+    }
+
+    // Color block from 16 RGBA8 texels, alpha is ignored. Always uses the four color mode, as BC3 requires.
+    inline void encodeBC1(const uint8_t texels[16 * 4], uint8_t* block){
+        float mean[3] = {0.f, 0.f, 0.f};
+        for(int i = 0; i < 16; i++){
+            for(int c = 0; c < 3; c++){
+                mean[c] += texels[i * 4 + c] / 16.f;
+            }
+        }
+
+        float covariance[6] = {};
+        for(int i = 0; i < 16; i++){
+            float d[3] = {texels[i * 4] - mean[0], texels[i * 4 + 1] - mean[1], texels[i * 4 + 2] - mean[2]};
+
+            covariance[0] += d[0] * d[0];
+            covariance[1] += d[0] * d[1];
+            covariance[2] += d[0] * d[2];
+            covariance[3] += d[1] * d[1];
+            covariance[4] += d[1] * d[2];
+            covariance[5] += d[2] * d[2];
+        }
+
+        // Power iteration for the principal axis
+        float axis[3] = {1.f, 1.f, 1.f};
+        for(int iteration = 0; iteration < 8; iteration++){
+            float next[3] = {
+                covariance[0] * axis[0] + covariance[1] * axis[1] + covariance[2] * axis[2],
+                covariance[1] * axis[0] + covariance[3] * axis[1] + covariance[4] * axis[2],
+                covariance[2] * axis[0] + covariance[4] * axis[1] + covariance[5] * axis[2],
+            };
+
+            float length = std::max({std::abs(next[0]), std::abs(next[1]), std::abs(next[2])});
+            if(length < 1e-6f)
+                break;
+
+            for(int c = 0; c < 3; c++){
+                axis[c] = next[c] / length;
+            }
+        }
+
+        float minProjection = 0.f, maxProjection = 0.f;
+        for(int i = 0; i < 16; i++){
+            float projection = (texels[i * 4] - mean[0]) * axis[0] + (texels[i * 4 + 1] - mean[1]) * axis[1] + (texels[i * 4 + 2] - mean[2]) * axis[2];
+            minProjection = std::min(minProjection, projection);
+            maxProjection = std::max(maxProjection, projection);
+        }
+
+        float axisLengthSquared = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+        float maxColor[3], minColor[3];
+        for(int c = 0; c < 3; c++){
+            maxColor[c] = mean[c] + axis[c] * maxProjection / axisLengthSquared;
+            minColor[c] = mean[c] + axis[c] * minProjection / axisLengthSquared;
+        }
+
+        uint16_t color0 = packRgb565(maxColor), color1 = packRgb565(minColor);
+        if(color0 < color1){
+            std::swap(color0, color1);
+        }
+
+        uint32_t indices = 0;
+
+        // Equal endpoints would select the three color mode, every texel uses color0 then
+        if(color0 != color1){
+            uint8_t palette[4][3];
+            unpackRgb565(color0, palette[0]);
+            unpackRgb565(color1, palette[1]);
+
+            for(int c = 0; c < 3; c++){
+                palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+                palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+            }
+
+            for(int i = 0; i < 16; i++){
+                int bestIndex = 0, bestError = INT32_MAX;
+
+                for(int p = 0; p < 4; p++){
+                    int error = 0;
+                    for(int c = 0; c < 3; c++){
+                        int d = int(texels[i * 4 + c]) - palette[p][c];
+                        error += d * d;
+                    }
+
+                    if(error < bestError){
+                        bestError = error;
+                        bestIndex = p;
+                    }
+                }
+
+                indices |= uint32_t(bestIndex) << (i * 2);
+            }
+        }
+
+        memcpy(block, &color0, 2);
+        memcpy(block + 2, &color1, 2);
+        memcpy(block + 4, &indices, 4);
+    }
+
+    // Single channel block, stride selects the channel out of RGBA8 texels
+    inline void encodeBC4(const uint8_t* values, int stride, uint8_t* block){
+        uint8_t minValue = 255, maxValue = 0;
+        for(int i = 0; i < 16; i++){
+            minValue = std::min(minValue, values[i * stride]);
+            maxValue = std::max(maxValue, values[i * stride]);
+        }
+
+        block[0] = maxValue;
+        block[1] = minValue;
+
+        uint64_t indices = 0;
+
+        if(maxValue != minValue){
+            uint8_t palette[8] = {maxValue, minValue};
+            for(int p = 2; p < 8; p++){
+                palette[p] = static_cast<uint8_t>(((8 - p) * maxValue + (p - 1) * minValue) / 7);
+            }
+
+            for(int i = 0; i < 16; i++){
+                int bestIndex = 0, bestError = INT32_MAX;
+
+                for(int p = 0; p < 8; p++){
+                    int error = std::abs(int(values[i * stride]) - palette[p]);
+                    if(error < bestError){
+                        bestError = error;
+                        bestIndex = p;
+                    }
+                }
+
+                indices |= uint64_t(bestIndex) << (i * 3);
+            }
+        }
+
+        for(int i = 0; i < 6; i++){
+            block[2 + i] = static_cast<uint8_t>(indices >> (i * 8));
+        }
+    }
+
+    inline void decodeBC1(const uint8_t* block, uint8_t texels[16 * 4], bool forceFourColor){
+        uint16_t color0, color1;
+        uint32_t indices;
+        memcpy(&color0, block, 2);
+        memcpy(&color1, block + 2, 2);
+        memcpy(&indices, block + 4, 4);
+
+        uint8_t palette[4][4];
+        unpackRgb565(color0, palette[0]);
+        unpackRgb565(color1, palette[1]);
+        palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 255;
+
+        for(int c = 0; c < 3; c++){
+            if(color0 > color1 || forceFourColor){
+                palette[2][c] = static_cast<uint8_t>((2 * palette[0][c] + palette[1][c]) / 3);
+                palette[3][c] = static_cast<uint8_t>((palette[0][c] + 2 * palette[1][c]) / 3);
+            } else {
+                palette[2][c] = static_cast<uint8_t>((palette[0][c] + palette[1][c]) / 2);
+                palette[3][c] = 0;
+            }
+        }
+
+        if(color0 <= color1 && !forceFourColor){
+            palette[3][3] = 0;
+        }
+
+        for(int i = 0; i < 16; i++){
+            memcpy(texels + i * 4, palette[(indices >> (i * 2)) & 3], 4);
+        }
+    }
+
+    inline void decodeBC4(const uint8_t* block, uint8_t* values, int stride){
+        uint8_t palette[8] = {block[0], block[1]};
+
+        if(block[0] > block[1]){
+            for(int p = 2; p < 8; p++){
+                palette[p] = static_cast<uint8_t>(((8 - p) * block[0] + (p - 1) * block[1]) / 7);
+            }
+        } else {
+            for(int p = 2; p < 6; p++){
+                palette[p] = static_cast<uint8_t>(((6 - p) * block[0] + (p - 1) * block[1]) / 5);
+            }
+            palette[6] = 0;
+            palette[7] = 255;
+        }
+
+        uint64_t indices = 0;
+        for(int i = 0; i < 6; i++){
+            indices |= uint64_t(block[2 + i]) << (i * 8);
+        }
+
+        for(int i = 0; i < 16; i++){
+            values[i * stride] = palette[(indices >> (i * 3)) & 7];
+        }
+    }
+
+    // Encodes the block rows [firstRow, firstRow + rowCount) of an RGBA8 image into dst, which holds the whole level.
+    // Rows are independent so the caller can spread them over threads.
+    inline void encodeRows(VkFormat format, const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t firstRow, uint32_t rowCount, uint8_t* dst){
+        uint32_t blocksX = (width + 3) / 4;
+        size_t blockBytes = (format == VK_FORMAT_BC3_UNORM_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK || format == VK_FORMAT_BC5_UNORM_BLOCK) ? 16 : 8;
+
+        uint8_t texels[16 * 4];
+
+        for(uint32_t by = firstRow; by < firstRow + rowCount; by++){
+            for(uint32_t bx = 0; bx < blocksX; bx++){
+                // Edge blocks repeat the last row and column
+                for(uint32_t y = 0; y < 4; y++){
+                    for(uint32_t x = 0; x < 4; x++){
+                        uint32_t px = std::min(bx * 4 + x, width - 1), py = std::min(by * 4 + y, height - 1);
+                        memcpy(texels + (y * 4 + x) * 4, pixels + (size_t(py) * width + px) * 4, 4);
+                    }
+                }
+
+                uint8_t* block = dst + (size_t(by) * blocksX + bx) * blockBytes;
+
+                switch(format){
+                    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+                    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                        encodeBC1(texels, block);
+                        break;
+                    case VK_FORMAT_BC3_UNORM_BLOCK:
+                    case VK_FORMAT_BC3_SRGB_BLOCK:
+                        encodeBC4(texels + 3, 4, block);
+                        encodeBC1(texels, block + 8);
+                        break;
+                    case VK_FORMAT_BC4_UNORM_BLOCK:
+                        encodeBC4(texels, 4, block);
+                        break;
+                    case VK_FORMAT_BC5_UNORM_BLOCK:
+                        encodeBC4(texels, 4, block);
+                        encodeBC4(texels + 1, 4, block + 8);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+    }
+
+    // Expands a whole level to RGBA8. Missing channels are 0, alpha defaults to 255.
+    inline void decode(VkFormat format, const uint8_t* src, uint32_t width, uint32_t height, uint8_t* pixels){
+        uint32_t blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        size_t blockBytes = (format == VK_FORMAT_BC3_UNORM_BLOCK || format == VK_FORMAT_BC3_SRGB_BLOCK || format == VK_FORMAT_BC5_UNORM_BLOCK) ? 16 : 8;
+
+        uint8_t texels[16 * 4];
+
+        for(uint32_t by = 0; by < blocksY; by++){
+            for(uint32_t bx = 0; bx < blocksX; bx++){
+                const uint8_t* block = src + (size_t(by) * blocksX + bx) * blockBytes;
+
+                switch(format){
+                    case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+                    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+                        decodeBC1(block, texels, false);
+                        for(int i = 0; i < 16; i++){
+                            texels[i * 4 + 3] = 255;
+                        }
+                        break;
+                    case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+                    case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+                        decodeBC1(block, texels, false);
+                        break;
+                    case VK_FORMAT_BC3_UNORM_BLOCK:
+                    case VK_FORMAT_BC3_SRGB_BLOCK:
+                        decodeBC1(block + 8, texels, true);
+                        decodeBC4(block, texels + 3, 4);
+                        break;
+                    case VK_FORMAT_BC4_UNORM_BLOCK:
+                        memset(texels, 0, sizeof(texels));
+                        decodeBC4(block, texels, 4);
+                        for(int i = 0; i < 16; i++){
+                            texels[i * 4 + 3] = 255;
+                        }
+                        break;
+                    case VK_FORMAT_BC5_UNORM_BLOCK:
+                        memset(texels, 0, sizeof(texels));
+                        decodeBC4(block, texels, 4);
+                        decodeBC4(block + 8, texels + 1, 4);
+                        for(int i = 0; i < 16; i++){
+                            texels[i * 4 + 3] = 255;
+                        }
+                        break;
+                    default:
+                        memset(texels, 0, sizeof(texels));
+                        break;
+                }
+
+                for(uint32_t y = 0; y < 4 && by * 4 + y < height; y++){
+                    for(uint32_t x = 0; x < 4 && bx * 4 + x < width; x++){
+                        memcpy(pixels + ((size_t(by) * 4 + y) * width + bx * 4 + x) * 4, texels + (y * 4 + x) * 4, 4);
+                    }
+                }
+            }
+        }
+    }
+
+    // 2x2 box filter for building mip chains offline. sRGB data is averaged in linear space.
+    inline std::vector<uint8_t> downsample(const std::vector<uint8_t>& pixels, uint32_t width, uint32_t height, bool srgb){
+        uint32_t halfWidth = std::max(width / 2, 1u), halfHeight = std::max(height / 2, 1u);
+        std::vector<uint8_t> result(size_t(halfWidth) * halfHeight * 4);
+
+        static const std::vector<float> toLinear = []{
+            std::vector<float> table(256);
+            for(int i = 0; i < 256; i++){
+                float c = i / 255.f;
+                table[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+            }
+            return table;
+        }();
+
+        auto toSrgb = [](float c){
+            c = c <= 0.0031308f ? c * 12.92f : 1.055f * std::pow(c, 1.f / 2.4f) - 0.055f;
+            return static_cast<uint8_t>(std::clamp(c * 255.f + 0.5f, 0.f, 255.f));
+        };
+
+        for(uint32_t y = 0; y < halfHeight; y++){
+            for(uint32_t x = 0; x < halfWidth; x++){
+                uint32_t x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+                uint32_t y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+
+                const uint8_t* samples[4] = {
+                    &pixels[(size_t(y0) * width + x0) * 4], &pixels[(size_t(y0) * width + x1) * 4],
+                    &pixels[(size_t(y1) * width + x0) * 4], &pixels[(size_t(y1) * width + x1) * 4],
+                };
+
+                uint8_t* out = &result[(size_t(y) * halfWidth + x) * 4];
+
+                for(int c = 0; c < 4; c++){
+                    if(srgb && c < 3){
+                        float sum = toLinear[samples[0][c]] + toLinear[samples[1][c]] + toLinear[samples[2][c]] + toLinear[samples[3][c]];
+                        out[c] = toSrgb(sum / 4.f);
+                    } else {
+                        out[c] = static_cast<uint8_t>((samples[0][c] + samples[1][c] + samples[2][c] + samples[3][c] + 2) / 4);
+                    }
+                }
+            }
+        }
+
+        return result;
+    }
+
+    // Full chain down to 1x1, mips[0] is the image itself
+    inline std::vector<std::vector<uint8_t>> buildMips(std::vector<uint8_t> pixels, uint32_t width, uint32_t height, bool srgb){
+        std::vector<std::vector<uint8_t>> mips;
+        mips.push_back(std::move(pixels));
+
+        while(width > 1 || height > 1){
+            mips.push_back(downsample(mips.back(), width, height, srgb));
+            width = std::max(width / 2, 1u);
+            height = std::max(height / 2, 1u);
+        }
+
+        return mips;
+    }
+
+    // BC3 for images with any alpha, BC1 otherwise. Colour data is sRGB unless linear is set.
+    inline VkFormat chooseFormat(const std::vector<uint8_t>& pixels, bool linear){
+        bool hasAlpha = false;
+        for(size_t p = 3; p < pixels.size() && !hasAlpha; p += 4){
+            hasAlpha = pixels[p] != 255;
+        }
+
+        if(hasAlpha){
+            return linear ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC3_SRGB_BLOCK;
+        }
+
+        return linear ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+    }
+};
@@ -271,19 +271,27 @@ namespace Bootstrap{
 
         BootstrapDevice createLogicalDevice(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface) {
             VkDevice device;
-            VkQueue graphicsQueue;
+            VkQueue graphicsQueue, transferQueue, computeQueue;
 
             QueueFamilyIndices indices = QueueFamilyIndices::findQueueFamilies(physicalDevice, surface);
 
             std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
             std::set<uint32_t> uniqueuQueueFamilies =  {indices.graphicsFamily.value(), indices.presentFamily.value()};
 
+            if(indices.transferFamily.has_value()){
+                uniqueuQueueFamilies.insert(indices.transferFamily.value());
+            }
+
+            if(indices.computeFamily.has_value()){
+                uniqueuQueueFamilies.insert(indices.computeFamily.value());
+            }
+
             float queuePriority = 1.0f;
             
             for (uint32_t queueFamily : uniqueuQueueFamilies){
                 VkDeviceQueueCreateInfo queueCreateInfo{};
                 queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-                queueCreateInfo.queueFamilyIndex = indices.graphicsFamily.value();
+                queueCreateInfo.queueFamilyIndex = queueFamily;
                 queueCreateInfo.queueCount = 1;
                 queueCreateInfo.pQueuePriorities = &queuePriority;
                 queueCreateInfos.push_back(queueCreateInfo);
@@ -294,9 +302,71 @@ namespace Bootstrap{
             deviceFeatures.fillModeNonSolid = VK_TRUE;
             deviceFeatures.shaderFloat64 = VK_TRUE;
 
+            // Block compressed textures are uploaded as is when the device can sample them, see TextureLoader::parseKtx2
+            VkPhysicalDeviceFeatures supportedDeviceFeatures;
+            vkGetPhysicalDeviceFeatures(physicalDevice, &supportedDeviceFeatures);
+            deviceFeatures.textureCompressionBC = supportedDeviceFeatures.textureCompressionBC;
+            deviceFeatures.textureCompressionASTC_LDR = supportedDeviceFeatures.textureCompressionASTC_LDR;
+
+            // Lets storage writes go to any draw image format, without it the draw image stays RGBA16F
+            deviceFeatures.shaderStorageImageWriteWithoutFormat = supportedDeviceFeatures.shaderStorageImageWriteWithoutFormat;
+
+            std::vector<const char*> enabledExtensions(deviceExtensions.begin(), deviceExtensions.end());
+            for(const char* extension: optionalDeviceExtensions){
+                if(isExtensionSupported(physicalDevice, extension)){
+                    enabledExtensions.push_back(extension);
+                }
+            }
+
             features11.pNext = &features12;
             features12.pNext = &features13;
 
+            // Mesh shading is optional, renderers fall back to vertex pulling without it
+            VkPhysicalDeviceMeshShaderFeaturesEXT meshShaderFeatures{};
+            meshShaderFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MESH_SHADER_FEATURES_EXT;
+
+            bool meshShaderSupported = false;
+            if(isExtensionSupported(physicalDevice, VK_EXT_MESH_SHADER_EXTENSION_NAME)){
+                VkPhysicalDeviceFeatures2 supportedFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+                supportedFeatures.pNext = &meshShaderFeatures;
+                vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+
+                meshShaderSupported = meshShaderFeatures.taskShader && meshShaderFeatures.meshShader;
+
+                meshShaderFeatures.pNext = nullptr;
+                meshShaderFeatures.multiviewMeshShader = VK_FALSE;
+                meshShaderFeatures.primitiveFragmentShadingRateMeshShader = VK_FALSE;
+                meshShaderFeatures.meshShaderQueries = VK_FALSE;
+
+                if(meshShaderSupported){
+                    meshShaderFeatures.pNext = features13.pNext;
+                    features13.pNext = &meshShaderFeatures;
+                }
+            }
+
+            // Present wait is optional too, frame latency falls back to the render fences without it
+            VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+            presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+
+            VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+            presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+
+            bool presentWaitSupported = false;
+            if(isExtensionSupported(physicalDevice, VK_KHR_PRESENT_ID_EXTENSION_NAME) && isExtensionSupported(physicalDevice, VK_KHR_PRESENT_WAIT_EXTENSION_NAME)){
+                presentIdFeatures.pNext = &presentWaitFeatures;
+
+                VkPhysicalDeviceFeatures2 supportedFeatures{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
+                supportedFeatures.pNext = &presentIdFeatures;
+                vkGetPhysicalDeviceFeatures2(physicalDevice, &supportedFeatures);
+
+                presentWaitSupported = presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+
+                if(presentWaitSupported){
+                    presentWaitFeatures.pNext = features13.pNext;
+                    features13.pNext = &presentIdFeatures;
+                }
+            }
+
             VkPhysicalDeviceFeatures2 physicalDeviceFeatures2{ VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2 };
             physicalDeviceFeatures2.features = deviceFeatures;
             physicalDeviceFeatures2.pNext = &features11;
@@ -310,8 +380,8 @@ namespace Bootstrap{
             createInfo.pEnabledFeatures = nullptr;
             createInfo.pNext = &physicalDeviceFeatures2;
 
-            createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-            createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+            createInfo.enabledExtensionCount = static_cast<uint32_t>(enabledExtensions.size());
+            createInfo.ppEnabledExtensionNames = enabledExtensions.data();
 
             if(USE_VALIDATION_LAYERS) {
                 createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -327,11 +397,25 @@ namespace Bootstrap{
 
             vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 
+            uint32_t transferQueueFamily = indices.transferFamily.value_or(indices.graphicsFamily.value());
+            vkGetDeviceQueue(device, transferQueueFamily, 0, &transferQueue);
+
+            uint32_t computeQueueFamily = indices.computeFamily.value_or(indices.graphicsFamily.value());
+            vkGetDeviceQueue(device, computeQueueFamily, 0, &computeQueue);
+
             BootstrapDevice bd;
             bd.device = device;
             bd.physicalDevice = physicalDevice;
             bd.graphicsQueue = graphicsQueue;
             bd.graphicsQueueFamily = indices.graphicsFamily.value();
+            bd.transferQueue = transferQueue;
+            bd.transferQueueFamily = transferQueueFamily;
+            bd.computeQueue = computeQueue;
+            bd.computeQueueFamily = computeQueueFamily;
+            bd.meshShaderSupported = meshShaderSupported;
+            bd.presentWaitSupported = presentWaitSupported;
+            bd.storageWithoutFormat = deviceFeatures.shaderStorageImageWriteWithoutFormat;
+            bd.calibratedTimestampsSupported = isExtensionSupported(physicalDevice, VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
 
             return bd;
         }
@@ -368,6 +452,22 @@ namespace Bootstrap{
 
             return requiredExtensions.empty();
         }
+
+        bool isExtensionSupported(VkPhysicalDevice device, const char* extensionName){
+            uint32_t extensionCount;
+            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+            std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+            vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+            for (const auto& extension: availableExtensions) {
+                if(strcmp(extension.extensionName, extensionName) == 0) {
+                    return true;
+                }
+            }
+
+            return false;
+        }
     };
 
     class SwapchainBuilder{
@@ -379,6 +479,11 @@ namespace Bootstrap{
         std::vector<VkFramebuffer> swapChainFrameBuffers;
 
         VkImageUsageFlags imageUsage;
+        bool storageRequested{false};
+        VkSwapchainKHR oldSwapChain{VK_NULL_HANDLE};
+        VkPresentModeKHR preferredPresentMode{VK_PRESENT_MODE_MAILBOX_KHR};
+        VkPresentModeKHR presentMode;
+        std::vector<VkPresentModeKHR> availablePresentModes;
     public:
 
         SwapChainInfomation setupSwapChain(VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, VkDevice device, GLFWwindow* window){
@@ -391,6 +496,9 @@ namespace Bootstrap{
             scI.swapchainImageFormat = swapChainImageFormat;
             scI.swapchainImages = swapChainImages;
             scI.swapchainImageViews = swapChainImageViews;
+            scI.swapchainImageUsage = imageUsage;
+            scI.presentMode = presentMode;
+            scI.availablePresentModes = availablePresentModes;
 
             return scI;
         }
@@ -403,6 +511,21 @@ namespace Bootstrap{
             imageUsage = newFlags;
         }
 
+        // Storage usage on top of the usage flags when the surface and the chosen format allow it, swapchainImageUsage tells
+        void requestStorageUsage(){
+            storageRequested = true;
+        }
+
+        // Used when the surface supports it, FIFO otherwise. swapchainInfomation's presentMode tells which one it got.
+        void setPresentMode(VkPresentModeKHR mode){
+            preferredPresentMode = mode;
+        }
+
+        // The swapchain being replaced, its images can still be presented while the new one is created
+        void setOldSwapchain(VkSwapchainKHR oldSwapchain){
+            oldSwapChain = oldSwapchain;
+        }
+
         /*
         // void recreateSwapChain(VkDevice device, VkPhysicalDevice physicalDevice, VkSurfaceKHR surface, GLFWwindow* window, DepthBuffer& depthBuffer, VkRenderPass renderPass){
         //     int width = 0, height = 0;
@@ -442,7 +565,8 @@ namespace Bootstrap{
             SwapChainSupportDetails swapChainSupport = SwapChainSupportDetails::querySwapChainSupport(physicalDevice, surface);
 
             VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
-            VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+            presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
+            availablePresentModes = swapChainSupport.presentModes;
             VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities, window);
 
             uint32_t imageCount = swapChainSupport.capabilities.minImageCount + 1;
@@ -460,6 +584,15 @@ namespace Bootstrap{
             createInfo.imageColorSpace = surfaceFormat.colorSpace;
             createInfo.imageExtent = extent;
             createInfo.imageArrayLayers = 1;
+            if(storageRequested && (swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_STORAGE_BIT)){
+                VkFormatProperties formatProperties;
+                vkGetPhysicalDeviceFormatProperties(physicalDevice, surfaceFormat.format, &formatProperties);
+
+                if(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT){
+                    imageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
+                }
+            }
+
             createInfo.imageUsage = imageUsage;
             // createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
 
@@ -482,7 +615,7 @@ namespace Bootstrap{
 
             createInfo.presentMode = presentMode;
             createInfo.clipped = VK_TRUE;
-            createInfo.oldSwapchain = VK_NULL_HANDLE;
+            createInfo.oldSwapchain = oldSwapChain;
 
             if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
                 throw std::runtime_error("failed to create swap chain!");
@@ -510,11 +643,12 @@ namespace Bootstrap{
 
         VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
             for (const auto& availablePresentMode: availablePresentModes) {
-                if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+                if (availablePresentMode == preferredPresentMode) {
                     return availablePresentMode;
                 }
             }
             
+            // The only one every surface supports
             return VK_PRESENT_MODE_FIFO_KHR;
         }
 
@@ -0,0 +1,477 @@
+#pragma once
+
+// Only depends on the Vulkan headers, so the tools in tools/ can use it too
+#include <vulkan/vulkan.h>
+
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Cooked runtime scene, laid out so loading is mapping the file and copying its chunks into staging memory.
+//
+//     Header | ChunkEntry[chunkCount] | chunk data...
+//
+// Every chunk starts on a 16 byte boundary and is stored in the layout the GPU consumes, vertices in the
+// header's VertexFormat and indices in its VkIndexType, so nothing is parsed or converted per element.
+// Each chunk carries a checksum of its bytes and the table of contents one of its own.
+// Readers skip chunk types they don't know, VERSION only changes when existing layouts do.
+namespace CookedScene{
+    const char MAGIC[8] = {'V', 'K', 'S', 'C', 'E', 'N', 'E', '\0'};
+    const uint32_t VERSION = 1;
+    const uint64_t ALIGNMENT = 16;
+    const char EXTENSION[] = ".scene";
+
+    enum ChunkType : uint32_t {
+        CHUNK_VERTICES = 1,     // Header::vertexCount vertices in Header::vertexFormat
+        CHUNK_INDICES = 2,      // Header::indexCount indices of Header::indexType, local to their submesh
+        CHUNK_SUBMESHES = 3,    // SubmeshRecord array
+        CHUNK_TEXTURE = 4,      // A complete KTX2 file, one chunk per texture
+        CHUNK_BOUNDS = 5,       // float[4] bounding sphere per submesh, in mesh space
+        CHUNK_LODS = 6,         // LodRecord array, SubmeshRecord::lodCount of them per submesh in submesh order
+        CHUNK_MESHLETS = 7,     // Meshlets, their vertex indices, then their triangles, like Meshlets::writeGpuData
+        CHUNK_MESHLET_RANGES = 8,   // MeshletRange per submesh
+        CHUNK_LOD_MESHLET_RANGES = 9,   // MeshletRange per LodRecord, in the order of CHUNK_LODS
+    };
+
+    struct Header{
+        char magic[8];
+        uint32_t version;
+        uint32_t chunkCount;
+        uint64_t tocOffset;
+        uint64_t tocChecksum;
+
+        uint32_t vertexFormat;  // VertexFormat
+        uint32_t indexType;     // VkIndexType
+        uint64_t vertexCount, indexCount;
+        float positionMin[4], positionExtent[4];    // Dequantization of compact vertices
+    };
+    static_assert(sizeof(Header) == 88);
+
+    struct ChunkEntry{
+        uint32_t type;
+        uint32_t reserved;
+        uint64_t offset, size;
+        uint64_t checksum;
+    };
+    static_assert(sizeof(ChunkEntry) == 32);
+
+    // Same fields as Submesh, with a layout that doesn't depend on glm's configuration
+    struct SubmeshRecord{
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        int32_t vertexOffset;
+        uint32_t lodCount;
+        float transform[16];    // Column major
+    };
+    static_assert(sizeof(SubmeshRecord) == 80);
+
+    // Coarser index list of a submesh, over the same vertices
+    struct LodRecord{
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        float error;            // Furthest a vertex moved, in mesh units
+        uint32_t reserved;
+    };
+    static_assert(sizeof(LodRecord) == 16);
+
+    // Meshlet vertex indices are absolute into the vertex chunk. The offsets are in uint32 units relative to the
+    // range's first meshlet, so the range draws on its own with the meshlet buffer address moved to that meshlet.
+    struct MeshletRange{
+        uint32_t firstMeshlet;
+        uint32_t meshletCount;
+        uint32_t vertexOffset;
+        uint32_t triangleOffset;
+    };
+    static_assert(sizeof(MeshletRange) == 16);
+
+    inline uint64_t alignOffset(uint64_t offset){
+        return (offset + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    }
+
+    inline bool isCookedScene(const std::filesystem::path& path){
+        return path.extension() == EXTENSION;
+    }
+
+    // 64-bit hash on four independent lanes, built from xxHash64's rounds but not compatible with it.
+    // Runs close to memory bandwidth, so verifying a scene costs about as much as reading it once.
+    inline uint64_t checksum(const void* data, size_t size, uint64_t seed = 0){
+        const uint64_t PRIME1 = 0x9E3779B185EBCA87ull, PRIME2 = 0xC2B2AE3D27D4EB4Full, PRIME3 = 0x165667B19E3779F9ull;
+
+        auto round = [&](uint64_t accumulator, uint64_t value){
+            accumulator += value * PRIME2;
+            return std::rotl(accumulator, 31) * PRIME1;
+        };
+
+        const uint8_t* p = static_cast<const uint8_t*>(data);
+        const uint8_t* end = p + size;
+
+        uint64_t lanes[4] = {seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1};
+
+        while(end - p >= 32){
+            for(uint32_t i = 0; i < 4; i++){
+                uint64_t value;
+                memcpy(&value, p + i * 8, 8);
+                lanes[i] = round(lanes[i], value);
+            }
+            p += 32;
+        }
+
+        uint64_t hash = std::rotl(lanes[0], 1) + std::rotl(lanes[1], 7) + std::rotl(lanes[2], 12) + std::rotl(lanes[3], 18) + size;
+
+        while(end - p >= 8){
+            uint64_t value;
+            memcpy(&value, p, 8);
+            hash = std::rotl(hash ^ round(0, value), 27) * PRIME1 + PRIME3;
+            p += 8;
+        }
+
+        while(p < end){
+            hash = std::rotl(hash ^ (*p++ * PRIME3), 11) * PRIME1;
+        }
+
+        hash ^= hash >> 33;
+        hash *= PRIME2;
+        hash ^= hash >> 29;
+        hash *= PRIME3;
+        hash ^= hash >> 32;
+
+        return hash;
+    }
+
+    // Read-only mapping of a whole file, the OS pages it in on first touch
+    class MappedFile{
+    public:
+        MappedFile() = default;
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile(){
+            close();
+        }
+
+        bool open(const std::filesystem::path& path){
+            close();
+
+#ifdef _WIN32
+            _file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+            if(_file == INVALID_HANDLE_VALUE)
+                return false;
+
+            LARGE_INTEGER fileSize;
+            if(!GetFileSizeEx(_file, &fileSize) || fileSize.QuadPart == 0){
+                close();
+                return false;
+            }
+            _size = static_cast<size_t>(fileSize.QuadPart);
+
+            _mapping = CreateFileMappingW(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if(!_mapping){
+                close();
+                return false;
+            }
+
+            _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+#else
+            _file = ::open(path.c_str(), O_RDONLY);
+            if(_file < 0)
+                return false;
+
+            struct stat info;
+            if(fstat(_file, &info) != 0 || info.st_size == 0){
+                close();
+                return false;
+            }
+            _size = static_cast<size_t>(info.st_size);
+
+            void* mapped = mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _file, 0);
+            if(mapped == MAP_FAILED){
+                close();
+                return false;
+            }
+
+            // Chunks are read front to back exactly once
+            madvise(mapped, _size, MADV_SEQUENTIAL);
+            madvise(mapped, _size, MADV_WILLNEED);
+            _data = static_cast<const char*>(mapped);
+#endif
+
+            if(!_data){
+                close();
+                return false;
+            }
+
+            return true;
+        }
+
+        void close(){
+#ifdef _WIN32
+            if(_data) UnmapViewOfFile(_data);
+            if(_mapping) CloseHandle(_mapping);
+            if(_file != INVALID_HANDLE_VALUE) CloseHandle(_file);
+
+            _mapping = nullptr;
+            _file = INVALID_HANDLE_VALUE;
+#else
+            if(_data) munmap(const_cast<char*>(_data), _size);
+            if(_file >= 0) ::close(_file);
+
+            _file = -1;
+#endif
+            _data = nullptr;
+            _size = 0;
+        }
+
+        const char* data() const {
+            return _data;
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+    private:
+#ifdef _WIN32
+        HANDLE _file{INVALID_HANDLE_VALUE};
+        HANDLE _mapping{nullptr};
+#else
+        int _file{-1};
+#endif
+        const char* _data{nullptr};
+        size_t _size{0};
+    };
+
+    // Chunk views point into the mapping and stay valid until the Scene is destroyed
+    class Scene{
+    public:
+        double openMs{0.0};     // Mapping and validating the table of contents
+        double verifyMs{0.0};   // Chunk checksums, 0 when not verified
+
+        bool open(const std::filesystem::path& path, std::string& error, bool verifyChecksums = true){
+            auto startTime = std::chrono::high_resolution_clock::now();
+
+            if(!_file.open(path)){
+                error = "can't map file";
+                return false;
+            }
+
+            if(_file.size() < sizeof(Header)){
+                error = "file too small";
+                return false;
+            }
+
+            // The mapping is page aligned, so the header and the table of contents are too
+            _header = reinterpret_cast<const Header*>(_file.data());
+
+            if(memcmp(_header->magic, MAGIC, sizeof(MAGIC)) != 0){
+                error = "not a cooked scene";
+                return false;
+            }
+
+            if(_header->version != VERSION){
+                error = "version " + std::to_string(_header->version) + ", expected " + std::to_string(VERSION) + ", cook it again";
+                return false;
+            }
+
+            uint64_t tocSize = uint64_t(_header->chunkCount) * sizeof(ChunkEntry);
+            if(_header->tocOffset % ALIGNMENT != 0 || tocSize > _file.size() || _header->tocOffset > _file.size() - tocSize){
+                error = "table of contents out of bounds";
+                return false;
+            }
+
+            _toc = std::span<const ChunkEntry>(reinterpret_cast<const ChunkEntry*>(_file.data() + _header->tocOffset), _header->chunkCount);
+
+            if(checksum(_toc.data(), tocSize) != _header->tocChecksum){
+                error = "table of contents checksum mismatch";
+                return false;
+            }
+
+            for(const ChunkEntry& entry: _toc){
+                if(entry.offset % ALIGNMENT != 0 || entry.size > _file.size() || entry.offset > _file.size() - entry.size){
+                    error = "chunk out of bounds";
+                    return false;
+                }
+            }
+
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+            openMs = elapsed.count();
+
+            if(verifyChecksums && !verify(error))
+                return false;
+
+            return true;
+        }
+
+        bool verify(std::string& error){
+            auto startTime = std::chrono::high_resolution_clock::now();
+
+            for(size_t i = 0; i < _toc.size(); i++){
+                if(checksum(_file.data() + _toc[i].offset, _toc[i].size) != _toc[i].checksum){
+                    error = "checksum mismatch in chunk " + std::to_string(i);
+                    return false;
+                }
+            }
+
+            std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+            verifyMs = elapsed.count();
+
+            return true;
+        }
+
+        const Header& header() const {
+            return *_header;
+        }
+
+        size_t fileSize() const {
+            return _file.size();
+        }
+
+        uint32_t chunkCount(ChunkType type) const {
+            uint32_t count = 0;
+            for(const ChunkEntry& entry: _toc){
+                count += entry.type == type;
+            }
+            return count;
+        }
+
+        // The n-th chunk of a type, empty when there is none
+        std::span<const char> chunk(ChunkType type, uint32_t n = 0) const {
+            for(const ChunkEntry& entry: _toc){
+                if(entry.type == type && n-- == 0)
+                    return std::span<const char>(_file.data() + entry.offset, entry.size);
+            }
+            return {};
+        }
+
+        // A chunk viewed as an array of fixed size records
+        template<typename T>
+        std::span<const T> records(ChunkType type) const {
+            std::span<const char> data = chunk(type);
+            return std::span<const T>(reinterpret_cast<const T*>(data.data()), data.size() / sizeof(T));
+        }
+
+        std::span<const SubmeshRecord> submeshes() const {
+            return records<SubmeshRecord>(CHUNK_SUBMESHES);
+        }
+
+    private:
+        MappedFile _file;
+        const Header* _header{nullptr};
+        std::span<const ChunkEntry> _toc;
+    };
+
+    // Collects chunks and writes them out in one go. Chunk data isn't copied, it has to stay alive until write().
+    class Writer{
+    public:
+        Header header{};
+
+        Writer(){
+            memcpy(header.magic, MAGIC, sizeof(MAGIC));
+            header.version = VERSION;
+            header.indexType = VK_INDEX_TYPE_UINT32;
+            header.positionExtent[0] = header.positionExtent[1] = header.positionExtent[2] = header.positionExtent[3] = 1.f;
+        }
+
+        void addChunk(ChunkType type, const void* data, size_t size){
+            _chunks.push_back({type, static_cast<const char*>(data), size});
+        }
+
+        // Goes through a temporary file, so an interrupted cook never leaves a truncated scene behind
+        bool write(const std::filesystem::path& path, std::string& error){
+            std::vector<ChunkEntry> toc(_chunks.size());
+
+            header.chunkCount = static_cast<uint32_t>(_chunks.size());
+            header.tocOffset = alignOffset(sizeof(Header));
+
+            uint64_t offset = header.tocOffset + toc.size() * sizeof(ChunkEntry);
+
+            for(size_t i = 0; i < _chunks.size(); i++){
+                offset = alignOffset(offset);
+
+                toc[i].type = _chunks[i].type;
+                toc[i].offset = offset;
+                toc[i].size = _chunks[i].size;
+                toc[i].checksum = checksum(_chunks[i].data, _chunks[i].size);
+
+                offset += _chunks[i].size;
+            }
+
+            header.tocChecksum = checksum(toc.data(), toc.size() * sizeof(ChunkEntry));
+
+            std::filesystem::path temporaryPath = path;
+            temporaryPath += ".tmp";
+
+            {
+                std::ofstream stream(temporaryPath, std::ios::binary | std::ios::trunc);
+                if(!stream){
+                    error = "can't open " + temporaryPath.string();
+                    return false;
+                }
+
+                const char padding[ALIGNMENT] = {};
+                uint64_t written = 0;
+
+                auto put = [&](const void* data, size_t size){
+                    stream.write(static_cast<const char*>(data), size);
+                    written += size;
+                };
+
+                auto padTo = [&](uint64_t target){
+                    put(padding, target - written);
+                };
+
+                put(&header, sizeof(Header));
+                padTo(header.tocOffset);
+                put(toc.data(), toc.size() * sizeof(ChunkEntry));
+
+                for(size_t i = 0; i < _chunks.size(); i++){
+                    padTo(toc[i].offset);
+                    put(_chunks[i].data, _chunks[i].size);
+                }
+
+                if(!stream){
+                    error = "failed writing " + temporaryPath.string();
+                    return false;
+                }
+            }
+
+            std::error_code renameError;
+            std::filesystem::rename(temporaryPath, path, renameError);
+            if(renameError){
+                error = "can't replace " + path.string() + ": " + renameError.message();
+                return false;
+            }
+
+            return true;
+        }
+
+    private:
+        struct PendingChunk{
+            ChunkType type;
+            const char* data;
+            size_t size;
+        };
+
+        std::vector<PendingChunk> _chunks;
+    };
+};
@@ -4,7 +4,9 @@
 #include "utility.h"
 #include "initializers.h"
 #include "structs.h"
-#include "pipelineBuilder.h"
+#include "meshPipelines.h"
+#include "meshlet.h"
+#include "simulation.h"
 
 struct RectangleUniform {
     glm::mat4 modelMatrix;
@@ -13,6 +15,7 @@ struct RectangleUniform {
 struct RectangleMesh: public Mesh {
 public:
     std::string vertexShaderFile = "shaders\\shader.vert.spv", fragShaderFile = "shaders\\shader.frag.spv";
+    std::string taskShaderFile = "shaders\\meshlet.task.spv", meshShaderFile = "shaders\\meshlet.mesh.spv";
 
     void setup(VkDevice _device, VmaAllocator& _allocator, VkFormat drawImageFormat, VkFormat depthImageFormat) override {
         createDescriptorSetLayout(_device);
@@ -28,13 +31,33 @@ public:
 
     void imguiInterface(){
         if(ImGui::Begin("External Mesh Test")){
-            ImGui::SliderFloat("Rotation Speed", &rotationSpeed, -20.f, 20.f);
+            bool changed = ImGui::SliderFloat("Rotation Speed", &rotationSpeed, -20.f, 20.f);
 
-            ImGui::SliderFloat3("Axis of Rotation", (float*)& axisOfRotation, -20.f, 20.f);
+            changed |= ImGui::SliderFloat3("Axis of Rotation", (float*)& axisOfRotation, -20.f, 20.f);
+
+            if(changed && simulation){
+                simulation->post([this, speed = rotationSpeed, axis = axisOfRotation](){
+                    simulatedSpeed = speed;
+                    simulatedAxis = axis;
+                });
+            }
+
+            // The rectangle is drawn double sided, so backface cone culling is off by default
+            if(vkCmdDrawMeshTasks){
+                ImGui::Checkbox("Cone Culling", &coneCulling);
+            }
         }
         ImGui::End();
     }
 
+    bool animated() override {
+        return rotationSpeed != 0.f;
+    }
+
+    uint64_t drawState() override {
+        return Utility::hashBytes(Utility::FNV_OFFSET, &modelMatrix, sizeof(modelMatrix));
+    }
+
     void update(VkDevice _device, VmaAllocator& allocator, DescriptorAllocator& _descriptorAllocator) override {
         updateUniformBuffer();
 
@@ -46,101 +69,91 @@ public:
     }
 
     void draw(VkCommandBuffer& command, glm::mat4 viewProj) override {
+        if(useMeshShading && vkCmdDrawMeshTasks){
+            drawMeshlets(command, viewProj);
+            return;
+        }
+
         vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
 
-        MeshPushConstants pushConstantsOpaque;
-        pushConstantsOpaque.worldMatrix = viewProj;
+        MeshPushConstants pushConstantsOpaque{};
+        pushConstantsOpaque.frameConstants = frameConstantsAddress;
         pushConstantsOpaque.vertexBuffer = vertexBufferAddress;
+        pushConstantsOpaque.vertexFormat = vertexFormat;
+        pushConstantsOpaque.positionMin = positionMin;
+        pushConstantsOpaque.positionExtent = positionExtent;
 
         vkCmdPushConstants(command, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &pushConstantsOpaque);
 
-        vkCmdBindIndexBuffer(command, indexBuffer.buffer, 0, VK_INDEX_TYPE_UINT32);
+        vkCmdBindIndexBuffer(command, indexBuffer.buffer, 0, indexType);
         vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &set, 0, nullptr);
 
         vkCmdDrawIndexed(command, indexCount, 1, 0, 0, 0);
     }
 
+    void drawMeshlets(VkCommandBuffer& command, glm::mat4 viewProj){
+        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipeline);
+
+        MeshletPushConstants pushConstants{};
+        pushConstants.frameConstants = frameConstantsAddress;
+        pushConstants.vertexBuffer = vertexBufferAddress;
+        pushConstants.meshletBuffer = meshletBufferAddress;
+        pushConstants.meshletCount = static_cast<uint32_t>(meshletData.meshlets.size());
+        pushConstants.meshletVertexOffset = Meshlets::gpuVertexOffset(meshletData);
+        pushConstants.meshletTriangleOffset = Meshlets::gpuTriangleOffset(meshletData);
+        pushConstants.flags = (coneCulling ? MESHLET_FLAG_CONE_CULLING : 0) | (vertexFormat == VERTEX_FORMAT_COMPACT ? MESHLET_FLAG_COMPACT_VERTICES : 0);
+        pushConstants.positionMin = positionMin;
+        pushConstants.positionExtent = positionExtent;
+
+        vkCmdPushConstants(command, meshletPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshletPushConstants), &pushConstants);
+        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipelineLayout, 0, 1, &set, 0, nullptr);
+
+        uint32_t taskGroups = (pushConstants.meshletCount + Meshlets::TASK_GROUP_SIZE - 1) / Meshlets::TASK_GROUP_SIZE;
+        vkCmdDrawMeshTasks(command, taskGroups, 1, 1);
+    }
+
     void setVertexBufferAddress(VkDeviceAddress address) override {
         vertexBufferAddress = address;
     }
 
+    // Each arrow key adds a triangle while it is held
     void keyUpdate(GLFWwindow* window, int key, int scancode, int action, int mods) override {
-        if (key == GLFW_KEY_LEFT){
-            if(action == GLFW_PRESS){
-                indices.push_back(2);
-                indices.push_back(3);
-                indices.push_back(4);
-                indexCount += 3;
+        for(uint32_t i = 0; i < 4; i++){
+            if(key != ARROW_KEYS[i])
+                continue;
 
-                updateIndexBuffer = true;
-            }
-            
-            if(action == GLFW_RELEASE){
-                indices.pop_back();
-                indices.pop_back();
-                indices.pop_back();
-                indexCount-=3;
-
-                updateIndexBuffer = true;
-            }
-        } else 
-        if (key == GLFW_KEY_RIGHT){
             if(action == GLFW_PRESS){
-                indices.push_back(0);
-                indices.push_back(5);
-                indices.push_back(1);
-                indexCount += 3;
-
-                updateIndexBuffer = true;
-            }
-            
-            if(action == GLFW_RELEASE){
-                indices.pop_back();
-                indices.pop_back();
-                indices.pop_back();
-                indexCount-=3;
-
-                updateIndexBuffer = true;
+                heldArrows |= 1u << i;
+            } else if(action == GLFW_RELEASE){
+                heldArrows &= ~(1u << i);
             }
-        } else
-        if (key == GLFW_KEY_DOWN){
-            if(action == GLFW_PRESS){
-                indices.push_back(6);
-                indices.push_back(0);
-                indices.push_back(2);
-                indexCount += 3;
+        }
+    }
 
-                updateIndexBuffer = true;
-            }
-            
-            if(action == GLFW_RELEASE){
-                indices.pop_back();
-                indices.pop_back();
-                indices.pop_back();
-                indexCount-=3;
-
-                updateIndexBuffer = true;
-            }
-        } else 
-        if (key == GLFW_KEY_UP){
-            if(action == GLFW_PRESS){
-                indices.push_back(3);
-                indices.push_back(1);
-                indices.push_back(7);
-                indexCount += 3;
+    void simulate(double dt, MeshState& state) override {
+        rotAngle += static_cast<float>(dt) * simulatedSpeed;
 
-                updateIndexBuffer = true;
-            }
-            
-            if(action == GLFW_RELEASE){
-                indices.pop_back();
-                indices.pop_back();
-                indices.pop_back();
-                indexCount-=3;
-
-                updateIndexBuffer = true;
+        state.transform = glm::rotate(glm::mat4(1.0f), rotAngle, simulatedAxis);
+        state.input = heldArrows;
+    }
+
+    void applyState(const MeshState& state) override {
+        modelMatrix = state.transform;
+
+        // Rebuilt from the held keys rather than pushed and popped, so releasing them in any order works
+        if(!resident || state.input == arrows)
+            return;
+
+        arrows = state.input;
+        indices.resize(6);
+        for(uint32_t i = 0; i < 4; i++){
+            if(arrows & (1u << i)){
+                indices.insert(indices.end(), ARROW_TRIANGLES[i], ARROW_TRIANGLES[i] + 3);
             }
         }
+
+        indexCount = static_cast<uint32_t>(indices.size());
+        updateIndexBuffer = true;
     }
 
 
@@ -162,79 +175,41 @@ private:
         });
     }
 
+    static constexpr int ARROW_KEYS[4] = {GLFW_KEY_LEFT, GLFW_KEY_RIGHT, GLFW_KEY_DOWN, GLFW_KEY_UP};
+    static constexpr uint32_t ARROW_TRIANGLES[4][3] = {{2, 3, 4}, {0, 5, 1}, {6, 0, 2}, {3, 1, 7}};
+    static constexpr MeshPipelines::Style PIPELINE_STYLE{VK_FRONT_FACE_CLOCKWISE, true};
+
+    // Render thread, edited through ImGui and posted to the simulation
     float rotationSpeed = 0.1f;
-    float rotAngle = 0.f;
     glm::vec3 axisOfRotation = glm::vec3(0.0f, 0.0f, 1.0f);
 
-    std::chrono::time_point<std::chrono::high_resolution_clock> prevTime = std::chrono::high_resolution_clock::now();
+    // Render thread, from the last snapshot
+    glm::mat4 modelMatrix{1.f};
+    uint64_t arrows{0};
 
-    void updateUniformBuffer() {
-        float timeDelta = getTimeDelta();
-        rotAngle += timeDelta * rotationSpeed;
+    // Simulation side
+    float simulatedSpeed = 0.1f;
+    glm::vec3 simulatedAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+    float rotAngle = 0.f;
+    uint64_t heldArrows{0};
 
+    void updateUniformBuffer() {
         RectangleUniform* data = (RectangleUniform*)uniformBuffer.allocation->GetMappedData();
         *data = {
-            glm::rotate(glm::mat4(1.0f), rotAngle, axisOfRotation)
+            modelMatrix
         };
     }
 
     void createPipeline(VkDevice _device, VkFormat drawImageFormat, VkFormat depthImageFormat){
-        VkShaderModule vertexShader;
-        if(!Utility::loadShaderModule(vertexShaderFile.c_str(), _device, &vertexShader)){
-            fmt::println("Failed to load vertex shader");
-        }
+        MeshPipelines::createVertexPipeline(_device, *this, vertexShaderFile, fragShaderFile, PIPELINE_STYLE, drawImageFormat, depthImageFormat);
 
-        VkShaderModule fragShader;
-        if(!Utility::loadShaderModule(fragShaderFile.c_str(), _device, &fragShader)){
-            fmt::println("Failed to load frag shader");
+        if(vkCmdDrawMeshTasks){
+            MeshPipelines::createMeshletPipeline(_device, *this, taskShaderFile, meshShaderFile, fragShaderFile, PIPELINE_STYLE, drawImageFormat, depthImageFormat);
         }
-
-        VkPushConstantRange bufferRange{};
-        bufferRange.offset = 0;
-        bufferRange.size = sizeof(MeshPushConstants);
-        bufferRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-
-        VkPipelineLayoutCreateInfo layoutInfo = Initializers::pipelineLayoutCreateInfo();
-        layoutInfo.pushConstantRangeCount = 1;
-        layoutInfo.pPushConstantRanges = &bufferRange;
-
-        layoutInfo.setLayoutCount = 1;
-        layoutInfo.pSetLayouts = &setLayout;
-
-        VK_CHECK(vkCreatePipelineLayout(_device, &layoutInfo, nullptr, &pipelineLayout));
-
-        PipelineBuilder pipelineBuilder;
-        pipelineBuilder.pipelineLayout = pipelineLayout;
-        pipelineBuilder.setShaders(vertexShader, fragShader);
-        pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
-        // pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
-        pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
-        pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_CLOCKWISE);
-        pipelineBuilder.setMultisamplingNone();
-        pipelineBuilder.enableBlendingAlphablend();
-        pipelineBuilder.enableDepthtest(VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
-        // pipelineBuilder.disableDepthtest();
-
-        pipelineBuilder.setColorAttachmentFormat(drawImageFormat);
-        pipelineBuilder.setDepthFormat(depthImageFormat);
-
-        pipeline = pipelineBuilder.buildPipeline(_device);
-
-        vkDestroyShaderModule(_device, vertexShader, nullptr);
-        vkDestroyShaderModule(_device, fragShader, nullptr);
-
-        pipelineDeletionQueue.pushFunction([this, _device](){
-            // fmt::println("About to destroy mesh pipelinelayout");
-            vkDestroyPipelineLayout(_device, pipelineLayout, nullptr);
-            // fmt::println("About to destroy mesh pipeline");
-            vkDestroyPipeline(_device, pipeline, nullptr);
-        });
     }
 
     void createDescriptorSetLayout(VkDevice _device){
-        DescriptorLayoutBuilder builder;
-        builder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-        setLayout = builder.build(_device, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+        setLayout = MeshPipelines::createUniformSetLayout(_device, vkCmdDrawMeshTasks != nullptr);
     }
 
     void setupData(){
@@ -274,12 +249,4 @@ private:
         indices[4] = 1;
         indices[5] = 3;
     }
-
-    float getTimeDelta() {
-        // static auto startTime = std::chrono::high_resolution_clock::now();
-        auto currentTime = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<float> elapsed = currentTime - prevTime;
-        prevTime = currentTime;
-        return elapsed.count();
-    }
 };
\ No newline at end of file
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "types.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+struct LatencyStats{
+    uint64_t measured{0};
+    uint64_t dropped{0};            // Still pending when their swapchain was replaced
+    uint64_t pacedFrames{0};
+    double delayMs{0.0};            // Slept before paced frames, summed
+
+    double averageDelayMs() const {
+        return pacedFrames == 0 ? 0.0 : delayMs / pacedFrames;
+    }
+};
+
+// Input to photon latency and just in time frame starts.
+// Latency runs from the glfwPollEvents that started a frame to the completion of its present, as vkWaitForPresentKHR
+// reports it. Without VK_KHR_present_wait a timeline value signaled by the frame's submit stands in, which leaves out
+// the time the image spends queued in the presentation engine.
+// A waiter thread blocks on one frame after the other and takes the time as soon as the wait returns, so neither the
+// render loop's own waits nor its idle sleeps end up in the samples.
+// In low latency mode each frame starts only once the previous one has completed, then sleeps for whatever of the
+// refresh interval the recent CPU and GPU work won't need. Input is polled as late as possible and frames never queue
+// up behind each other.
+class FramePacer{
+public:
+    static const size_t MAX_SAMPLES = 4096;             // The most recent ones make up the percentiles
+    static constexpr double MARGIN_MS = 1.0;            // Left of the interval for frames that take longer than predicted
+    static constexpr double WORK_SMOOTHING = 0.1;
+    static constexpr uint64_t PRESENT_WAIT_TIMEOUT = 100000000;    // 100ms, a present that takes longer is counted as complete
+    static constexpr uint64_t WAIT_SLICE = 10000000;    // 10ms, how long a replaced swapchain can keep the waiter busy
+    static constexpr uint64_t PRESENT_WAIT_SLICE = 1000000;    // 1ms, the longest acquire or present wait for the waiter
+
+    bool lowLatency{false};
+
+    void setup(VkDevice device, bool presentWaitSupported, double refreshRate){
+        _device = device;
+        setRefreshRate(refreshRate);
+
+        if(presentWaitSupported){
+            _vkWaitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr(device, "vkWaitForPresentKHR");
+        }
+
+        VkSemaphoreTypeCreateInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        timelineInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &timelineInfo;
+        VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &_completionTimeline));
+
+        _waiter = std::thread([this](){ waiterLoop(); });
+    }
+
+    // Before the device goes, once nothing is submitted any more
+    void cleanup(){
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _changed.notify_all();
+
+        if(_waiter.joinable()){
+            _waiter.join();
+        }
+
+        vkDestroySemaphore(_device, _completionTimeline, nullptr);
+    }
+
+    bool presentWait() const {
+        return _vkWaitForPresent != nullptr;
+    }
+
+    // Of the monitor the window is on, it can change while the window moves
+    void setRefreshRate(double refreshRate){
+        _intervalMs = refreshRate > 0.0 ? 1000.0 / refreshRate : 1000.0 / 60.0;
+    }
+
+    double intervalMs() const {
+        return _intervalMs;
+    }
+
+    // vkWaitForPresentKHR needs its swapchain externally synchronized with vkAcquireNextImageKHR and vkQueuePresentKHR,
+    // so the render thread holds this around both and the waiter around every present wait slice
+    std::unique_lock<std::mutex> lockSwapchain(){
+        return std::unique_lock<std::mutex>(_swapchainMutex);
+    }
+
+    // Right after glfwPollEvents
+    void inputPolled(){
+        _inputTime = std::chrono::high_resolution_clock::now();
+    }
+
+    // To be signaled by the frame's last submit, it's what the waiter waits on without present wait
+    VkSemaphoreSubmitInfo completionSignal(){
+        VkSemaphoreSubmitInfo info{};
+        info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO;
+        info.semaphore = _completionTimeline;
+        info.value = ++_completionValue;
+        info.stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        return info;
+    }
+
+    // After the submit that signals completionSignal(), chains a present id into presentInfo when present wait is used
+    void present(VkPresentInfoKHR& presentInfo){
+        Pending pending{};
+        pending.swapchain = presentInfo.pSwapchains[0];
+        pending.completionValue = _completionValue;
+        pending.inputTime = _inputTime;
+
+        if(presentWait()){
+            pending.presentId = ++_presentId;
+
+            _presentIdInfo = {};
+            _presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+            _presentIdInfo.pNext = presentInfo.pNext;
+            _presentIdInfo.swapchainCount = 1;
+            _presentIdInfo.pPresentIds = &_presentId;
+
+            presentInfo.pNext = &_presentIdInfo;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending.push_back(pending);
+        }
+        _changed.notify_all();
+    }
+
+    // Present ids belong to the swapchain they were presented to. Returns once the waiter no longer waits on the old
+    // swapchain, which the caller retires right after.
+    void swapchainReplaced(){
+        if(!presentWait())
+            return;
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stats.dropped += _pending.size();
+        _pending.clear();
+        _changed.notify_all();
+        _changed.wait(lock, [this](){ return !_waiting; });
+    }
+
+    // Before glfwPollEvents, in low latency mode. Waits until every frame presented so far has completed, then sleeps
+    // away what the interval leaves over. cpuMs and gpuMs are the last frame's work on either side.
+    void paceFrameStart(double cpuMs, double gpuMs){
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _changed.wait_for(lock, std::chrono::nanoseconds(PRESENT_WAIT_TIMEOUT), [this](){ return _pending.empty(); });
+        }
+
+        double workMs = cpuMs + gpuMs;
+        _predictedWorkMs = _predictedWorkMs == 0.0 ? workMs : _predictedWorkMs + WORK_SMOOTHING * (workMs - _predictedWorkMs);
+
+        // Frames that need the whole interval or more can't start any later
+        double delayMs = std::clamp(_intervalMs - _predictedWorkMs - MARGIN_MS, 0.0, _intervalMs);
+        if(delayMs > 0.0){
+            std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(delayMs));
+        }
+
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stats.pacedFrames++;
+        _stats.delayMs += delayMs;
+        _lastDelayMs = delayMs;
+    }
+
+    double lastDelayMs() const {
+        return _lastDelayMs;
+    }
+
+    LatencyStats stats(){
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _stats;
+    }
+
+    // Of the recent samples, percentile between 0 and 1
+    double percentileMs(double percentile){
+        std::vector<double> sorted;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            sorted = _samples;
+        }
+
+        if(sorted.empty())
+            return 0.0;
+
+        size_t index = std::min(static_cast<size_t>(percentile * sorted.size()), sorted.size() - 1);
+        std::nth_element(sorted.begin(), sorted.begin() + index, sorted.end());
+        return sorted[index];
+    }
+
+    void printStats(const char* presentMode){
+        LatencyStats total = stats();
+        fmt::println("Input to {} latency with {}{}: p50 {:.2f}ms, p90 {:.2f}ms, p99 {:.2f}ms over {} frames, {} dropped",
+            presentWait() ? "present" : "GPU completion", presentMode, lowLatency ? " and low latency pacing" : "",
+            percentileMs(0.5), percentileMs(0.9), percentileMs(0.99), total.measured, total.dropped);
+
+        if(total.pacedFrames > 0){
+            fmt::println("    {} frames paced to a {:.2f}ms interval, {:.2f}ms delay on average", total.pacedFrames, _intervalMs, total.averageDelayMs());
+        }
+    }
+
+private:
+    struct Pending{
+        VkSwapchainKHR swapchain;
+        uint64_t presentId;
+        uint64_t completionValue;
+        std::chrono::high_resolution_clock::time_point inputTime;
+    };
+
+    VkDevice _device;
+    PFN_vkWaitForPresentKHR _vkWaitForPresent{nullptr};
+    VkSemaphore _completionTimeline{VK_NULL_HANDLE};
+    uint64_t _completionValue{0};
+
+    uint64_t _presentId{0};
+    VkPresentIdKHR _presentIdInfo{};
+    std::chrono::high_resolution_clock::time_point _inputTime;
+
+    double _intervalMs;
+    double _predictedWorkMs{0.0};
+    double _lastDelayMs{0.0};
+
+    std::thread _waiter;
+    std::mutex _swapchainMutex;
+
+    // Everything below is shared with the waiter
+    std::mutex _mutex;
+    std::condition_variable _changed;
+    std::deque<Pending> _pending;       // In present order, the front is the one being waited on
+    bool _waiting{false};               // On the front's swapchain
+    bool _stopping{false};
+
+    LatencyStats _stats;
+    std::vector<double> _samples;
+    size_t _nextSample{0};
+
+    // Waits in slices so a replaced swapchain or shutdown is noticed soon, the front is dropped from _pending by then
+    void waiterLoop(){
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while(true){
+            _changed.wait(lock, [this](){ return _stopping || !_pending.empty(); });
+            if(_stopping)
+                return;
+
+            Pending pending = _pending.front();
+            _waiting = true;
+            lock.unlock();
+
+            auto waitStart = std::chrono::high_resolution_clock::now();
+            auto timeout = std::chrono::nanoseconds(PRESENT_WAIT_TIMEOUT);
+
+            bool complete = false;
+            while(!complete && std::chrono::high_resolution_clock::now() - waitStart < timeout){
+                complete = waitSlice(pending);
+
+                std::lock_guard<std::mutex> check(_mutex);
+                if(_stopping || _pending.empty() || _pending.front().completionValue != pending.completionValue)
+                    break;
+            }
+            auto completeTime = std::chrono::high_resolution_clock::now();
+
+            lock.lock();
+            _waiting = false;
+
+            // Still ours unless the swapchain was replaced meanwhile
+            if(!_pending.empty() && _pending.front().completionValue == pending.completionValue){
+                _pending.pop_front();
+                addSample(std::chrono::duration<double, std::milli>(completeTime - pending.inputTime).count());
+            }
+            _changed.notify_all();
+        }
+    }
+
+    // The present can't complete before the frame's GPU work, so the swapchain is only locked while the image waits
+    // in the presentation engine, and then for short slices
+    bool waitSlice(const Pending& pending){
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &_completionTimeline;
+        waitInfo.pValues = &pending.completionValue;
+
+        bool gpuComplete = vkWaitSemaphores(_device, &waitInfo, WAIT_SLICE) != VK_TIMEOUT;
+        if(!presentWait() || !gpuComplete)
+            return gpuComplete;
+
+        // Out of date and surface lost also mean the present is as complete as it's going to get
+        std::lock_guard<std::mutex> lock(_swapchainMutex);
+        return _vkWaitForPresent(_device, pending.swapchain, pending.presentId, PRESENT_WAIT_SLICE) != VK_TIMEOUT;
+    }
+
+    // With _mutex held
+    void addSample(double ms){
+        if(_samples.size() < MAX_SAMPLES){
+            _samples.push_back(ms);
+        } else {
+            _samples[_nextSample] = ms;
+        }
+        _nextSample = (_nextSample + 1) % MAX_SAMPLES;
+
+        _stats.measured++;
+    }
+};
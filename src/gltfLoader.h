@@ -0,0 +1,553 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "meshOptimizer.h"
+#include "jobSystem.h"
+
+#include <fastgltf/core.hpp>
+#include <fastgltf/tools.hpp>
+#include <fastgltf/glm_element_traits.hpp>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <optional>
+
+struct GltfImportStats{
+    size_t sourceBytes{0};
+    size_t primitiveCount{0};
+    size_t vertexCount{0};
+    size_t indexCount{0};
+    uint32_t threadCount{0};
+
+    double parseMs{0.0};
+    double decodeMs{0.0};
+
+    double megabytesPerSecond() const {
+        double seconds = (parseMs + decodeMs) / 1000.0;
+        return seconds == 0.0 ? 0.0 : double(sourceBytes) / (1024.0 * 1024.0) / seconds;
+    }
+
+    double primitivesPerSecond() const {
+        return decodeMs == 0.0 ? 0.0 : double(primitiveCount) / (decodeMs / 1000.0);
+    }
+};
+
+// Memory-maps a .gltf/.glb and the buffers it references, then decodes every triangle primitive into
+// Vertex and index data on the job system's workers, written straight to caller provided (staging) memory.
+// The binary chunk of a .glb is used in place, only data URIs are decoded into memory of their own.
+// Indices stay local to their primitive, each Submesh draws with its own vertexOffset.
+class GltfImporter{
+public:
+    std::vector<Submesh> submeshes;
+    GltfImportStats stats;
+
+    bool open(const std::filesystem::path& path){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        auto mapped = fastgltf::MappedGltfFile::FromPath(path);
+        if(mapped.error() != fastgltf::Error::None){
+            fmt::println("Failed to map glTF file {}: {}", path.string(), fastgltf::getErrorMessage(mapped.error()));
+            return false;
+        }
+
+        source.file = std::move(mapped.get());
+        source.findBinaryChunk();
+        stats.sourceBytes = source.file.totalSize();
+
+        parser.setUserPointer(&source);
+        parser.setBufferAllocationCallback(&MappedSource::allocateBuffer);
+
+        auto loaded = parser.loadGltf(source, path.parent_path(), fastgltf::Options::None);
+        if(loaded.error() != fastgltf::Error::None){
+            fmt::println("Failed to parse glTF file {}: {}", path.string(), fastgltf::getErrorMessage(loaded.error()));
+            return false;
+        }
+
+        asset = std::move(loaded.get());
+
+        if(fastgltf::Error error = fastgltf::validate(asset); error != fastgltf::Error::None){
+            fmt::println("Invalid glTF file {}: {}", path.string(), fastgltf::getErrorMessage(error));
+            return false;
+        }
+
+        if(!resolveBuffers(path.parent_path()))
+            return false;
+
+        planPrimitives();
+        planSubmeshes();
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        stats.parseMs = elapsed.count();
+
+        return true;
+    }
+
+    size_t vertexCount() const {
+        return stats.vertexCount;
+    }
+
+    size_t indexCount() const {
+        return stats.indexCount;
+    }
+
+    // Indices are primitive local, so 16 bits are enough as long as every primitive fits
+    VkIndexType indexType() const {
+        return MeshOptimizer::chooseIndexType(maxPrimitiveVertices);
+    }
+
+    // vertexDst must hold vertexCount() vertices, indexDst indexCount() indices of indexType(). Primitives are spread
+    // over the job system, without one everything decodes on the calling thread.
+    void decode(Vertex* vertexDst, void* indexDst, JobSystem* jobSystem = nullptr){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // Largest primitives first, so one big primitive doesn't end up last on a single thread
+        std::vector<uint32_t> order(jobs.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(), [&](uint32_t l, uint32_t r){
+            return jobs[l].vertexCount + jobs[l].indexCount > jobs[r].vertexCount + jobs[r].indexCount;
+        });
+
+        VkIndexType type = indexType();
+
+        auto body = [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++){
+                decodePrimitive(jobs[order[i]], vertexDst, indexDst, type);
+            }
+        };
+
+        if(jobSystem){
+            jobSystem->parallelFor(order.size(), 1, body);
+        } else {
+            body(0, order.size());
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        stats.decodeMs = elapsed.count();
+        stats.threadCount = jobSystem ? jobSystem->threadCount() : 1;
+    }
+
+    void printStats(){
+        fmt::println("glTF import: {} primitives, {} vertices, {} indices from {:.2f}MB", stats.primitiveCount, stats.vertexCount, stats.indexCount, double(stats.sourceBytes) / (1024.0 * 1024.0));
+        fmt::println("    parse {:.2f}ms, decode {:.2f}ms on {} threads", stats.parseMs, stats.decodeMs, stats.threadCount);
+        fmt::println("    {:.1f}MB/s, {:.0f} primitives/s", stats.megabytesPerSecond(), stats.primitivesPerSecond());
+
+        if(invalidIndices > 0){
+            fmt::println("    {} indices past their primitive's vertices replaced", invalidIndices.load());
+        }
+    }
+
+private:
+    static const size_t DECODE_BLOCK_SIZE = 256;
+
+    // Hands the parser a mapped file. The GLB binary chunk is found from the file's own chunk headers, when the parser
+    // asks for memory for it while reading right at its start it gets the mapping itself and the read copies nothing.
+    struct MappedSource : public fastgltf::GltfDataGetter{
+        static constexpr fastgltf::CustomBufferId BINARY_CHUNK_ID = UINT64_MAX;
+
+        fastgltf::MappedGltfFile file;
+
+        // Data of the BIN chunk inside the mapping, size 0 for .gltf files and GLBs without one
+        size_t binaryChunkOffset{0}, binaryChunkSize{0};
+
+        // Memory for buffers the parser has to decode itself, like base64 data URIs
+        struct DecodedBuffer{
+            std::unique_ptr<std::byte[]> data;
+            size_t size;
+        };
+        std::vector<DecodedBuffer> decodedBuffers;
+
+        // Header, JSON chunk, BIN chunk, see the GLB section of the glTF spec
+        void findBinaryChunk(){
+            const uint32_t GLB_MAGIC = 0x46546C67, BIN_CHUNK = 0x004E4942;
+            const size_t HEADER_SIZE = 12, CHUNK_HEADER_SIZE = 8;
+
+            fastgltf::span<const std::byte> bytes = mappedBytes();
+
+            auto word = [&](size_t offset){
+                uint32_t value;
+                memcpy(&value, bytes.data() + offset, sizeof(value));
+                return value;
+            };
+
+            if(bytes.size() < HEADER_SIZE + CHUNK_HEADER_SIZE || word(0) != GLB_MAGIC)
+                return;
+
+            size_t binaryHeader = HEADER_SIZE + CHUNK_HEADER_SIZE + size_t(word(HEADER_SIZE));
+            if(binaryHeader > bytes.size() || bytes.size() - binaryHeader < CHUNK_HEADER_SIZE || word(binaryHeader + 4) != BIN_CHUNK)
+                return;
+
+            size_t size = word(binaryHeader);
+            if(size > bytes.size() - binaryHeader - CHUNK_HEADER_SIZE)
+                return;
+
+            binaryChunkOffset = binaryHeader + CHUNK_HEADER_SIZE;
+            binaryChunkSize = size;
+        }
+
+        fastgltf::span<const std::byte> binaryChunk(){
+            return mappedBytes().subspan(binaryChunkOffset, binaryChunkSize);
+        }
+
+        static fastgltf::BufferInfo allocateBuffer(uint64_t bufferSize, void* userPointer){
+            MappedSource* self = static_cast<MappedSource*>(userPointer);
+
+            if(self->binaryChunkSize != 0 && self->file.bytesRead() == self->binaryChunkOffset && bufferSize == self->binaryChunkSize){
+                return {const_cast<std::byte*>(self->binaryChunk().data()), BINARY_CHUNK_ID};
+            }
+
+            self->decodedBuffers.push_back({std::make_unique<std::byte[]>(bufferSize), bufferSize});
+            return {self->decodedBuffers.back().data.get(), self->decodedBuffers.size() - 1};
+        }
+
+        // Into the mapping at the current position is the binary chunk landing where it already is
+        void read(void* ptr, std::size_t count) override {
+            if(ptr == mappedBytes().data() + file.bytesRead()){
+                (void)file.read(count, 0);
+                return;
+            }
+
+            file.read(ptr, count);
+        }
+
+        fastgltf::span<std::byte> read(std::size_t count, std::size_t padding) override {
+            return file.read(count, padding);
+        }
+
+        void reset() override {
+            file.reset();
+        }
+
+        std::size_t bytesRead() override {
+            return file.bytesRead();
+        }
+
+        std::size_t totalSize() override {
+            return file.totalSize();
+        }
+
+        fastgltf::span<const std::byte> mappedBytes(){
+            fastgltf::span<std::byte> bytes(file);
+            return fastgltf::span<const std::byte>(bytes.data(), bytes.size());
+        }
+    };
+
+    // Resolves buffer views against the mapped files instead of fastgltf's loaded buffers. resolveBuffers checked that
+    // every view lies inside its buffer.
+    struct BufferAdapter{
+        const std::vector<fastgltf::span<const std::byte>>* buffers;
+
+        fastgltf::span<const std::byte> operator()(const fastgltf::Asset& asset, std::size_t bufferViewIdx) const {
+            const fastgltf::BufferView& view = asset.bufferViews[bufferViewIdx];
+            return (*buffers)[view.bufferIndex].subspan(view.byteOffset, view.byteLength);
+        }
+    };
+
+    template<typename T>
+    struct AttributeStream{
+        std::optional<fastgltf::IterableAccessor<T, BufferAdapter>> accessor;
+        std::optional<typename fastgltf::IterableAccessor<T, BufferAdapter>::iterator> it;
+
+        AttributeStream(const fastgltf::Asset& asset, const fastgltf::Primitive& primitive, std::string_view name, fastgltf::AccessorType type, const BufferAdapter& adapter){
+            auto attribute = primitive.findAttribute(name);
+            if(attribute == primitive.attributes.end())
+                return;
+
+            const fastgltf::Accessor& a = asset.accessors[attribute->accessorIndex];
+            if(a.type != type || !a.bufferViewIndex.has_value())
+                return;
+
+            accessor.emplace(asset, a, adapter);
+            it.emplace(accessor->begin());
+        }
+
+        bool valid() const {
+            return accessor.has_value();
+        }
+
+        T next(){
+            T value = **it;
+            ++*it;
+            return value;
+        }
+    };
+
+    struct PrimitiveJob{
+        const fastgltf::Primitive* primitive;
+        uint32_t firstVertex, vertexCount;
+        uint32_t firstIndex, indexCount;
+        glm::vec4 baseColor;
+    };
+
+    fastgltf::Parser parser;
+    fastgltf::Asset asset;
+    MappedSource source;
+
+    std::vector<fastgltf::MappedGltfFile> externalFiles;
+    std::vector<fastgltf::span<const std::byte>> bufferData;
+
+    std::vector<PrimitiveJob> jobs;
+    // First job of every glTF mesh, its primitives follow in order
+    std::vector<uint32_t> meshFirstJob, meshJobCount;
+    size_t maxPrimitiveVertices{0};
+    std::atomic<size_t> invalidIndices{0};     // Replaced by 0 while decoding
+
+    bool resolveBuffers(const std::filesystem::path& directory){
+        bufferData.resize(asset.buffers.size());
+
+        for(size_t i = 0; i < asset.buffers.size(); i++){
+            const fastgltf::Buffer& buffer = asset.buffers[i];
+
+            bool resolved = std::visit(fastgltf::visitor{
+                [&](const fastgltf::sources::CustomBuffer& custom){
+                    if(custom.id == MappedSource::BINARY_CHUNK_ID){
+                        bufferData[i] = source.binaryChunk();
+                    } else {
+                        const MappedSource::DecodedBuffer& decoded = source.decodedBuffers[custom.id];
+                        bufferData[i] = fastgltf::span<const std::byte>(decoded.data.get(), decoded.size);
+                    }
+                    return true;
+                },
+                [&](const fastgltf::sources::URI& uri){
+                    auto mapped = fastgltf::MappedGltfFile::FromPath(directory / uri.uri.fspath());
+                    if(mapped.error() != fastgltf::Error::None){
+                        fmt::println("Failed to map glTF buffer {}", uri.uri.string());
+                        return false;
+                    }
+
+                    externalFiles.push_back(std::move(mapped.get()));
+                    fastgltf::span<std::byte> bytes(externalFiles.back());
+
+                    stats.sourceBytes += bytes.size();
+                    bufferData[i] = fastgltf::span<const std::byte>(bytes.data() + uri.fileByteOffset, buffer.byteLength);
+                    return true;
+                },
+                [&](const fastgltf::sources::Array& array){
+                    bufferData[i] = fastgltf::span<const std::byte>(array.bytes.data(), array.bytes.size());
+                    return true;
+                },
+                [&](const fastgltf::sources::ByteView& view){
+                    bufferData[i] = view.bytes;
+                    return true;
+                },
+                [&](auto&){
+                    fmt::println("Unsupported source for glTF buffer {}", i);
+                    return false;
+                },
+            }, buffer.data);
+
+            if(!resolved)
+                return false;
+
+            if(bufferData[i].size() < buffer.byteLength){
+                fmt::println("glTF buffer {} is shorter than its byteLength", i);
+                return false;
+            }
+        }
+
+        for(size_t i = 0; i < asset.bufferViews.size(); i++){
+            const fastgltf::BufferView& view = asset.bufferViews[i];
+            size_t size = bufferData[view.bufferIndex].size();
+
+            if(view.byteLength > size || view.byteOffset > size - view.byteLength){
+                fmt::println("glTF buffer view {} is out of its buffer's bounds", i);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Every element the accessor iterates lies inside its buffer view. Sparse accessors aren't decoded.
+    bool accessorInBounds(const fastgltf::Accessor& accessor, fastgltf::AccessorType type) const {
+        if(accessor.type != type || !accessor.bufferViewIndex.has_value() || accessor.sparse)
+            return false;
+
+        const fastgltf::BufferView& view = asset.bufferViews[*accessor.bufferViewIndex];
+        size_t elementSize = fastgltf::getElementByteSize(accessor.type, accessor.componentType);
+        size_t stride = view.byteStride.value_or(elementSize);
+
+        if(accessor.byteOffset > view.byteLength || elementSize > view.byteLength - accessor.byteOffset)
+            return false;
+
+        return (accessor.count - 1) <= (view.byteLength - accessor.byteOffset - elementSize) / stride;
+    }
+
+    // POSITION decides the vertex count, the other attributes decodePrimitive reads have to match it
+    bool primitiveValid(const fastgltf::Primitive& primitive, const fastgltf::Accessor& position) const {
+        if(!accessorInBounds(position, fastgltf::AccessorType::Vec3))
+            return false;
+
+        for(const char* name: {"NORMAL", "TEXCOORD_0", "COLOR_0"}){
+            auto attribute = primitive.findAttribute(name);
+            if(attribute == primitive.attributes.end())
+                continue;
+
+            const fastgltf::Accessor& accessor = asset.accessors[attribute->accessorIndex];
+            if(accessor.bufferViewIndex.has_value() && (accessor.count != position.count || !accessorInBounds(accessor, accessor.type)))
+                return false;
+        }
+
+        return !primitive.indicesAccessor.has_value() || accessorInBounds(asset.accessors[*primitive.indicesAccessor], fastgltf::AccessorType::Scalar);
+    }
+
+    // Lays every primitive out back to back in the vertex and index arrays
+    void planPrimitives(){
+        uint32_t vertexCursor = 0, indexCursor = 0;
+
+        meshFirstJob.resize(asset.meshes.size());
+        meshJobCount.resize(asset.meshes.size());
+
+        for(size_t m = 0; m < asset.meshes.size(); m++){
+            meshFirstJob[m] = static_cast<uint32_t>(jobs.size());
+
+            for(const fastgltf::Primitive& primitive: asset.meshes[m].primitives){
+                auto position = primitive.findAttribute("POSITION");
+
+                if(primitive.type != fastgltf::PrimitiveType::Triangles || position == primitive.attributes.end())
+                    continue;
+
+                if(!primitiveValid(primitive, asset.accessors[position->accessorIndex])){
+                    fmt::println("Skipping glTF primitive of mesh {}: accessors out of bounds or not matching POSITION", m);
+                    continue;
+                }
+
+                PrimitiveJob job{};
+                job.primitive = &primitive;
+                job.vertexCount = static_cast<uint32_t>(asset.accessors[position->accessorIndex].count);
+                job.indexCount = primitive.indicesAccessor.has_value() ? static_cast<uint32_t>(asset.accessors[*primitive.indicesAccessor].count) : job.vertexCount;
+                job.firstVertex = vertexCursor;
+                job.firstIndex = indexCursor;
+                job.baseColor = glm::vec4(1.f);
+
+                if(primitive.materialIndex.has_value()){
+                    const auto& factor = asset.materials[*primitive.materialIndex].pbrData.baseColorFactor;
+                    job.baseColor = glm::vec4(factor[0], factor[1], factor[2], factor[3]);
+                }
+
+                vertexCursor += job.vertexCount;
+                indexCursor += job.indexCount;
+                maxPrimitiveVertices = std::max<size_t>(maxPrimitiveVertices, job.vertexCount);
+
+                jobs.push_back(job);
+            }
+
+            meshJobCount[m] = static_cast<uint32_t>(jobs.size()) - meshFirstJob[m];
+        }
+
+        stats.primitiveCount = jobs.size();
+        stats.vertexCount = vertexCursor;
+        stats.indexCount = indexCursor;
+    }
+
+    // One submesh per primitive per node instance, with the node's world transform
+    void planSubmeshes(){
+        auto addMesh = [&](size_t meshIndex, const glm::mat4& transform){
+            for(uint32_t j = meshFirstJob[meshIndex]; j < meshFirstJob[meshIndex] + meshJobCount[meshIndex]; j++){
+                Submesh submesh{};
+                submesh.firstIndex = jobs[j].firstIndex;
+                submesh.indexCount = jobs[j].indexCount;
+                submesh.vertexOffset = static_cast<int32_t>(jobs[j].firstVertex);
+                submesh.transform = transform;
+
+                submeshes.push_back(submesh);
+            }
+        };
+
+        if(asset.scenes.empty()){
+            for(size_t m = 0; m < asset.meshes.size(); m++){
+                addMesh(m, glm::mat4(1.f));
+            }
+            return;
+        }
+
+        size_t sceneIndex = asset.defaultScene.has_value() ? *asset.defaultScene : 0;
+
+        fastgltf::iterateSceneNodes(asset, sceneIndex, fastgltf::math::fmat4x4(), [&](fastgltf::Node& node, const fastgltf::math::fmat4x4& matrix){
+            if(!node.meshIndex.has_value())
+                return;
+
+            addMesh(*node.meshIndex, glm::make_mat4(matrix.data()));
+        });
+    }
+
+    void decodePrimitive(const PrimitiveJob& job, Vertex* vertexDst, void* indexDst, VkIndexType type){
+        const fastgltf::Primitive& primitive = *job.primitive;
+        BufferAdapter adapter{&bufferData};
+
+        AttributeStream<glm::vec3> positions(asset, primitive, "POSITION", fastgltf::AccessorType::Vec3, adapter);
+        AttributeStream<glm::vec3> normals(asset, primitive, "NORMAL", fastgltf::AccessorType::Vec3, adapter);
+        AttributeStream<glm::vec2> uvs(asset, primitive, "TEXCOORD_0", fastgltf::AccessorType::Vec2, adapter);
+        AttributeStream<glm::vec4> colors(asset, primitive, "COLOR_0", fastgltf::AccessorType::Vec4, adapter);
+        AttributeStream<glm::vec3> colorsRgb(asset, primitive, "COLOR_0", fastgltf::AccessorType::Vec3, adapter);
+
+        // Vertices are built a block at a time and copied out whole, staging memory is usually write-combined
+        Vertex block[DECODE_BLOCK_SIZE];
+        Vertex* out = vertexDst + job.firstVertex;
+
+        for(uint32_t first = 0; first < job.vertexCount; first += DECODE_BLOCK_SIZE){
+            uint32_t count = std::min<uint32_t>(DECODE_BLOCK_SIZE, job.vertexCount - first);
+
+            for(uint32_t i = 0; i < count; i++){
+                Vertex& v = block[i];
+
+                v.position = positions.valid() ? positions.next() : glm::vec3(0.f);
+                v.normal = normals.valid() ? normals.next() : glm::vec3(0.f, 0.f, 1.f);
+
+                glm::vec2 uv = uvs.valid() ? uvs.next() : glm::vec2(0.f);
+                v.uv_x = uv.x;
+                v.uv_y = uv.y;
+
+                glm::vec4 color = colors.valid() ? colors.next() : colorsRgb.valid() ? glm::vec4(colorsRgb.next(), 1.f) : glm::vec4(1.f);
+                v.color = color * job.baseColor;
+            }
+
+            memcpy(out + first, block, count * sizeof(Vertex));
+        }
+
+        if(type == VK_INDEX_TYPE_UINT16){
+            writeIndices(job, static_cast<uint16_t*>(indexDst) + job.firstIndex, adapter);
+        } else {
+            writeIndices(job, static_cast<uint32_t*>(indexDst) + job.firstIndex, adapter);
+        }
+    }
+
+    template<typename IndexType>
+    void writeIndices(const PrimitiveJob& job, IndexType* out, const BufferAdapter& adapter){
+        IndexType block[DECODE_BLOCK_SIZE];
+
+        std::optional<fastgltf::IterableAccessor<uint32_t, BufferAdapter>> accessor;
+        std::optional<typename fastgltf::IterableAccessor<uint32_t, BufferAdapter>::iterator> it;
+
+        if(job.primitive->indicesAccessor.has_value() && asset.accessors[*job.primitive->indicesAccessor].bufferViewIndex.has_value()){
+            accessor.emplace(asset, asset.accessors[*job.primitive->indicesAccessor], adapter);
+            it.emplace(accessor->begin());
+        }
+
+        for(uint32_t first = 0; first < job.indexCount; first += DECODE_BLOCK_SIZE){
+            uint32_t count = std::min<uint32_t>(DECODE_BLOCK_SIZE, job.indexCount - first);
+
+            for(uint32_t i = 0; i < count; i++){
+                // Non-indexed primitives draw their vertices in order
+                uint32_t index = first + i;
+                if(it.has_value()){
+                    index = **it;
+                    ++*it;
+                }
+
+                // The GPU would fetch past the primitive's vertices
+                if(index >= job.vertexCount){
+                    index = 0;
+                    invalidIndices.fetch_add(1, std::memory_order_relaxed);
+                }
+
+                block[i] = static_cast<IndexType>(index);
+            }
+
+            memcpy(out + first, block, count * sizeof(IndexType));
+        }
+    }
+};
@@ -0,0 +1,243 @@
+#pragma once
+
+#include "types.h"
+#include "utility.h"
+#include "initializers.h"
+#include "structs.h"
+#include "meshPipelines.h"
+#include "meshlet.h"
+
+#include <atomic>
+
+struct GltfUniform {
+    glm::mat4 modelMatrix;
+};
+
+// Static scene imported from a glTF file or a cooked .scene, see Renderer::decodeGltfMesh and Renderer::decodeCookedMesh.
+// Draws every submesh with the vertex pulling pipeline. Cooked scenes also bring LODs, picked per submesh by distance,
+// and meshlets for the mesh shading path.
+struct GltfMesh: public Mesh {
+public:
+    std::string vertexShaderFile = "shaders\\shader.vert.spv", fragShaderFile = "shaders\\shader.frag.spv";
+    std::string taskShaderFile = "shaders\\meshlet.task.spv", meshShaderFile = "shaders\\meshlet.mesh.spv";
+
+    float scale = 1.f;
+
+    // LOD error allowed per unit of view distance, 0.001 is about a pixel at 1080p with a 60 degree field of view
+    float lodTolerance = 0.001f;
+    int forcedLod = -1;
+    std::atomic<uint32_t> trianglesDrawn{0};     // Summed by the draw ranges, which may record on several threads
+
+    GltfMesh(const std::string& path){
+        importPath = path;
+
+        updateVertexBuffer = false;
+        updateIndexBuffer = false;
+    }
+
+    void setup(VkDevice _device, VmaAllocator& _allocator, VkFormat drawImageFormat, VkFormat depthImageFormat) override {
+        createDescriptorSetLayout(_device);
+        createPipeline(_device, drawImageFormat, depthImageFormat);
+        setupUniformBuffer(_device, _allocator);
+    }
+
+    void remakePipeline(VkDevice _device, VkFormat drawImageFormat, VkFormat depthImageFormat) override {
+        pipelineDeletionQueue.flush();
+        createPipeline(_device, drawImageFormat, depthImageFormat);
+    }
+
+    void imguiInterface(){
+        if(ImGui::Begin("glTF Scene")){
+            ImGui::Text("%s", importPath.c_str());
+            ImGui::Text("%zu submeshes, %u triangles", submeshes.size(), indexCount / 3);
+            ImGui::SliderFloat("Scale", &scale, 0.01f, 10.f);
+
+            if(hasLods()){
+                ImGui::Text("%u triangles drawn", trianglesDrawn.load());
+                ImGui::SliderFloat("LOD Tolerance", &lodTolerance, 0.0001f, 0.05f, "%.4f", ImGuiSliderFlags_Logarithmic);
+                ImGui::SliderInt("Force LOD", &forcedLod, -1, 4);
+            }
+
+            if(meshletBuffer.buffer != VK_NULL_HANDLE){
+                ImGui::Checkbox("Cone Culling", &coneCulling);
+            }
+        }
+        ImGui::End();
+    }
+
+    // LODs are picked by distance to the camera, only a forced one draws the same every frame
+    bool staticDraw() override {
+        return !hasLods() || forcedLod >= 0;
+    }
+
+    uint64_t drawState() override {
+        uint64_t hash = Utility::hashBytes(Utility::FNV_OFFSET, &scale, sizeof(scale));
+        return Utility::hashBytes(hash, &forcedLod, sizeof(forcedLod));
+    }
+
+    void update(VkDevice _device, VmaAllocator& allocator, DescriptorAllocator& _descriptorAllocator) override {
+        GltfUniform* data = (GltfUniform*)uniformBuffer.allocation->GetMappedData();
+        *data = {
+            glm::scale(glm::mat4(1.f), glm::vec3(scale))
+        };
+
+        set = _descriptorAllocator.allocate(_device, setLayout);
+
+        DescriptorWriter writer;
+        writer.writeBuffer(0, uniformBuffer.buffer, sizeof(GltfUniform), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        writer.updateSet(_device, set);
+
+        trianglesDrawn = 0;
+    }
+
+    void draw(VkCommandBuffer& command, glm::mat4 viewProj) override {
+        drawRange(command, viewProj, 0, submeshes.size());
+    }
+
+    // One draw per submesh
+    size_t drawCount() override {
+        return submeshes.size();
+    }
+
+    void drawRange(VkCommandBuffer& command, glm::mat4 viewProj, size_t first, size_t last) override {
+        if(useMeshShading && vkCmdDrawMeshTasks && meshletBuffer.buffer != VK_NULL_HANDLE){
+            drawMeshlets(command, viewProj, first, last);
+            return;
+        }
+
+        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+        vkCmdBindIndexBuffer(command, indexBuffer.buffer, 0, indexType);
+        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &set, 0, nullptr);
+
+        MeshPushConstants pushConstants{};
+        pushConstants.vertexBuffer = vertexBufferAddress;
+        pushConstants.frameConstants = frameConstantsAddress;
+        pushConstants.vertexFormat = vertexFormat;
+        pushConstants.positionMin = positionMin;
+        pushConstants.positionExtent = positionExtent;
+
+        uint32_t triangles = 0;
+
+        for(size_t i = first; i < last; i++){
+            const Submesh& submesh = submeshes[i];
+            pushConstants.transformRows = affineRows(submesh.transform);
+
+            uint32_t firstIndex = submesh.firstIndex, count = submesh.indexCount;
+            if(const SubmeshLod* lod = selectLod(submesh, viewProj * submesh.transform)){
+                firstIndex = lod->firstIndex;
+                count = lod->indexCount;
+            }
+
+            triangles += count / 3;
+
+            vkCmdPushConstants(command, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
+            vkCmdDrawIndexed(command, count, 1, firstIndex, submesh.vertexOffset, 0);
+        }
+
+        trianglesDrawn += triangles;
+    }
+
+    // Every submesh's meshlets on their own, the buffer address moves to its first meshlet. The LOD is picked like on
+    // the vertex path, each one was clustered when it was cooked.
+    void drawMeshlets(VkCommandBuffer& command, glm::mat4 viewProj, size_t first, size_t last){
+        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipeline);
+        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, meshletPipelineLayout, 0, 1, &set, 0, nullptr);
+
+        MeshletPushConstants pushConstants{};
+        pushConstants.vertexBuffer = vertexBufferAddress;
+        pushConstants.frameConstants = frameConstantsAddress;
+        pushConstants.flags = (coneCulling ? MESHLET_FLAG_CONE_CULLING : 0) | (vertexFormat == VERTEX_FORMAT_COMPACT ? MESHLET_FLAG_COMPACT_VERTICES : 0);
+        pushConstants.positionMin = positionMin;
+        pushConstants.positionExtent = positionExtent;
+
+        uint32_t triangles = 0;
+
+        for(size_t i = first; i < last; i++){
+            const Submesh& submesh = submeshes[i];
+
+            uint32_t firstMeshlet = submesh.firstMeshlet, meshletCount = submesh.meshletCount, indexCount = submesh.indexCount;
+            uint32_t vertexOffset = submesh.meshletVertexOffset, triangleOffset = submesh.meshletTriangleOffset;
+            if(const SubmeshLod* lod = selectLod(submesh, viewProj * submesh.transform)){
+                firstMeshlet = lod->firstMeshlet;
+                meshletCount = lod->meshletCount;
+                indexCount = lod->indexCount;
+                vertexOffset = lod->meshletVertexOffset;
+                triangleOffset = lod->meshletTriangleOffset;
+            }
+
+            if(meshletCount == 0)
+                continue;
+
+            pushConstants.transformRows = affineRows(submesh.transform);
+            pushConstants.meshletBuffer = meshletBufferAddress + firstMeshlet * sizeof(Meshlet);
+            pushConstants.meshletCount = meshletCount;
+            pushConstants.meshletVertexOffset = vertexOffset;
+            pushConstants.meshletTriangleOffset = triangleOffset;
+
+            triangles += indexCount / 3;
+
+            vkCmdPushConstants(command, meshletPipelineLayout, VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT, 0, sizeof(MeshletPushConstants), &pushConstants);
+
+            uint32_t taskGroups = (meshletCount + Meshlets::TASK_GROUP_SIZE - 1) / Meshlets::TASK_GROUP_SIZE;
+            vkCmdDrawMeshTasks(command, taskGroups, 1, 1);
+        }
+
+        trianglesDrawn += triangles;
+    }
+
+private:
+    static constexpr MeshPipelines::Style PIPELINE_STYLE{VK_FRONT_FACE_COUNTER_CLOCKWISE, false};
+
+    bool hasLods() const {
+        return !submeshes.empty() && !submeshes[0].lods.empty();
+    }
+
+    // Coarsest LOD whose error, seen from the near side of the submesh's bounds, stays within lodTolerance.
+    // Assumes a perspective projection, where clip space w is the view depth.
+    const SubmeshLod* selectLod(const Submesh& submesh, const glm::mat4& worldMatrix){
+        if(submesh.lods.empty() || forcedLod == 0)
+            return nullptr;
+
+        if(forcedLod > 0)
+            return &submesh.lods[std::min<size_t>(forcedLod, submesh.lods.size()) - 1];
+
+        // Mesh units to world units, taking the largest axis for non-uniform scales
+        float meshScale = scale * std::max({glm::length(glm::vec3(submesh.transform[0])), glm::length(glm::vec3(submesh.transform[1])), glm::length(glm::vec3(submesh.transform[2]))});
+
+        glm::mat4 model = glm::scale(glm::mat4(1.f), glm::vec3(scale));
+        float distance = (worldMatrix * model * glm::vec4(glm::vec3(submesh.sphere), 1.f)).w - submesh.sphere.w * meshScale;
+        if(distance <= 0.f)
+            return nullptr;
+
+        const SubmeshLod* selected = nullptr;
+        for(const SubmeshLod& lod: submesh.lods){
+            if(lod.error * meshScale > lodTolerance * distance)
+                break;
+
+            selected = &lod;
+        }
+
+        return selected;
+    }
+
+    void setupUniformBuffer(VkDevice device, VmaAllocator& allocator){
+        uniformBuffer = Utility::createBuffer(allocator, sizeof(GltfUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+        uniformDeletionQueue.pushFunction([this, allocator]{
+            Utility::destroyBuffer(allocator, uniformBuffer);
+        });
+    }
+
+    void createPipeline(VkDevice _device, VkFormat drawImageFormat, VkFormat depthImageFormat){
+        MeshPipelines::createVertexPipeline(_device, *this, vertexShaderFile, fragShaderFile, PIPELINE_STYLE, drawImageFormat, depthImageFormat);
+
+        if(vkCmdDrawMeshTasks){
+            MeshPipelines::createMeshletPipeline(_device, *this, taskShaderFile, meshShaderFile, fragShaderFile, PIPELINE_STYLE, drawImageFormat, depthImageFormat);
+        }
+    }
+
+    void createDescriptorSetLayout(VkDevice _device){
+        setLayout = MeshPipelines::createUniformSetLayout(_device, vkCmdDrawMeshTasks != nullptr);
+    }
+};
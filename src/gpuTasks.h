@@ -0,0 +1,362 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "utility.h"
+#include "transferQueue.h"
+
+#include <coroutine>
+#include <utility>
+#include <exception>
+#include <span>
+
+class GpuScheduler;
+
+// A coroutine that co_awaits GPU work, started by calling it and handed to GpuScheduler::spawn right away.
+// It runs on the calling thread up to its first co_await, and after that on the render thread from GpuScheduler::poll.
+class [[nodiscard]] GpuTask{
+public:
+    struct promise_type{
+        std::exception_ptr exception;
+
+        GpuTask get_return_object(){
+            return GpuTask(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        // Kept until the scheduler has looked at it, so an exception isn't lost
+        std::suspend_always final_suspend() noexcept { return {}; }
+
+        void return_void(){}
+
+        void unhandled_exception(){
+            exception = std::current_exception();
+        }
+    };
+
+    GpuTask(GpuTask&& other) noexcept: _handle(std::exchange(other._handle, {})){}
+    GpuTask(const GpuTask&) = delete;
+    GpuTask& operator=(const GpuTask&) = delete;
+
+    GpuTask& operator=(GpuTask&& other) noexcept {
+        if(this != &other){
+            if(_handle){
+                _handle.destroy();
+            }
+            _handle = std::exchange(other._handle, {});
+        }
+        return *this;
+    }
+
+    ~GpuTask(){
+        if(_handle){
+            _handle.destroy();
+        }
+    }
+
+    bool done() const {
+        return !_handle || _handle.done();
+    }
+
+private:
+    friend class GpuScheduler;
+
+    explicit GpuTask(std::coroutine_handle<promise_type> handle): _handle(handle){}
+
+    std::coroutine_handle<promise_type> _handle;
+};
+
+struct GpuTaskStats{
+    uint64_t spawned{0};
+    uint64_t finished{0};
+    uint64_t submissions{0};
+    uint64_t uploadedBytes{0};
+    uint64_t images{0};
+    size_t maxInFlight{0};      // Submissions awaited at the same time
+};
+
+// An image a transfer submission fills. The submission moves every level to TRANSFER_DST_OPTIMAL before its copies,
+// the graphics side acquires the image and leaves it in SHADER_READ_ONLY_OPTIMAL, with the levels after filledLevels
+// generated by a blit chain.
+struct GpuImage{
+    VkImage image;
+    VkExtent2D extent;
+    uint32_t mipLevels;
+    uint32_t filledLevels;      // Either all of them or only level 0
+    VkFilter mipFilter{VK_FILTER_LINEAR};
+};
+
+// Awaitable for a submission on the transfer queue, co_await yields true once it has completed and false when the
+// scheduler is shutting down instead. Buffers and images it released are acquired for the graphics family before the
+// resume. Staging memory of an upload is freed at the same point, also when the result is never awaited.
+class [[nodiscard]] GpuWait{
+public:
+    GpuWait(GpuWait&& other) noexcept: _scheduler(std::exchange(other._scheduler, nullptr)), _pending(std::move(other._pending)){}
+    GpuWait(const GpuWait&) = delete;
+    GpuWait& operator=(const GpuWait&) = delete;
+
+    ~GpuWait();
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    void await_suspend(std::coroutine_handle<> handle);
+
+    bool await_resume() const noexcept {
+        return _completed;
+    }
+
+    // Staging memory the submission reads from, destroyed with the rest once it has completed
+    void adoptStaging(const AllocatedBuffer& staging){
+        _pending.staging.push_back(staging);
+    }
+
+private:
+    friend class GpuScheduler;
+
+    struct Pending{
+        uint64_t value;
+        std::vector<VkBuffer> acquire;
+        std::vector<GpuImage> acquireImages;
+        std::vector<AllocatedBuffer> staging;
+        std::coroutine_handle<> handle;
+        bool* completed{nullptr};
+    };
+
+    GpuWait(GpuScheduler* scheduler, Pending&& pending): _scheduler(scheduler), _pending(std::move(pending)){}
+
+    GpuScheduler* _scheduler;
+    Pending _pending;
+    bool _completed{false};
+};
+
+// Resumes GpuTasks once the transfer queue's timeline semaphore has reached the values they wait for. Nothing blocks:
+// poll() reads the counter once a frame, so any number of uploads can be in flight while the render loop keeps going.
+// Like TransferQueue, only used from the render thread.
+//
+//     GpuTask loadThing(AllocatedBuffer buffer, std::vector<char> data){
+//         if(!co_await gpu.upload(buffer, data))
+//             co_return;
+//         // buffer holds data and belongs to the graphics family
+//     }
+//     gpu.spawn(loadThing(buffer, std::move(data)));
+//
+// Images go the same way through uploadImage, or submit with the images the copies write.
+class GpuScheduler{
+public:
+    GpuTaskStats stats;
+
+    void setup(VmaAllocator allocator, TransferQueue* transfer){
+        _allocator = allocator;
+        _transfer = transfer;
+    }
+
+    // Lets everything submitted finish, then resumes whatever still waits with false so it can clean up after itself
+    void cleanup(){
+        _transfer->wait(_transfer->submittedValue());
+
+        while(!_waiting.empty()){
+            std::vector<GpuWait::Pending> waiting = std::move(_waiting);
+            _waiting.clear();
+
+            for(GpuWait::Pending& pending: waiting){
+                release(pending);
+            }
+            for(GpuWait::Pending& pending: waiting){
+                if(pending.handle){
+                    *pending.completed = false;
+                    pending.handle.resume();
+                }
+            }
+        }
+
+        collectFinished();
+        _tasks.clear();
+    }
+
+    void spawn(GpuTask&& task){
+        stats.spawned++;
+        _tasks.push_back(std::move(task));
+        collectFinished();
+    }
+
+    // record fills a command buffer for the transfer queue, released are the buffers it writes that graphics work
+    // reads afterwards. images are ready to be copied into when record runs.
+    GpuWait submit(const std::function<void(VkCommandBuffer)>& record, std::span<const VkBuffer> released = {}, std::span<const GpuImage> images = {}){
+        VkCommandBuffer command = _transfer->begin();
+
+        for(const GpuImage& image: images){
+            Utility::transitionMips(command, image.image, 0, image.mipLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+        }
+
+        record(command);
+
+        _transfer->releaseBuffers(command, released);
+        for(const GpuImage& image: images){
+            _transfer->releaseImage(command, image.image, image.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        }
+
+        GpuWait::Pending pending{};
+        pending.value = _transfer->submit(command);
+        pending.acquire.assign(released.begin(), released.end());
+        pending.acquireImages.assign(images.begin(), images.end());
+        stats.images += images.size();
+
+        stats.submissions++;
+        return GpuWait(this, std::move(pending));
+    }
+
+    // data into buffer at offset, through a staging buffer of its own
+    GpuWait upload(const AllocatedBuffer& buffer, std::span<const char> data, VkDeviceSize offset = 0){
+        AllocatedBuffer staging = Utility::createBuffer(_allocator, data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        memcpy(staging.allocation->GetMappedData(), data.data(), data.size());
+
+        VkBufferCopy region{};
+        region.dstOffset = offset;
+        region.size = data.size();
+
+        GpuWait wait = submit([&](VkCommandBuffer command){
+            vkCmdCopyBuffer(command, staging.buffer, buffer.buffer, 1, &region);
+        }, {&buffer.buffer, 1});
+
+        wait.adoptStaging(staging);
+        stats.uploadedBytes += data.size();
+        return wait;
+    }
+
+    // data into image, regions have their buffer offsets relative to data and fill image.filledLevels levels
+    GpuWait uploadImage(const GpuImage& image, std::span<const char> data, std::span<const VkBufferImageCopy> regions){
+        AllocatedBuffer staging = Utility::createBuffer(_allocator, data.size(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        memcpy(staging.allocation->GetMappedData(), data.data(), data.size());
+
+        GpuWait wait = submit([&](VkCommandBuffer command){
+            vkCmdCopyBufferToImage(command, staging.buffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(regions.size()), regions.data());
+        }, {}, {&image, 1});
+
+        wait.adoptStaging(staging);
+        stats.uploadedBytes += data.size();
+        return wait;
+    }
+
+    // Once a frame on the render thread, after command has begun and before anything that uses what the tasks load.
+    // Records the acquires of everything that completed and resumes its tasks. Returns the timeline value the frame's
+    // submit has to wait on, which has already passed and only orders the acquires after the releases.
+    uint64_t poll(VkCommandBuffer command){
+        if(_waiting.empty())
+            return 0;
+
+        uint64_t completedValue = _transfer->completedValue();
+        uint64_t waitValue = 0;
+
+        std::vector<GpuWait::Pending> ready, waiting;
+        for(GpuWait::Pending& pending: _waiting){
+            (pending.value <= completedValue ? ready : waiting).push_back(std::move(pending));
+        }
+        _waiting = std::move(waiting);
+
+        for(GpuWait::Pending& pending: ready){
+            _transfer->acquireBuffers(command, pending.acquire, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_MEMORY_READ_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT);
+            for(const GpuImage& image: pending.acquireImages){
+                acquireImage(command, image);
+            }
+
+            waitValue = std::max(waitValue, pending.value);
+            release(pending);
+        }
+
+        // Resumed tasks may submit and wait again, which only adds to _waiting
+        for(GpuWait::Pending& pending: ready){
+            if(pending.handle){
+                *pending.completed = true;
+                pending.handle.resume();
+            }
+        }
+
+        collectFinished();
+        return waitValue;
+    }
+
+    size_t inFlight() const {
+        return _waiting.size();
+    }
+
+    size_t running() const {
+        return _tasks.size();
+    }
+
+    void printStats(){
+        fmt::println("GPU tasks: {} spawned, {} finished, {} submissions with up to {} in flight, {} images, {:.2f}MB uploaded", stats.spawned, stats.finished,
+            stats.submissions, stats.maxInFlight, stats.images, double(stats.uploadedBytes) / (1024.0 * 1024.0));
+    }
+
+private:
+    friend class GpuWait;
+
+    VmaAllocator _allocator;
+    TransferQueue* _transfer;
+
+    std::vector<GpuWait::Pending> _waiting;
+    std::vector<GpuTask> _tasks;
+
+    void wait(GpuWait::Pending&& pending){
+        _waiting.push_back(std::move(pending));
+        stats.maxInFlight = std::max(stats.maxInFlight, _waiting.size());
+    }
+
+    // Without a dedicated queue only the transition is left, the copies ran earlier on the same queue
+    void acquireImage(VkCommandBuffer command, const GpuImage& image){
+        _transfer->acquireImage(command, image.image, image.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+        if(image.filledLevels < image.mipLevels){
+            Utility::generateMipmaps(command, image.image, image.extent, image.mipLevels, image.mipFilter);
+        } else {
+            Utility::transitionMips(command, image.image, 0, image.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+        }
+    }
+
+    void release(GpuWait::Pending& pending){
+        for(AllocatedBuffer& staging: pending.staging){
+            Utility::destroyBuffer(_allocator, staging);
+        }
+        pending.staging.clear();
+    }
+
+    // Exceptions that escaped a task come out here, on the render thread
+    void collectFinished(){
+        std::exception_ptr exception;
+
+        std::erase_if(_tasks, [&](GpuTask& task){
+            if(!task.done())
+                return false;
+
+            if(task._handle.promise().exception && !exception){
+                exception = task._handle.promise().exception;
+            }
+            stats.finished++;
+            return true;
+        });
+
+        if(exception){
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+// A wait that was never awaited still has to keep its staging memory until the copy is done, and still gets acquired
+inline GpuWait::~GpuWait(){
+    if(_scheduler && !_pending.handle){
+        _scheduler->wait(std::move(_pending));
+    }
+}
+
+inline void GpuWait::await_suspend(std::coroutine_handle<> handle){
+    _pending.handle = handle;
+    _pending.completed = &_completed;
+    _scheduler->wait(std::move(_pending));
+    _scheduler = nullptr;
+}
@@ -0,0 +1,396 @@
+#pragma once
+
+#include "types.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Counts the jobs started with it that haven't finished yet, JobSystem::wait blocks on it
+class JobCounter{
+public:
+    bool done() const {
+        return _pending.load(std::memory_order_acquire) == 0;
+    }
+
+private:
+    friend class JobSystem;
+    std::atomic<uint32_t> _pending{0};
+};
+
+struct JobStats{
+    uint64_t executed{0};
+    uint64_t stolen{0};         // Taken from another worker's deque
+    uint64_t injected{0};       // Submitted from threads outside the system
+    uint64_t background{0};
+};
+
+// Work stealing scheduler. Every worker, and the thread that set the system up, owns a Chase-Lev deque: the owner
+// pushes and pops at the bottom without locks, idle workers steal from the top of the others'. Jobs submitted from any
+// other thread go through one locked queue. A job that waits on a counter keeps running jobs in the meantime, so jobs
+// can start jobs of their own and wait for them without tying up a worker.
+// Background jobs, long ones that may block on I/O, have a queue of their own that only the worker threads take from
+// once nothing else is left. A frame waiting on its jobs never ends up running one of them.
+class JobSystem{
+public:
+    static const size_t DEQUE_CAPACITY = 4096;     // Per worker, pushes to a full deque run the job right away
+    static const uint32_t NO_WORKER = UINT32_MAX;
+    static const uint32_t SPIN_ROUNDS = 64;         // Of failed steals before a worker goes to sleep
+
+    // Worker threads besides the calling one, which becomes worker 0. 0 uses one thread per hardware thread.
+    // There is always at least one, background jobs only run there.
+    void setup(uint32_t workerThreads = 0){
+        if(workerThreads == 0){
+            workerThreads = std::max(2u, std::thread::hardware_concurrency()) - 1;
+        }
+
+        _workers = std::vector<Worker>(workerThreads + 1);
+        _stopping = false;
+
+        t_workerIndex = 0;
+        t_system = this;
+
+        for(uint32_t i = 1; i <= workerThreads; i++){
+            _workers[i].thread = std::thread([this, i](){ workerLoop(i); });
+        }
+    }
+
+    // Jobs still queued run first
+    void cleanup(){
+        _stopping = true;
+        _wakeups.fetch_add(1);
+        _wakeups.notify_all();
+
+        for(Worker& worker: _workers){
+            if(worker.thread.joinable()){
+                worker.thread.join();
+            }
+        }
+
+        // Nothing is left to steal them, and the deques go away with the workers
+        while(Job* job = findJob(0, true)){
+            execute(job);
+        }
+
+        _workers.clear();
+
+        if(t_system == this){
+            t_system = nullptr;
+            t_workerIndex = NO_WORKER;
+        }
+    }
+
+    uint32_t threadCount() const {
+        return static_cast<uint32_t>(_workers.size());
+    }
+
+    // Between 0 and threadCount() on the threads of the system that is running the caller, NO_WORKER elsewhere.
+    // For per thread resources like command pools.
+    static uint32_t workerIndex(){
+        return t_workerIndex;
+    }
+
+    void run(std::function<void()>&& function, JobCounter* counter = nullptr){
+        Job* job = new Job{std::move(function), counter};
+        if(counter){
+            counter->_pending.fetch_add(1);
+        }
+
+        uint32_t index = currentWorker();
+        if(index == NO_WORKER){
+            _injected.push(job);
+        } else if(!_workers[index].deque.push(job)){
+            execute(job);
+            return;
+        }
+
+        wakeWorker();
+    }
+
+    // From any thread. Runs on a worker thread when it has nothing else to do.
+    void runBackground(std::function<void()>&& function, JobCounter* counter = nullptr){
+        Job* job = new Job{std::move(function), counter};
+        if(counter){
+            counter->_pending.fetch_add(1);
+        }
+
+        _background.push(job);
+        wakeWorker();
+    }
+
+    // Runs other jobs until the counter's are done
+    void wait(JobCounter& counter){
+        uint32_t index = currentWorker();
+
+        while(!counter.done()){
+            if(Job* job = findJob(index)){
+                execute(job);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // body(begin, end) over [0, count) in ranges of grain, the calling thread takes part. Returns once all have run.
+    template<typename Body>
+    void parallelFor(size_t count, size_t grain, Body&& body){
+        if(count == 0)
+            return;
+
+        grain = std::max<size_t>(grain, 1);
+        if(count <= grain || _workers.size() <= 1){
+            body(size_t(0), count);
+            return;
+        }
+
+        JobCounter counter;
+        for(size_t begin = grain; begin < count; begin += grain){
+            size_t end = std::min(begin + grain, count);
+            run([&body, begin, end](){ body(begin, end); }, &counter);
+        }
+
+        body(size_t(0), grain);
+        wait(counter);
+    }
+
+    // A few ranges per thread, so stealing can even out ranges that take longer
+    template<typename Body>
+    void parallelFor(size_t count, Body&& body){
+        size_t ranges = std::max<size_t>(threadCount(), 1) * 4;
+        parallelFor(count, (count + ranges - 1) / ranges, std::forward<Body>(body));
+    }
+
+    JobStats stats() const {
+        JobStats total{};
+        for(const Worker& worker: _workers){
+            total.executed += worker.executed.load(std::memory_order_relaxed);
+            total.stolen += worker.stolen.load(std::memory_order_relaxed);
+        }
+        total.injected = _injected.pushed.load(std::memory_order_relaxed);
+        total.background = _background.pushed.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void printStats(){
+        JobStats total = stats();
+        fmt::println("Jobs: {} executed on {} threads, {} stolen, {} submitted from outside, {} in the background", total.executed, threadCount(),
+            total.stolen, total.injected, total.background);
+    }
+
+private:
+    struct Job{
+        std::function<void()> function;
+        JobCounter* counter;
+    };
+
+    // Chase-Lev deque with a fixed ring, in the C11 formulation of Le, Pop, Cohen and Zappa Nardelli.
+    // push and pop only from the owner, steal from anywhere.
+    class Deque{
+    public:
+        bool push(Job* job){
+            int64_t bottom = _bottom.load(std::memory_order_relaxed);
+            int64_t top = _top.load(std::memory_order_acquire);
+            if(bottom - top >= static_cast<int64_t>(DEQUE_CAPACITY))
+                return false;
+
+            // Released with bottom, thieves read the slot after acquiring it
+            _jobs[bottom & MASK].store(job, std::memory_order_relaxed);
+            _bottom.store(bottom + 1, std::memory_order_release);
+            return true;
+        }
+
+        Job* pop(){
+            int64_t bottom = _bottom.load(std::memory_order_relaxed) - 1;
+            _bottom.store(bottom, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t top = _top.load(std::memory_order_relaxed);
+
+            if(top > bottom){
+                _bottom.store(bottom + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+
+            Job* job = _jobs[bottom & MASK].load(std::memory_order_relaxed);
+
+            // The last one, a thief may be taking it at the same time
+            if(top == bottom){
+                if(!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed)){
+                    job = nullptr;
+                }
+                _bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+
+            return job;
+        }
+
+        Job* steal(){
+            int64_t top = _top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t bottom = _bottom.load(std::memory_order_acquire);
+
+            if(top >= bottom)
+                return nullptr;
+
+            Job* job = _jobs[top & MASK].load(std::memory_order_relaxed);
+            if(!_top.compare_exchange_strong(top, top + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+
+            return job;
+        }
+
+    private:
+        static const size_t MASK = DEQUE_CAPACITY - 1;
+        static_assert((DEQUE_CAPACITY & MASK) == 0, "Deque capacity has to be a power of two");
+
+        // Owner and thieves write different ends, keep them off each other's cache line
+        alignas(64) std::atomic<int64_t> _top{0};
+        alignas(64) std::atomic<int64_t> _bottom{0};
+        alignas(64) std::atomic<Job*> _jobs[DEQUE_CAPACITY];
+    };
+
+    struct LockedQueue{
+        std::mutex mutex;
+        std::deque<Job*> jobs;
+        std::atomic<uint64_t> pushed{0};
+        std::atomic<uint64_t> taken{0};
+
+        void push(Job* job){
+            std::lock_guard<std::mutex> lock(mutex);
+            jobs.push_back(job);
+            pushed++;
+        }
+
+        // Skips the lock while there is obviously nothing in it
+        Job* take(){
+            if(taken.load(std::memory_order_relaxed) >= pushed.load(std::memory_order_relaxed))
+                return nullptr;
+
+            std::lock_guard<std::mutex> lock(mutex);
+            if(jobs.empty())
+                return nullptr;
+
+            Job* job = jobs.front();
+            jobs.pop_front();
+            taken++;
+            return job;
+        }
+    };
+
+    struct Worker{
+        Deque deque;
+        std::thread thread;
+        std::atomic<uint64_t> executed{0};
+        std::atomic<uint64_t> stolen{0};
+        uint32_t nextVictim{0};
+    };
+
+    std::vector<Worker> _workers;
+    std::atomic<bool> _stopping{false};
+
+    // Bumped on every submission, sleeping workers wait for it to change
+    std::atomic<uint32_t> _wakeups{0};
+    std::atomic<uint32_t> _sleeping{0};
+
+    LockedQueue _injected;
+    LockedQueue _background;
+
+    static inline thread_local uint32_t t_workerIndex{NO_WORKER};
+    static inline thread_local JobSystem* t_system{nullptr};
+
+    // Threads of another system count as outside this one
+    uint32_t currentWorker() const {
+        return t_system == this ? t_workerIndex : NO_WORKER;
+    }
+
+    void workerLoop(uint32_t index){
+        t_workerIndex = index;
+        t_system = this;
+
+        uint32_t failedRounds = 0;
+
+        while(true){
+            if(Job* job = findJob(index, true)){
+                execute(job);
+                failedRounds = 0;
+                continue;
+            }
+
+            if(_stopping)
+                return;
+
+            if(++failedRounds < SPIN_ROUNDS){
+                std::this_thread::yield();
+                continue;
+            }
+
+            // Anything submitted after wakeups was read changes it, so the wait can't miss it
+            _sleeping.fetch_add(1);
+            uint32_t wakeups = _wakeups.load();
+
+            if(Job* job = findJob(index, true)){
+                _sleeping.fetch_sub(1);
+                execute(job);
+                failedRounds = 0;
+                continue;
+            }
+
+            if(!_stopping){
+                _wakeups.wait(wakeups);
+            }
+            _sleeping.fetch_sub(1);
+            failedRounds = 0;
+        }
+    }
+
+    void wakeWorker(){
+        _wakeups.fetch_add(1);
+        if(_sleeping.load() > 0){
+            _wakeups.notify_one();
+        }
+    }
+
+    // Own deque first, then the others round robin, then whatever came from outside, background jobs last
+    Job* findJob(uint32_t index, bool background = false){
+        if(index != NO_WORKER){
+            if(Job* job = _workers[index].deque.pop())
+                return job;
+        }
+
+        uint32_t count = static_cast<uint32_t>(_workers.size());
+        uint32_t start = index != NO_WORKER ? _workers[index].nextVictim : 0;
+
+        for(uint32_t i = 0; i < count; i++){
+            uint32_t victim = (start + i) % count;
+            if(victim == index)
+                continue;
+
+            if(Job* job = _workers[victim].deque.steal()){
+                if(index != NO_WORKER){
+                    _workers[index].nextVictim = victim;
+                    _workers[index].stolen.fetch_add(1, std::memory_order_relaxed);
+                }
+                return job;
+            }
+        }
+
+        if(Job* job = _injected.take())
+            return job;
+
+        return background ? _background.take() : nullptr;
+    }
+
+    void execute(Job* job){
+        job->function();
+
+        if(job->counter){
+            job->counter->_pending.fetch_sub(1, std::memory_order_release);
+        }
+
+        uint32_t index = currentWorker();
+        if(index != NO_WORKER){
+            _workers[index].executed.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        delete job;
+    }
+};
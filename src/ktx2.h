@@ -0,0 +1,288 @@
+#pragma once
+
+// Only depends on the Vulkan headers, so the offline encoder in tools/ can use it too
+#include <vulkan/vulkan.h>
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Reading and writing of KTX2 containers without supercompression, one 2D image with a mip chain.
+// https://registry.khronos.org/KTX/specs/2.0/ktxspec.v2.html
+namespace Ktx2{
+    const uint8_t IDENTIFIER[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+
+    enum class FormatFamily{
+        Uncompressed,
+        BC,
+        ASTC,
+        Unsupported,
+    };
+
+    struct FormatInfo{
+        FormatFamily family;
+        uint32_t blockWidth, blockHeight;
+        uint32_t blockBytes;
+    };
+
+    struct Header{
+        uint8_t identifier[12];
+        uint32_t vkFormat;
+        uint32_t typeSize;
+        uint32_t pixelWidth, pixelHeight, pixelDepth;
+        uint32_t layerCount, faceCount, levelCount;
+        uint32_t supercompressionScheme;
+
+        uint32_t dfdByteOffset, dfdByteLength;
+        uint32_t kvdByteOffset, kvdByteLength;
+        uint64_t sgdByteOffset, sgdByteLength;
+    };
+    static_assert(sizeof(Header) == 80);
+
+    struct LevelIndex{
+        uint64_t byteOffset;
+        uint64_t byteLength;
+        uint64_t uncompressedByteLength;
+    };
+
+    struct Level{
+        uint64_t byteOffset, byteLength;
+        uint32_t width, height;
+    };
+
+    // Views into the file data, which has to outlive it
+    struct Texture{
+        VkFormat format;
+        uint32_t width, height;
+        std::vector<Level> levels;
+        const char* data;
+    };
+
+    inline FormatInfo formatInfo(VkFormat format){
+        switch(format){
+            case VK_FORMAT_R8G8B8A8_UNORM:
+            case VK_FORMAT_R8G8B8A8_SRGB:
+                return {FormatFamily::Uncompressed, 1, 1, 4};
+
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+            case VK_FORMAT_BC1_RGBA_UNORM_BLOCK:
+            case VK_FORMAT_BC1_RGBA_SRGB_BLOCK:
+            case VK_FORMAT_BC4_UNORM_BLOCK:
+            case VK_FORMAT_BC4_SNORM_BLOCK:
+                return {FormatFamily::BC, 4, 4, 8};
+
+            case VK_FORMAT_BC2_UNORM_BLOCK:
+            case VK_FORMAT_BC2_SRGB_BLOCK:
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+            case VK_FORMAT_BC3_SRGB_BLOCK:
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+            case VK_FORMAT_BC5_SNORM_BLOCK:
+            case VK_FORMAT_BC6H_UFLOAT_BLOCK:
+            case VK_FORMAT_BC6H_SFLOAT_BLOCK:
+            case VK_FORMAT_BC7_UNORM_BLOCK:
+            case VK_FORMAT_BC7_SRGB_BLOCK:
+                return {FormatFamily::BC, 4, 4, 16};
+
+            default:
+                break;
+        }
+
+        // ASTC LDR formats come in UNORM/SRGB pairs, ordered by block size
+        if(format >= VK_FORMAT_ASTC_4x4_UNORM_BLOCK && format <= VK_FORMAT_ASTC_12x12_SRGB_BLOCK){
+            const uint32_t blockSizes[14][2] = {{4, 4}, {5, 4}, {5, 5}, {6, 5}, {6, 6}, {8, 5}, {8, 6}, {8, 8}, {10, 5}, {10, 6}, {10, 8}, {10, 10}, {12, 10}, {12, 12}};
+            uint32_t i = (format - VK_FORMAT_ASTC_4x4_UNORM_BLOCK) / 2;
+
+            return {FormatFamily::ASTC, blockSizes[i][0], blockSizes[i][1], 16};
+        }
+
+        return {FormatFamily::Unsupported, 1, 1, 0};
+    }
+
+    inline uint64_t levelSize(VkFormat format, uint32_t width, uint32_t height){
+        FormatInfo info = formatInfo(format);
+
+        uint64_t blocksX = (width + info.blockWidth - 1) / info.blockWidth;
+        uint64_t blocksY = (height + info.blockHeight - 1) / info.blockHeight;
+
+        return blocksX * blocksY * info.blockBytes;
+    }
+
+    inline bool parse(const char* data, size_t size, Texture& out, std::string& error){
+        if(size < sizeof(Header)){
+            error = "file too small";
+            return false;
+        }
+
+        Header header;
+        memcpy(&header, data, sizeof(Header));
+
+        if(memcmp(header.identifier, IDENTIFIER, sizeof(IDENTIFIER)) != 0){
+            error = "not a KTX2 file";
+            return false;
+        }
+
+        if(header.supercompressionScheme != 0){
+            error = "supercompressed (Basis/zstd) files are not supported";
+            return false;
+        }
+
+        if(header.pixelDepth > 1 || header.layerCount > 1 || header.faceCount != 1){
+            error = "only single 2D images are supported";
+            return false;
+        }
+
+        out.format = static_cast<VkFormat>(header.vkFormat);
+        if(formatInfo(out.format).family == FormatFamily::Unsupported){
+            error = "unsupported vkFormat " + std::to_string(header.vkFormat);
+            return false;
+        }
+
+        if(header.pixelWidth == 0){
+            error = "zero width";
+            return false;
+        }
+
+        out.width = header.pixelWidth;
+        out.height = std::max(header.pixelHeight, 1u);
+        out.data = data;
+
+        // A level count of 0 asks the loader to generate mips, which compressed formats can't do
+        uint32_t levelCount = std::max(header.levelCount, 1u);
+
+        // Past the full chain the levels would be 1x1 again, and shifting the size by 32 or more is undefined
+        if(levelCount > static_cast<uint32_t>(std::bit_width(std::max(out.width, out.height)))){
+            error = "more levels than the full mip chain";
+            return false;
+        }
+
+        if(sizeof(Header) + levelCount * sizeof(LevelIndex) > size){
+            error = "truncated level index";
+            return false;
+        }
+
+        out.levels.resize(levelCount);
+
+        for(uint32_t i = 0; i < levelCount; i++){
+            LevelIndex index;
+            memcpy(&index, data + sizeof(Header) + i * sizeof(LevelIndex), sizeof(LevelIndex));
+
+            Level& level = out.levels[i];
+            level.byteOffset = index.byteOffset;
+            level.byteLength = index.byteLength;
+            level.width = std::max(out.width >> i, 1u);
+            level.height = std::max(out.height >> i, 1u);
+
+            // Written so that hostile 64 bit values can't wrap around
+            if(level.byteLength > size || level.byteOffset > size - level.byteLength || level.byteLength < levelSize(out.format, level.width, level.height)){
+                error = "level " + std::to_string(i) + " is out of bounds";
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Basic data format descriptor, required by the spec. Describes the block layout of the formats the encoder writes.
+    inline std::vector<uint32_t> dataFormatDescriptor(VkFormat format){
+        // KHR_DF_MODEL_* values
+        uint8_t colorModel = 0;
+        bool srgb = false;
+
+        struct Sample{ uint16_t bitOffset; uint8_t bitLength; uint8_t channel; };
+        std::vector<Sample> samples;
+
+        switch(format){
+            case VK_FORMAT_BC1_RGB_SRGB_BLOCK: srgb = true; [[fallthrough]];
+            case VK_FORMAT_BC1_RGB_UNORM_BLOCK:
+                colorModel = 128;
+                samples = {{0, 63, 0}};
+                break;
+            case VK_FORMAT_BC3_SRGB_BLOCK: srgb = true; [[fallthrough]];
+            case VK_FORMAT_BC3_UNORM_BLOCK:
+                colorModel = 130;
+                samples = {{0, 63, 15}, {64, 63, 0}};
+                break;
+            case VK_FORMAT_BC4_UNORM_BLOCK:
+                colorModel = 131;
+                samples = {{0, 63, 0}};
+                break;
+            case VK_FORMAT_BC5_UNORM_BLOCK:
+                colorModel = 132;
+                samples = {{0, 63, 0}, {64, 63, 1}};
+                break;
+            case VK_FORMAT_R8G8B8A8_SRGB: srgb = true; [[fallthrough]];
+            default:
+                colorModel = 1;     // RGBSDA
+                samples = {{0, 7, 0}, {8, 7, 1}, {16, 7, 2}, {24, 7, 15}};
+                break;
+        }
+
+        FormatInfo info = formatInfo(format);
+        uint32_t blockSize = 24 + 16 * static_cast<uint32_t>(samples.size());
+
+        std::vector<uint32_t> dfd;
+        dfd.push_back(4 + blockSize);                               // dfdTotalSize
+        dfd.push_back(0);                                           // vendorId = KHRONOS, descriptorType = BASICFORMAT
+        dfd.push_back(2 | (blockSize << 16));                       // versionNumber, descriptorBlockSize
+        dfd.push_back(colorModel | (1 << 8) | ((srgb ? 2u : 1u) << 16));  // model, BT709 primaries, transfer, flags
+        dfd.push_back((info.blockWidth - 1) | ((info.blockHeight - 1) << 8));
+        dfd.push_back(info.blockBytes);                             // bytesPlane0
+        dfd.push_back(0);
+
+        for(const Sample& sample: samples){
+            dfd.push_back(sample.bitOffset | (uint32_t(sample.bitLength) << 16) | (uint32_t(sample.channel) << 24));
+            dfd.push_back(0);                                       // samplePosition
+            dfd.push_back(0);                                       // sampleLower
+            dfd.push_back(sample.bitLength == 7 ? 255u : UINT32_MAX); // sampleUpper
+        }
+
+        return dfd;
+    }
+
+    // levels[0] is the full resolution image. Mip data is stored smallest first, as the spec recommends.
+    inline std::vector<char> write(VkFormat format, uint32_t width, uint32_t height, const std::vector<std::vector<uint8_t>>& levels){
+        std::vector<uint32_t> dfd = dataFormatDescriptor(format);
+
+        Header header{};
+        memcpy(header.identifier, IDENTIFIER, sizeof(IDENTIFIER));
+        header.vkFormat = format;
+        header.typeSize = 1;
+        header.pixelWidth = width;
+        header.pixelHeight = height;
+        header.faceCount = 1;
+        header.levelCount = static_cast<uint32_t>(levels.size());
+
+        header.dfdByteOffset = static_cast<uint32_t>(sizeof(Header) + levels.size() * sizeof(LevelIndex));
+        header.dfdByteLength = static_cast<uint32_t>(dfd.size() * sizeof(uint32_t));
+
+        // Level data is aligned to lcm(texel block size, 4), which is at most 16 for the formats written here
+        size_t alignment = std::max<size_t>(formatInfo(format).blockBytes, 4);
+        auto align = [&](size_t offset){ return (offset + alignment - 1) / alignment * alignment; };
+
+        std::vector<LevelIndex> index(levels.size());
+        size_t offset = header.dfdByteOffset + header.dfdByteLength;
+
+        for(size_t i = levels.size(); i-- > 0;){
+            offset = align(offset);
+            index[i].byteOffset = offset;
+            index[i].byteLength = levels[i].size();
+            index[i].uncompressedByteLength = levels[i].size();
+            offset += levels[i].size();
+        }
+
+        std::vector<char> file(offset, 0);
+        memcpy(file.data(), &header, sizeof(Header));
+        memcpy(file.data() + sizeof(Header), index.data(), index.size() * sizeof(LevelIndex));
+        memcpy(file.data() + header.dfdByteOffset, dfd.data(), header.dfdByteLength);
+
+        for(size_t i = 0; i < levels.size(); i++){
+            memcpy(file.data() + index[i].byteOffset, levels[i].data(), levels[i].size());
+        }
+
+        return file;
+    }
+};
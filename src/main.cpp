@@ -2,13 +2,31 @@
 
 #include "renderer.h"
 #include "external_test.h"
+#include "gltfMesh.h"
+#include "virtualTexturedMesh.h"
 
 int main(){
     Renderer app;
 
     RectangleMesh newMesh;
+    // newMesh.vertexFormat = VERTEX_FORMAT_COMPACT;   // 16 byte quantized vertices
     app.addMesh(&newMesh);
 
+    // GltfMesh scene("assets\\scene.glb");     // any .gltf/.glb, decoded in parallel on load
+    // scene.vertexFormat = VERTEX_FORMAT_COMPACT;   // encoded on import
+    // scene.optimizeOnImport = true;               // vertex cache, overdraw and fetch order per primitive, see meshOptimizer.h
+    // app.addMesh(&scene);
+
+    // GltfMesh cooked("assets\\scene.scene");   // scene from AssetCooker, mapped and copied into staging as is, see cookedScene.h
+    // app.addMesh(&cooked);
+
+    // app.addTexture("assets\\texture.png");     // decoded on worker threads, mips generated on the GPU
+    // app.addTexture("assets\\texture.ktx2");    // BCn/ASTC with its mips, see tools/ktxEncoder.cpp
+
+    // app.setVirtualTexture("assets\\terrain.png");   // cooked into pages once, streamed by GPU feedback
+    // VirtualTexturedPlane terrain(app._virtualTexture);
+    // app.addMesh(&terrain);
+
     app.init();
 
     try {
@@ -0,0 +1,721 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+
+#include <numeric>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <glm/gtx/component_wise.hpp>
+
+// Import/cook time reordering of index and vertex data:
+// post-transform vertex cache (Forsyth), then overdraw (cluster sorting), then vertex fetch locality
+namespace MeshOptimizer{
+    const uint32_t FORSYTH_CACHE_SIZE = 32;
+
+    // Size of the FIFO cache used for statistics and cluster boundaries
+    const uint32_t ANALYSIS_CACHE_SIZE = 16;
+
+    const uint32_t OVERDRAW_GRID_SIZE = 256;
+
+    struct VertexCacheStats{
+        float acmr;     // Cache misses per triangle
+        float atvr;     // Cache misses per referenced vertex
+    };
+
+    struct OverdrawStats{
+        float overdraw;     // Shaded pixels per covered pixel
+        uint64_t pixelsCovered;
+        uint64_t pixelsShaded;
+    };
+
+    float forsythVertexScore(int cachePosition, uint32_t remainingValence){
+        if(remainingValence == 0)
+            return -1.f;
+
+        float score = 0.f;
+
+        if(cachePosition >= 0){
+            // The last triangle's vertices get a fixed score so it doesn't get reused right away
+            if(cachePosition < 3){
+                score = 0.75f;
+            } else {
+                float s = 1.f - float(cachePosition - 3) / float(FORSYTH_CACHE_SIZE - 3);
+                score = std::pow(s, 1.5f);
+            }
+        }
+
+        // Boost vertices with few triangles left so they get finished off
+        score += 2.f * std::pow(float(remainingValence), -0.5f);
+
+        return score;
+    }
+
+    std::vector<uint32_t> optimizeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount){
+        size_t triangleCount = indices.size() / 3;
+
+        // Triangles of every vertex, the live ones are kept at the front of each range
+        std::vector<uint32_t> remaining(vertexCount, 0);
+        for(size_t i = 0; i < triangleCount * 3; i++){
+            remaining[indices[i]]++;
+        }
+
+        std::vector<uint32_t> offsets(vertexCount + 1, 0);
+        for(size_t v = 0; v < vertexCount; v++){
+            offsets[v + 1] = offsets[v] + remaining[v];
+        }
+
+        std::vector<uint32_t> adjacency(triangleCount * 3);
+        std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+        for(uint32_t t = 0; t < triangleCount; t++){
+            for(uint32_t c = 0; c < 3; c++){
+                adjacency[cursor[indices[t * 3 + c]]++] = t;
+            }
+        }
+
+        std::vector<int> cachePosition(vertexCount, -1);
+        std::vector<float> vertexScore(vertexCount);
+        for(size_t v = 0; v < vertexCount; v++){
+            vertexScore[v] = forsythVertexScore(-1, remaining[v]);
+        }
+
+        std::vector<float> triangleScore(triangleCount);
+        std::vector<bool> emitted(triangleCount, false);
+
+        int64_t best = -1;
+        float bestScore = -1.f;
+        for(uint32_t t = 0; t < triangleCount; t++){
+            triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+            if(triangleScore[t] > bestScore){
+                bestScore = triangleScore[t];
+                best = t;
+            }
+        }
+
+        std::vector<uint32_t> cache, newCache;
+        cache.reserve(FORSYTH_CACHE_SIZE + 3);
+        newCache.reserve(FORSYTH_CACHE_SIZE + 3);
+
+        std::vector<uint32_t> result;
+        result.reserve(triangleCount * 3);
+
+        size_t scanCursor = 0;
+
+        while(result.size() < triangleCount * 3){
+            // Nothing in the cache has live triangles left, continue with the next unused one
+            if(best < 0){
+                while(emitted[scanCursor]){
+                    scanCursor++;
+                }
+
+                best = static_cast<int64_t>(scanCursor);
+            }
+
+            uint32_t triangle = static_cast<uint32_t>(best);
+            emitted[triangle] = true;
+
+            newCache.clear();
+
+            for(uint32_t c = 0; c < 3; c++){
+                uint32_t v = indices[triangle * 3 + c];
+                result.push_back(v);
+                newCache.push_back(v);
+
+                // Remove the triangle from the vertex's live range
+                uint32_t begin = offsets[v], end = offsets[v] + remaining[v];
+                for(uint32_t i = begin; i < end; i++){
+                    if(adjacency[i] == triangle){
+                        std::swap(adjacency[i], adjacency[end - 1]);
+                        break;
+                    }
+                }
+
+                remaining[v]--;
+            }
+
+            for(uint32_t v: cache){
+                if(v != newCache[0] && v != newCache[1] && v != newCache[2]){
+                    newCache.push_back(v);
+                }
+            }
+
+            // Evicted vertices keep their slot at the end so their triangles get rescored too
+            for(size_t i = 0; i < newCache.size(); i++){
+                uint32_t v = newCache[i];
+                cachePosition[v] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+                vertexScore[v] = forsythVertexScore(cachePosition[v], remaining[v]);
+            }
+
+            best = -1;
+            bestScore = -1.f;
+
+            for(uint32_t v: newCache){
+                for(uint32_t i = offsets[v]; i < offsets[v] + remaining[v]; i++){
+                    uint32_t t = adjacency[i];
+                    triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+                    if(triangleScore[t] > bestScore){
+                        bestScore = triangleScore[t];
+                        best = t;
+                    }
+                }
+            }
+
+            if(newCache.size() > FORSYTH_CACHE_SIZE){
+                newCache.resize(FORSYTH_CACHE_SIZE);
+            }
+            std::swap(cache, newCache);
+        }
+
+        return result;
+    }
+
+    // Splits the index list where the FIFO cache starts over, then sorts those clusters front to back as seen from outside the mesh.
+    // Clusters are only split further while their own ACMR stays within threshold of the whole mesh.
+    std::vector<uint32_t> optimizeOverdraw(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, float threshold = 1.05f){
+        size_t triangleCount = indices.size() / 3;
+        if(triangleCount == 0)
+            return indices;
+
+        // Hard boundaries: every triangle that misses the cache on all three vertices
+        std::vector<uint32_t> clusterStarts;
+        {
+            std::vector<uint32_t> timestamps(vertices.size(), 0);
+            uint32_t time = ANALYSIS_CACHE_SIZE + 1;
+            uint32_t misses = 0;
+
+            for(uint32_t t = 0; t < triangleCount; t++){
+                uint32_t triangleMisses = 0;
+                for(uint32_t c = 0; c < 3; c++){
+                    uint32_t v = indices[t * 3 + c];
+                    if(time - timestamps[v] > ANALYSIS_CACHE_SIZE){
+                        timestamps[v] = time++;
+                        triangleMisses++;
+                    }
+                }
+
+                if(t == 0 || triangleMisses == 3){
+                    clusterStarts.push_back(t);
+                }
+
+                misses += triangleMisses;
+            }
+
+            // Soft boundaries: cut a hard cluster whenever its running ACMR is good enough
+            float meshAcmr = float(misses) / float(triangleCount);
+            std::vector<uint32_t> softStarts;
+
+            for(size_t i = 0; i < clusterStarts.size(); i++){
+                uint32_t start = clusterStarts[i];
+                uint32_t end = i + 1 < clusterStarts.size() ? clusterStarts[i + 1] : static_cast<uint32_t>(triangleCount);
+
+                std::fill(timestamps.begin(), timestamps.end(), 0);
+                time = ANALYSIS_CACHE_SIZE + 1;
+                uint32_t clusterMisses = 0, clusterTriangles = 0;
+
+                softStarts.push_back(start);
+
+                for(uint32_t t = start; t < end; t++){
+                    for(uint32_t c = 0; c < 3; c++){
+                        uint32_t v = indices[t * 3 + c];
+                        if(time - timestamps[v] > ANALYSIS_CACHE_SIZE){
+                            timestamps[v] = time++;
+                            clusterMisses++;
+                        }
+                    }
+
+                    clusterTriangles++;
+
+                    if(t + 1 < end && float(clusterMisses) / float(clusterTriangles) <= meshAcmr * threshold){
+                        softStarts.push_back(t + 1);
+
+                        std::fill(timestamps.begin(), timestamps.end(), 0);
+                        time = ANALYSIS_CACHE_SIZE + 1;
+                        clusterMisses = 0;
+                        clusterTriangles = 0;
+                    }
+                }
+            }
+
+            clusterStarts = softStarts;
+        }
+
+        size_t clusterCount = clusterStarts.size();
+
+        std::vector<glm::vec3> clusterCentroid(clusterCount, glm::vec3(0.f));
+        std::vector<glm::vec3> clusterNormal(clusterCount, glm::vec3(0.f));
+        std::vector<float> clusterArea(clusterCount, 0.f);
+
+        glm::vec3 meshCentroid{0.f};
+        float meshArea = 0.f;
+
+        for(size_t i = 0; i < clusterCount; i++){
+            uint32_t start = clusterStarts[i];
+            uint32_t end = i + 1 < clusterCount ? clusterStarts[i + 1] : static_cast<uint32_t>(triangleCount);
+
+            for(uint32_t t = start; t < end; t++){
+                const glm::vec3& a = vertices[indices[t * 3]].position;
+                const glm::vec3& b = vertices[indices[t * 3 + 1]].position;
+                const glm::vec3& c = vertices[indices[t * 3 + 2]].position;
+
+                glm::vec3 n = glm::cross(b - a, c - a);
+                float area = glm::length(n);
+
+                clusterCentroid[i] += (a + b + c) / 3.f * area;
+                clusterNormal[i] += n;
+                clusterArea[i] += area;
+            }
+
+            meshCentroid += clusterCentroid[i];
+            meshArea += clusterArea[i];
+
+            if(clusterArea[i] > 0.f){
+                clusterCentroid[i] /= clusterArea[i];
+            }
+        }
+
+        if(meshArea > 0.f){
+            meshCentroid /= meshArea;
+        }
+
+        // Clusters facing outwards, far from the center, are likely to occlude the rest
+        std::vector<float> sortKey(clusterCount);
+        for(size_t i = 0; i < clusterCount; i++){
+            float normalLength = glm::length(clusterNormal[i]);
+            glm::vec3 n = normalLength > 0.f ? clusterNormal[i] / normalLength : glm::vec3(0.f);
+
+            sortKey[i] = glm::dot(clusterCentroid[i] - meshCentroid, n);
+        }
+
+        std::vector<uint32_t> order(clusterCount);
+        std::iota(order.begin(), order.end(), 0);
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t l, uint32_t r){
+            return sortKey[l] > sortKey[r];
+        });
+
+        std::vector<uint32_t> result;
+        result.reserve(triangleCount * 3);
+
+        for(uint32_t cluster: order){
+            uint32_t start = clusterStarts[cluster];
+            uint32_t end = cluster + 1 < clusterCount ? clusterStarts[cluster + 1] : static_cast<uint32_t>(triangleCount);
+
+            result.insert(result.end(), indices.begin() + start * 3, indices.begin() + end * 3);
+        }
+
+        return result;
+    }
+
+    // Renumbers vertices in order of first use. Unreferenced vertices are kept, at the end.
+    void optimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices){
+        std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+        uint32_t next = 0;
+
+        for(uint32_t& index: indices){
+            if(remap[index] == UINT32_MAX){
+                remap[index] = next++;
+            }
+
+            index = remap[index];
+        }
+
+        for(uint32_t& r: remap){
+            if(r == UINT32_MAX){
+                r = next++;
+            }
+        }
+
+        std::vector<Vertex> reordered(vertices.size());
+        for(size_t v = 0; v < vertices.size(); v++){
+            reordered[remap[v]] = vertices[v];
+        }
+
+        vertices.swap(reordered);
+    }
+
+    struct Lod{
+        std::vector<uint32_t> indices;
+        float error;        // Furthest any vertex moved, in mesh units
+    };
+
+    // Symmetric 4x4 matrix summing squared distances to planes, upper triangle only
+    struct Quadric{
+        double q[10]{};
+
+        void addPlane(glm::dvec3 n, double d, double weight){
+            double p[4] = {n.x, n.y, n.z, d};
+            for(int i = 0, k = 0; i < 4; i++){
+                for(int j = i; j < 4; j++){
+                    q[k++] += weight * p[i] * p[j];
+                }
+            }
+        }
+
+        void add(const Quadric& other){
+            for(int k = 0; k < 10; k++){
+                q[k] += other.q[k];
+            }
+        }
+
+        double error(glm::dvec3 v) const {
+            return q[0] * v.x * v.x + 2.0 * q[1] * v.x * v.y + 2.0 * q[2] * v.x * v.z + 2.0 * q[3] * v.x
+                 + q[4] * v.y * v.y + 2.0 * q[5] * v.y * v.z + 2.0 * q[6] * v.y
+                 + q[7] * v.z * v.z + 2.0 * q[8] * v.z
+                 + q[9];
+        }
+    };
+
+    // Vertex clustering: positions are snapped to a uniform grid and every cell collapses onto whichever of its vertices
+    // has the smallest quadric error against the triangles around the cell, so LODs index the original vertex buffer.
+    // The grid resolution is binary searched for the finest one that gets down to targetIndexCount indices.
+    Lod generateLod(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices, size_t targetIndexCount){
+        std::vector<Quadric> vertexQuadrics(vertices.size());
+        glm::vec3 minPos{std::numeric_limits<float>::max()}, maxPos{-std::numeric_limits<float>::max()};
+
+        for(size_t i = 0; i + 2 < indices.size(); i += 3){
+            glm::dvec3 a = vertices[indices[i]].position, b = vertices[indices[i + 1]].position, c = vertices[indices[i + 2]].position;
+            glm::dvec3 n = glm::cross(b - a, c - a);
+
+            double length = glm::length(n);
+            if(length == 0.0)
+                continue;
+
+            // Weighted by area, so large triangles keep their shape over slivers
+            n /= length;
+            Quadric plane;
+            plane.addPlane(n, -glm::dot(n, a), length * 0.5);
+
+            for(int corner = 0; corner < 3; corner++){
+                uint32_t v = indices[i + corner];
+                vertexQuadrics[v].add(plane);
+                minPos = glm::min(minPos, vertices[v].position);
+                maxPos = glm::max(maxPos, vertices[v].position);
+            }
+        }
+
+        Lod best{indices, 0.f};
+        if(indices.size() <= targetIndexCount || minPos.x > maxPos.x)
+            return best;
+
+        float extent = std::max(glm::compMax(maxPos - minPos), std::numeric_limits<float>::min());
+
+        struct Triangle{
+            uint32_t a, b, c;
+            bool operator==(const Triangle& other) const { return a == other.a && b == other.b && c == other.c; }
+        };
+        struct TriangleHash{
+            size_t operator()(const Triangle& t) const { return (size_t(t.a) * 73856093u) ^ (size_t(t.b) * 19349663u) ^ (size_t(t.c) * 83492791u); }
+        };
+
+        // Cell of every referenced vertex, UINT32_MAX for the rest
+        std::vector<uint32_t> vertexCell(vertices.size());
+        auto assignCells = [&](uint32_t resolution){
+            float scale = float(resolution) / extent;
+            std::unordered_map<uint64_t, uint32_t> cellIndex;
+            cellIndex.reserve(vertices.size());
+
+            std::fill(vertexCell.begin(), vertexCell.end(), UINT32_MAX);
+
+            for(uint32_t index: indices){
+                if(vertexCell[index] != UINT32_MAX)
+                    continue;
+
+                glm::uvec3 cell = glm::min(glm::uvec3((vertices[index].position - minPos) * scale), glm::uvec3(resolution - 1));
+                uint64_t key = (uint64_t(cell.x) << 42) | (uint64_t(cell.y) << 21) | uint64_t(cell.z);
+
+                vertexCell[index] = cellIndex.try_emplace(key, static_cast<uint32_t>(cellIndex.size())).first->second;
+            }
+
+            return static_cast<uint32_t>(cellIndex.size());
+        };
+
+        // A triangle survives when its corners land in three different cells, which is all the search needs to know.
+        // Duplicates are only removed afterwards, so this can overestimate but never exceed the target.
+        auto countTriangles = [&](){
+            size_t count = 0;
+            for(size_t i = 0; i + 2 < indices.size(); i += 3){
+                uint32_t a = vertexCell[indices[i]], b = vertexCell[indices[i + 1]], c = vertexCell[indices[i + 2]];
+                count += a != b && b != c && a != c;
+            }
+            return count * 3;
+        };
+
+        uint32_t low = 1, high = 1u << 16, resolution = 1;
+
+        while(low <= high){
+            uint32_t middle = low + (high - low) / 2;
+            assignCells(middle);
+
+            if(countTriangles() <= targetIndexCount){
+                resolution = middle;
+                low = middle + 1;
+            } else {
+                high = middle - 1;
+            }
+        }
+
+        uint32_t cellCount = assignCells(resolution);
+
+        std::vector<Quadric> cellQuadrics(cellCount);
+        for(uint32_t v = 0; v < vertices.size(); v++){
+            if(vertexCell[v] != UINT32_MAX){
+                cellQuadrics[vertexCell[v]].add(vertexQuadrics[v]);
+            }
+        }
+
+        std::vector<uint32_t> representative(cellCount, UINT32_MAX);
+        std::vector<double> representativeError(cellCount, std::numeric_limits<double>::max());
+
+        for(uint32_t v = 0; v < vertices.size(); v++){
+            if(vertexCell[v] == UINT32_MAX)
+                continue;
+
+            double error = cellQuadrics[vertexCell[v]].error(vertices[v].position);
+            if(error < representativeError[vertexCell[v]]){
+                representativeError[vertexCell[v]] = error;
+                representative[vertexCell[v]] = v;
+            }
+        }
+
+        best = {{}, 0.f};
+        std::unordered_set<Triangle, TriangleHash> seen;
+
+        for(size_t i = 0; i + 2 < indices.size(); i += 3){
+            uint32_t a = representative[vertexCell[indices[i]]], b = representative[vertexCell[indices[i + 1]]], c = representative[vertexCell[indices[i + 2]]];
+            if(a == b || b == c || a == c)
+                continue;
+
+            // Same winding, rotated so the smallest index comes first
+            Triangle t = a < b && a < c ? Triangle{a, b, c} : b < c ? Triangle{b, c, a} : Triangle{c, a, b};
+            if(!seen.insert(t).second)
+                continue;
+
+            best.indices.insert(best.indices.end(), {a, b, c});
+        }
+
+        for(uint32_t v = 0; v < vertices.size(); v++){
+            if(vertexCell[v] != UINT32_MAX){
+                best.error = std::max(best.error, glm::distance(vertices[v].position, vertices[representative[vertexCell[v]]].position));
+            }
+        }
+
+        best.indices = optimizeVertexCache(best.indices, vertices.size());
+        return best;
+    }
+
+    VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = ANALYSIS_CACHE_SIZE){
+        std::vector<uint32_t> timestamps(vertexCount, 0);
+        std::vector<bool> referenced(vertexCount, false);
+
+        uint32_t time = cacheSize + 1;
+        uint64_t misses = 0, uniqueVertices = 0;
+
+        for(uint32_t index: indices){
+            if(time - timestamps[index] > cacheSize){
+                timestamps[index] = time++;
+                misses++;
+            }
+
+            if(!referenced[index]){
+                referenced[index] = true;
+                uniqueVertices++;
+            }
+        }
+
+        VertexCacheStats stats{};
+        stats.acmr = indices.size() < 3 ? 0.f : float(misses) / float(indices.size() / 3);
+        stats.atvr = uniqueVertices == 0 ? 0.f : float(misses) / float(uniqueVertices);
+
+        return stats;
+    }
+
+    // Rasterizes the mesh in index order from the six axis directions with a depth test,
+    // counting every pixel that passes as shaded
+    OverdrawStats analyzeOverdraw(const std::vector<uint32_t>& indices, const std::vector<Vertex>& vertices){
+        OverdrawStats stats{};
+
+        if(vertices.empty() || indices.size() < 3)
+            return stats;
+
+        glm::vec3 minPos = vertices[0].position, maxPos = vertices[0].position;
+        for(const Vertex& v: vertices){
+            minPos = glm::min(minPos, v.position);
+            maxPos = glm::max(maxPos, v.position);
+        }
+
+        float extent = std::max(std::max(maxPos.x - minPos.x, maxPos.y - minPos.y), maxPos.z - minPos.z);
+        if(extent <= 0.f)
+            return stats;
+
+        const float scale = float(OVERDRAW_GRID_SIZE - 1) / extent;
+        std::vector<float> depthBuffer(OVERDRAW_GRID_SIZE * OVERDRAW_GRID_SIZE);
+
+        for(int axis = 0; axis < 3; axis++){
+            for(int direction = 0; direction < 2; direction++){
+                std::fill(depthBuffer.begin(), depthBuffer.end(), std::numeric_limits<float>::max());
+
+                // Projects a position into grid space, z is the depth along the view direction
+                auto project = [&](const glm::vec3& p){
+                    glm::vec3 n = (p - minPos) * scale;
+                    glm::vec3 r{n[(axis + 1) % 3], n[(axis + 2) % 3], n[axis]};
+                    if(direction == 1)
+                        r.z = extent * scale - r.z;
+                    return r;
+                };
+
+                for(size_t t = 0; t + 2 < indices.size(); t += 3){
+                    glm::vec3 a = project(vertices[indices[t]].position);
+                    glm::vec3 b = project(vertices[indices[t + 1]].position);
+                    glm::vec3 c = project(vertices[indices[t + 2]].position);
+
+                    float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+                    if(area == 0.f)
+                        continue;
+
+                    int minX = std::max(0, (int)std::floor(std::min({a.x, b.x, c.x})));
+                    int maxX = std::min((int)OVERDRAW_GRID_SIZE - 1, (int)std::ceil(std::max({a.x, b.x, c.x})));
+                    int minY = std::max(0, (int)std::floor(std::min({a.y, b.y, c.y})));
+                    int maxY = std::min((int)OVERDRAW_GRID_SIZE - 1, (int)std::ceil(std::max({a.y, b.y, c.y})));
+
+                    for(int y = minY; y <= maxY; y++){
+                        for(int x = minX; x <= maxX; x++){
+                            float px = x + 0.5f, py = y + 0.5f;
+
+                            // Barycentrics, both windings are rasterized
+                            float w0 = ((b.x - px) * (c.y - py) - (b.y - py) * (c.x - px)) / area;
+                            float w1 = ((c.x - px) * (a.y - py) - (c.y - py) * (a.x - px)) / area;
+                            float w2 = 1.f - w0 - w1;
+
+                            if(w0 < 0.f || w1 < 0.f || w2 < 0.f)
+                                continue;
+
+                            float depth = w0 * a.z + w1 * b.z + w2 * c.z;
+                            float& stored = depthBuffer[y * OVERDRAW_GRID_SIZE + x];
+
+                            if(depth < stored){
+                                stored = depth;
+                                stats.pixelsShaded++;
+                            }
+                        }
+                    }
+                }
+
+                for(float depth: depthBuffer){
+                    if(depth != std::numeric_limits<float>::max())
+                        stats.pixelsCovered++;
+                }
+            }
+        }
+
+        stats.overdraw = stats.pixelsCovered == 0 ? 0.f : float(stats.pixelsShaded) / float(stats.pixelsCovered);
+
+        return stats;
+    }
+
+    VkIndexType chooseIndexType(size_t vertexCount){
+        return vertexCount < 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+    }
+
+    size_t indexSize(VkIndexType type){
+        return type == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+    }
+
+    // Copies the index list into the layout the index buffer was created with
+    std::vector<char> packIndices(const std::vector<uint32_t>& indices, VkIndexType type){
+        std::vector<char> data(indices.size() * indexSize(type));
+
+        if(type == VK_INDEX_TYPE_UINT16){
+            uint16_t* out = reinterpret_cast<uint16_t*>(data.data());
+            for(size_t i = 0; i < indices.size(); i++){
+                out[i] = static_cast<uint16_t>(indices[i]);
+            }
+        } else {
+            memcpy(data.data(), indices.data(), data.size());
+        }
+
+        return data;
+    }
+
+    std::vector<uint32_t> unpackIndices(const void* data, size_t count, VkIndexType type){
+        std::vector<uint32_t> indices(count);
+
+        if(type == VK_INDEX_TYPE_UINT16){
+            const uint16_t* in = static_cast<const uint16_t*>(data);
+            std::copy(in, in + count, indices.begin());
+        } else {
+            memcpy(indices.data(), data, count * sizeof(uint32_t));
+        }
+
+        return indices;
+    }
+
+    // The same passes for every primitive of an imported scene on its own. Indices are local to their submesh's
+    // vertexOffset, node instances of one primitive share its index range and are only optimised once.
+    void optimizePrimitives(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices, const std::vector<Submesh>& submeshes){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        std::unordered_set<uint32_t> done;
+        VertexCacheStats cacheBefore{}, cacheAfter{};
+        size_t triangles = 0;
+
+        for(const Submesh& submesh: submeshes){
+            if(submesh.indexCount == 0 || !done.insert(submesh.firstIndex).second)
+                continue;
+
+            std::vector<uint32_t> local(indices.begin() + submesh.firstIndex, indices.begin() + submesh.firstIndex + submesh.indexCount);
+
+            // Vertices past the last referenced one are left where they are
+            uint32_t vertexCount = *std::max_element(local.begin(), local.end()) + 1;
+            auto first = vertices.begin() + submesh.vertexOffset;
+            std::vector<Vertex> primitive(first, first + vertexCount);
+
+            VertexCacheStats before = analyzeVertexCache(local, primitive.size());
+
+            local = optimizeVertexCache(local, primitive.size());
+            local = optimizeOverdraw(local, primitive);
+            optimizeVertexFetch(primitive, local);
+
+            VertexCacheStats after = analyzeVertexCache(local, primitive.size());
+
+            // Weighted by triangles, so the totals are the scene's own ACMR
+            size_t count = local.size() / 3;
+            cacheBefore.acmr += before.acmr * count;
+            cacheAfter.acmr += after.acmr * count;
+            triangles += count;
+
+            std::copy(primitive.begin(), primitive.end(), first);
+            std::copy(local.begin(), local.end(), indices.begin() + submesh.firstIndex);
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+
+        if(triangles > 0){
+            fmt::println("Mesh optimisation ({} primitives, {} triangles, {}ms): ACMR {} -> {}", done.size(), triangles, elapsed.count(),
+                cacheBefore.acmr / triangles, cacheAfter.acmr / triangles);
+        }
+    }
+
+    // Runs every pass in order and reports the statistics before and after
+    void optimizeMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices){
+        VertexCacheStats cacheBefore = analyzeVertexCache(indices, vertices.size());
+        OverdrawStats overdrawBefore = analyzeOverdraw(indices, vertices);
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        indices = optimizeVertexCache(indices, vertices.size());
+        indices = optimizeOverdraw(indices, vertices);
+        optimizeVertexFetch(vertices, indices);
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+
+        VertexCacheStats cacheAfter = analyzeVertexCache(indices, vertices.size());
+        OverdrawStats overdrawAfter = analyzeOverdraw(indices, vertices);
+
+        fmt::println("Mesh optimisation ({} triangles, {}ms):", indices.size() / 3, elapsed.count());
+        fmt::println("    ACMR {} -> {}", cacheBefore.acmr, cacheAfter.acmr);
+        fmt::println("    ATVR {} -> {}", cacheBefore.atvr, cacheAfter.atvr);
+        fmt::println("    Overdraw {} -> {}", overdrawBefore.overdraw, overdrawAfter.overdraw);
+    }
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include "types.h"
+#include "utility.h"
+#include "initializers.h"
+#include "structs.h"
+#include "pipelineBuilder.h"
+
+// Pipeline setup the meshes share: vertex pulling with MeshPushConstants, the mesh shading path with
+// MeshletPushConstants, both over the mesh's uniform set. Meshes only differ in winding and blending.
+namespace MeshPipelines{
+    struct Style{
+        VkFrontFace frontFace{VK_FRONT_FACE_COUNTER_CLOCKWISE};
+        bool alphaBlend{false};
+    };
+
+    const VkShaderStageFlags MESHLET_STAGES = VK_SHADER_STAGE_TASK_BIT_EXT | VK_SHADER_STAGE_MESH_BIT_EXT;
+
+    VkShaderModule loadShader(VkDevice device, const std::string& file, const char* stage){
+        VkShaderModule shader;
+        if(!Utility::loadShaderModule(file.c_str(), device, &shader)){
+            fmt::println("Failed to load {} shader", stage);
+        }
+        return shader;
+    }
+
+    // The uniform buffer at binding 0, also visible to the mesh shading stages when the device has them
+    VkDescriptorSetLayout createUniformSetLayout(VkDevice device, bool meshShading){
+        DescriptorLayoutBuilder builder;
+        builder.addBinding(0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+
+        VkShaderStageFlags stages = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        if(meshShading){
+            stages |= MESHLET_STAGES;
+        }
+
+        return builder.build(device, stages);
+    }
+
+    VkPipelineLayout createLayout(VkDevice device, const std::vector<VkDescriptorSetLayout>& setLayouts, VkShaderStageFlags pushStages, uint32_t pushSize){
+        VkPushConstantRange bufferRange{};
+        bufferRange.offset = 0;
+        bufferRange.size = pushSize;
+        bufferRange.stageFlags = pushStages;
+
+        VkPipelineLayoutCreateInfo layoutInfo = Initializers::pipelineLayoutCreateInfo();
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &bufferRange;
+
+        layoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        layoutInfo.pSetLayouts = setLayouts.data();
+
+        VkPipelineLayout layout;
+        VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &layout));
+        return layout;
+    }
+
+    // Triangle lists, filled, no culling, depth tested. Shaders are still to be set.
+    PipelineBuilder builder(VkPipelineLayout layout, const Style& style, VkFormat drawImageFormat, VkFormat depthImageFormat){
+        PipelineBuilder pipelineBuilder;
+        pipelineBuilder.pipelineLayout = layout;
+        pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+        pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, style.frontFace);
+        pipelineBuilder.setMultisamplingNone();
+        if(style.alphaBlend){
+            pipelineBuilder.enableBlendingAlphablend();
+        } else {
+            pipelineBuilder.disableBlending();
+        }
+        pipelineBuilder.enableDepthtest(VK_TRUE, VK_COMPARE_OP_LESS_OR_EQUAL);
+
+        pipelineBuilder.setColorAttachmentFormat(drawImageFormat);
+        pipelineBuilder.setDepthFormat(depthImageFormat);
+
+        return pipelineBuilder;
+    }
+
+    // Fills the mesh's pipeline and pipelineLayout, destroyed with its pipelineDeletionQueue
+    void createVertexPipeline(VkDevice device, Mesh& mesh, const std::string& vertexShaderFile, const std::string& fragShaderFile, const Style& style,
+        VkFormat drawImageFormat, VkFormat depthImageFormat){
+        VkShaderModule vertexShader = loadShader(device, vertexShaderFile, "vertex");
+        VkShaderModule fragShader = loadShader(device, fragShaderFile, "frag");
+
+        mesh.pipelineLayout = createLayout(device, {mesh.setLayout}, VK_SHADER_STAGE_VERTEX_BIT, sizeof(MeshPushConstants));
+
+        PipelineBuilder pipelineBuilder = builder(mesh.pipelineLayout, style, drawImageFormat, depthImageFormat);
+        pipelineBuilder.setShaders(vertexShader, fragShader);
+
+        mesh.pipeline = pipelineBuilder.buildPipeline(device);
+
+        vkDestroyShaderModule(device, vertexShader, nullptr);
+        vkDestroyShaderModule(device, fragShader, nullptr);
+
+        mesh.pipelineDeletionQueue.pushFunction([&mesh, device](){
+            vkDestroyPipelineLayout(device, mesh.pipelineLayout, nullptr);
+            vkDestroyPipeline(device, mesh.pipeline, nullptr);
+        });
+    }
+
+    // Same for meshletPipeline and meshletPipelineLayout
+    void createMeshletPipeline(VkDevice device, Mesh& mesh, const std::string& taskShaderFile, const std::string& meshShaderFile, const std::string& fragShaderFile,
+        const Style& style, VkFormat drawImageFormat, VkFormat depthImageFormat){
+        VkShaderModule taskShader = loadShader(device, taskShaderFile, "task");
+        VkShaderModule meshShader = loadShader(device, meshShaderFile, "mesh");
+        VkShaderModule fragShader = loadShader(device, fragShaderFile, "frag");
+
+        mesh.meshletPipelineLayout = createLayout(device, {mesh.setLayout}, MESHLET_STAGES, sizeof(MeshletPushConstants));
+
+        PipelineBuilder pipelineBuilder = builder(mesh.meshletPipelineLayout, style, drawImageFormat, depthImageFormat);
+        pipelineBuilder.setMeshShaders(taskShader, meshShader, fragShader);
+
+        mesh.meshletPipeline = pipelineBuilder.buildPipeline(device);
+
+        vkDestroyShaderModule(device, taskShader, nullptr);
+        vkDestroyShaderModule(device, meshShader, nullptr);
+        vkDestroyShaderModule(device, fragShader, nullptr);
+
+        mesh.pipelineDeletionQueue.pushFunction([&mesh, device](){
+            vkDestroyPipelineLayout(device, mesh.meshletPipelineLayout, nullptr);
+            vkDestroyPipeline(device, mesh.meshletPipeline, nullptr);
+        });
+    }
+};
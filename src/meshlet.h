@@ -0,0 +1,160 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+
+namespace Meshlets{
+    const uint32_t MAX_VERTICES = 64;
+    const uint32_t MAX_TRIANGLES = 124;
+
+    // Must match the local_size_x of meshlet.task
+    const uint32_t TASK_GROUP_SIZE = 32;
+
+    Meshlet computeBounds(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& meshletVertices, const std::vector<uint32_t>& meshletTriangles, const Meshlet& meshlet){
+        Meshlet result = meshlet;
+
+        // Bounding sphere, centered on the AABB of the cluster
+        glm::vec3 minPos{std::numeric_limits<float>::max()}, maxPos{-std::numeric_limits<float>::max()};
+        for(uint32_t i = 0; i < meshlet.vertexCount; i++){
+            const glm::vec3& p = vertices[meshletVertices[meshlet.vertexOffset + i]].position;
+            minPos = glm::min(minPos, p);
+            maxPos = glm::max(maxPos, p);
+        }
+
+        glm::vec3 center = (minPos + maxPos) * 0.5f;
+        float radius = 0.f;
+        for(uint32_t i = 0; i < meshlet.vertexCount; i++){
+            const glm::vec3& p = vertices[meshletVertices[meshlet.vertexOffset + i]].position;
+            radius = std::max(radius, glm::length(p - center));
+        }
+
+        result.sphere = glm::vec4(center, radius);
+
+        // Normal cone, the axis is the average triangle normal
+        std::vector<glm::vec3> normals;
+        normals.reserve(meshlet.triangleCount);
+
+        glm::vec3 axis{0.f};
+        for(uint32_t i = 0; i < meshlet.triangleCount; i++){
+            uint32_t packed = meshletTriangles[meshlet.triangleOffset + i];
+
+            const glm::vec3& a = vertices[meshletVertices[meshlet.vertexOffset + (packed & 0xff)]].position;
+            const glm::vec3& b = vertices[meshletVertices[meshlet.vertexOffset + ((packed >> 8) & 0xff)]].position;
+            const glm::vec3& c = vertices[meshletVertices[meshlet.vertexOffset + ((packed >> 16) & 0xff)]].position;
+
+            glm::vec3 n = glm::cross(b - a, c - a);
+            float area = glm::length(n);
+
+            // Degenerate triangles have no say in the cone
+            if(area == 0.f)
+                continue;
+
+            n /= area;
+            normals.push_back(n);
+            axis += n;
+        }
+
+        // A cutoff of 1 never passes the culling test
+        result.cone = glm::vec4(0.f, 0.f, 1.f, 1.f);
+
+        float axisLength = glm::length(axis);
+        if(normals.empty() || axisLength == 0.f)
+            return result;
+
+        axis /= axisLength;
+
+        float minDot = 1.f;
+        for(const glm::vec3& n: normals){
+            minDot = std::min(minDot, glm::dot(n, axis));
+        }
+
+        // Cone is wider than a hemisphere, some triangle is always facing the camera
+        if(minDot <= 0.f){
+            result.cone = glm::vec4(axis, 1.f);
+            return result;
+        }
+
+        result.cone = glm::vec4(axis, std::sqrt(1.f - minDot * minDot));
+        return result;
+    }
+
+    // Greedily splits the index list into clusters of at most MAX_VERTICES vertices and MAX_TRIANGLES triangles.
+    // Triangles are stored packed as 3 local 8-bit indices in one uint32.
+    MeshletData buildMeshlets(const std::vector<Vertex>& vertices, const std::vector<uint32_t>& indices, uint32_t indexCount){
+        MeshletData data;
+
+        // Local index of every vertex in the current meshlet, 0xff if not in it
+        std::vector<uint8_t> localIndex(vertices.size(), 0xff);
+
+        Meshlet current{};
+
+        auto flush = [&](){
+            if(current.triangleCount == 0)
+                return;
+
+            for(uint32_t i = 0; i < current.vertexCount; i++){
+                localIndex[data.meshletVertices[current.vertexOffset + i]] = 0xff;
+            }
+
+            data.meshlets.push_back(computeBounds(vertices, data.meshletVertices, data.meshletTriangles, current));
+
+            current = {};
+            current.vertexOffset = static_cast<uint32_t>(data.meshletVertices.size());
+            current.triangleOffset = static_cast<uint32_t>(data.meshletTriangles.size());
+        };
+
+        for(uint32_t i = 0; i + 2 < indexCount; i += 3){
+            uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+
+            uint32_t newVertices = (localIndex[a] == 0xff) + (localIndex[b] == 0xff) + (localIndex[c] == 0xff);
+
+            if(current.vertexCount + newVertices > MAX_VERTICES || current.triangleCount + 1 > MAX_TRIANGLES){
+                flush();
+            }
+
+            uint32_t packed = 0;
+            uint32_t corner = 0;
+            for(uint32_t v: {a, b, c}){
+                if(localIndex[v] == 0xff){
+                    localIndex[v] = static_cast<uint8_t>(current.vertexCount++);
+                    data.meshletVertices.push_back(v);
+                }
+
+                packed |= uint32_t(localIndex[v]) << (8 * corner++);
+            }
+
+            data.meshletTriangles.push_back(packed);
+            current.triangleCount++;
+        }
+
+        flush();
+
+        return data;
+    }
+
+    // Size in bytes of the single GPU buffer holding meshlets, vertex indices and triangles back to back
+    size_t gpuSize(const MeshletData& data){
+        return data.meshlets.size() * sizeof(Meshlet) + (data.meshletVertices.size() + data.meshletTriangles.size()) * sizeof(uint32_t);
+    }
+
+    void writeGpuData(const MeshletData& data, void* dst){
+        char* out = (char*)dst;
+
+        memcpy(out, data.meshlets.data(), data.meshlets.size() * sizeof(Meshlet));
+        out += data.meshlets.size() * sizeof(Meshlet);
+
+        memcpy(out, data.meshletVertices.data(), data.meshletVertices.size() * sizeof(uint32_t));
+        out += data.meshletVertices.size() * sizeof(uint32_t);
+
+        memcpy(out, data.meshletTriangles.data(), data.meshletTriangles.size() * sizeof(uint32_t));
+    }
+
+    // Offsets, in uint32 units, of the vertex index and triangle arrays inside the GPU buffer
+    uint32_t gpuVertexOffset(const MeshletData& data){
+        return static_cast<uint32_t>(data.meshlets.size() * sizeof(Meshlet) / sizeof(uint32_t));
+    }
+
+    uint32_t gpuTriangleOffset(const MeshletData& data){
+        return gpuVertexOffset(data) + static_cast<uint32_t>(data.meshletVertices.size());
+    }
+};
@@ -96,6 +96,17 @@ class PipelineBuilder {
             shaderStages.push_back(Initializers::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, fragShader, "main"));
         }
 
+        // Vertex input and input assembly are ignored once a mesh stage is present
+        void setMeshShaders(VkShaderModule taskShader, VkShaderModule meshShader, VkShaderModule fragShader){
+            shaderStages.clear();
+
+            shaderStages.push_back(Initializers::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_TASK_BIT_EXT, taskShader, "main"));
+
+            shaderStages.push_back(Initializers::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_MESH_BIT_EXT, meshShader, "main"));
+
+            shaderStages.push_back(Initializers::pipelineShaderStageCreateInfo(VK_SHADER_STAGE_FRAGMENT_BIT, fragShader, "main"));
+        }
+
         void setInputTopology(VkPrimitiveTopology top){
             inputAssembly.topology = top;
             inputAssembly.primitiveRestartEnable = VK_FALSE;
@@ -0,0 +1,220 @@
+#pragma once
+
+#include "types.h"
+
+#include <map>
+#include <string>
+
+struct GpuTimingStats{
+    double lastMs{0.0};
+    double totalMs{0.0};
+    uint64_t samples{0};
+
+    // Host clock time of the last sample, only set with calibrated timestamps. Raw timestamps of different queues
+    // don't share a time base that could be compared, these do.
+    bool calibrated{false};
+    double hostBeginMs{0.0};
+    double hostEndMs{0.0};
+
+    double averageMs() const {
+        return samples == 0 ? 0.0 : totalMs / samples;
+    }
+};
+
+// VK_EXT_calibrated_timestamps with a host time domain the device supports, see GpuProfiler::setup
+struct TimestampCalibration{
+    PFN_vkGetCalibratedTimestampsEXT getCalibratedTimestamps{nullptr};
+    VkTimeDomainEXT hostDomain{VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT};
+    double hostTicksPerMs{1000000.0};
+
+    bool available() const {
+        return getCalibratedTimestamps != nullptr;
+    }
+};
+
+// Timestamp queries around named scopes of a frame.
+// Every frame in flight owns a slice of the query pool, results are read back once its fence has been waited on.
+// Work on another queue gets a profiler of its own, recorded into that queue's command buffers.
+class GpuProfiler{
+public:
+    static const uint32_t MAX_SCOPES = 16;
+
+    std::map<std::string, GpuTimingStats> stats;
+
+    // queueFamily is the one the scopes are recorded on. With a calibration every readback also maps the results
+    // onto the host clock.
+    void setup(VkDevice device, VkPhysicalDevice physicalDevice, uint32_t queueFamily, const TimestampCalibration& calibration = {}){
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        timestampPeriod = properties.limits.timestampPeriod;
+        enabled = properties.limits.timestampComputeAndGraphics == VK_TRUE;
+
+        uint32_t familyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> families(familyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families.data());
+
+        uint32_t validBits = queueFamily < familyCount ? families[queueFamily].timestampValidBits : 64;
+        timestampMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+
+        _calibration = calibration;
+
+        if(!enabled){
+            fmt::println("Timestamp queries are not supported, GPU timings are disabled");
+            return;
+        }
+
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = FRAME_OVERLAP * MAX_SCOPES * 2;
+
+        VK_CHECK(vkCreateQueryPool(device, &poolInfo, nullptr, &queryPool));
+    }
+
+    void cleanup(VkDevice device){
+        if(enabled){
+            vkDestroyQueryPool(device, queryPool, nullptr);
+        }
+    }
+
+    // Call after the frame's fence was waited on, before anything else is recorded.
+    // Returns whether the scopes this slice held last time were read back.
+    bool beginFrame(VkDevice device, VkCommandBuffer command, uint32_t frameIndex){
+        if(!enabled)
+            return false;
+
+        currentFrame = frameIndex % FRAME_OVERLAP;
+        std::vector<std::string>& scopes = frameScopes[currentFrame];
+        bool read = false;
+
+        if(!scopes.empty()){
+            uint64_t results[MAX_SCOPES * 2];
+            VkResult result = vkGetQueryPoolResults(device, queryPool, firstQuery(), static_cast<uint32_t>(scopes.size() * 2), sizeof(results), results, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+            if(result == VK_SUCCESS){
+                Calibration now{};
+                bool calibrated = calibrate(device, now);
+
+                for(size_t i = 0; i < scopes.size(); i++){
+                    double ms = double((results[2 * i + 1] - results[2 * i]) & timestampMask) * timestampPeriod / 1000000.0;
+
+                    GpuTimingStats& s = stats[scopes[i]];
+                    s.lastMs = ms;
+                    s.totalMs += ms;
+                    s.samples++;
+
+                    s.calibrated = calibrated;
+                    if(calibrated){
+                        s.hostBeginMs = hostMs(now, results[2 * i]);
+                        s.hostEndMs = hostMs(now, results[2 * i + 1]);
+                    }
+                }
+
+                read = true;
+            }
+        }
+
+        scopes.clear();
+        vkCmdResetQueryPool(command, queryPool, firstQuery(), MAX_SCOPES * 2);
+
+        return read;
+    }
+
+    void beginScope(VkCommandBuffer command, const std::string& name){
+        std::vector<std::string>& scopes = frameScopes[currentFrame];
+
+        if(!enabled || scopes.size() >= MAX_SCOPES)
+            return;
+
+        uint32_t query = firstQuery() + static_cast<uint32_t>(scopes.size()) * 2;
+        scopes.push_back(name);
+
+        vkCmdWriteTimestamp2(command, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, queryPool, query);
+    }
+
+    void endScope(VkCommandBuffer command, const std::string& name){
+        if(!enabled)
+            return;
+
+        std::vector<std::string>& scopes = frameScopes[currentFrame];
+        for(size_t i = 0; i < scopes.size(); i++){
+            if(scopes[i] == name){
+                vkCmdWriteTimestamp2(command, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, queryPool, firstQuery() + static_cast<uint32_t>(i) * 2 + 1);
+                return;
+            }
+        }
+    }
+
+    double lastMs(const std::string& name){
+        auto it = stats.find(name);
+        return it == stats.end() ? 0.0 : it->second.lastMs;
+    }
+
+    void imguiInterface(){
+        if(ImGui::Begin("GPU Timings")){
+            if(!enabled)
+                ImGui::Text("Timestamp queries not supported");
+
+            for(auto& [name, s]: stats){
+                ImGui::Text("%s: %.3fms (avg %.3fms)", name.c_str(), s.lastMs, s.averageMs());
+            }
+        }
+        ImGui::End();
+    }
+
+    void printStats(){
+        for(auto& [name, s]: stats){
+            fmt::println("GPU {}: {}ms average over {} frames", name, s.averageMs(), s.samples);
+        }
+    }
+
+private:
+    // The same instant on the device and on the host clock
+    struct Calibration{
+        uint64_t deviceTicks;
+        uint64_t hostTicks;
+    };
+
+    VkQueryPool queryPool;
+    float timestampPeriod{1.f};
+    uint64_t timestampMask{~uint64_t(0)};
+    bool enabled{false};
+
+    TimestampCalibration _calibration;
+
+    uint32_t currentFrame{0};
+    std::vector<std::string> frameScopes[FRAME_OVERLAP];
+
+    uint32_t firstQuery(){
+        return currentFrame * MAX_SCOPES * 2;
+    }
+
+    // Right after the readback, the timestamps it maps are at most a few frames old
+    bool calibrate(VkDevice device, Calibration& calibration){
+        if(!_calibration.available())
+            return false;
+
+        VkCalibratedTimestampInfoEXT infos[2]{};
+        infos[0].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+        infos[0].timeDomain = VK_TIME_DOMAIN_DEVICE_EXT;
+        infos[1].sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_EXT;
+        infos[1].timeDomain = _calibration.hostDomain;
+
+        uint64_t timestamps[2];
+        uint64_t maxDeviation;
+        if(_calibration.getCalibratedTimestamps(device, 2, infos, timestamps, &maxDeviation) != VK_SUCCESS)
+            return false;
+
+        calibration.deviceTicks = timestamps[0];
+        calibration.hostTicks = timestamps[1];
+        return true;
+    }
+
+    // Counted back from the calibration, which comes after every timestamp it's used for
+    double hostMs(const Calibration& calibration, uint64_t timestamp) const {
+        double agoMs = double((calibration.deviceTicks - timestamp) & timestampMask) * timestampPeriod / 1000000.0;
+        return double(calibration.hostTicks) / _calibration.hostTicksPerMs - agoMs;
+    }
+};
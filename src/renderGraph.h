@@ -0,0 +1,734 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "initializers.h"
+
+#include <deque>
+#include <unordered_map>
+
+// How a pass touches an image, each one needs a layout and is done by a known set of stages and accesses
+enum class ImageUsage{
+    ColorAttachment,
+    DepthAttachment,
+    StorageImage,       // Compute shaders
+    Sampled,            // Fragment and compute shaders
+    TransferSrc,
+    TransferDst,
+};
+
+struct RenderGraphStats{
+    uint32_t passes{0};
+    uint32_t culledPasses{0};
+    uint32_t imageBarriers{0};
+    uint32_t barrierBatches{0};     // vkCmdPipelineBarrier2 calls
+    uint32_t elidedBarriers{0};     // Uses that found their image in the right layout and already visible
+};
+
+// An image the graph creates and owns, it only lives between its first and last use in a frame
+struct TransientImageInfo{
+    VkFormat format;
+    VkExtent2D extent;
+    VkImageUsageFlags usage;
+    VkImageAspectFlags aspect;
+    bool lazy{false};   // Attachments only, in lazily allocated memory where the device has it
+};
+
+// What the transient images of one frame configuration take, against giving each its own allocation
+struct TransientMemoryReport{
+    std::string configuration;
+    uint32_t images{0};
+    uint32_t lazyImages{0};
+    VkDeviceSize dedicatedBytes{0};     // Every image in an allocation of its own
+    VkDeviceSize allocatedBytes{0};     // What the aliased images actually take
+    VkDeviceSize lazyBytes{0};          // Not in allocatedBytes, tiled GPUs keep these in tile memory
+
+    VkDeviceSize savedBytes() const {
+        return dedicatedBytes - allocatedBytes;
+    }
+};
+
+// Rebuilt every frame: import the images, add passes in execution order with the images they read and write, then
+// execute(). Passes that nothing downstream reads are culled, the others get one batched barrier in front of them
+// with only the stages and accesses their uses need, and nothing when the image is already in shape.
+// write() means the pass overwrites the whole image, so the previous contents are discarded when the layout changes.
+// Passes that also read what's there (an attachment that loads, say) declare readWrite().
+// Images imported again next frame first wait for the stages that used them last, the frames go to the same queue.
+//
+// Transient images are created by the graph. Those whose lifetimes (first to last live pass) don't overlap share memory,
+// they're placed into one allocation by offset and their first use each frame waits for everything that touched the
+// memory before. Physical images are kept across frames while the set of transients and their lifetimes stay the same.
+class RenderGraph{
+public:
+    struct Pass{
+        struct Use{
+            uint32_t image;
+            ImageUsage usage;
+            bool read, write;
+            bool contentsNeeded{true};     // For writes, whether a later pass or an output reads the result
+        };
+
+        std::string name;
+        std::function<void(VkCommandBuffer)> execute;
+        std::vector<Use> uses;
+        bool sideEffects{false};
+        bool culled{false};
+
+        Pass& read(uint32_t image, ImageUsage usage){
+            uses.push_back({image, usage, true, false, true});
+            return *this;
+        }
+
+        Pass& write(uint32_t image, ImageUsage usage){
+            uses.push_back({image, usage, false, true, true});
+            return *this;
+        }
+
+        Pass& readWrite(uint32_t image, ImageUsage usage){
+            uses.push_back({image, usage, true, true, true});
+            return *this;
+        }
+
+        // For passes whose results leave the graph some other way, like a readback to the host
+        Pass& keep(){
+            sideEffects = true;
+            return *this;
+        }
+    };
+
+    RenderGraphStats stats;     // Of the last execute()
+
+    void setup(VkDevice device, VmaAllocator allocator){
+        _device = device;
+        _allocator = allocator;
+
+        // Tiled GPUs keep transient attachments in tile memory, desktop GPUs don't have the memory type
+        VkImageCreateInfo imageInfo = Initializers::imageCreateInfo(VK_FORMAT_D32_SFLOAT,
+            VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT, {1, 1, 1});
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+
+        uint32_t memoryType;
+        _lazyMemory = vmaFindMemoryTypeIndexForImageInfo(allocator, &imageInfo, &allocInfo, &memoryType) == VK_SUCCESS;
+    }
+
+    // With the device idle
+    void cleanup(){
+        destroyTransients();
+    }
+
+    void reset(){
+        _images.clear();
+        _passes.clear();
+    }
+
+    // An image the graph doesn't own, in initialLayout. Work outside the graph that used it has to be ordered before
+    // initialStage, by a semaphore wait on that stage for example.
+    uint32_t importImage(const std::string& name, VkImage image, VkImageAspectFlags aspect, VkImageLayout initialLayout, VkPipelineStageFlags2 initialStage = VK_PIPELINE_STAGE_2_NONE){
+        Image resource{};
+        resource.name = name;
+        resource.image = image;
+        resource.aspect = aspect;
+        resource.layout = initialLayout;
+        resource.writeStage = initialStage;
+
+        auto previous = _previousUse.find(image);
+        if(previous != _previousUse.end()){
+            resource.writeStage |= previous->second.stages;
+            resource.writeAccess = previous->second.writeAccess;
+        }
+
+        _images.push_back(resource);
+        return static_cast<uint32_t>(_images.size() - 1);
+    }
+
+    // Contents are undefined at the first use each frame, which has to be a write()
+    uint32_t createImage(const std::string& name, const TransientImageInfo& info){
+        Image resource{};
+        resource.name = name;
+        resource.image = VK_NULL_HANDLE;
+        resource.aspect = info.aspect;
+        resource.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        resource.transient = true;
+        resource.info = info;
+
+        _images.push_back(resource);
+        return static_cast<uint32_t>(_images.size() - 1);
+    }
+
+    // For the passes of a transient image, while they execute
+    const AllocatedImage& transientImage(uint32_t image) const {
+        return _physicalImages[_images[image].physical].image;
+    }
+
+    // For attachments of the pass that's executing. What nothing reads afterwards doesn't have to be written back to
+    // memory, which is most of an attachment's cost on tiled GPUs. Anything read outside the graph has to be an output.
+    VkAttachmentStoreOp storeOp(uint32_t image) const {
+        for(const Pass::Use& use: _executing->uses){
+            if(use.image == image && use.write && use.contentsNeeded)
+                return VK_ATTACHMENT_STORE_OP_STORE;
+        }
+
+        return VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    }
+
+    // Outputs keep the passes that write them alive and are left in finalLayout
+    void setOutput(uint32_t image, VkImageLayout finalLayout){
+        _images[image].output = true;
+        _images[image].finalLayout = finalLayout;
+    }
+
+    // Passes run in the order they were added. The reference stays valid until reset().
+    Pass& addPass(const std::string& name, std::function<void(VkCommandBuffer)>&& execute){
+        Pass& pass = _passes.emplace_back();
+        pass.name = name;
+        pass.execute = std::move(execute);
+        return pass;
+    }
+
+    // Physical images that aren't needed anymore go into retired, to be destroyed once the frame is done with them
+    void execute(VkCommandBuffer command, DeletionQueue& retired){
+        stats = {};
+        stats.passes = static_cast<uint32_t>(_passes.size());
+
+        cull();
+        allocateTransients(retired);
+
+        std::vector<VkImageMemoryBarrier2> barriers;
+
+        for(Pass& pass: _passes){
+            if(pass.culled)
+                continue;
+
+            barriers.clear();
+
+            for(const Pass::Use& use: mergeUses(pass)){
+                VkImageMemoryBarrier2 barrier;
+                if(transition(use, barrier)){
+                    barriers.push_back(barrier);
+                } else {
+                    stats.elidedBarriers++;
+                }
+            }
+
+            recordBarriers(command, barriers);
+
+            _executing = &pass;
+            pass.execute(command);
+        }
+        _executing = nullptr;
+
+        // Whoever comes after the graph synchronises on its own, a semaphore signal or a present
+        barriers.clear();
+        for(Image& image: _images){
+            if(!image.output || image.layout == image.finalLayout)
+                continue;
+
+            VkImageMemoryBarrier2 barrier = imageBarrier(image, image.layout, image.finalLayout);
+            barrier.srcStageMask = image.writeStage | image.readStages;
+            barrier.srcAccessMask = image.writeAccess;
+
+            barriers.push_back(barrier);
+            image.layout = image.finalLayout;
+            image.writeStage = VK_PIPELINE_STAGE_2_NONE;
+            image.writeAccess = VK_ACCESS_2_NONE;
+            image.readStages = VK_PIPELINE_STAGE_2_NONE;
+        }
+
+        recordBarriers(command, barriers);
+
+        _previousUse.clear();
+        for(const Image& image: _images){
+            if(image.image != VK_NULL_HANDLE){
+                _previousUse[image.image] = {image.writeStage | image.readStages, image.writeAccess};
+            }
+        }
+    }
+
+    void imguiInterface(){
+        if(ImGui::Begin("Render Graph")){
+            ImGui::Text("%u passes, %u culled", stats.passes, stats.culledPasses);
+            ImGui::Text("%u image barriers in %u batches, %u elided", stats.imageBarriers, stats.barrierBatches, stats.elidedBarriers);
+
+            for(const Pass& pass: _passes){
+                ImGui::Text("%s%s", pass.name.c_str(), pass.culled ? " (culled)" : "");
+            }
+
+            if(_report >= 0){
+                const TransientMemoryReport& report = _reports[_report];
+                ImGui::Separator();
+                ImGui::Text("%u transient images, %u lazily allocated", report.images, report.lazyImages);
+                ImGui::Text("%.2fMB instead of %.2fMB, %.2fMB saved", toMegabytes(report.allocatedBytes), toMegabytes(report.dedicatedBytes), toMegabytes(report.savedBytes()));
+            }
+        }
+        ImGui::End();
+    }
+
+    void printStats(){
+        fmt::println("Render graph: {} passes, {} culled, {} image barriers in {} batches, {} elided", stats.passes, stats.culledPasses,
+            stats.imageBarriers, stats.barrierBatches, stats.elidedBarriers);
+
+        for(const TransientMemoryReport& report: _reports){
+            fmt::println("    transient {}: {:.2f}MB allocated, {:.2f}MB lazily, instead of {:.2f}MB, {:.2f}MB saved", report.configuration,
+                toMegabytes(report.allocatedBytes), toMegabytes(report.lazyBytes), toMegabytes(report.dedicatedBytes), toMegabytes(report.savedBytes()));
+        }
+    }
+
+private:
+    struct Image{
+        std::string name;
+        VkImage image;
+        VkImageAspectFlags aspect;
+        bool output{false};
+        VkImageLayout finalLayout{VK_IMAGE_LAYOUT_UNDEFINED};
+
+        // Where the image is now. The last write (or layout transition) happened at writeStage, reads since then at
+        // readStages, and the write has been made visible to visibleStages and visibleAccess.
+        VkImageLayout layout;
+        VkPipelineStageFlags2 writeStage{VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 writeAccess{VK_ACCESS_2_NONE};
+        VkPipelineStageFlags2 readStages{VK_PIPELINE_STAGE_2_NONE};
+        VkPipelineStageFlags2 visibleStages{VK_PIPELINE_STAGE_2_NONE};
+        VkAccessFlags2 visibleAccess{VK_ACCESS_2_NONE};
+
+        bool transient{false};
+        TransientImageInfo info{};
+        uint32_t physical{0};               // Into _physicalImages
+        std::vector<uint32_t> aliases;      // Transients sharing memory with this one, until its first use
+    };
+
+    struct PhysicalImage{
+        AllocatedImage image{};
+        VkDeviceSize offset{0};
+        VkMemoryRequirements requirements{};
+        bool lazy{false};                   // Or with an allocation of its own, outside _transientMemory
+        std::vector<uint32_t> aliases;      // Into _physicalImages
+    };
+
+    struct UsageInfo{
+        VkImageLayout layout;
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2 readAccess;
+        VkAccessFlags2 writeAccess;
+    };
+
+    std::vector<Image> _images;
+    std::deque<Pass> _passes;
+    const Pass* _executing{nullptr};
+    struct PreviousUse{
+        VkPipelineStageFlags2 stages;
+        VkAccessFlags2 writeAccess;
+    };
+
+    std::unordered_map<VkImage, PreviousUse> _previousUse;    // How last frame's graph left each image
+
+    static constexpr VkImageUsageFlags ATTACHMENT_USAGE = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_INPUT_ATTACHMENT_BIT;
+
+    VkDevice _device;
+    VmaAllocator _allocator;
+    bool _lazyMemory{false};
+
+    std::string _transientLayout;       // What _physicalImages were made for
+    std::vector<PhysicalImage> _physicalImages;
+    VmaAllocation _transientMemory{VK_NULL_HANDLE};
+
+    std::vector<TransientMemoryReport> _reports;    // One per configuration seen
+    int _report{-1};                                // The current one
+
+    static double toMegabytes(VkDeviceSize bytes){
+        return double(bytes) / (1024.0 * 1024.0);
+    }
+
+    static UsageInfo usageInfo(ImageUsage usage){
+        switch(usage){
+            case ImageUsage::ColorAttachment:
+                return {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT, VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT};
+            case ImageUsage::DepthAttachment:
+                return {VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL, VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+                    VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT};
+            case ImageUsage::StorageImage:
+                return {VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_READ_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT};
+            case ImageUsage::Sampled:
+                return {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+                    VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_ACCESS_2_NONE};
+            case ImageUsage::TransferSrc:
+                return {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_BLIT_BIT | VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, VK_ACCESS_2_NONE};
+            case ImageUsage::TransferDst:
+                return {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_BLIT_BIT | VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_NONE, VK_ACCESS_2_TRANSFER_WRITE_BIT};
+        }
+
+        throw std::runtime_error("Unknown image usage");
+    }
+
+    // Walks backwards from the outputs. A pass lives if it has side effects or writes something a later live pass
+    // reads, an image it overwrites isn't needed from anyone before it.
+    void cull(){
+        std::vector<bool> needed(_images.size());
+        for(size_t i = 0; i < _images.size(); i++){
+            needed[i] = _images[i].output;
+        }
+
+        for(auto pass = _passes.rbegin(); pass != _passes.rend(); pass++){
+            bool live = pass->sideEffects;
+            for(const Pass::Use& use: pass->uses){
+                live = live || (use.write && needed[use.image]);
+            }
+
+            pass->culled = !live;
+            if(!live){
+                stats.culledPasses++;
+                continue;
+            }
+
+            for(Pass::Use& use: pass->uses){
+                if(use.write){
+                    use.contentsNeeded = needed[use.image];
+                }
+            }
+
+            for(const Pass::Use& use: pass->uses){
+                if(use.write && !use.read){
+                    needed[use.image] = false;
+                }
+            }
+
+            for(const Pass::Use& use: pass->uses){
+                if(use.read){
+                    needed[use.image] = true;
+                }
+            }
+        }
+    }
+
+    // Lifetimes are taken over the live passes only. When they match the last frame's, the physical images are reused.
+    void allocateTransients(DeletionQueue& retired){
+        std::vector<uint32_t> firstPass(_images.size(), UINT32_MAX), lastPass(_images.size(), 0);
+
+        for(uint32_t i = 0; i < _passes.size(); i++){
+            if(_passes[i].culled)
+                continue;
+
+            for(const Pass::Use& use: _passes[i].uses){
+                firstPass[use.image] = std::min(firstPass[use.image], i);
+                lastPass[use.image] = std::max(lastPass[use.image], i);
+            }
+        }
+
+        std::vector<uint32_t> transients;
+        std::string layout;
+
+        for(uint32_t i = 0; i < _images.size(); i++){
+            const Image& image = _images[i];
+            if(!image.transient || firstPass[i] == UINT32_MAX)
+                continue;
+
+            transients.push_back(i);
+            layout += fmt::format("{} {} {}x{} {} {} {}-{};", image.name, int(image.info.format), image.info.extent.width, image.info.extent.height,
+                image.info.usage, image.info.lazy, firstPass[i], lastPass[i]);
+        }
+
+        if(layout != _transientLayout){
+            retireTransients(retired);
+            createTransients(transients, firstPass, lastPass);
+            _transientLayout = layout;
+        }
+
+        for(uint32_t i = 0; i < transients.size(); i++){
+            Image& image = _images[transients[i]];
+            image.physical = i;
+            image.image = _physicalImages[i].image.image;
+
+            auto previous = _previousUse.find(image.image);
+            if(previous != _previousUse.end()){
+                image.writeStage = previous->second.stages;
+                image.writeAccess = previous->second.writeAccess;
+            }
+
+            for(uint32_t alias: _physicalImages[i].aliases){
+                image.aliases.push_back(transients[alias]);
+            }
+        }
+    }
+
+    // Largest first, each at the lowest offset that doesn't overlap an image placed earlier whose lifetime overlaps its own
+    void createTransients(const std::vector<uint32_t>& transients, const std::vector<uint32_t>& firstPass, const std::vector<uint32_t>& lastPass){
+        _physicalImages.resize(transients.size());
+
+        std::vector<VkImageCreateInfo> imageInfos;
+        TransientMemoryReport report{};
+
+        for(uint32_t i = 0; i < transients.size(); i++){
+            const Image& image = _images[transients[i]];
+            PhysicalImage& physical = _physicalImages[i];
+            physical.lazy = image.info.lazy && _lazyMemory && (image.info.usage & ~ATTACHMENT_USAGE) == 0;
+
+            VkImageUsageFlags usage = image.info.usage | (physical.lazy ? VK_IMAGE_USAGE_TRANSIENT_ATTACHMENT_BIT : 0);
+            imageInfos.push_back(Initializers::imageCreateInfo(image.info.format, usage, {image.info.extent.width, image.info.extent.height, 1}));
+
+            VkDeviceImageMemoryRequirements requirementsInfo{};
+            requirementsInfo.sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS;
+            requirementsInfo.pCreateInfo = &imageInfos.back();
+
+            VkMemoryRequirements2 requirements{};
+            requirements.sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2;
+            vkGetDeviceImageMemoryRequirements(_device, &requirementsInfo, &requirements);
+
+            physical.requirements = requirements.memoryRequirements;
+
+            report.configuration += fmt::format("{}{} {}x{}", i == 0 ? "" : ", ", image.name, image.info.extent.width, image.info.extent.height);
+            report.images++;
+            report.dedicatedBytes += physical.requirements.size;
+        }
+
+        std::vector<uint32_t> order;
+        VkMemoryRequirements heap{0, 1, UINT32_MAX};
+
+        for(uint32_t i = 0; i < transients.size(); i++){
+            if(!_physicalImages[i].lazy){
+                order.push_back(i);
+                heap.memoryTypeBits &= _physicalImages[i].requirements.memoryTypeBits;
+            }
+        }
+
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b){
+            return _physicalImages[a].requirements.size > _physicalImages[b].requirements.size;
+        });
+
+        // Images that can't share a memory type, unlikely as that is for attachments, don't get aliased
+        bool aliasing = heap.memoryTypeBits != 0;
+
+        auto lifetimesOverlap = [&](uint32_t a, uint32_t b){
+            return firstPass[transients[a]] <= lastPass[transients[b]] && firstPass[transients[b]] <= lastPass[transients[a]];
+        };
+
+        for(size_t i = 0; aliasing && i < order.size(); i++){
+            PhysicalImage& physical = _physicalImages[order[i]];
+            VkDeviceSize alignment = physical.requirements.alignment;
+
+            bool moved = true;
+            while(moved){
+                moved = false;
+
+                for(size_t j = 0; j < i; j++){
+                    const PhysicalImage& placed = _physicalImages[order[j]];
+                    bool memoryOverlaps = physical.offset < placed.offset + placed.requirements.size && placed.offset < physical.offset + physical.requirements.size;
+
+                    if(memoryOverlaps && lifetimesOverlap(order[i], order[j])){
+                        physical.offset = (placed.offset + placed.requirements.size + alignment - 1) / alignment * alignment;
+                        moved = true;
+                    }
+                }
+            }
+
+            heap.size = std::max(heap.size, physical.offset + physical.requirements.size);
+            heap.alignment = std::max(heap.alignment, alignment);
+        }
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        if(aliasing && heap.size > 0){
+            VK_CHECK(vmaAllocateMemory(_allocator, &heap, &allocInfo, &_transientMemory, nullptr));
+            report.allocatedBytes = heap.size;
+        }
+
+        VmaAllocationCreateInfo lazyAllocInfo{};
+        lazyAllocInfo.usage = VMA_MEMORY_USAGE_GPU_LAZILY_ALLOCATED;
+
+        for(uint32_t i = 0; i < transients.size(); i++){
+            const Image& image = _images[transients[i]];
+            PhysicalImage& physical = _physicalImages[i];
+
+            physical.image.imageFormat = image.info.format;
+            physical.image.imageExtent = imageInfos[i].extent;
+            physical.image.allocation = VK_NULL_HANDLE;
+
+            if(physical.lazy){
+                VK_CHECK(vmaCreateImage(_allocator, &imageInfos[i], &lazyAllocInfo, &physical.image.image, &physical.image.allocation, nullptr));
+                report.lazyImages++;
+                report.lazyBytes += physical.requirements.size;
+            } else if(aliasing){
+                VK_CHECK(vmaCreateAliasingImage2(_allocator, _transientMemory, physical.offset, &imageInfos[i], &physical.image.image));
+            } else {
+                VK_CHECK(vmaCreateImage(_allocator, &imageInfos[i], &allocInfo, &physical.image.image, &physical.image.allocation, nullptr));
+                report.allocatedBytes += physical.requirements.size;
+            }
+
+            VkImageViewCreateInfo viewInfo = Initializers::imageViewCreateInfo(image.info.format, physical.image.image, image.info.aspect);
+            VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &physical.image.imageView));
+
+            physical.aliases.clear();
+            for(uint32_t j = 0; aliasing && !physical.lazy && j < transients.size(); j++){
+                const PhysicalImage& other = _physicalImages[j];
+                if(j == i || other.lazy)
+                    continue;
+
+                if(physical.offset < other.offset + other.requirements.size && other.offset < physical.offset + physical.requirements.size){
+                    physical.aliases.push_back(j);
+                }
+            }
+        }
+
+        auto existing = std::find_if(_reports.begin(), _reports.end(), [&](const TransientMemoryReport& other){ return other.configuration == report.configuration; });
+        if(existing == _reports.end()){
+            existing = _reports.insert(_reports.end(), report);
+        } else {
+            *existing = report;
+        }
+        _report = static_cast<int>(existing - _reports.begin());
+    }
+
+    // Whatever last used them may still be in flight
+    void retireTransients(DeletionQueue& retired){
+        if(_physicalImages.empty() && _transientMemory == VK_NULL_HANDLE)
+            return;
+
+        retired.pushFunction([this, images = std::move(_physicalImages), memory = _transientMemory](){
+            destroyTransients(images, memory);
+        });
+
+        _physicalImages.clear();
+        _transientMemory = VK_NULL_HANDLE;
+        _transientLayout.clear();
+    }
+
+    void destroyTransients(){
+        destroyTransients(_physicalImages, _transientMemory);
+
+        _physicalImages.clear();
+        _transientMemory = VK_NULL_HANDLE;
+        _transientLayout.clear();
+    }
+
+    void destroyTransients(const std::vector<PhysicalImage>& images, VmaAllocation memory){
+        for(const PhysicalImage& physical: images){
+            vkDestroyImageView(_device, physical.image.imageView, nullptr);
+
+            if(physical.image.allocation != VK_NULL_HANDLE){
+                vmaDestroyImage(_allocator, physical.image.image, physical.image.allocation);
+            } else {
+                vkDestroyImage(_device, physical.image.image, nullptr);
+            }
+        }
+
+        if(memory != VK_NULL_HANDLE){
+            vmaFreeMemory(_allocator, memory);
+        }
+    }
+
+    // One use per image, a pass can't have an image in two layouts at once
+    std::vector<Pass::Use> mergeUses(const Pass& pass){
+        std::vector<Pass::Use> merged;
+
+        for(const Pass::Use& use: pass.uses){
+            auto it = std::find_if(merged.begin(), merged.end(), [&](const Pass::Use& other){ return other.image == use.image; });
+
+            if(it == merged.end()){
+                merged.push_back(use);
+                continue;
+            }
+
+            if(usageInfo(it->usage).layout != usageInfo(use.usage).layout){
+                throw std::runtime_error(fmt::format("Pass {} uses image {} in two layouts", pass.name, _images[use.image].name));
+            }
+
+            it->read = it->read || use.read;
+            it->write = it->write || use.write;
+        }
+
+        return merged;
+    }
+
+    // Fills in the barrier a use needs and moves the image's state past it, returns false when none is needed
+    bool transition(const Pass::Use& use, VkImageMemoryBarrier2& barrier){
+        Image& image = _images[use.image];
+        UsageInfo info = usageInfo(use.usage);
+
+        VkAccessFlags2 access = (use.read ? info.readAccess : VK_ACCESS_2_NONE) | (use.write ? info.writeAccess : VK_ACCESS_2_NONE);
+        bool layoutChange = image.layout != info.layout;
+
+        if(layoutChange || use.write){
+            // Writes and layout transitions wait for every earlier access, only earlier writes need flushing
+            VkPipelineStageFlags2 srcStages = image.writeStage | image.readStages;
+            VkAccessFlags2 srcAccess = image.writeAccess;
+
+            // The first use of aliased memory also waits for the images that had it before, in this frame or the last
+            for(uint32_t alias: image.aliases){
+                srcStages |= _images[alias].writeStage | _images[alias].readStages;
+                srcAccess |= _images[alias].writeAccess;
+            }
+            image.aliases.clear();
+
+            if(!layoutChange && srcStages == VK_PIPELINE_STAGE_2_NONE){
+                image.writeStage = info.stages;
+                image.writeAccess = info.writeAccess;
+                image.visibleStages = info.stages;
+                image.visibleAccess = access;
+                return false;
+            }
+
+            VkImageLayout oldLayout = use.read ? image.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+            barrier = imageBarrier(image, layoutChange ? oldLayout : image.layout, info.layout);
+            barrier.srcStageMask = srcStages;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstStageMask = info.stages;
+            barrier.dstAccessMask = access;
+
+            image.layout = info.layout;
+            image.writeStage = info.stages;
+            image.writeAccess = use.write ? info.writeAccess : VK_ACCESS_2_NONE;
+            image.readStages = use.write ? VK_PIPELINE_STAGE_2_NONE : info.stages;
+            image.visibleStages = info.stages;
+            image.visibleAccess = access;
+            return true;
+        }
+
+        // A read in the current layout only waits if the last write isn't visible to it yet
+        image.readStages |= info.stages;
+
+        bool visible = (info.stages & ~image.visibleStages) == 0 && (access & ~image.visibleAccess) == 0;
+        if(image.writeStage == VK_PIPELINE_STAGE_2_NONE || visible)
+            return false;
+
+        barrier = imageBarrier(image, image.layout, image.layout);
+        barrier.srcStageMask = image.writeStage;
+        barrier.srcAccessMask = image.writeAccess;
+        barrier.dstStageMask = info.stages;
+        barrier.dstAccessMask = access;
+
+        image.visibleStages |= info.stages;
+        image.visibleAccess |= access;
+        return true;
+    }
+
+    VkImageMemoryBarrier2 imageBarrier(const Image& image, VkImageLayout oldLayout, VkImageLayout newLayout){
+        VkImageMemoryBarrier2 barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        barrier.oldLayout = oldLayout;
+        barrier.newLayout = newLayout;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = image.image;
+        barrier.subresourceRange = Initializers::imageSubresourceRange(image.aspect);
+
+        return barrier;
+    }
+
+    void recordBarriers(VkCommandBuffer command, const std::vector<VkImageMemoryBarrier2>& barriers){
+        if(barriers.empty())
+            return;
+
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+        dependencyInfo.pImageMemoryBarriers = barriers.data();
+
+        vkCmdPipelineBarrier2(command, &dependencyInfo);
+
+        stats.imageBarriers += static_cast<uint32_t>(barriers.size());
+        stats.barrierBatches++;
+    }
+};
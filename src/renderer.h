@@ -6,6 +6,28 @@
 #include "utility.h"
 #include "initializers.h"
 #include "pipelineBuilder.h"
+#include "meshlet.h"
+#include "vertexQuantization.h"
+#include "meshOptimizer.h"
+#include "gltfLoader.h"
+#include "cookedScene.h"
+#include "textureLoader.h"
+#include "virtualTexture.h"
+#include "transferQueue.h"
+#include "gpuTasks.h"
+#include "assetStreamer.h"
+#include "profiler.h"
+#include "renderGraph.h"
+#include "upscaler.h"
+#include "framePacer.h"
+#include "jobSystem.h"
+#include "simulation.h"
+
+// How a frame gets into the swapchain image, see Renderer::choosePresentPath
+enum class PresentPath{
+    Resolve,    // One pass samples the draw image into the swapchain image, ImGui goes on top in the same rendering
+    Blit,       // Copy, then ImGui loads the swapchain image again
+};
 
 class Renderer{
 public:
@@ -25,6 +47,12 @@ public:
     VkQueue _graphicsQueue;
     uint32_t _graphicsQueueFamily;
 
+    VkQueue _transferQueue;
+    uint32_t _transferQueueFamily;
+
+    VkQueue _computeQueue;
+    uint32_t _computeQueueFamily;
+
     FrameData _frames[FRAME_OVERLAP];
     uint32_t _frameNumber;
 
@@ -34,9 +62,27 @@ public:
     std::vector<VkImage> _swapchainImages;
     std::vector<VkImageView> _swapchainImageViews;
 
-    AllocatedImage _drawImage, _depthImage;
+    // Sized for the largest swapchain so far plus headroom, frames render into the _drawExtent corner of it.
+    // The depth buffer is a transient of the render graph with the same size.
+    AllocatedImage _drawImage;
     VkExtent2D _drawExtent;
 
+    // A 32 bit draw image, and attachments nothing reads later in the frame aren't written back to memory.
+    // Switching rebuilds the draw image and the pipelines, see changeDrawFormat.
+    bool _bandwidthSaving{false};
+    bool _drawFormatChanged{false};
+    VkFormat _compactDrawFormat;
+
+    // Chosen every frame, the blit is only forced to compare against
+    PresentPath _presentPath{PresentPath::Blit};
+    bool _forceBlit{false};
+    bool _swapchainStorage{false};      // The surface and its format allowed storage usage
+
+    VkPipeline _resolvePipeline;
+    VkPipelineLayout _resolvePipelineLayout;
+    VkDescriptorSetLayout _resolveSetLayout;
+    VkSampler _resolveSampler;
+
     VkPipeline _backgroundShaderPipeline;
     VkPipelineLayout _backgroundShaderPipelineLayout;
     VkDescriptorSet _drawImageDescriptors;
@@ -45,19 +91,92 @@ public:
     std::vector<ComputeEffect> _backgroundEffects;
     int _currentBackground{0};
 
+    // The async background renders into one of these on the compute queue, see drawBackgroundAsync
+    bool _asyncBackground{false};
+    AllocatedImage _backgroundImages[FRAME_OVERLAP];
+    VkDescriptorSet _backgroundImageDescriptors[FRAME_OVERLAP];
+    VkSemaphore _computeTimeline;
+    GpuProfiler _computeProfiler;
+    GpuTimingStats _backgroundOverlap;     // GPU time the background shared with the previous frame's graphics work
+    TimestampCalibration _timestampCalibration;     // Without it the overlap isn't measured
+
     std::vector<Mesh*> _meshes;
 
-    VkFence _immediateFence;
-    VkCommandBuffer _immediateCommandBuffer;
-    VkCommandPool _immediateCommandPool;
-    
+    bool _meshShaderSupported{false};
+    bool _storageWithoutFormat{false};      // Otherwise storage writes only go to RGBA16F, see storageShader
+    bool _useMeshShading{false};
+    PFN_vkCmdDrawMeshTasksEXT _vkCmdDrawMeshTasks{nullptr};
+
+    GpuProfiler _profiler;
+    RenderGraph _renderGraph;
+
+    // Worker 0 is the render thread, asset decoding, mesh setup and mesh edits run as jobs
+    JobSystem _jobs;
+
+    // Geometry draws are split into batches recorded into secondary command buffers on the job system
+    bool _parallelRecording{true};
+    RecordingStats _recordingStats[3];      // 0 is recorded inline, 1 in parallel, 2 with the static meshes from their cache
+    uint32_t _recordingPath{0};             // Of the last frame, too few draws are recorded inline either way
+
+    // Meshes that draw the same every frame are recorded once per frame in flight, see staticGeometry
+    bool _cacheStaticGeometry{true};
+    StaticGeometryStats _staticGeometryStats;
+
+    // Frames render at _dynamicResolution's scale of the swapchain, the upscaler brings them back to full size
+    DynamicResolution _dynamicResolution;
+    Upscaler _upscaler;
+    bool _useUpscaler{true};        // Otherwise a linear blit, for comparison
+    uint64_t _frameTimeSamples{0};  // Of FRAME_SCOPE, the last one the controller saw
+
+    // Every upload goes through here, the frame's submit waits for _transferWaitValue
+    TransferQueue _transfer;
+    uint64_t _transferWaitValue{0};
+
+    // Resumes coroutines waiting on transfers once a frame, see gpuTasks.h
+    GpuScheduler _gpu;
+
+    AssetStreamer _streamer;
+
+    TextureLoader _textureLoader;
+    std::vector<std::string> _texturePaths;
+    std::vector<AllocatedImage> _textures;
+    VkSampler _defaultSampler;
+
+    VirtualTexture _virtualTexture;
+    std::string _virtualTexturePath;
+
     bool frameBufferResized;
 
+    // Switching the present mode recreates the swapchain, it falls back to FIFO when the surface lacks the requested one
+    VkPresentModeKHR _presentMode{VK_PRESENT_MODE_MAILBOX_KHR};
+    VkPresentModeKHR _swapchainPresentMode;
+    std::vector<VkPresentModeKHR> _availablePresentModes;
+
+    FramePacer _pacer;
+    double _lastCpuMs{0.0};     // From input to the present call, of the last drawn frame
+    glm::ivec2 _windowPos{0, 0};        // Where the pacer's refresh rate was last looked up
+
+    // Frames that would come out the same as the last one aren't drawn, the loop blocks on events instead
+    bool _skipIdleFrames{true};
+    bool _idle{false};
+    bool _inputEvents{false};           // Keys since the last frame, meshes may react to them
+    uint64_t _frameSignature{0};
+    uint32_t _unchangedFrames{0};       // Drawn in a row from the same signature
+    IdleStats _idleStats;
+    ResizeStats _resizeStats;
+
+    // Meshes are animated apart from drawing, either on the render thread or on a thread of their own
+    Simulation _simulation;
+    uint64_t _snapshotHash{0};
+    bool _snapshotChanged{false};       // Since frameUnchanged last looked
+
     glm::mat4 _view, _proj;
     float _fov{45.f};
     int _useOrtho{0};
 
     void init(){
+        _jobs.setup();
+
         setupWindow();
         setupVulkan();
         setupSwapchain();
@@ -65,7 +184,10 @@ public:
         setupSyncStructures();
         setupDescriptors();
         setupViewAndProjMatrices();
+        setupVirtualTexture();
+        setupTextures();    // Before the meshes, cooked scenes bring textures of their own
         setupPipeline();
+        setupSimulation();
         // setupDefaultRectangleData();
         setupImgui();
 
@@ -81,13 +203,28 @@ public:
         while(!glfwWindowShouldClose(_window)){
             // fmt::println("in loop");
 
+            // Nothing to draw until an event arrives, the timeout picks up work that finishes without one
+            if(_idle){
+                glfwWaitEventsTimeout(IDLE_WAIT_SECONDS);
+            } else {
+                if(_pacer.lowLatency){
+                    paceFrameStart();
+                }
+                glfwPollEvents();
+            }
+            _pacer.inputPolled();
+
             auto frameStartTime = std::chrono::high_resolution_clock::now();
-            glfwPollEvents();
 
             if(frameBufferResized) {
                 frameBufferResized = false;
                 recreateSwapChain();
             }
+
+            if(_drawFormatChanged){
+                _drawFormatChanged = false;
+                changeDrawFormat();
+            }
             // fmt::println("After checking framebuffer");
 
             ImGui_ImplGlfw_NewFrame();
@@ -95,16 +232,29 @@ public:
             ImGui::NewFrame();
             // fmt::println("About to render imgui");
             renderImgui();
+            applySimulation();
+
+            _idle = _skipIdleFrames && frameUnchanged();
+            _simulation.setRenderIdle(_idle);
+            if(_idle){
+                _idleStats.skippedFrames++;
+                continue;
+            }
 
             // fmt::println("REaching Draw");
 
             draw();
 
+            _unchangedFrames++;
+            _idleStats.drawnFrames++;
+
             auto frameEndTime = std::chrono::high_resolution_clock::now();
             std::chrono::duration<double, std::milli> frameDuration = frameEndTime - frameStartTime;
 
             totalFrameTime += frameDuration.count();
             frameCount++;
+
+            _lastCpuMs = frameDuration.count();
         }
 
         auto endTime = std::chrono::high_resolution_clock::now();
@@ -116,16 +266,59 @@ public:
         fmt::println("Total frames: {}", frameCount);
         fmt::println("Average frame time: {}ms", avgFrameTime*1000.0f);
         fmt::println("Average FPS: {}", fps);
+
+        _profiler.printStats();
+        _computeProfiler.printStats();
+        _jobs.printStats();
+        _gpu.printStats();
+        _simulation.printStats();
+
+        const char* recordingNames[3] = {"inline", "in parallel", "with cached static meshes"};
+        for(uint32_t i = 0; i < 3; i++){
+            if(_recordingStats[i].frames > 0){
+                fmt::println("Geometry recorded {}: {:.3f}ms on average over {} frames", recordingNames[i], _recordingStats[i].averageMs(), _recordingStats[i].frames);
+            }
+        }
+        if(_staticGeometryStats.recordings > 0){
+            fmt::println("Static meshes: recorded {} times in {:.3f}ms on average, reused for {} frames", _staticGeometryStats.recordings,
+                _staticGeometryStats.recordMs / _staticGeometryStats.recordings, _staticGeometryStats.reusedFrames);
+        }
+        _renderGraph.printStats();
+        printGeometryThroughput();
+        _dynamicResolution.printStats();
+
+        fmt::println("Idle frames: {} drawn, {} skipped", _idleStats.drawnFrames, _idleStats.skippedFrames);
+        fmt::println("Resizing: {} swapchain recreations, draw targets grown {} times to {}x{}", _resizeStats.swapchainRecreations, _resizeStats.drawTargetGrowths,
+            _drawImage.imageExtent.width, _drawImage.imageExtent.height);
+        _pacer.printStats(string_VkPresentModeKHR(_swapchainPresentMode));
+
+        fmt::println("Estimated traffic per frame at {}x{}: {:.2f}MB with {}, {:.2f}MB bandwidth saving with {}", _drawExtent.width, _drawExtent.height,
+            estimateFrameMegabytes(false), string_VkFormat(FULL_DRAW_FORMAT), estimateFrameMegabytes(true), string_VkFormat(_compactDrawFormat));
+
+        if(_backgroundOverlap.samples > 0){
+            fmt::println("Async background: {}ms of {}ms overlapped with the previous frame on average", _backgroundOverlap.averageMs(), _computeProfiler.stats[BACKGROUND_SCOPE].averageMs());
+        }
     }
 
     void cleanup(){
+        _simulation.cleanup();
         vkDeviceWaitIdle(_device);
+        _pacer.cleanup();
 
-        getCurrentFrame().deletionQueue.flush();
+        for (size_t i = 0; i < FRAME_OVERLAP; i++)
+        {
+            _frames[i].deletionQueue.flush();
+        }
 
         for (size_t i = 0; i < FRAME_OVERLAP; i++)
         {
             vkDestroyCommandPool(_device, _frames[i].commandPool, nullptr);
+            vkDestroyCommandPool(_device, _frames[i].computeCommandPool, nullptr);
+
+            for(SecondaryCommandPool& secondaryPool: _frames[i].secondaryPools){
+                vkDestroyCommandPool(_device, secondaryPool.pool, nullptr);
+            }
+            vkDestroyCommandPool(_device, _frames[i].staticGeometry.pool, nullptr);
 
             vkDestroyFence(_device, _frames[i].renderFence, nullptr);
             vkDestroySemaphore(_device, _frames[i].renderSemaphore, nullptr);
@@ -144,6 +337,8 @@ public:
 
         _mainDeletionQueue.flush();
 
+        _jobs.cleanup();
+
         vkDestroySurfaceKHR(_instance, _surface, nullptr);
         vkDestroyDevice(_device, nullptr);
         destroyDebugUtilsMessengerEXT(_instance, _debugMessenger, nullptr);
@@ -156,11 +351,45 @@ public:
         _meshes.push_back(newMesh);
     }
 
+    // Loaded together in init, so decoding runs in parallel
+    void addTexture(const std::string& path){
+        _texturePaths.push_back(path);
+    }
+
+    // Streamed page by page, meshes sample it through _virtualTexture (see VirtualTexturedPlane)
+    void setVirtualTexture(const std::string& path){
+        _virtualTexturePath = path;
+    }
+
 private:
+    // GPU timing scopes the async background is measured with
+    static constexpr const char* FRAME_SCOPE = "graphics frame";
+    static constexpr const char* BACKGROUND_SCOPE = "background (async compute)";
+    static constexpr const char* UPSCALE_SCOPE = "upscale";
+    static constexpr const char* PRESENT_SCOPES[] = {"present (resolve)", "present (blit)"};   // By PresentPath
+
+    // Drawn frames of the same state before the loop goes idle. Feedback and timings come back FRAME_OVERLAP frames later
+    // and may still change what gets drawn.
+    static const uint32_t IDLE_SETTLE_FRAMES = FRAME_OVERLAP + 1;
+    static constexpr double IDLE_WAIT_SECONDS = 0.25;
+
+    static constexpr VkFormat DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+    static constexpr VkFormat FULL_DRAW_FORMAT = VK_FORMAT_R16G16B16A16_SFLOAT;
+
+    // Draw targets grow by this much past what a resize needs, so dragging a window edge only reallocates a few times
+    static constexpr float DRAW_TARGET_GROWTH = 1.5f;
+
     DeletionQueue _mainDeletionQueue;
     DeletionQueue _swapchainDeletionQueue;
     DeletionQueue _descriptorDeletionQueue;
 
+    // Fewer draws than this per batch cost more in secondary command buffer overhead than they save
+    static const size_t MIN_DRAWS_PER_BATCH = 64;
+
+    // Triangle throughput of the two geometry paths, 0 is vertex pulling and 1 is mesh shading
+    uint64_t _trianglesSubmitted[2]{0, 0};
+    uint64_t _geometryFrames[2]{0, 0};
+
     float elapsedTimeMandelbrot = 0.0f; //for Mandelbrot 
     float elapsedTimeJulia = 0.0f; //for Mandelbrot 
 
@@ -169,55 +398,95 @@ private:
         
         VK_CHECK(vkWaitForFences(_device, 1, &getCurrentFrame().renderFence, VK_TRUE, 1000000000));
 
+
         getCurrentFrame().deletionQueue.flush();
         getCurrentFrame().frameDescriptors.clearDescriptors(_device);
 
-        VK_CHECK(vkResetFences(_device, 1, &getCurrentFrame().renderFence));
+        FrameConstants* frameConstants = (FrameConstants*)getCurrentFrame().frameConstantsBuffer.allocation->GetMappedData();
+        frameConstants->viewProj = _proj * _view;
 
+        // Nothing is submitted when the swapchain is out of date, the fence stays signaled for the retry
         uint32_t swapchainImageIndex;
-        if(vkAcquireNextImageKHR(_device, _swapchain, 1000000000, getCurrentFrame().swapchainSemaphore, nullptr, &swapchainImageIndex) == VK_ERROR_OUT_OF_DATE_KHR){
+        VkResult acquireResult;
+        {
+            auto swapchainLock = _pacer.lockSwapchain();
+            acquireResult = vkAcquireNextImageKHR(_device, _swapchain, 1000000000, getCurrentFrame().swapchainSemaphore, nullptr, &swapchainImageIndex);
+        }
+        if(acquireResult == VK_ERROR_OUT_OF_DATE_KHR){
             frameBufferResized = true;
             return;
         }
+        if(acquireResult == VK_SUBOPTIMAL_KHR){
+            frameBufferResized = true;
+        }
+
+        VK_CHECK(vkResetFences(_device, 1, &getCurrentFrame().renderFence));
 
         VkCommandBuffer command = getCurrentFrame().mainCommandBuffer;
 
         VK_CHECK(vkResetCommandBuffer(command, 0));
 
-        _drawExtent.width = _drawImage.imageExtent.width;
-        _drawExtent.height = _drawImage.imageExtent.height;
+        for(SecondaryCommandPool& secondaryPool: getCurrentFrame().secondaryPools){
+            if(secondaryPool.used > 0){
+                VK_CHECK(vkResetCommandPool(_device, secondaryPool.pool, 0));
+                secondaryPool.used = 0;
+            }
+        }
+
+        updateDrawExtent();
+        _presentPath = choosePresentPath();
+
+        // Submitted ahead of the graphics work, so it runs alongside whatever is left of the previous frame
+        bool asyncBackground = _asyncBackground;
+        if(asyncBackground){
+            drawBackgroundAsync();
+        }
 
         VkCommandBufferBeginInfo beginInfo = Initializers::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
         VK_CHECK(vkBeginCommandBuffer(command, &beginInfo));
 
-        Utility::transitionImage(command, _drawImage.image, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL);
+        _profiler.beginFrame(_device, command, _frameNumber);
+        _profiler.beginScope(command, FRAME_SCOPE);
 
-        drawBackground(command);
+        // Meshes whose uploads landed become resident here, before anything draws them
+        _transferWaitValue = _gpu.poll(command);
+        _streamer.update();
 
-        Utility::transitionImage(command, _drawImage.image,VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        Utility::transitionImage(command, _depthImage.image,VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+        _virtualTexture.beginFrame(command, _frameNumber % FRAME_OVERLAP);
 
-        drawGeometry(command);
+        recordFrameGraph(asyncBackground, swapchainImageIndex);
+        _renderGraph.execute(command, getCurrentFrame().deletionQueue);
 
-        Utility::transitionImage(command, _drawImage.image, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
-        Utility::transitionImage(command, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        _profiler.endScope(command, FRAME_SCOPE);
 
-        Utility::copyImageToImage(command, _drawImage.image, _swapchainImages[swapchainImageIndex], _drawExtent, _swapchainExtent);
+        VK_CHECK(vkEndCommandBuffer(command));
 
-        Utility::transitionImage(command, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+        VkCommandBufferSubmitInfo commandInfo = Initializers::commandBufferSubmitInfo(command);
 
-        drawImgui(command, _swapchainImageViews[swapchainImageIndex]);
+        VkSemaphoreSubmitInfo waitInfos[3];
+        uint32_t waitCount = 0;
 
-        Utility::transitionImage(command, _swapchainImages[swapchainImageIndex], VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+        waitInfos[waitCount++] = Initializers::semaphoreSubmitInfo(swapchainWaitStage(_presentPath), getCurrentFrame().swapchainSemaphore);
 
-        VK_CHECK(vkEndCommandBuffer(command));
+        // Orders the queue family acquires after their releases, and this frame after the buffer edits it reads
+        if(_transferWaitValue > 0){
+            waitInfos[waitCount] = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _transfer.timeline());
+            waitInfos[waitCount++].value = _transferWaitValue;
+        }
 
-        VkCommandBufferSubmitInfo commandInfo = Initializers::commandBufferSubmitInfo(command);
+        // Only the background copy waits, everything recorded before it can start right away
+        if(asyncBackground){
+            waitInfos[waitCount] = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_BLIT_BIT, _computeTimeline);
+            waitInfos[waitCount++].value = _frameNumber + 1;
+        }
 
-        VkSemaphoreSubmitInfo waitInfo = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, getCurrentFrame().swapchainSemaphore);
-        VkSemaphoreSubmitInfo signalInfo = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, getCurrentFrame().renderSemaphore);
+        VkSemaphoreSubmitInfo signalInfos[2];
+        signalInfos[0] = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_GRAPHICS_BIT, getCurrentFrame().renderSemaphore);
+        signalInfos[1] = _pacer.completionSignal();
 
-        VkSubmitInfo2 submitInfo = Initializers::submitInfo(&commandInfo, &signalInfo, &waitInfo);
+        VkSubmitInfo2 submitInfo = Initializers::submitInfo(&commandInfo, signalInfos, waitInfos);
+        submitInfo.waitSemaphoreInfoCount = waitCount;
+        submitInfo.signalSemaphoreInfoCount = 2;
 
         VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submitInfo, getCurrentFrame().renderFence));
 
@@ -231,34 +500,64 @@ private:
         presentInfo.pWaitSemaphores = &getCurrentFrame().renderSemaphore;
 
         presentInfo.pImageIndices = &swapchainImageIndex;
-        if(vkQueuePresentKHR(_graphicsQueue, &presentInfo) == VK_ERROR_OUT_OF_DATE_KHR){
+
+        VkResult presentResult;
+        {
+            auto swapchainLock = _pacer.lockSwapchain();
+            _pacer.present(presentInfo);
+            presentResult = vkQueuePresentKHR(_graphicsQueue, &presentInfo);
+        }
+        if(presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR){
             frameBufferResized = true;
         }
 
         _frameNumber++;
     }
 
-    void drawGeometry(VkCommandBuffer command){
+    void drawGeometry(VkCommandBuffer command, VkImageView depthView, VkAttachmentStoreOp depthStoreOp){
         
         // Check if buffer needs to be updated, instead of in keyUpdate
-        for(auto& mesh: _meshes){
+        std::vector<MeshEdit> edits = prepareMeshEdits();
+
+        for(size_t i = 0; i < _meshes.size(); i++){
+            Mesh* mesh = _meshes[i];
+            if(!mesh->resident)
+                continue;
+
             if(mesh->updateIndexBuffer){
-                size_t s = mesh->indices.size() * sizeof(uint32_t);
-                copyBuffer(mesh->indexBuffer.buffer, mesh->indices.data(), s);
+                std::vector<char>& indexData = edits[i].indexData;
+                replaceBuffer(command, mesh->indexBuffer, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexData.data(), indexData.size());
 
                 mesh->updateIndexBuffer = false;
             }
 
+            if(!edits[i].meshletData.empty()){
+                std::vector<char>& meshletData = edits[i].meshletData;
+                replaceBuffer(command, mesh->meshletBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, meshletData.data(), meshletData.size());
+                mesh->meshletBufferAddress = bufferAddress(mesh->meshletBuffer.buffer);
+            }
+
             if(mesh->updateVertexBuffer){
-                size_t s = mesh->vertices.size() * sizeof(Vertex);
-                copyBuffer(mesh->vertexBuffer.buffer, mesh->vertices.data(), s);
+                if(mesh->vertexFormat == VERTEX_FORMAT_COMPACT){
+                    VertexQuantization::EncodedVertices& encoded = edits[i].encoded;
+                    mesh->positionMin = encoded.positionMin;
+                    mesh->positionExtent = encoded.positionExtent;
+
+                    replaceBuffer(command, mesh->vertexBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, encoded.vertices.data(), encoded.vertices.size() * sizeof(CompactVertex));
+                } else {
+                    size_t s = mesh->vertices.size() * sizeof(Vertex);
+                    replaceBuffer(command, mesh->vertexBuffer, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, mesh->vertices.data(), s);
+                }
+
+                mesh->vertexBufferAddress = bufferAddress(mesh->vertexBuffer.buffer);
 
                 mesh->updateVertexBuffer = false;
             }
         }
 
         VkRenderingAttachmentInfo colorAttachment = Initializers::attachmentInfo(_drawImage.imageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
-        VkRenderingAttachmentInfo depthAttachment = Initializers::depthAttachmentInfo(_depthImage.imageView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+        VkRenderingAttachmentInfo depthAttachment = Initializers::depthAttachmentInfo(depthView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+        depthAttachment.storeOp = depthStoreOp;
 
         VkRenderingInfo renderInfo = Initializers::renderingInfo(_drawExtent, &colorAttachment, &depthAttachment);
 
@@ -276,17 +575,236 @@ private:
         scissor.extent.width = _drawExtent.width;
         scissor.extent.height = _drawExtent.height;
 
-        vkCmdBeginRendering(command, &renderInfo);  
-        vkCmdSetViewport(command, 0, 1, &viewport);
-        vkCmdSetScissor(command, 0, 1, &scissor);
+        uint32_t path = _useMeshShading ? 1 : 0;
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        FrameData& frame = getCurrentFrame();
 
+        // Updates allocate from the frame's descriptor pool, which only this thread may use
+        std::vector<Mesh*> drawn, cached;
+        size_t drawCount = 0;
         for(auto& mesh: _meshes){
-            mesh->update(_device, _allocator, getCurrentFrame().frameDescriptors);
+            if(!mesh->resident)
+                continue;
 
-            mesh->draw(command, _proj * _view);
+            mesh->frameConstantsAddress = frame.frameConstantsAddress;
+            _trianglesSubmitted[path] += mesh->indexCount / 3;
+
+            if(_cacheStaticGeometry && mesh->staticDraw()){
+                cached.push_back(mesh);
+                continue;
+            }
+
+            mesh->update(_device, _allocator, frame.frameDescriptors);
+            drawn.push_back(mesh);
+            drawCount += mesh->drawCount();
         }
 
+        // By draws rather than meshes, a single scene with thousands of submeshes is split just the same
+        size_t batchCount = _parallelRecording ? std::min<size_t>(_jobs.threadCount(), drawCount / MIN_DRAWS_PER_BATCH) : 0;
+
+        if(!cached.empty() || batchCount > 1){
+            renderInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+            vkCmdBeginRendering(command, &renderInfo);
+
+            std::vector<VkCommandBuffer> secondaries;
+            if(!cached.empty()){
+                secondaries.push_back(staticGeometry(frame, cached, viewport, scissor));
+            }
+
+            // Nothing can be recorded inline next to secondaries, the rest make one batch at least
+            if(!drawn.empty()){
+                batchCount = std::max<size_t>(batchCount, 1);
+                std::vector<VkCommandBuffer> batches = recordGeometryBatches(drawn, batchCount, viewport, scissor);
+                secondaries.insert(secondaries.end(), batches.begin(), batches.end());
+            } else {
+                batchCount = 0;
+            }
+
+            vkCmdExecuteCommands(command, static_cast<uint32_t>(secondaries.size()), secondaries.data());
+        } else {
+            batchCount = 0;
+
+            vkCmdBeginRendering(command, &renderInfo);
+            vkCmdSetViewport(command, 0, 1, &viewport);
+            vkCmdSetScissor(command, 0, 1, &scissor);
+
+            glm::mat4 viewProj = _proj * _view;
+            for(Mesh* mesh: drawn){
+                mesh->draw(command, viewProj);
+            }
+        }
+
+        _geometryFrames[path]++;
+
         vkCmdEndRendering(command);
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        _recordingPath = !cached.empty() ? 2 : batchCount > 0 ? 1 : 0;
+
+        RecordingStats& recording = _recordingStats[_recordingPath];
+        recording.lastMs = elapsed.count();
+        recording.totalMs += recording.lastMs;
+        recording.frames++;
+        recording.lastBatches = static_cast<uint32_t>(batchCount);
+    }
+
+    // For a rendering begun for secondaries in drawGeometry.
+    // Dynamic state doesn't carry over into secondaries, every one sets its own viewport and scissor.
+    void beginGeometrySecondary(VkCommandBuffer secondary, VkCommandBufferUsageFlags flags, const VkViewport& viewport, const VkRect2D& scissor){
+        VkFormat colorFormat = _drawImage.imageFormat;
+
+        VkCommandBufferInheritanceRenderingInfo renderingInheritance{};
+        renderingInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+        renderingInheritance.colorAttachmentCount = 1;
+        renderingInheritance.pColorAttachmentFormats = &colorFormat;
+        renderingInheritance.depthAttachmentFormat = DEPTH_FORMAT;
+        renderingInheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkCommandBufferInheritanceInfo inheritance{};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance.pNext = &renderingInheritance;
+
+        VkCommandBufferBeginInfo beginInfo = Initializers::commandBufferBeginInfo(flags | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+        beginInfo.pInheritanceInfo = &inheritance;
+
+        VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+        vkCmdSetViewport(secondary, 0, 1, &viewport);
+        vkCmdSetScissor(secondary, 0, 1, &scissor);
+    }
+
+    // The draws are split into batchCount even ranges, see splitDraws, each recorded by a job into a secondary from the
+    // pool of the thread that runs it. Returned in draw order.
+    std::vector<VkCommandBuffer> recordGeometryBatches(const std::vector<Mesh*>& drawn, size_t batchCount, const VkViewport& viewport, const VkRect2D& scissor){
+        glm::mat4 viewProj = _proj * _view;
+        FrameData& frame = getCurrentFrame();
+
+        std::vector<std::vector<DrawRange>> ranges = splitDraws(drawn, batchCount);
+        std::vector<VkCommandBuffer> batches(batchCount);
+
+        _jobs.parallelFor(batchCount, 1, [&](size_t begin, size_t end){
+            for(size_t batch = begin; batch < end; batch++){
+                VkCommandBuffer secondary = nextSecondary(frame.secondaryPools[JobSystem::workerIndex()]);
+                beginGeometrySecondary(secondary, VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, viewport, scissor);
+
+                for(const DrawRange& range: ranges[batch]){
+                    range.mesh->drawRange(secondary, viewProj, range.first, range.last);
+                }
+
+                VK_CHECK(vkEndCommandBuffer(secondary));
+                batches[batch] = secondary;
+            }
+        });
+
+        return batches;
+    }
+
+    // The frame's cached commands for the static meshes, recorded again only when staticGeometryKey changed since the
+    // last time. Their view projection comes from the frame's FrameConstants, so camera movement doesn't count.
+    // The meshes' update() only runs here, with sets from the cache's own pool that live as long as the commands.
+    VkCommandBuffer staticGeometry(FrameData& frame, const std::vector<Mesh*>& meshes, const VkViewport& viewport, const VkRect2D& scissor){
+        StaticGeometryCache& cache = frame.staticGeometry;
+
+        uint64_t key = staticGeometryKey(meshes);
+        if(key == cache.key){
+            _staticGeometryStats.reusedFrames++;
+            return cache.commands;
+        }
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        // Not ONE_TIME_SUBMIT, the same commands are submitted every time this frame comes around
+        VK_CHECK(vkResetCommandPool(_device, cache.pool, 0));
+        cache.descriptors.clearDescriptors(_device);
+
+        if(cache.commands == VK_NULL_HANDLE){
+            VkCommandBufferAllocateInfo allocInfo = Initializers::commandBufferAllocateInfo(cache.pool, 1);
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &cache.commands));
+        }
+
+        for(Mesh* mesh: meshes){
+            mesh->update(_device, _allocator, cache.descriptors);
+        }
+
+        beginGeometrySecondary(cache.commands, 0, viewport, scissor);
+
+        glm::mat4 viewProj = _proj * _view;
+        for(Mesh* mesh: meshes){
+            mesh->draw(cache.commands, viewProj);
+        }
+
+        VK_CHECK(vkEndCommandBuffer(cache.commands));
+
+        cache.key = key;
+        cache.meshCount = static_cast<uint32_t>(meshes.size());
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        _staticGeometryStats.recordings++;
+        _staticGeometryStats.recordMs += elapsed.count();
+
+        return cache.commands;
+    }
+
+    // Everything the cached commands depend on: which meshes they draw, the buffers, pipelines and settings those use,
+    // and the rendering they are recorded for
+    uint64_t staticGeometryKey(const std::vector<Mesh*>& meshes){
+        uint64_t hash = Utility::FNV_OFFSET;
+        auto add = [&](const auto& value){
+            hash = Utility::hashBytes(hash, &value, sizeof(value));
+        };
+
+        add(_drawExtent);
+        add(_drawImage.imageFormat);
+        add(_useMeshShading);
+
+        for(Mesh* mesh: meshes){
+            add(mesh);
+            add(mesh->drawState());
+            add(mesh->pipeline);
+            add(mesh->indexBuffer.buffer);
+            add(mesh->indexCount);
+            add(mesh->indexType);
+            add(mesh->vertexBufferAddress);
+            add(mesh->vertexFormat);
+            add(mesh->positionMin);
+            add(mesh->positionExtent);
+            add(mesh->coneCulling);
+
+            if(_useMeshShading){
+                add(mesh->meshletPipeline);
+                add(mesh->meshletBufferAddress);
+            }
+        }
+
+        return hash;
+    }
+
+    VkCommandBuffer nextSecondary(SecondaryCommandPool& secondaryPool){
+        if(secondaryPool.used == secondaryPool.buffers.size()){
+            VkCommandBufferAllocateInfo allocInfo = Initializers::commandBufferAllocateInfo(secondaryPool.pool, 1);
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+
+            VkCommandBuffer buffer;
+            VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &buffer));
+            secondaryPool.buffers.push_back(buffer);
+        }
+
+        return secondaryPool.buffers[secondaryPool.used++];
+    }
+
+    // Runs after drawGeometry so the meshes' descriptor sets for this frame exist, the result is read FRAME_OVERLAP frames later
+    void drawVirtualTextureFeedback(VkCommandBuffer command, VkImageView feedbackView, VkImageView depthView, VkAttachmentStoreOp depthStoreOp){
+        _virtualTexture.beginFeedback(command, feedbackView, depthView, depthStoreOp);
+
+        for(auto& mesh: _meshes){
+            if(mesh->resident){
+                mesh->drawFeedback(command, _proj * _view);
+            }
+        }
+
+        _virtualTexture.endFeedback(command);
     }
 
     void drawImgui(VkCommandBuffer command, VkImageView targetImageView){
@@ -300,30 +818,571 @@ private:
         vkCmdEndRendering(command);
     }
 
-    void drawBackground(VkCommandBuffer command){
+    // Every pixel of the swapchain image comes from the source, so nothing is loaded, and ImGui blends on top before anything is stored
+    void drawResolveAndImgui(VkCommandBuffer command, VkImageView sourceView, VkExtent2D sourceExtent, VkImageView targetImageView){
+        VkRenderingAttachmentInfo colorAttachment = Initializers::attachmentInfo(targetImageView, nullptr, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+
+        VkRenderingInfo renderInfo = Initializers::renderingInfo(_swapchainExtent, &colorAttachment, nullptr);
+
+        VkDescriptorSet set = getCurrentFrame().frameDescriptors.allocate(_device, _resolveSetLayout);
+
+        DescriptorWriter writer;
+        writer.writeImage(0, sourceView, _resolveSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.updateSet(_device, set);
+
+        ResolvePushConstants constants{};
+        constants.inputScale = glm::vec2(float(sourceExtent.width) / _swapchainExtent.width, float(sourceExtent.height) / _swapchainExtent.height);
+        constants.inputLimit = glm::vec2(sourceExtent.width - 0.5f, sourceExtent.height - 0.5f);
+
+        VkViewport viewport{};
+        viewport.width = _swapchainExtent.width;
+        viewport.height = _swapchainExtent.height;
+        viewport.minDepth = 0.f;
+        viewport.maxDepth = 1.f;
+
+        VkRect2D scissor{};
+        scissor.extent = _swapchainExtent;
+
+        vkCmdBeginRendering(command, &renderInfo);
+
+        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, _resolvePipeline);
+        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, _resolvePipelineLayout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(command, _resolvePipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(ResolvePushConstants), &constants);
+        vkCmdSetViewport(command, 0, 1, &viewport);
+        vkCmdSetScissor(command, 0, 1, &scissor);
+        vkCmdDraw(command, 3, 1, 0, 0);
+
+        ImGui_ImplVulkan_RenderDrawData(ImGui::GetDrawData(), command);
+
+        vkCmdEndRendering(command);
+    }
+
+    void drawBackground(VkCommandBuffer command, VkDescriptorSet imageDescriptors){
         ComputeEffect& effect = _backgroundEffects[_currentBackground];
 
         vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_COMPUTE, effect.pipeline);
-        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_COMPUTE, _backgroundShaderPipelineLayout, 0, 1, &_drawImageDescriptors, 0, nullptr);
+        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_COMPUTE, _backgroundShaderPipelineLayout, 0, 1, &imageDescriptors, 0, nullptr);
+
+        effect.data.extent = glm::ivec2(_drawExtent.width, _drawExtent.height);
 
         vkCmdPushConstants(command, _backgroundShaderPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(ComputeShaderPushConstants), &effect.data);
         vkCmdDispatch(command, std::ceil(_drawExtent.width/16.0), std::ceil(_drawExtent.height/16.0), 1);
     }
 
+    // The background on the compute queue, into an image of its own so it doesn't wait for the previous frame to be
+    // done with the draw image. Signals _frameNumber + 1 on _computeTimeline once written.
+    // The frame two back was the last to read this image, draw() has already waited for its fence.
+    void drawBackgroundAsync(){
+        VkCommandBuffer command = getCurrentFrame().computeCommandBuffer;
+        AllocatedImage& background = _backgroundImages[_frameNumber % FRAME_OVERLAP];
+
+        VK_CHECK(vkResetCommandBuffer(command, 0));
+
+        VkCommandBufferBeginInfo beginInfo = Initializers::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        VK_CHECK(vkBeginCommandBuffer(command, &beginInfo));
+
+        if(_computeProfiler.beginFrame(_device, command, _frameNumber)){
+            measureBackgroundOverlap();
+        }
+
+        _computeProfiler.beginScope(command, BACKGROUND_SCOPE);
+
+        // Every pixel gets written, the old contents can go
+        Utility::transitionMips(command, background.image, 0, 1, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_GENERAL,
+            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT);
+
+        drawBackground(command, _backgroundImageDescriptors[_frameNumber % FRAME_OVERLAP]);
+
+        _computeProfiler.endScope(command, BACKGROUND_SCOPE);
+
+        VK_CHECK(vkEndCommandBuffer(command));
+
+        VkCommandBufferSubmitInfo commandInfo = Initializers::commandBufferSubmitInfo(command);
+        VkSemaphoreSubmitInfo signalInfo = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, _computeTimeline);
+        signalInfo.value = _frameNumber + 1;
+
+        VkSubmitInfo2 submit = Initializers::submitInfo(&commandInfo, &signalInfo, nullptr);
+        VK_CHECK(vkQueueSubmit2(_computeQueue, 1, &submit, VK_NULL_HANDLE));
+    }
+
+    // Low latency mode, before input is polled. The frame submitted last has to be complete first, the pacer then
+    // sleeps away what the refresh interval of the window's monitor leaves over.
+    void paceFrameStart(){
+        int x, y;
+        glfwGetWindowPos(_window, &x, &y);
+        if(x != _windowPos.x || y != _windowPos.y){
+            _windowPos = glm::ivec2(x, y);
+            _pacer.setRefreshRate(windowRefreshRate());
+        }
+
+        _pacer.paceFrameStart(_lastCpuMs, _profiler.lastMs(FRAME_SCOPE));
+    }
+
+    // A host clock the device can calibrate against, one whose tick rate is known here
+    TimestampCalibration chooseTimestampCalibration(bool supported){
+        TimestampCalibration calibration{};
+        if(!supported)
+            return calibration;
+
+        auto getTimeDomains = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr(_instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT");
+        auto getTimestamps = (PFN_vkGetCalibratedTimestampsEXT)vkGetDeviceProcAddr(_device, "vkGetCalibratedTimestampsEXT");
+        if(!getTimeDomains || !getTimestamps)
+            return calibration;
+
+        uint32_t count = 0;
+        getTimeDomains(_physicalDevice, &count, nullptr);
+        std::vector<VkTimeDomainEXT> domains(count);
+        getTimeDomains(_physicalDevice, &count, domains.data());
+
+        auto has = [&](VkTimeDomainEXT domain){
+            return std::find(domains.begin(), domains.end(), domain) != domains.end();
+        };
+
+        if(!has(VK_TIME_DOMAIN_DEVICE_EXT))
+            return calibration;
+
+        // GLFW's timer is the performance counter on Windows, so its frequency is that counter's
+        if(has(VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_EXT)){
+            calibration.hostDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_RAW_EXT;
+        } else if(has(VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT)){
+            calibration.hostDomain = VK_TIME_DOMAIN_CLOCK_MONOTONIC_EXT;
+        } else if(has(VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT)){
+            calibration.hostDomain = VK_TIME_DOMAIN_QUERY_PERFORMANCE_COUNTER_EXT;
+            calibration.hostTicksPerMs = double(glfwGetTimerFrequency()) / 1000.0;
+        } else {
+            return calibration;
+        }
+
+        calibration.getCalibratedTimestamps = getTimestamps;
+        return calibration;
+    }
+
+    // Of the monitor that holds the window's center, fullscreen windows know theirs
+    double windowRefreshRate(){
+        GLFWmonitor* monitor = glfwGetWindowMonitor(_window);
+
+        if(!monitor){
+            int x, y, width, height;
+            glfwGetWindowPos(_window, &x, &y);
+            glfwGetWindowSize(_window, &width, &height);
+            glm::ivec2 center(x + width / 2, y + height / 2);
+
+            int count;
+            GLFWmonitor** monitors = glfwGetMonitors(&count);
+            for(int i = 0; i < count && !monitor; i++){
+                const GLFWvidmode* mode = glfwGetVideoMode(monitors[i]);
+                int monitorX, monitorY;
+                glfwGetMonitorPos(monitors[i], &monitorX, &monitorY);
+
+                if(mode && center.x >= monitorX && center.x < monitorX + mode->width && center.y >= monitorY && center.y < monitorY + mode->height){
+                    monitor = monitors[i];
+                }
+            }
+        }
+
+        const GLFWvidmode* videoMode = glfwGetVideoMode(monitor ? monitor : glfwGetPrimaryMonitor());
+        return videoMode ? videoMode->refreshRate : 0.0;
+    }
+
+    // Once the meshes are set up. Steps on the render thread until the thread is switched on.
+    void setupSimulation(){
+        for(auto& mesh: _meshes){
+            mesh->simulation = &_simulation;
+        }
+
+        _simulation.setup(_meshes);
+    }
+
+    // Hands the meshes their state from the newest snapshot, whichever thread produced it
+    void applySimulation(){
+        const SceneSnapshot* snapshot = _simulation.consume();
+        if(!snapshot)
+            return;
+
+        for(size_t i = 0; i < _meshes.size(); i++){
+            _meshes[i]->applyState(snapshot->meshes[i]);
+        }
+
+        _snapshotChanged |= snapshot->hash != _snapshotHash;
+        _snapshotHash = snapshot->hash;
+    }
+
+    // After renderImgui. True once the same state has been drawn IDLE_SETTLE_FRAMES times in a row and nothing is still
+    // on its way in, the next frame would only repeat what is on screen.
+    bool frameUnchanged(){
+        uint64_t signature = frameSignature();
+
+        bool pending = !_streamer.finished() || _gpu.inFlight() > 0 || _virtualTexture.stats.pendingPages > 0 || _inputEvents || _snapshotChanged || imguiActive();
+        _inputEvents = false;
+        _snapshotChanged = false;
+
+        for(auto& mesh: _meshes){
+            pending |= mesh->updateVertexBuffer || mesh->updateIndexBuffer || mesh->animated();
+        }
+
+        if(pending || signature != _frameSignature){
+            _frameSignature = signature;
+            _unchangedFrames = 0;
+            return false;
+        }
+
+        return _unchangedFrames >= IDLE_SETTLE_FRAMES;
+    }
+
+    // Everything outside the meshes that decides what a frame looks like. ImGui's own output is left out, its windows
+    // show timings of the frames just drawn and would never settle, interaction with it is caught by imguiActive.
+    uint64_t frameSignature(){
+        const ComputeEffect& effect = _backgroundEffects[_currentBackground];
+
+        uint64_t hash = Utility::FNV_OFFSET;
+        hash = Utility::hashBytes(hash, &_view, sizeof(_view));
+        hash = Utility::hashBytes(hash, &_proj, sizeof(_proj));
+        hash = Utility::hashBytes(hash, &_currentBackground, sizeof(_currentBackground));
+        hash = Utility::hashBytes(hash, &effect.data, sizeof(effect.data));
+        hash = Utility::hashBytes(hash, &_drawExtent, sizeof(_drawExtent));
+        hash = Utility::hashBytes(hash, &_swapchainExtent, sizeof(_swapchainExtent));
+        hash = Utility::hashBytes(hash, &_drawImage.imageFormat, sizeof(_drawImage.imageFormat));
+        hash = Utility::hashBytes(hash, &_dynamicResolution.scale, sizeof(_dynamicResolution.scale));
+        hash = Utility::hashBytes(hash, &_upscaler.sharpness, sizeof(_upscaler.sharpness));
+
+        bool toggles[] = {_useMeshShading, _asyncBackground, _bandwidthSaving, _useUpscaler, _forceBlit};
+        hash = Utility::hashBytes(hash, toggles, sizeof(toggles));
+
+        uint32_t resident = 0;
+        for(auto& mesh: _meshes){
+            resident += mesh->resident ? 1 : 0;
+        }
+        hash = Utility::hashBytes(hash, &resident, sizeof(resident));
+
+        return hash;
+    }
+
+    static bool imguiActive(){
+        ImGuiIO& io = ImGui::GetIO();
+
+        if(ImGui::IsAnyItemActive() || io.MouseWheel != 0.f || io.MouseWheelH != 0.f || io.InputQueueCharacters.Size > 0)
+            return true;
+
+        for(bool down: io.MouseDown){
+            if(down)
+                return true;
+        }
+
+        // Hovering changes highlights, but only over ImGui's windows
+        return io.WantCaptureMouse && (io.MouseDelta.x != 0.f || io.MouseDelta.y != 0.f);
+    }
+
+    // Feeds the controller the GPU frame time once per new measurement. Only _drawExtent moves, the draw targets are
+    // already large enough for the full swapchain extent.
+    void updateDrawExtent(){
+        auto frame = _profiler.stats.find(FRAME_SCOPE);
+        if(frame != _profiler.stats.end() && frame->second.samples != _frameTimeSamples){
+            _frameTimeSamples = frame->second.samples;
+            _dynamicResolution.update(frame->second.lastMs);
+        }
+
+        VkExtent2D drawExtent = _dynamicResolution.extent(_swapchainExtent);
+        bool changed = drawExtent.width != _drawExtent.width || drawExtent.height != _drawExtent.height;
+
+        if(changed){
+            _drawExtent = drawExtent;
+            _virtualTexture.resize(_drawExtent, {_drawImage.imageExtent.width, _drawImage.imageExtent.height}, getCurrentFrame().deletionQueue);
+        }
+
+        _dynamicResolution.recordFrame(changed);
+    }
+
+    bool upscaling() const {
+        return _useUpscaler && (_drawExtent.width != _swapchainExtent.width || _drawExtent.height != _swapchainExtent.height);
+    }
+
+    // Background, geometry, getting the result into the swapchain image and ImGui on top. The graph works out the barriers between them.
+    void recordFrameGraph(bool asyncBackground, uint32_t swapchainImageIndex){
+        _renderGraph.reset();
+
+        PresentPath path = _presentPath;
+
+        uint32_t swapchainImage = _renderGraph.importImage("swapchain", _swapchainImages[swapchainImageIndex], VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, swapchainWaitStage(path));
+        _renderGraph.setOutput(swapchainImage, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+        uint32_t drawImage = _renderGraph.importImage("draw", _drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED);
+
+        VkExtent2D drawCapacity = {_drawImage.imageExtent.width, _drawImage.imageExtent.height};
+
+        uint32_t depthImage = _renderGraph.createImage("depth", {DEPTH_FORMAT, drawCapacity, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, true});
+
+        if(asyncBackground){
+            // Written on the compute queue, the frame's submit waits for it at the blit stage
+            AllocatedImage& background = _backgroundImages[_frameNumber % FRAME_OVERLAP];
+            uint32_t backgroundImage = _renderGraph.importImage("async background", background.image, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_PIPELINE_STAGE_2_BLIT_BIT);
+
+            _renderGraph.addPass("background copy", [this, image = background.image](VkCommandBuffer command){
+                Utility::copyImageToImage(command, image, _drawImage.image, _drawExtent, _drawExtent);
+            }).read(backgroundImage, ImageUsage::TransferSrc).write(drawImage, ImageUsage::TransferDst);
+        } else {
+            _renderGraph.addPass("background", [this](VkCommandBuffer command){
+                drawBackground(command, _drawImageDescriptors);
+            }).write(drawImage, ImageUsage::StorageImage);
+        }
+
+        const char* geometryScope = _useMeshShading ? "geometry (mesh shading)" : "geometry (vertex pulling)";
+
+        _renderGraph.addPass(geometryScope, [this, geometryScope, depthImage](VkCommandBuffer command){
+            _profiler.beginScope(command, geometryScope);
+            drawGeometry(command, _renderGraph.transientImage(depthImage).imageView, attachmentStoreOp(depthImage));
+            _profiler.endScope(command, geometryScope);
+        }).readWrite(drawImage, ImageUsage::ColorAttachment).write(depthImage, ImageUsage::DepthAttachment);
+
+        // Done with the depth buffer by then, so its targets can take the same memory
+        if(_virtualTexture.enabled()){
+            VkExtent2D feedbackExtent = VirtualTexture::feedbackExtent(drawCapacity);
+
+            uint32_t feedbackImage = _renderGraph.createImage("feedback", {VirtualTexture::FEEDBACK_FORMAT, feedbackExtent,
+                VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT});
+            uint32_t feedbackDepth = _renderGraph.createImage("feedback depth", {VirtualTexture::FEEDBACK_DEPTH_FORMAT, feedbackExtent,
+                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, true});
+
+            _renderGraph.addPass("virtual texture feedback", [this, feedbackImage, feedbackDepth](VkCommandBuffer command){
+                drawVirtualTextureFeedback(command, _renderGraph.transientImage(feedbackImage).imageView, _renderGraph.transientImage(feedbackDepth).imageView,
+                    attachmentStoreOp(feedbackDepth));
+            }).write(feedbackImage, ImageUsage::ColorAttachment).write(feedbackDepth, ImageUsage::DepthAttachment);
+
+            // Read on the host FRAME_OVERLAP frames later
+            _renderGraph.addPass("feedback readback", [this, feedbackImage](VkCommandBuffer command){
+                _virtualTexture.readbackFeedback(command, _renderGraph.transientImage(feedbackImage).image, _frameNumber % FRAME_OVERLAP);
+            }).read(feedbackImage, ImageUsage::TransferSrc).keep();
+        }
+
+        const char* presentScope = PRESENT_SCOPES[static_cast<int>(path)];
+
+        switch(path){
+            case PresentPath::Resolve:
+                if(upscaling() && _swapchainStorage){
+                    // The upscaler's store converts to the swapchain format itself
+                    recordUpscalePass(drawImage, swapchainImage, _swapchainImageViews[swapchainImageIndex]);
+
+                    _renderGraph.addPass("imgui", [this, presentScope, swapchainImageIndex](VkCommandBuffer command){
+                        _profiler.beginScope(command, presentScope);
+                        drawImgui(command, _swapchainImageViews[swapchainImageIndex]);
+                        _profiler.endScope(command, presentScope);
+                    }).readWrite(swapchainImage, ImageUsage::ColorAttachment);
+                } else {
+                    uint32_t source = drawImage;
+                    if(upscaling()){
+                        source = _renderGraph.createImage("upscaled", {_drawImage.imageFormat, _swapchainExtent,
+                            VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT});
+                        recordUpscalePass(drawImage, source, VK_NULL_HANDLE);
+                    }
+
+                    _renderGraph.addPass("resolve and imgui", [this, presentScope, source, upscaled = upscaling(), swapchainImageIndex](VkCommandBuffer command){
+                        VkImageView sourceView = upscaled ? _renderGraph.transientImage(source).imageView : _drawImage.imageView;
+                        VkExtent2D sourceExtent = upscaled ? _swapchainExtent : _drawExtent;
+
+                        _profiler.beginScope(command, presentScope);
+                        drawResolveAndImgui(command, sourceView, sourceExtent, _swapchainImageViews[swapchainImageIndex]);
+                        _profiler.endScope(command, presentScope);
+                    }).read(source, ImageUsage::Sampled).write(swapchainImage, ImageUsage::ColorAttachment);
+                }
+                break;
+
+            case PresentPath::Blit:
+                if(upscaling()){
+                    // Into an image of the draw format, the swapchain's format usually can't be a storage image
+                    uint32_t upscaledImage = _renderGraph.createImage("upscaled", {_drawImage.imageFormat, _swapchainExtent,
+                        VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_IMAGE_ASPECT_COLOR_BIT});
+                    recordUpscalePass(drawImage, upscaledImage, VK_NULL_HANDLE);
+
+                    _renderGraph.addPass("copy to swapchain", [this, presentScope, upscaledImage, swapchainImageIndex](VkCommandBuffer command){
+                        _profiler.beginScope(command, presentScope);
+                        Utility::copyImageToImage(command, _renderGraph.transientImage(upscaledImage).image, _swapchainImages[swapchainImageIndex], _swapchainExtent, _swapchainExtent);
+                    }).read(upscaledImage, ImageUsage::TransferSrc).write(swapchainImage, ImageUsage::TransferDst);
+                } else {
+                    _renderGraph.addPass("copy to swapchain", [this, presentScope, swapchainImageIndex](VkCommandBuffer command){
+                        _profiler.beginScope(command, presentScope);
+                        Utility::copyImageToImage(command, _drawImage.image, _swapchainImages[swapchainImageIndex], _drawExtent, _swapchainExtent);
+                    }).read(drawImage, ImageUsage::TransferSrc).write(swapchainImage, ImageUsage::TransferDst);
+                }
+
+                _renderGraph.addPass("imgui", [this, presentScope, swapchainImageIndex](VkCommandBuffer command){
+                    drawImgui(command, _swapchainImageViews[swapchainImageIndex]);
+                    _profiler.endScope(command, presentScope);
+                }).readWrite(swapchainImage, ImageUsage::ColorAttachment);
+                break;
+        }
+    }
+
+    // Reads the draw image, writes target through outputView, or through the graph's own view when it is a transient
+    void recordUpscalePass(uint32_t drawImage, uint32_t target, VkImageView outputView){
+        _renderGraph.addPass(UPSCALE_SCOPE, [this, target, outputView](VkCommandBuffer command){
+            VkImageView view = outputView != VK_NULL_HANDLE ? outputView : _renderGraph.transientImage(target).imageView;
+
+            _profiler.beginScope(command, UPSCALE_SCOPE);
+            _upscaler.record(command, getCurrentFrame().frameDescriptors, _drawImage.imageView, _drawExtent, view, _swapchainExtent);
+            _profiler.endScope(command, UPSCALE_SCOPE);
+        }).read(drawImage, ImageUsage::Sampled).write(target, ImageUsage::StorageImage);
+    }
+
+    // The resolve replaces the copy and ImGui's load of the swapchain image with one pass. Rendering straight into the
+    // swapchain image would need its format to match the draw image's, the sRGB swapchain never does and has no storage usage.
+    PresentPath choosePresentPath() const {
+        return _forceBlit ? PresentPath::Blit : PresentPath::Resolve;
+    }
+
+    // The acquire only has to be waited on where the path first writes the swapchain image
+    static VkPipelineStageFlags2 swapchainWaitStage(PresentPath path){
+        switch(path){
+            case PresentPath::Resolve:
+                return VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT;
+            default:
+                return VK_PIPELINE_STAGE_2_BLIT_BIT;
+        }
+    }
+
+    // Only the bandwidth saving mode lets the graph drop attachment stores, so the two can be compared
+    VkAttachmentStoreOp attachmentStoreOp(uint32_t image){
+        return _bandwidthSaving ? _renderGraph.storeOp(image) : VK_ATTACHMENT_STORE_OP_STORE;
+    }
+
+    // Whole attachment loads and stores, storage writes and both sides of every copy in one frame at the current size.
+    // Overdraw, blending and caches aren't accounted for, neither are clears, which tiled GPUs do on chip.
+    double estimateFrameMegabytes(bool bandwidthSaving){
+        double drawPixels = double(_drawExtent.width) * _drawExtent.height;
+        double swapchainPixels = double(_swapchainExtent.width) * _swapchainExtent.height;
+        double colorBytes = drawPixels * formatBytes(bandwidthSaving ? _compactDrawFormat : FULL_DRAW_FORMAT);
+
+        double bytes = colorBytes;                          // Background
+        if(_asyncBackground){
+            bytes += 2.0 * colorBytes;                      // Copied over from the compute queue's image
+        }
+
+        bytes += 2.0 * colorBytes;                          // Geometry loads and stores colour
+        if(!bandwidthSaving){
+            bytes += drawPixels * formatBytes(DEPTH_FORMAT);
+        }
+
+        if(_virtualTexture.enabled()){
+            VkExtent2D feedbackExtent = _virtualTexture.feedbackExtent();
+            double feedbackPixels = double(feedbackExtent.width) * feedbackExtent.height;
+
+            bytes += 3.0 * feedbackPixels * formatBytes(VirtualTexture::FEEDBACK_FORMAT);   // Stored, then copied to the readback buffer
+            if(!bandwidthSaving){
+                bytes += feedbackPixels * formatBytes(VirtualTexture::FEEDBACK_DEPTH_FORMAT);
+            }
+        }
+
+        double swapchainBytes = swapchainPixels * formatBytes(_swapchainImageFormat);
+        double upscaledBytes = swapchainPixels * formatBytes(bandwidthSaving ? _compactDrawFormat : FULL_DRAW_FORMAT);
+
+        switch(_presentPath){
+            case PresentPath::Resolve:
+                if(upscaling() && _swapchainStorage){
+                    bytes += colorBytes + swapchainBytes;   // Upscaled into the swapchain image
+                    bytes += 2.0 * swapchainBytes;          // ImGui loads and stores it
+                } else {
+                    if(upscaling()){
+                        bytes += colorBytes + 2.0 * upscaledBytes;      // Upscaled, then read by the resolve
+                    } else {
+                        bytes += colorBytes;
+                    }
+                    bytes += swapchainBytes;                // Stored once with ImGui on top
+                }
+                break;
+
+            case PresentPath::Blit:
+                if(upscaling()){
+                    bytes += colorBytes + 2.0 * upscaledBytes;          // Upscaled, then read by the copy
+                } else {
+                    bytes += colorBytes;
+                }
+                bytes += swapchainBytes;                    // Copy to the swapchain
+                bytes += 2.0 * swapchainBytes;              // ImGui loads and stores it
+                break;
+        }
+
+        return bytes / (1024.0 * 1024.0);
+    }
+
+    static uint32_t formatBytes(VkFormat format){
+        switch(format){
+            case VK_FORMAT_R16G16B16A16_SFLOAT:
+                return 8;
+            default:
+                return 4;   // Everything else the frame uses, RGBA8, B10G11R11, R32 and D32
+        }
+    }
+
+    // Compute shaders that write the draw image, built once without a format qualifier and once for RGBA16F only
+    std::string storageShader(const char* name) const {
+        return fmt::format("shaders\\{}{}", name, _storageWithoutFormat ? ".spv" : ".typed.spv");
+    }
+
+    // B10G11R11 keeps the range of the float format, RGBA8 is enough for what reaches the swapchain now but clamps.
+    // Without formatless storage writes the background shaders only write RGBA16F, bandwidth saving then only drops stores.
+    VkFormat chooseCompactDrawFormat(){
+        if(!_storageWithoutFormat)
+            return FULL_DRAW_FORMAT;
+
+        const VkFormatFeatureFlags features = VK_FORMAT_FEATURE_STORAGE_IMAGE_BIT | VK_FORMAT_FEATURE_COLOR_ATTACHMENT_BIT |
+            VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, VK_FORMAT_B10G11R11_UFLOAT_PACK32, &formatProperties);
+
+        if((formatProperties.optimalTilingFeatures & features) == features)
+            return VK_FORMAT_B10G11R11_UFLOAT_PACK32;
+
+        return VK_FORMAT_R8G8B8A8_UNORM;
+    }
+
+    // The background that was just read back ran while the GPU finished the frame before it. That frame's timings
+    // are still the latest the graphics profiler has, its own readback for this frame comes later in draw().
+    // Both are on the host clock, the queues' own timestamps can't be compared with each other.
+    void measureBackgroundOverlap(){
+        auto background = _computeProfiler.stats.find(BACKGROUND_SCOPE);
+        auto frame = _profiler.stats.find(FRAME_SCOPE);
+
+        if(background == _computeProfiler.stats.end() || frame == _profiler.stats.end() || !background->second.calibrated || !frame->second.calibrated)
+            return;
+
+        double overlapMs = std::min(background->second.hostEndMs, frame->second.hostEndMs) - std::max(background->second.hostBeginMs, frame->second.hostBeginMs);
+
+        _backgroundOverlap.lastMs = std::max(overlapMs, 0.0);
+        _backgroundOverlap.totalMs += _backgroundOverlap.lastMs;
+        _backgroundOverlap.samples++;
+    }
+
     void setupPipeline(){
         setupBackgroundPipeline();
+
+        _upscaler.setup(_device, !_storageWithoutFormat);
+        setupResolvePipeline();
+
+        _mainDeletionQueue.pushFunction([this](){
+            _upscaler.cleanup();
+        });
         // setupMeshPipeline();
 
-        for(auto& mesh: _meshes){
-            mesh->setup(_device, _allocator, _drawImage.imageFormat, _depthImage.imageFormat);
+        _streamer.setup(_allocator, &_transfer, &_jobs, &_gpu);
 
-            uploadExternalMesh(*mesh);
+        _mainDeletionQueue.pushFunction([this](){
+            _streamer.cleanup();
+        });
+
+        // Meshes only create layouts, pipelines and buffers of their own, which Vulkan and VMA allow from any thread.
+        // Pipeline compilation is most of it.
+        _jobs.parallelFor(_meshes.size(), 1, [this](size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++){
+                _meshes[i]->vkCmdDrawMeshTasks = _vkCmdDrawMeshTasks;
+                _meshes[i]->setup(_device, _allocator, _drawImage.imageFormat, DEPTH_FORMAT);
+            }
+        });
+
+        for(auto& mesh: _meshes){
+            // Buffers are only known once the mesh is resident, see applyMeshUpload
+            requestMesh(*mesh);
 
             mesh->bufferDeletionQueue.pushFunction([this, mesh]{
-                // fmt::println("About to destroy mesh vertex buffer");
-                Utility::destroyBuffer(_allocator, mesh->vertexBuffer);
-                // fmt::println("About to destroy mesh index buffer");
-                Utility::destroyBuffer(_allocator, mesh->indexBuffer);
                 // fmt::println("About to destroy desc set layout");
                 vkDestroyDescriptorSetLayout(_device, mesh->setLayout, nullptr);
             });
@@ -332,6 +1391,47 @@ private:
         }
     }
 
+    void setupTextures(){
+        _textureLoader.setup(_device, _physicalDevice, _allocator, _graphicsQueue, _graphicsQueueFamily, &_transfer, &_gpu);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+        VK_CHECK(vkCreateSampler(_device, &samplerInfo, nullptr, &_defaultSampler));
+
+        if(!_texturePaths.empty()){
+            _textures = _textureLoader.load(_texturePaths);
+            _textureLoader.printStats();
+        }
+
+        _mainDeletionQueue.pushFunction([this](){
+            for(AllocatedImage& texture: _textures){
+                _textureLoader.destroyImage(texture);
+            }
+
+            vkDestroySampler(_device, _defaultSampler, nullptr);
+            _textureLoader.cleanup();
+        });
+    }
+
+    void setupVirtualTexture(){
+        if(_virtualTexturePath.empty())
+            return;
+
+        _virtualTexture.setup(_device, _allocator, _virtualTexturePath, _drawExtent);
+
+        _mainDeletionQueue.pushFunction([this](){
+            _virtualTexture.cleanup();
+        });
+    }
+
     void setupBackgroundPipeline(){
         VkPipelineLayoutCreateInfo computeLayout{};
         computeLayout.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
@@ -350,22 +1450,22 @@ private:
         VK_CHECK(vkCreatePipelineLayout(_device, &computeLayout, nullptr, &_backgroundShaderPipelineLayout));
         
         VkShaderModule gradientShader;
-        if(!Utility::loadShaderModule("shaders\\gradient.comp.spv", _device, &gradientShader)){
+        if(!Utility::loadShaderModule(storageShader("gradient.comp").c_str(), _device, &gradientShader)){
             throw std::runtime_error("Failed to load gradient Shader!");
         }
 
         VkShaderModule skyShader;
-        if(!Utility::loadShaderModule("shaders\\sky.comp.spv", _device, &skyShader)){
+        if(!Utility::loadShaderModule(storageShader("sky.comp").c_str(), _device, &skyShader)){
             fmt::print("Failed to load sky Shader!");
         }
 
         VkShaderModule mandelbrotShader;
-        if(!Utility::loadShaderModule("shaders\\mandelbrot.comp.spv", _device, &mandelbrotShader)){
+        if(!Utility::loadShaderModule(storageShader("mandelbrot.comp").c_str(), _device, &mandelbrotShader)){
             fmt::print("Failed to load mandelbrot Shader!");
         }
 
         VkShaderModule juliaShader;
-        if(!Utility::loadShaderModule("shaders\\julia.comp.spv", _device, &juliaShader)){
+        if(!Utility::loadShaderModule(storageShader("julia.comp").c_str(), _device, &juliaShader)){
             fmt::print("Failed to load julia Shader!");
         }
 
@@ -389,7 +1489,7 @@ private:
         gradient.data = {};
         gradient.data.color1 = glm::vec4(1, 1, 0, 1);
         gradient.data.color2 = glm::vec4(0, 0, 1, 1);
-        gradient.data.viewMatrix = _view;
+        gradient.data.viewMatrix = effectViewMatrix(_view);
 
         VK_CHECK(vkCreateComputePipelines(_device,VK_NULL_HANDLE,1,&computePipelineCreateInfo, nullptr, &gradient.pipeline));
 
@@ -400,7 +1500,7 @@ private:
         sky.name = "sky";
         sky.data = {};
         sky.data.color1 = glm::vec4(0.709f, 0.113f, 0.333f, 0.97f);
-        sky.data.viewMatrix = _view;
+        sky.data.viewMatrix = effectViewMatrix(_view);
 
         VK_CHECK(vkCreateComputePipelines(_device,VK_NULL_HANDLE,1,&computePipelineCreateInfo, nullptr, &sky.pipeline));
 
@@ -411,7 +1511,7 @@ private:
         mandelbrot.name = "mandelbrot";
         mandelbrot.data = {};
         mandelbrot.data.color1 = glm::vec4(0.0465f, 0.2252f, 0.f, 0.f);    // z and w dont matter
-        mandelbrot.data.viewMatrix = _view;
+        mandelbrot.data.viewMatrix = effectViewMatrix(_view);
 
         VK_CHECK(vkCreateComputePipelines(_device,VK_NULL_HANDLE,1,&computePipelineCreateInfo, nullptr, &mandelbrot.pipeline));
 
@@ -423,7 +1523,7 @@ private:
         julia.data = {};
         julia.data.color1 = glm::vec4(0.0465f, 0.2252f, 0.f, 0.f);    // z and w dont matter
         julia.data.color2 = glm::vec4(-0.618f, 0.f, 0.f, 0.f);
-        julia.data.viewMatrix = _view;
+        julia.data.viewMatrix = effectViewMatrix(_view);
 
         VK_CHECK(vkCreateComputePipelines(_device,VK_NULL_HANDLE,1,&computePipelineCreateInfo, nullptr, &julia.pipeline));
 
@@ -446,6 +1546,69 @@ private:
         });
     }
 
+    // Draws into the swapchain image, so it is built for the swapchain format like ImGui
+    void setupResolvePipeline(){
+        DescriptorLayoutBuilder builder;
+        builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        _resolveSetLayout = builder.build(_device, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+        VkPushConstantRange pushConstant{};
+        pushConstant.offset = 0;
+        pushConstant.size = sizeof(ResolvePushConstants);
+        pushConstant.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+
+        VkPipelineLayoutCreateInfo layoutInfo = Initializers::pipelineLayoutCreateInfo();
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &_resolveSetLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+
+        VK_CHECK(vkCreatePipelineLayout(_device, &layoutInfo, nullptr, &_resolvePipelineLayout));
+
+        VkShaderModule vertexShader;
+        if(!Utility::loadShaderModule("shaders\\resolve.vert.spv", _device, &vertexShader)){
+            throw std::runtime_error("Failed to load resolve vertex Shader!");
+        }
+
+        VkShaderModule fragShader;
+        if(!Utility::loadShaderModule("shaders\\resolve.frag.spv", _device, &fragShader)){
+            throw std::runtime_error("Failed to load resolve fragment Shader!");
+        }
+
+        PipelineBuilder pipelineBuilder;
+        pipelineBuilder.pipelineLayout = _resolvePipelineLayout;
+        pipelineBuilder.setShaders(vertexShader, fragShader);
+        pipelineBuilder.setInputTopology(VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+        pipelineBuilder.setPolygonMode(VK_POLYGON_MODE_FILL);
+        pipelineBuilder.setCullMode(VK_CULL_MODE_NONE, VK_FRONT_FACE_COUNTER_CLOCKWISE);
+        pipelineBuilder.setMultisamplingNone();
+        pipelineBuilder.disableBlending();
+        pipelineBuilder.disableDepthtest();
+        pipelineBuilder.setColorAttachmentFormat(_swapchainImageFormat);
+
+        _resolvePipeline = pipelineBuilder.buildPipeline(_device);
+
+        vkDestroyShaderModule(_device, vertexShader, nullptr);
+        vkDestroyShaderModule(_device, fragShader, nullptr);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        VK_CHECK(vkCreateSampler(_device, &samplerInfo, nullptr, &_resolveSampler));
+
+        _mainDeletionQueue.pushFunction([this](){
+            vkDestroySampler(_device, _resolveSampler, nullptr);
+            vkDestroyPipeline(_device, _resolvePipeline, nullptr);
+            vkDestroyPipelineLayout(_device, _resolvePipelineLayout, nullptr);
+            vkDestroyDescriptorSetLayout(_device, _resolveSetLayout, nullptr);
+        });
+    }
+
     float getTimeMandelbrot(float& timeVariable) {
         static auto lastTimeMandelbrot = std::chrono::high_resolution_clock::now();
 
@@ -486,6 +1649,15 @@ private:
 
             ImGui::SliderInt("Effect Index: ", &_currentBackground, 0, _backgroundEffects.size() - 1);
 
+            ImGui::Checkbox("Async compute", &_asyncBackground);
+            if(_asyncBackground && _timestampCalibration.available()){
+                ImGui::Text("%.3fms on the %s queue, %.3fms overlapped with the previous frame", _computeProfiler.lastMs(BACKGROUND_SCOPE),
+                    _computeQueueFamily != _graphicsQueueFamily ? "compute" : "graphics", _backgroundOverlap.lastMs);
+            } else if(_asyncBackground){
+                ImGui::Text("%.3fms on the %s queue, overlap needs calibrated timestamps", _computeProfiler.lastMs(BACKGROUND_SCOPE),
+                    _computeQueueFamily != _graphicsQueueFamily ? "compute" : "graphics");
+            }
+
             _currentBackground = std::clamp(_currentBackground, 0, (int)(_backgroundEffects.size() - 1));
 
             // Temp colors so that we can easily set RGB values in range of 255
@@ -589,10 +1761,127 @@ private:
 
         ImGui::End();
 
+        if(ImGui::Begin("Geometry")) {
+            if(_meshShaderSupported){
+                ImGui::Checkbox("Mesh Shading", &_useMeshShading);
+            } else {
+                ImGui::Text("VK_EXT_mesh_shader not supported, using vertex pulling");
+            }
+        }
+        ImGui::End();
+
+        if(ImGui::Begin("Resolution")) {
+            ImGui::Checkbox("Dynamic resolution", &_dynamicResolution.enabled);
+            if(_dynamicResolution.enabled){
+                ImGui::SliderFloat("Target GPU ms", &_dynamicResolution.targetMs, 4.f, 50.f);
+                ImGui::Text("Scale %.2f", _dynamicResolution.scale);
+            } else {
+                ImGui::SliderFloat("Scale", &_dynamicResolution.scale, DynamicResolution::MIN_SCALE, DynamicResolution::MAX_SCALE);
+            }
+
+            ImGui::Checkbox("Upscaler", &_useUpscaler);
+            if(_useUpscaler){
+                ImGui::SliderFloat("Sharpness", &_upscaler.sharpness, 0.f, 1.f);
+            }
+
+            ImGui::Text("%ux%u to %ux%u, GPU frame %.3fms, upscale %.3fms", _drawExtent.width, _drawExtent.height, _swapchainExtent.width, _swapchainExtent.height,
+                _profiler.lastMs(FRAME_SCOPE), upscaling() ? _profiler.lastMs(UPSCALE_SCOPE) : 0.0);
+        }
+        ImGui::End();
+
+        if(ImGui::Begin("Latency")) {
+            if(ImGui::BeginCombo("Present mode", string_VkPresentModeKHR(_swapchainPresentMode))){
+                for(VkPresentModeKHR mode: _availablePresentModes){
+                    if(ImGui::Selectable(string_VkPresentModeKHR(mode), mode == _swapchainPresentMode) && mode != _swapchainPresentMode){
+                        _presentMode = mode;
+                        frameBufferResized = true;
+                    }
+                }
+                ImGui::EndCombo();
+            }
+
+            ImGui::Checkbox("Low latency pacing", &_pacer.lowLatency);
+            if(_pacer.lowLatency){
+                ImGui::Text("%.2fms delay of a %.2fms interval", _pacer.lastDelayMs(), _pacer.intervalMs());
+            }
+
+            ImGui::Text("Input to %s: p50 %.2fms, p90 %.2fms, p99 %.2fms", _pacer.presentWait() ? "present" : "GPU completion",
+                _pacer.percentileMs(0.5), _pacer.percentileMs(0.9), _pacer.percentileMs(0.99));
+        }
+        ImGui::End();
+
+        if(ImGui::Begin("Command Recording")) {
+            ImGui::Checkbox("Parallel geometry recording", &_parallelRecording);
+
+            const RecordingStats& recording = _recordingStats[_recordingPath];
+            ImGui::Text("%.3fms recording, %u batches on %u threads", recording.lastMs, recording.lastBatches, _jobs.threadCount());
+
+            ImGui::Checkbox("Cache static meshes", &_cacheStaticGeometry);
+
+            const StaticGeometryCache& cache = getCurrentFrame().staticGeometry;
+            ImGui::Text("%u meshes cached, recorded %llu times, reused for %llu frames", cache.meshCount,
+                (unsigned long long)_staticGeometryStats.recordings, (unsigned long long)_staticGeometryStats.reusedFrames);
+        }
+        ImGui::End();
+
+        if(ImGui::Begin("Idle Frames")) {
+            ImGui::Checkbox("Skip idle frames", &_skipIdleFrames);
+            ImGui::Text("%llu drawn, %llu skipped", (unsigned long long)_idleStats.drawnFrames, (unsigned long long)_idleStats.skippedFrames);
+        }
+        ImGui::End();
+
+        if(ImGui::Begin("Bandwidth")) {
+            if(ImGui::Checkbox("Bandwidth saving", &_bandwidthSaving)){
+                _drawFormatChanged = true;
+            }
+
+            ImGui::Text("Draw image %s, %ux%u", string_VkFormat(_drawImage.imageFormat), _drawImage.imageExtent.width, _drawImage.imageExtent.height);
+            ImGui::Text("%u swapchain recreations, draw targets grown %u times", _resizeStats.swapchainRecreations, _resizeStats.drawTargetGrowths);
+
+            ImGui::Checkbox("Force blit to swapchain", &_forceBlit);
+            ImGui::Text("Swapchain %s%s, %s: %.3fms", string_VkFormat(_swapchainImageFormat), _swapchainStorage ? " with storage" : "",
+                PRESENT_SCOPES[static_cast<int>(_presentPath)], _profiler.lastMs(PRESENT_SCOPES[static_cast<int>(_presentPath)]));
+            ImGui::Text("Estimated %.2fMB/frame, %.2fMB/frame in the other mode", estimateFrameMegabytes(_bandwidthSaving), estimateFrameMegabytes(!_bandwidthSaving));
+        }
+        ImGui::End();
+
         for(auto mesh: _meshes){
+            mesh->useMeshShading = _useMeshShading;
             mesh->imguiInterface();
         }
 
+        _profiler.imguiInterface();
+        _streamer.imguiInterface();
+
+        if(ImGui::Begin("GPU Tasks")) {
+            ImGui::Text("%zu running, %zu submissions in flight", _gpu.running(), _gpu.inFlight());
+            ImGui::Text("%llu spawned, up to %zu in flight at once", (unsigned long long)_gpu.stats.spawned, _gpu.stats.maxInFlight);
+        }
+        ImGui::End();
+
+        if(ImGui::Begin("Simulation")) {
+            bool threaded = _simulation.threaded();
+            if(ImGui::Checkbox("Own thread", &threaded)){
+                _simulation.setThreaded(threaded);
+            }
+
+            float tickRate = _simulation.tickRate();
+            if(ImGui::SliderFloat("Steps per second", &tickRate, 10.f, 1000.f)){
+                _simulation.setTickRate(tickRate);
+            }
+
+            float stepCostMs = _simulation.stepCostMs();
+            if(ImGui::SliderFloat("Extra step cost (ms)", &stepCostMs, 0.f, 50.f)){
+                _simulation.setStepCostMs(stepCostMs);
+            }
+
+            SimulationStats stats = _simulation.stats();
+            ImGui::Text("%llu steps at %.3fms", (unsigned long long)stats.steps, stats.averageStepMs());
+            ImGui::Text("Snapshots %.2fms old when drawn, %llu replaced unread", stats.averageSnapshotAgeMs(), (unsigned long long)stats.overwritten);
+        }
+        ImGui::End();
+        _renderGraph.imguiInterface();
+
         ImGui::Render();
     }
 
@@ -609,16 +1898,30 @@ private:
             _drawImageDescriptorLayout = builder.build(_device, VK_SHADER_STAGE_COMPUTE_BIT);
         }
 
+        writeDrawImageDescriptors();
+
+        _descriptorDeletionQueue.pushFunction([&](){
+            _backgroundDescriptorAllocator.destroyPool(_device);
+            vkDestroyDescriptorSetLayout(_device, _drawImageDescriptorLayout, nullptr);
+        });
+    }
+
+    // Fresh sets every time, the old ones may still be bound by frames in flight. They stay in the pool until
+    // shutdown, which only costs a few sets per draw target reallocation.
+    void writeDrawImageDescriptors(){
         _drawImageDescriptors = _backgroundDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
 
         DescriptorWriter writer;
         writer.writeImage(0, _drawImage.imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
         writer.updateSet(_device, _drawImageDescriptors);
 
-        _descriptorDeletionQueue.pushFunction([&](){
-            _backgroundDescriptorAllocator.destroyPool(_device);
-            vkDestroyDescriptorSetLayout(_device, _drawImageDescriptorLayout, nullptr);
-        });
+        for(size_t i = 0; i < FRAME_OVERLAP; i++){
+            _backgroundImageDescriptors[i] = _backgroundDescriptorAllocator.allocate(_device, _drawImageDescriptorLayout);
+
+            DescriptorWriter backgroundWriter;
+            backgroundWriter.writeImage(0, _backgroundImages[i].imageView, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+            backgroundWriter.updateSet(_device, _backgroundImageDescriptors[i]);
+        }
     }
 
     FrameData& getCurrentFrame() {
@@ -649,80 +1952,532 @@ private:
             _mainDeletionQueue.pushFunction([&, i]() {
                 _frames[i].frameDescriptors.destroyPool(_device);
             });
+
+            VkCommandPoolCreateInfo computeCreateInfo = Initializers::commandPoolCreateInfo(_computeQueueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+            VK_CHECK(vkCreateCommandPool(_device, &computeCreateInfo, nullptr, &_frames[i].computeCommandPool));
+
+            VkCommandBufferAllocateInfo computeAllocInfo = Initializers::commandBufferAllocateInfo(_frames[i].computeCommandPool, 1);
+            VK_CHECK(vkAllocateCommandBuffers(_device, &computeAllocInfo, &_frames[i].computeCommandBuffer));
+
+            // Command pools can't be used from two threads at once, every thread of the job system gets its own.
+            // Reset whole once the frame's fence has been waited on, buffers are allocated as needed.
+            VkCommandPoolCreateInfo secondaryCreateInfo = Initializers::commandPoolCreateInfo(_graphicsQueueFamily, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT);
+
+            _frames[i].secondaryPools.resize(_jobs.threadCount());
+            for(SecondaryCommandPool& secondaryPool: _frames[i].secondaryPools){
+                VK_CHECK(vkCreateCommandPool(_device, &secondaryCreateInfo, nullptr, &secondaryPool.pool));
+            }
+
+            // Long lived, reset whole before the static meshes are recorded again
+            VkCommandPoolCreateInfo staticCreateInfo = Initializers::commandPoolCreateInfo(_graphicsQueueFamily, 0);
+            VK_CHECK(vkCreateCommandPool(_device, &staticCreateInfo, nullptr, &_frames[i].staticGeometry.pool));
+
+            _frames[i].staticGeometry.descriptors = DescriptorAllocator{};
+            _frames[i].staticGeometry.descriptors.setupPool(_device, 64, frame_sizes);
+
+            _frames[i].frameConstantsBuffer = Utility::createBuffer(_allocator, sizeof(FrameConstants), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+            _frames[i].frameConstantsAddress = bufferAddress(_frames[i].frameConstantsBuffer.buffer);
+
+            _mainDeletionQueue.pushFunction([&, i]() {
+                _frames[i].staticGeometry.descriptors.destroyPool(_device);
+                Utility::destroyBuffer(_allocator, _frames[i].frameConstantsBuffer);
+            });
         }
 
-        VK_CHECK(vkCreateCommandPool(_device, &createInfo, nullptr, &_immediateCommandPool));
+        _transfer.setup(_device, _transferQueue, _transferQueueFamily, _graphicsQueueFamily);
+        _gpu.setup(_allocator, &_transfer);
 
-        VkCommandBufferAllocateInfo allocInfo = Initializers::commandBufferAllocateInfo(_immediateCommandPool, 1);
+        _mainDeletionQueue.pushFunction([this](){
+            _gpu.cleanup();
+            _transfer.cleanup();
+        });
 
-        VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &_immediateCommandBuffer));
+        _renderGraph.setup(_device, _allocator);
 
-        _mainDeletionQueue.pushFunction([&](){
-            vkDestroyCommandPool(_device, _immediateCommandPool, nullptr);
+        _mainDeletionQueue.pushFunction([this](){
+            _renderGraph.cleanup();
         });
     }
 
-    void uploadExternalMesh(Mesh& newSurface){
-        const size_t vertexBufferSize = newSurface.vertices.size() * sizeof(Vertex);
-        const size_t indexBufferSize = newSurface.indices.size() * sizeof(uint32_t);
+    // Everything a mesh gets from its upload. Filled by a streaming worker and moved into the mesh once it's resident.
+    struct MeshUpload{
+        std::string importPath;
+        bool optimizeOnImport{false};
+
+        AllocatedBuffer vertexBuffer{}, indexBuffer{}, meshletBuffer{};
+
+        VertexFormat vertexFormat{VERTEX_FORMAT_FULL};
+        VkIndexType indexType{VK_INDEX_TYPE_UINT32};
+        glm::vec4 positionMin{0.f}, positionExtent{1.f};
+        uint32_t indexCount{0}, maxVertexCount{0}, maxIndexCount{0};
+
+        std::vector<Submesh> submeshes;
+
+        // Copies of hand-made geometry, the mesh's own vectors aren't touched off the render thread
+        std::vector<Vertex> vertices;
+        std::vector<uint32_t> indices;
+        MeshletData meshletData;
+
+        // Texture chunks of a cooked scene, staged by the decode job
+        std::vector<TextureLoader::StagedTexture> textures;
+    };
+
+    // Queues the mesh's geometry on the streamer, drawing skips the mesh until applyMeshUpload made it resident
+    void requestMesh(Mesh& mesh){
+        auto upload = std::make_shared<MeshUpload>();
+        upload->importPath = mesh.importPath;
+        upload->vertexFormat = mesh.vertexFormat;
+        upload->optimizeOnImport = mesh.optimizeOnImport;
+
+        if(mesh.importPath.empty()){
+            upload->indexCount = mesh.indexCount;
+            upload->maxVertexCount = mesh.maxVertexCount;
+            upload->maxIndexCount = mesh.maxIndexCount;
+            upload->vertices = mesh.vertices;
+            upload->indices = mesh.indices;
+        }
 
-        const size_t maxVertexBufferSize = newSurface.maxVertexCount * sizeof(Vertex);
-        const size_t maxIndexBufferSize = newSurface.maxIndexCount * sizeof(uint32_t);
+        Mesh* target = &mesh;
+        std::string name = mesh.importPath.empty() ? fmt::format("mesh {}", _streamer.stats.requested) : mesh.importPath;
 
-        newSurface.vertexBuffer = Utility::createBuffer(_allocator, maxVertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        _streamer.request(name, [this, upload, target](StreamedAsset& asset){
+            asset.discarded = [this, upload](){
+                for(TextureLoader::StagedTexture& texture: upload->textures){
+                    _textureLoader.destroyStaged(texture);
+                }
+            };
 
-        VkBufferDeviceAddressInfo deviceAddressInfo{};
-        deviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
-        deviceAddressInfo.buffer = newSurface.vertexBuffer.buffer;
+            if(CookedScene::isCookedScene(upload->importPath)){
+                decodeCookedMesh(*upload, asset);
+            } else if(!upload->importPath.empty()){
+                decodeGltfMesh(*upload, asset);
+            } else {
+                decodeExternalMesh(*upload, asset);
+            }
+
+            asset.makeResident = [this, upload, target](){
+                applyMeshUpload(*target, *upload);
+            };
+        });
+    }
+
+    // Render thread, once the streamer has acquired the buffers for the graphics queue
+    void applyMeshUpload(Mesh& mesh, MeshUpload& upload){
+        mesh.vertexBuffer = upload.vertexBuffer;
+        mesh.indexBuffer = upload.indexBuffer;
+        mesh.meshletBuffer = upload.meshletBuffer;
+
+        mesh.vertexBufferAddress = bufferAddress(mesh.vertexBuffer.buffer);
+
+        if(mesh.meshletBuffer.buffer != VK_NULL_HANDLE){
+            mesh.meshletBufferAddress = bufferAddress(mesh.meshletBuffer.buffer);
+        }
+
+        mesh.vertexFormat = upload.vertexFormat;
+        mesh.indexType = upload.indexType;
+        mesh.positionMin = upload.positionMin;
+        mesh.positionExtent = upload.positionExtent;
+        mesh.indexCount = upload.indexCount;
+        mesh.maxVertexCount = upload.maxVertexCount;
+        mesh.maxIndexCount = upload.maxIndexCount;
+        mesh.submeshes = std::move(upload.submeshes);
+        mesh.meshletData = std::move(upload.meshletData);
+
+        if(upload.importPath.empty()){
+            mesh.vertices = std::move(upload.vertices);
+            mesh.indices = std::move(upload.indices);
+        }
+
+        mesh.bufferDeletionQueue.pushFunction([this, &mesh]{
+            // fmt::println("About to destroy mesh vertex buffer");
+            Utility::destroyBuffer(_allocator, mesh.vertexBuffer);
+            // fmt::println("About to destroy mesh index buffer");
+            Utility::destroyBuffer(_allocator, mesh.indexBuffer);
+
+            if(mesh.meshletBuffer.buffer != VK_NULL_HANDLE){
+                Utility::destroyBuffer(_allocator, mesh.meshletBuffer);
+            }
+        });
+
+        // Uploaded without waiting, the mesh doesn't sample them yet
+        if(!upload.textures.empty()){
+            _gpu.spawn(uploadTextures(upload.importPath, std::move(upload.textures)));
+            upload.textures.clear();
+        }
+
+        mesh.resident = true;
+    }
+
+    // Textures join _textures once their copies have landed and the graphics queue owns them
+    GpuTask uploadTextures(std::string name, std::vector<TextureLoader::StagedTexture> textures){
+        for(size_t i = 0; i < textures.size(); i++){
+            if(!textures[i].error.empty()){
+                fmt::println("Failed to load texture {} of {}: {}", i, name, textures[i].error);
+            }
+        }
+
+        bool completed = co_await _textureLoader.uploadStaged(textures);
+
+        for(TextureLoader::StagedTexture& texture: textures){
+            if(texture.image.image == VK_NULL_HANDLE)
+                continue;
+
+            if(completed){
+                _textures.push_back(texture.image);
+            } else {
+                _textureLoader.destroyImage(texture.image);
+            }
+        }
+    }
+
+    // Hand-made geometry, buffers are sized for maxVertexCount and maxIndexCount so it can change later
+    void decodeExternalMesh(MeshUpload& upload, StreamedAsset& asset){
+        if(upload.optimizeOnImport){
+            MeshOptimizer::optimizeMesh(upload.vertices, upload.indices);
+        }
+
+        // Compact vertices are encoded here, the GPU never sees the full layout
+        VertexQuantization::EncodedVertices encoded;
+        const void* vertexData = upload.vertices.data();
+
+        if(upload.vertexFormat == VERTEX_FORMAT_COMPACT){
+            encoded = VertexQuantization::encode(upload.vertices);
+            upload.positionMin = encoded.positionMin;
+            upload.positionExtent = encoded.positionExtent;
+
+            vertexData = encoded.vertices.data();
+        }
+
+        const size_t vertexStride = VertexQuantization::vertexStride(upload.vertexFormat);
+
+        upload.indexType = MeshOptimizer::chooseIndexType(std::max<size_t>(upload.vertices.size(), upload.maxVertexCount));
+        std::vector<char> indexData = MeshOptimizer::packIndices(upload.indices, upload.indexType);
+
+        const size_t vertexBufferSize = upload.vertices.size() * vertexStride;
+        const size_t maxVertexBufferSize = std::max<size_t>(upload.maxVertexCount * vertexStride, sizeof(Vertex));
+        const size_t maxIndexBufferSize = std::max<size_t>(upload.maxIndexCount * MeshOptimizer::indexSize(upload.indexType), sizeof(uint32_t));
+
+        // Keep a valid meshlet buffer around even for an empty mesh
+        std::vector<char> meshletData;
+        if(_meshShaderSupported){
+            upload.meshletData = Meshlets::buildMeshlets(upload.vertices, upload.indices, upload.indexCount);
+
+            meshletData.resize(Meshlets::gpuSize(upload.meshletData));
+            Meshlets::writeGpuData(upload.meshletData, meshletData.data());
+        }
+
+        upload.vertexBuffer = _streamer.addBuffer(asset, maxVertexBufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, vertexBufferSize);
+        upload.indexBuffer = _streamer.addBuffer(asset, maxIndexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexData.size());
+
+        if(_meshShaderSupported){
+            upload.meshletBuffer = _streamer.addBuffer(asset, std::max(meshletData.size(), sizeof(Meshlet)), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, meshletData.size());
+        }
+
+        char* data = _streamer.createStaging(asset);
+
+        for(const StreamedAsset::Copy& copy: asset.copies){
+            const void* src = copy.buffer == 0 ? vertexData : copy.buffer == 1 ? (const void*)indexData.data() : (const void*)meshletData.data();
+            memcpy(data + copy.region.srcOffset, src, copy.region.size);
+        }
+    }
+
+    // Decodes the glTF file into one staging buffer, vertices first and indices after them. The full layout goes
+    // straight into staging, optimised or compact meshes are decoded into memory first and written from there.
+    void decodeGltfMesh(MeshUpload& upload, StreamedAsset& asset){
+        GltfImporter importer;
+        if(!importer.open(upload.importPath)){
+            throw std::runtime_error("Failed to import " + upload.importPath);
+        }
+
+        upload.indexType = importer.indexType();
+
+        const size_t vertexStride = VertexQuantization::vertexStride(upload.vertexFormat);
+        const size_t vertexBufferSize = importer.vertexCount() * vertexStride;
+        const size_t indexBufferSize = importer.indexCount() * MeshOptimizer::indexSize(upload.indexType);
+
+        // Keep valid buffers around even for an empty mesh
+        upload.vertexBuffer = _streamer.addBuffer(asset, sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, vertexBufferSize);
+
+        size_t indexOffset = asset.bytes;
+        upload.indexBuffer = _streamer.addBuffer(asset, sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBufferSize);
+
+        char* data = _streamer.createStaging(asset);
+        if(data && upload.vertexFormat == VERTEX_FORMAT_FULL && !upload.optimizeOnImport){
+            importer.decode((Vertex*)data, data + indexOffset, &_jobs);
+        } else if(data){
+            std::vector<Vertex> vertices(importer.vertexCount());
+            std::vector<char> indexData(indexBufferSize);
+            importer.decode(vertices.data(), indexData.data(), &_jobs);
+
+            if(upload.optimizeOnImport){
+                std::vector<uint32_t> indices = MeshOptimizer::unpackIndices(indexData.data(), importer.indexCount(), upload.indexType);
+                MeshOptimizer::optimizePrimitives(vertices, indices, importer.submeshes);
+                indexData = MeshOptimizer::packIndices(indices, upload.indexType);
+            }
+
+            const void* vertexData = vertices.data();
+
+            VertexQuantization::EncodedVertices encoded;
+            if(upload.vertexFormat == VERTEX_FORMAT_COMPACT){
+                encoded = VertexQuantization::encode(vertices);
+                upload.positionMin = encoded.positionMin;
+                upload.positionExtent = encoded.positionExtent;
+
+                vertexData = encoded.vertices.data();
+            }
+
+            memcpy(data, vertexData, vertexBufferSize);
+            memcpy(data + indexOffset, indexData.data(), indexBufferSize);
+        }
+
+        upload.submeshes = std::move(importer.submeshes);
+        upload.indexCount = static_cast<uint32_t>(importer.indexCount());
+        upload.maxVertexCount = static_cast<uint32_t>(importer.vertexCount());
+        upload.maxIndexCount = upload.indexCount;
+
+        importer.printStats();
+    }
+
+    // Maps a scene written by CookedScene::Writer and copies its chunks into staging as they are, see cookedScene.h.
+    // Texture chunks are staged here too and uploaded once the scene is resident, see applyMeshUpload.
+    void decodeCookedMesh(MeshUpload& upload, StreamedAsset& asset){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        CookedScene::Scene scene;
+
+        std::string error;
+        if(!scene.open(upload.importPath, error)){
+            throw std::runtime_error("Failed to load " + upload.importPath + ": " + error);
+        }
+
+        const CookedScene::Header& header = scene.header();
+        std::span<const char> vertices = scene.chunk(CookedScene::CHUNK_VERTICES);
+        std::span<const char> indices = scene.chunk(CookedScene::CHUNK_INDICES);
+
+        // Both end up in commands as they are, anything else would only pass the size check below as the default
+        if((header.vertexFormat != VERTEX_FORMAT_FULL && header.vertexFormat != VERTEX_FORMAT_COMPACT) || (header.indexType != VK_INDEX_TYPE_UINT16 && header.indexType != VK_INDEX_TYPE_UINT32)){
+            throw std::runtime_error("Failed to load " + upload.importPath + ": unknown vertex format or index type");
+        }
+
+        upload.vertexFormat = static_cast<VertexFormat>(header.vertexFormat);
+        upload.indexType = static_cast<VkIndexType>(header.indexType);
+        upload.positionMin = glm::make_vec4(header.positionMin);
+        upload.positionExtent = glm::make_vec4(header.positionExtent);
+
+        if(vertices.size() != header.vertexCount * VertexQuantization::vertexStride(upload.vertexFormat) || indices.size() != header.indexCount * MeshOptimizer::indexSize(upload.indexType)){
+            throw std::runtime_error("Failed to load " + upload.importPath + ": geometry chunks don't match the header");
+        }
+
+        std::span<const CookedScene::SubmeshRecord> submeshRecords = scene.submeshes();
+        std::span<const glm::vec4> bounds = scene.records<glm::vec4>(CookedScene::CHUNK_BOUNDS);
+        std::span<const CookedScene::LodRecord> lods = scene.records<CookedScene::LodRecord>(CookedScene::CHUNK_LODS);
+        std::span<const CookedScene::MeshletRange> meshletRanges = scene.records<CookedScene::MeshletRange>(CookedScene::CHUNK_MESHLET_RANGES);
+        std::span<const CookedScene::MeshletRange> lodMeshletRanges = scene.records<CookedScene::MeshletRange>(CookedScene::CHUNK_LOD_MESHLET_RANGES);
 
-        newSurface.vertexBufferAddress = vkGetBufferDeviceAddress(_device, &deviceAddressInfo);
+        auto indexRangeValid = [&](uint32_t first, uint32_t count){
+            return count <= header.indexCount && first <= header.indexCount - count;
+        };
+
+        for(const CookedScene::SubmeshRecord& record: submeshRecords){
+            if(!indexRangeValid(record.firstIndex, record.indexCount) || record.vertexOffset < 0 || uint64_t(record.vertexOffset) > header.vertexCount){
+                throw std::runtime_error("Failed to load " + upload.importPath + ": submesh outside the geometry chunks");
+            }
+        }
+
+        for(const CookedScene::LodRecord& lod: lods){
+            if(!indexRangeValid(lod.firstIndex, lod.indexCount)){
+                throw std::runtime_error("Failed to load " + upload.importPath + ": LOD outside the index chunk");
+            }
+        }
+
+        // Cooked meshlets are only uploaded where they can be drawn. Without meshlets for every LOD the vertex pipeline
+        // draws, mesh shading would be stuck with the full detail.
+        std::span<const char> meshlets = scene.chunk(CookedScene::CHUNK_MESHLETS);
+        bool uploadMeshlets = _meshShaderSupported && !meshlets.empty() && meshletRanges.size() == submeshRecords.size() && lodMeshletRanges.size() == lods.size();
+
+        auto copyStartTime = std::chrono::high_resolution_clock::now();
+
+        // Keep valid buffers around even for an empty mesh
+        upload.vertexBuffer = _streamer.addBuffer(asset, sizeof(Vertex), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, vertices.size());
+        upload.indexBuffer = _streamer.addBuffer(asset, sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indices.size());
+
+        if(uploadMeshlets){
+            upload.meshletBuffer = _streamer.addBuffer(asset, meshlets.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, meshlets.size());
+        }
+
+        char* data = _streamer.createStaging(asset);
+
+        for(const StreamedAsset::Copy& copy: asset.copies){
+            const char* src = copy.buffer == 0 ? vertices.data() : copy.buffer == 1 ? indices.data() : meshlets.data();
+            memcpy(data + copy.region.srcOffset, src, copy.region.size);
+        }
+
+        std::chrono::duration<double, std::milli> copyElapsed = std::chrono::high_resolution_clock::now() - copyStartTime;
+
+        size_t nextLod = 0;
+
+        for(size_t i = 0; i < submeshRecords.size(); i++){
+            const CookedScene::SubmeshRecord& record = submeshRecords[i];
+
+            Submesh submesh{record.firstIndex, record.indexCount, record.vertexOffset, glm::make_mat4(record.transform)};
+
+            if(i < bounds.size()){
+                submesh.sphere = bounds[i];
+            }
+
+            for(uint32_t l = 0; l < record.lodCount && nextLod < lods.size(); l++, nextLod++){
+                SubmeshLod lod{lods[nextLod].firstIndex, lods[nextLod].indexCount, lods[nextLod].error};
+
+                if(uploadMeshlets){
+                    lod.firstMeshlet = lodMeshletRanges[nextLod].firstMeshlet;
+                    lod.meshletCount = lodMeshletRanges[nextLod].meshletCount;
+                    lod.meshletVertexOffset = lodMeshletRanges[nextLod].vertexOffset;
+                    lod.meshletTriangleOffset = lodMeshletRanges[nextLod].triangleOffset;
+                }
+
+                submesh.lods.push_back(lod);
+            }
+
+            if(uploadMeshlets){
+                submesh.firstMeshlet = meshletRanges[i].firstMeshlet;
+                submesh.meshletCount = meshletRanges[i].meshletCount;
+                submesh.meshletVertexOffset = meshletRanges[i].vertexOffset;
+                submesh.meshletTriangleOffset = meshletRanges[i].triangleOffset;
+            }
+
+            upload.submeshes.push_back(std::move(submesh));
+        }
+
+        upload.indexCount = static_cast<uint32_t>(header.indexCount);
+        upload.maxVertexCount = static_cast<uint32_t>(header.vertexCount);
+        upload.maxIndexCount = upload.indexCount;
+
+        auto textureStartTime = std::chrono::high_resolution_clock::now();
 
-        newSurface.indexBuffer = Utility::createBuffer(_allocator, maxIndexBufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+        for(uint32_t i = 0; i < scene.chunkCount(CookedScene::CHUNK_TEXTURE); i++){
+            upload.textures.push_back(_textureLoader.stageKtx2(scene.chunk(CookedScene::CHUNK_TEXTURE, i)));
+        }
+
+        std::chrono::duration<double, std::milli> textureElapsed = std::chrono::high_resolution_clock::now() - textureStartTime;
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+
+        fmt::println("Cooked scene: {} submeshes, {} vertices, {} indices, {} LODs, {} textures from {:.2f}MB", upload.submeshes.size(), header.vertexCount, header.indexCount,
+            lods.size(), scene.chunkCount(CookedScene::CHUNK_TEXTURE), double(scene.fileSize()) / (1024.0 * 1024.0));
+        fmt::println("    open {:.2f}ms, verify {:.2f}ms, copy into staging {:.2f}ms, stage textures {:.2f}ms, total {:.2f}ms", scene.openMs, scene.verifyMs, copyElapsed.count(),
+            textureElapsed.count(), elapsed.count());
+    }
 
-        AllocatedBuffer stagingBuffer = Utility::createBuffer(_allocator, vertexBufferSize + indexBufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+    // What the copies of an edited mesh upload, see prepareMeshEdits
+    struct MeshEdit{
+        std::vector<char> indexData;
+        std::vector<char> meshletData;
+        VertexQuantization::EncodedVertices encoded;
+    };
+
+    // Packing, meshlet building and quantization of the edited meshes run as jobs, one per mesh, each touching only
+    // its own mesh. Indexed like _meshes, entries of meshes without edits stay empty.
+    std::vector<MeshEdit> prepareMeshEdits(){
+        std::vector<MeshEdit> edits(_meshes.size());
+
+        bool edited = false;
+        for(auto& mesh: _meshes){
+            edited |= mesh->resident && (mesh->updateIndexBuffer || mesh->updateVertexBuffer);
+        }
 
-        void* data = stagingBuffer.allocation->GetMappedData();
+        if(!edited)
+            return edits;
 
-        memcpy(data, newSurface.vertices.data(), vertexBufferSize);
-        memcpy((char*)data + vertexBufferSize, newSurface.indices.data(), indexBufferSize);
+        _jobs.parallelFor(_meshes.size(), 1, [&](size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++){
+                Mesh& mesh = *_meshes[i];
+                if(!mesh.resident)
+                    continue;
 
-        immediateSubmit([&](VkCommandBuffer command){
-            VkBufferCopy vertexCopy{0};
-            vertexCopy.dstOffset = 0;
-            vertexCopy.srcOffset = 0;
-            vertexCopy.size = vertexBufferSize;
+                if(mesh.updateIndexBuffer){
+                    edits[i].indexData = MeshOptimizer::packIndices(mesh.indices, mesh.indexType);
+                }
 
-            VkBufferCopy indexCopy{0};
-            indexCopy.dstOffset = 0;
-            indexCopy.srcOffset = vertexBufferSize;
-            indexCopy.size = indexBufferSize;
+                // Bounding spheres and normal cones come from the positions, culling would drop visible meshlets otherwise
+                bool meshletsStale = mesh.updateIndexBuffer || (mesh.updateVertexBuffer && !mesh.meshletData.meshlets.empty());
+                if(_meshShaderSupported && meshletsStale){
+                    edits[i].meshletData = buildMeshletData(mesh);
+                }
 
-            vkCmdCopyBuffer(command, stagingBuffer.buffer, newSurface.vertexBuffer.buffer, 1, &vertexCopy);
-            vkCmdCopyBuffer(command, stagingBuffer.buffer, newSurface.indexBuffer.buffer, 1, &indexCopy);
+                if(mesh.updateVertexBuffer && mesh.vertexFormat == VERTEX_FORMAT_COMPACT){
+                    edits[i].encoded = VertexQuantization::encode(mesh.vertices);
+                }
+            }
         });
 
-        Utility::destroyBuffer(_allocator, stagingBuffer);
+        return edits;
+    }
 
-        return;
+    // The mesh's meshlets in their GPU layout
+    static std::vector<char> buildMeshletData(Mesh& mesh){
+        mesh.meshletData = Meshlets::buildMeshlets(mesh.vertices, mesh.indices, mesh.indexCount);
+
+        // Keep a valid buffer around even for an empty mesh
+        std::vector<char> data(std::max(Meshlets::gpuSize(mesh.meshletData), sizeof(Meshlet)));
+        if(!mesh.meshletData.meshlets.empty()){
+            Meshlets::writeGpuData(mesh.meshletData, data.data());
+        }
+
+        return data;
+    }
+
+    void printGeometryThroughput(){
+        const char* names[2] = {"geometry (vertex pulling)", "geometry (mesh shading)"};
+
+        for(uint32_t path = 0; path < 2; path++){
+            auto it = _profiler.stats.find(names[path]);
+            if(_geometryFrames[path] == 0 || it == _profiler.stats.end() || it->second.averageMs() == 0.0)
+                continue;
+
+            double trianglesPerFrame = double(_trianglesSubmitted[path]) / _geometryFrames[path];
+            double trianglesPerSecond = trianglesPerFrame / (it->second.averageMs() / 1000.0);
+
+            fmt::println("{}: {} triangles/frame, {}ms, {} Mtriangles/s", names[path], trianglesPerFrame, it->second.averageMs(), trianglesPerSecond / 1000000.0);
+        }
     }
 
-    void copyBuffer(VkBuffer dstBuffer, void* src, size_t size){
+    // Edits go into a new buffer instead of overwriting the one the frames in flight still read, which also keeps the
+    // copy off the graphics queue without handing the old buffer over to the transfer family first.
+    // The copy is submitted on the transfer queue right away, its acquire is recorded into command and the frame's
+    // submit waits for it. The old buffer and the staging memory go once this frame has retired.
+    void replaceBuffer(VkCommandBuffer command, AllocatedBuffer& buffer, VkBufferUsageFlags usage, const void* src, size_t size){
         AllocatedBuffer stagingBuffer = Utility::createBuffer(_allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        memcpy(stagingBuffer.allocation->GetMappedData(), src, size);
+
+        // Sized like the old one, so edits that grow the mesh again still fit
+        AllocatedBuffer oldBuffer = buffer;
+        buffer = Utility::createBuffer(_allocator, std::max<size_t>(size, oldBuffer.info.size), usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
 
-        void* data = stagingBuffer.allocation->GetMappedData();
+        VkCommandBuffer copyCommand = _transfer.begin();
 
-        memcpy(data, src, size);
+        VkBufferCopy copyRegion{0};
+        copyRegion.size = size;
+        vkCmdCopyBuffer(copyCommand, stagingBuffer.buffer, buffer.buffer, 1, &copyRegion);
 
-        immediateSubmit([&](VkCommandBuffer command){
-            VkBufferCopy copyRegion{0};
-            copyRegion.dstOffset = 0;
-            copyRegion.srcOffset = 0;
-            copyRegion.size = size;
+        _transfer.releaseBuffers(copyCommand, {&buffer.buffer, 1});
+        _transferWaitValue = std::max(_transferWaitValue, _transfer.submit(copyCommand));
 
-            vkCmdCopyBuffer(command, stagingBuffer.buffer, dstBuffer, 1, &copyRegion);
+        _transfer.acquireBuffers(command, {&buffer.buffer, 1}, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_INDEX_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT);
+
+        getCurrentFrame().deletionQueue.pushFunction([this, stagingBuffer, oldBuffer](){
+            Utility::destroyBuffer(_allocator, stagingBuffer);
+
+            if(oldBuffer.buffer != VK_NULL_HANDLE){
+                Utility::destroyBuffer(_allocator, oldBuffer);
+            }
         });
+    }
 
-        Utility::destroyBuffer(_allocator, stagingBuffer);
+    VkDeviceAddress bufferAddress(VkBuffer buffer){
+        VkBufferDeviceAddressInfo deviceAddressInfo{};
+        deviceAddressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+        deviceAddressInfo.buffer = buffer;
+
+        return vkGetBufferDeviceAddress(_device, &deviceAddressInfo);
     }
 
     void setupSyncStructures(){
@@ -738,10 +2493,22 @@ private:
             VK_CHECK(vkCreateSemaphore(_device, &semaphoreCreateInfo, nullptr, &_frames[i].renderSemaphore));
         }
 
-        VK_CHECK(vkCreateFence(_device, &fenceCreateInfo, nullptr, &_immediateFence));
+        VkSemaphoreTypeCreateInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        timelineInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        timelineInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo timelineCreateInfo = Initializers::semaphoreCreateInfo();
+        timelineCreateInfo.pNext = &timelineInfo;
+        VK_CHECK(vkCreateSemaphore(_device, &timelineCreateInfo, nullptr, &_computeTimeline));
+
+        _profiler.setup(_device, _physicalDevice, _graphicsQueueFamily, _timestampCalibration);
+        _computeProfiler.setup(_device, _physicalDevice, _computeQueueFamily, _timestampCalibration);
 
         _mainDeletionQueue.pushFunction([&](){
-            vkDestroyFence(_device, _immediateFence, nullptr);
+            _profiler.cleanup(_device);
+            _computeProfiler.cleanup(_device);
+            vkDestroySemaphore(_device, _computeTimeline, nullptr);
         });
     }
 
@@ -796,44 +2563,30 @@ private:
         });
     }
 
-    void immediateSubmit(std::function<void(VkCommandBuffer command)>&& function){
-        VK_CHECK(vkResetFences(_device, 1, &_immediateFence));
-        VK_CHECK(vkResetCommandBuffer(_immediateCommandBuffer, 0));
-
-        VkCommandBuffer command = _immediateCommandBuffer;
-        VkCommandBufferBeginInfo commandBeginInfo = Initializers::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
-        VK_CHECK(vkBeginCommandBuffer(command, &commandBeginInfo));
-
-        function(command);
-
-        VK_CHECK(vkEndCommandBuffer(command));
+    void setupSwapchain(){
+        createSwapchain(VK_NULL_HANDLE);
 
-        VkCommandBufferSubmitInfo submitInfo = Initializers::commandBufferSubmitInfo(command);
-        VkSubmitInfo2 submit = Initializers::submitInfo(&submitInfo, nullptr, nullptr);
+        _drawExtent = _swapchainExtent;
+        createDrawTargets({_swapchainExtent.width, _swapchainExtent.height, 1});
 
-        VK_CHECK(vkQueueSubmit2(_graphicsQueue, 1, &submit, _immediateFence));
-        VK_CHECK(vkWaitForFences(_device, 1, &_immediateFence, true, 9999999999));
+        _swapchainDeletionQueue.pushFunction([&](){
+            destroyDrawTargets(_drawImage, _backgroundImages);
+        });
     }
 
-    void setupSwapchain(){
-        createSwapchain();
-    // Create Draw Image
-        VkExtent3D drawImageExent = {
-            _swapchainExtent.width,
-            _swapchainExtent.height,
-            1
-        };
-
-        _drawImage.imageFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
-        _drawImage.imageExtent = drawImageExent;
+    // The draw image and the async background images, all the same size and format
+    void createDrawTargets(VkExtent3D capacity){
+        _drawImage.imageFormat = _bandwidthSaving ? _compactDrawFormat : FULL_DRAW_FORMAT;
+        _drawImage.imageExtent = capacity;
 
         VkImageUsageFlags drawImageUsage{};
         drawImageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
         drawImageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
         drawImageUsage |= VK_IMAGE_USAGE_STORAGE_BIT;
         drawImageUsage |= VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+        drawImageUsage |= VK_IMAGE_USAGE_SAMPLED_BIT;      // Upscaler input
 
-        VkImageCreateInfo rimageInfo = Initializers::imageCreateInfo(_drawImage.imageFormat, drawImageUsage, drawImageExent);
+        VkImageCreateInfo rimageInfo = Initializers::imageCreateInfo(_drawImage.imageFormat, drawImageUsage, capacity);
 
         VmaAllocationCreateInfo rimageAllocInfo{};
         rimageAllocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
@@ -844,36 +2597,50 @@ private:
         VkImageViewCreateInfo rviewInfo = Initializers::imageViewCreateInfo(_drawImage.imageFormat, _drawImage.image, VK_IMAGE_ASPECT_COLOR_BIT);
 
         VK_CHECK(vkCreateImageView(_device, &rviewInfo, nullptr, &_drawImage.imageView));
-    
-    // Create Depth Image
-        _depthImage.imageFormat = VK_FORMAT_D32_SFLOAT;
-        _depthImage.imageExtent = drawImageExent;
 
-        VkImageUsageFlags depthImageUsages{};
-        depthImageUsages |= VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+    // Create Async Background Images
+        // Written on the compute queue and copied from on the graphics queue. Concurrent sharing saves a queue family
+        // ownership transfer each way every frame, for images that are only touched twice.
+        uint32_t backgroundFamilies[2] = {_graphicsQueueFamily, _computeQueueFamily};
 
-        VkImageCreateInfo dImageInfo = Initializers::imageCreateInfo(_depthImage.imageFormat, depthImageUsages, drawImageExent);
+        for(size_t i = 0; i < FRAME_OVERLAP; i++){
+            _backgroundImages[i].imageFormat = _drawImage.imageFormat;
+            _backgroundImages[i].imageExtent = capacity;
 
-        VK_CHECK(vmaCreateImage(_allocator, &dImageInfo, &rimageAllocInfo, &_depthImage.image, &_depthImage.allocation, nullptr));
+            VkImageCreateInfo bImageInfo = Initializers::imageCreateInfo(_drawImage.imageFormat, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, capacity);
 
-        VkImageViewCreateInfo dviewInfo = Initializers::imageViewCreateInfo(_depthImage.imageFormat, _depthImage.image, VK_IMAGE_ASPECT_DEPTH_BIT);
+            if(_computeQueueFamily != _graphicsQueueFamily){
+                bImageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+                bImageInfo.queueFamilyIndexCount = 2;
+                bImageInfo.pQueueFamilyIndices = backgroundFamilies;
+            }
 
-        VK_CHECK(vkCreateImageView(_device, &dviewInfo, nullptr, &_depthImage.imageView));
+            VK_CHECK(vmaCreateImage(_allocator, &bImageInfo, &rimageAllocInfo, &_backgroundImages[i].image, &_backgroundImages[i].allocation, nullptr));
 
-        _swapchainDeletionQueue.pushFunction([&](){
+            VkImageViewCreateInfo bviewInfo = Initializers::imageViewCreateInfo(_drawImage.imageFormat, _backgroundImages[i].image, VK_IMAGE_ASPECT_COLOR_BIT);
 
-            vkDestroyImageView(_device, _drawImage.imageView, nullptr);
-            vmaDestroyImage(_allocator, _drawImage.image, _drawImage.allocation);
+            VK_CHECK(vkCreateImageView(_device, &bviewInfo, nullptr, &_backgroundImages[i].imageView));
+        }
+    }
 
-            vkDestroyImageView(_device, _depthImage.imageView, nullptr);
-            vmaDestroyImage(_allocator, _depthImage.image, _depthImage.allocation);
-        });
+    // Takes copies, so retired targets can be destroyed after the members point at their replacements
+    void destroyDrawTargets(AllocatedImage drawImage, const AllocatedImage (&backgroundImages)[FRAME_OVERLAP]){
+        for(size_t i = 0; i < FRAME_OVERLAP; i++){
+            vkDestroyImageView(_device, backgroundImages[i].imageView, nullptr);
+            vmaDestroyImage(_allocator, backgroundImages[i].image, backgroundImages[i].allocation);
+        }
+
+        vkDestroyImageView(_device, drawImage.imageView, nullptr);
+        vmaDestroyImage(_allocator, drawImage.image, drawImage.allocation);
     }
 
-    void createSwapchain(){
+    void createSwapchain(VkSwapchainKHR oldSwapchain){
         Bootstrap::SwapchainBuilder builder;
 
         builder.setUsageFlags(VkImageUsageFlags(VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT));
+        builder.setOldSwapchain(oldSwapchain);
+        builder.setPresentMode(_presentMode);
+        builder.requestStorageUsage();
 
         SwapChainInfomation scI = builder.setupSwapChain(_physicalDevice, _surface, _device, _window);
 
@@ -882,8 +2649,15 @@ private:
         _swapchainImageFormat = scI.swapchainImageFormat;
         _swapchainImages = scI.swapchainImages;
         _swapchainImageViews = scI.swapchainImageViews;
+        // Storage writes into the swapchain's format need the formatless shaders
+        _swapchainStorage = (scI.swapchainImageUsage & VK_IMAGE_USAGE_STORAGE_BIT) != 0 && _storageWithoutFormat;
+        _swapchainPresentMode = scI.presentMode;
+        _availablePresentModes = scI.availablePresentModes;
     }
 
+    // Doesn't wait for the GPU. The old swapchain and anything the last frames used are retired into the deletion queue
+    // of the frame submitted last, which runs once that frame's fence has been waited on in a later draw.
+    // Draw targets only grow, smaller windows render into a corner of them through _drawExtent.
     void recreateSwapChain(){
 
         // Get new Width and Height
@@ -897,22 +2671,56 @@ private:
         WIDTH = static_cast<uint32_t>(width);
         HEIGHT = static_cast<uint32_t>(height);
 
-        // Wait for device to get idlt
-        vkDeviceWaitIdle(_device);
+        DeletionQueue& retired = _frames[(_frameNumber + FRAME_OVERLAP - 1) % FRAME_OVERLAP].deletionQueue;
 
-        // Cleanup swapchain, mesh pipeline and descriptors for that stuff
-        cleanupSwapchain();
-        _descriptorDeletionQueue.flush();
+        VkSwapchainKHR oldSwapchain = _swapchain;
+        std::vector<VkImageView> oldImageViews = _swapchainImageViews;
 
-        // Set everything back up again
-        setupSwapchain();
-        // setupMeshPipeline();
+        // Passing it as oldSwapchain needs the same external synchronization as a present
+        {
+            auto swapchainLock = _pacer.lockSwapchain();
+            createSwapchain(oldSwapchain);
+        }
+        _pacer.swapchainReplaced();
+        _resizeStats.swapchainRecreations++;
 
-        for(auto& mesh: _meshes){
-            mesh->remakePipeline(_device, _drawImage.imageFormat, _depthImage.imageFormat);
+        retired.pushFunction([this, oldSwapchain, oldImageViews](){
+            for(VkImageView view: oldImageViews){
+                vkDestroyImageView(_device, view, nullptr);
+            }
+            vkDestroySwapchainKHR(_device, oldSwapchain, nullptr);
+        });
+
+        VkExtent3D capacity = _drawImage.imageExtent;
+        if(_swapchainExtent.width > capacity.width || _swapchainExtent.height > capacity.height){
+            VkPhysicalDeviceProperties properties;
+            vkGetPhysicalDeviceProperties(_physicalDevice, &properties);
+            uint32_t maxDimension = properties.limits.maxImageDimension2D;
+            auto grow = [&](uint32_t current, uint32_t needed){
+                if(needed <= current)
+                    return current;
+                return std::min(std::max(needed, static_cast<uint32_t>(current * DRAW_TARGET_GROWTH)), maxDimension);
+            };
+
+            capacity.width = grow(capacity.width, _swapchainExtent.width);
+            capacity.height = grow(capacity.height, _swapchainExtent.height);
+
+            AllocatedImage oldDrawImage = _drawImage;
+            AllocatedImage oldBackgroundImages[FRAME_OVERLAP];
+            std::copy(std::begin(_backgroundImages), std::end(_backgroundImages), oldBackgroundImages);
+
+            retired.pushFunction([this, oldDrawImage, oldBackgroundImages](){
+                destroyDrawTargets(oldDrawImage, oldBackgroundImages);
+            });
+
+            createDrawTargets(capacity);
+            writeDrawImageDescriptors();
+            _resizeStats.drawTargetGrowths++;
         }
 
-        setupDescriptors();
+        _drawExtent = _dynamicResolution.extent(_swapchainExtent);
+
+        _virtualTexture.resize(_drawExtent, {capacity.width, capacity.height}, retired);
 
         // Set the new projection matrix
         setProjMatrix();
@@ -921,6 +2729,22 @@ private:
         frameBufferResized = false;
     }
 
+    // The one draw target change that has to wait: the pipelines are built for the draw image's format
+    void changeDrawFormat(){
+        vkDeviceWaitIdle(_device);
+
+        destroyDrawTargets(_drawImage, _backgroundImages);
+        createDrawTargets(_drawImage.imageExtent);
+
+        _jobs.parallelFor(_meshes.size(), 1, [this](size_t begin, size_t end){
+            for(size_t i = begin; i < end; i++){
+                _meshes[i]->remakePipeline(_device, _drawImage.imageFormat, DEPTH_FORMAT);
+            }
+        });
+
+        writeDrawImageDescriptors();
+    }
+
     void cleanupSwapchain(){
         _swapchainDeletionQueue.flush();
         vkDestroySwapchainKHR(_device, _swapchain, nullptr);
@@ -973,6 +2797,7 @@ private:
         features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
         features12.bufferDeviceAddress = VK_TRUE;
         features12.descriptorIndexing = VK_TRUE;
+        features12.timelineSemaphore = VK_TRUE;
 
         VkPhysicalDeviceVulkan11Features features11{};
         features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
@@ -988,6 +2813,40 @@ private:
 
         _graphicsQueue = bd.graphicsQueue;
         _graphicsQueueFamily = bd.graphicsQueueFamily;
+
+        _transferQueue = bd.transferQueue;
+        _transferQueueFamily = bd.transferQueueFamily;
+
+        _computeQueue = bd.computeQueue;
+        _computeQueueFamily = bd.computeQueueFamily;
+
+        // Still works on the graphics queue, but there's nothing to overlap with there
+        _asyncBackground = _computeQueueFamily != _graphicsQueueFamily;
+
+        _meshShaderSupported = bd.meshShaderSupported;
+        if(_meshShaderSupported){
+            _vkCmdDrawMeshTasks = (PFN_vkCmdDrawMeshTasksEXT)vkGetDeviceProcAddr(_device, "vkCmdDrawMeshTasksEXT");
+            _meshShaderSupported = _vkCmdDrawMeshTasks != nullptr;
+        }
+
+        fmt::println("Mesh shading: {}", _meshShaderSupported ? "supported" : "not supported, using vertex pulling");
+
+        glfwGetWindowPos(_window, &_windowPos.x, &_windowPos.y);
+        _pacer.setup(_device, bd.presentWaitSupported, windowRefreshRate());
+
+        _timestampCalibration = chooseTimestampCalibration(bd.calibratedTimestampsSupported);
+        fmt::println("Calibrated timestamps: {}", _timestampCalibration.available() ? "supported" : "not supported, async compute overlap isn't measured");
+
+        fmt::println("Present wait: {}", _pacer.presentWait() ? "supported" : "not supported, latency is measured to GPU completion");
+        fmt::println("Transfer queue: {}", _transferQueueFamily != _graphicsQueueFamily ? fmt::format("dedicated, family {}", _transferQueueFamily) : "none, uploads share the graphics queue");
+        fmt::println("Compute queue: {}", _computeQueueFamily != _graphicsQueueFamily ? fmt::format("dedicated, family {}", _computeQueueFamily) : "none, compute shares the graphics queue");
+
+        _storageWithoutFormat = bd.storageWithoutFormat;
+        if(!_storageWithoutFormat){
+            fmt::println("Formatless storage writes: not supported, the draw image stays {}", string_VkFormat(FULL_DRAW_FORMAT));
+        }
+
+        _compactDrawFormat = chooseCompactDrawFormat();
     }
 
     void setupWindow(){
@@ -1023,9 +2882,14 @@ private:
         }
 
     void appKeyCallback(GLFWwindow* window, int key, int scancode, int action, int mods){
-        for(auto& mesh: _meshes){
-            mesh->keyUpdate(window, key, scancode, action, mods);
-        }
+        _inputEvents = true;
+
+        // Handled on the simulation's side, the meshes only see the result in their next snapshot
+        _simulation.post([this, window, key, scancode, action, mods](){
+            for(auto& mesh: _meshes){
+                mesh->keyUpdate(window, key, scancode, action, mods);
+            }
+        });
     }
 
     void setupSurface(){
@@ -1067,8 +2931,12 @@ private:
         _view = glm::lookAt(eye, center, up);
 
         for(ComputeEffect& effect: _backgroundEffects){
-            effect.data.viewMatrix = _view;
+            effect.data.viewMatrix = effectViewMatrix(_view);
         }
     }
 
+    static glm::mat3x4 effectViewMatrix(const glm::mat4& view){
+        return glm::mat3x4(view[0], view[1], view[3]);
+    }
+
 };
\ No newline at end of file
@@ -0,0 +1,296 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "utility.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Single producer, single consumer hand-off of the newest value without locks. Three slots: the writer fills its back
+// slot and swaps it into the middle, the reader swaps the middle with its front slot whenever the middle holds
+// something it hasn't seen. Neither side ever waits for the other, values the reader is too slow for are overwritten.
+template<typename T>
+class TripleBuffer{
+public:
+    // Writer side
+    T& back(){
+        return _slots[_back];
+    }
+
+    // Returns true when it replaced a value the reader never took
+    bool publish(){
+        uint8_t previous = _middle.exchange(_back | FRESH, std::memory_order_acq_rel);
+        _back = previous & INDEX;
+        return (previous & FRESH) != 0;
+    }
+
+    // Reader side. True when front() changed.
+    bool update(){
+        if((_middle.load(std::memory_order_relaxed) & FRESH) == 0)
+            return false;
+
+        uint8_t previous = _middle.exchange(_front, std::memory_order_acq_rel);
+        _front = previous & INDEX;
+        return true;
+    }
+
+    const T& front() const {
+        return _slots[_front];
+    }
+
+    // Only while neither side is running
+    T& slot(uint32_t index){
+        return _slots[index];
+    }
+
+private:
+    static const uint8_t INDEX = 0x3;
+    static const uint8_t FRESH = 0x4;
+
+    // What either side writes on lines of its own
+    T _slots[3];
+    alignas(64) uint8_t _back{0};
+    alignas(64) uint8_t _front{1};
+    alignas(64) std::atomic<uint8_t> _middle{2};
+};
+
+// Immutable once published, the renderer only ever reads it
+struct SceneSnapshot{
+    uint64_t step{0};
+    double time{0.0};               // Simulated seconds
+    uint64_t hash{0};               // Of the mesh states
+    std::chrono::high_resolution_clock::time_point publishTime;
+    std::vector<MeshState> meshes;  // In the renderer's mesh order
+};
+
+struct SimulationStats{
+    uint64_t steps{0};
+    uint64_t overwritten{0};        // Published but replaced before the renderer took them
+    uint64_t consumed{0};
+    double stepMs{0.0};             // Summed, like the two below
+    double snapshotAgeMs{0.0};      // From publish to the renderer taking it
+
+    double averageStepMs() const {
+        return steps == 0 ? 0.0 : stepMs / steps;
+    }
+
+    double averageSnapshotAgeMs() const {
+        return consumed == 0 ? 0.0 : snapshotAgeMs / consumed;
+    }
+};
+
+// Steps the meshes' simulate() and publishes the result as a SceneSnapshot through a TripleBuffer.
+// Single threaded, the render thread steps once a frame right before it takes the snapshot. Threaded, a thread of its
+// own steps at tickRate and the renderer draws whatever is newest, so a slow step no longer holds up frames and a slow
+// frame no longer slows down the simulation.
+// Everything the simulation reads from the render thread arrives through post(): key events and the meshes' settings.
+class Simulation{
+public:
+    static constexpr double MAX_STEP_SECONDS = 0.1;     // Steps after a stall don't jump ahead any further
+
+    ~Simulation(){
+        stop();
+    }
+
+    void setup(const std::vector<Mesh*>& meshes){
+        _meshes = meshes;
+        _states.assign(meshes.size(), MeshState{});
+
+        for(uint32_t i = 0; i < 3; i++){
+            _snapshots.slot(i).meshes = _states;
+        }
+
+        _lastStep = std::chrono::high_resolution_clock::now();
+    }
+
+    void cleanup(){
+        stop();
+    }
+
+    bool threaded() const {
+        return _thread.joinable();
+    }
+
+    void setThreaded(bool threaded){
+        if(threaded == this->threaded())
+            return;
+
+        if(!threaded){
+            stop();
+            return;
+        }
+
+        _stopping = false;
+        _thread = std::thread([this](){ threadLoop(); });
+    }
+
+    float tickRate() const {
+        return _tickRate.load(std::memory_order_relaxed);
+    }
+
+    // Steps per second on the simulation thread
+    void setTickRate(float rate){
+        _tickRate.store(std::max(rate, 1.f), std::memory_order_relaxed);
+    }
+
+    float stepCostMs() const {
+        return _stepCostMs.load(std::memory_order_relaxed);
+    }
+
+    // Busy work added to every step, stands in for a simulation that doesn't fit into a frame
+    void setStepCostMs(float ms){
+        _stepCostMs.store(std::max(ms, 0.f), std::memory_order_relaxed);
+    }
+
+    // From the render thread, runs on the simulation's side before its next step
+    void post(std::function<void()>&& command){
+        std::lock_guard<std::mutex> lock(_commandMutex);
+        _commands.push_back(std::move(command));
+    }
+
+    // While the renderer waits for events, a snapshot that changes something wakes it up
+    void setRenderIdle(bool idle){
+        _renderIdle.store(idle, std::memory_order_relaxed);
+    }
+
+    // Render thread, once a frame. The newest snapshot if there is one the renderer hasn't seen, nullptr otherwise.
+    const SceneSnapshot* consume(){
+        if(!threaded()){
+            step(false);
+        }
+
+        if(!_snapshots.update())
+            return nullptr;
+
+        const SceneSnapshot& snapshot = _snapshots.front();
+        std::chrono::duration<double, std::milli> age = std::chrono::high_resolution_clock::now() - snapshot.publishTime;
+
+        _consumed++;
+        _snapshotAgeMs += age.count();
+        return &snapshot;
+    }
+
+    SimulationStats stats() const {
+        SimulationStats total{};
+        total.steps = _steps.load(std::memory_order_relaxed);
+        total.overwritten = _overwritten.load(std::memory_order_relaxed);
+        total.stepMs = _stepNs.load(std::memory_order_relaxed) / 1000000.0;
+        total.consumed = _consumed;
+        total.snapshotAgeMs = _snapshotAgeMs;
+        return total;
+    }
+
+    void printStats(){
+        SimulationStats total = stats();
+        fmt::println("Simulation {}: {} steps at {:.3f}ms, {} snapshots drawn {:.2f}ms after they were published on average, {} replaced unread",
+            threaded() ? "on its own thread" : "on the render thread", total.steps, total.averageStepMs(), total.consumed,
+            total.averageSnapshotAgeMs(), total.overwritten);
+    }
+
+private:
+    std::vector<Mesh*> _meshes;
+    std::vector<MeshState> _states;     // Only touched by whichever thread steps
+    TripleBuffer<SceneSnapshot> _snapshots;
+
+    uint64_t _step{0};
+    double _time{0.0};
+    uint64_t _publishedHash{0};
+    std::chrono::high_resolution_clock::time_point _lastStep;
+
+    std::mutex _commandMutex;
+    std::vector<std::function<void()>> _commands;
+
+    std::thread _thread;
+    std::atomic<bool> _stopping{false};
+    std::atomic<bool> _renderIdle{false};
+    std::atomic<float> _tickRate{120.f};
+    std::atomic<float> _stepCostMs{0.f};
+
+    std::atomic<uint64_t> _steps{0};
+    std::atomic<uint64_t> _overwritten{0};
+    std::atomic<uint64_t> _stepNs{0};
+
+    // Render thread only
+    uint64_t _consumed{0};
+    double _snapshotAgeMs{0.0};
+
+    // Joining hands the stepping back to the render thread, commands still queued run on its next step
+    void stop(){
+        if(!_thread.joinable())
+            return;
+
+        _stopping = true;
+        _thread.join();
+    }
+
+    void threadLoop(){
+        auto nextStep = std::chrono::high_resolution_clock::now();
+
+        while(!_stopping.load(std::memory_order_acquire)){
+            step(true);
+
+            // A step that took longer than the interval starts the next one right away, without trying to catch up
+            auto now = std::chrono::high_resolution_clock::now();
+            nextStep += std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double>(1.0 / tickRate()));
+            nextStep = std::max(nextStep, now);
+
+            std::this_thread::sleep_until(nextStep);
+        }
+    }
+
+    // Advances by the time that actually passed since the last step, so the rate only changes how smooth it is
+    void step(bool onThread){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        std::chrono::duration<double> elapsed = startTime - _lastStep;
+        double dt = std::min(elapsed.count(), MAX_STEP_SECONDS);
+        _lastStep = startTime;
+
+        std::vector<std::function<void()>> commands;
+        {
+            std::lock_guard<std::mutex> lock(_commandMutex);
+            commands.swap(_commands);
+        }
+        for(std::function<void()>& command: commands){
+            command();
+        }
+
+        for(size_t i = 0; i < _meshes.size(); i++){
+            _meshes[i]->simulate(dt, _states[i]);
+        }
+
+        float stepCostMs = this->stepCostMs();
+        if(stepCostMs > 0.f){
+            auto until = startTime + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(std::chrono::duration<double, std::milli>(stepCostMs));
+            while(std::chrono::high_resolution_clock::now() < until){}
+        }
+
+        _step++;
+        _time += dt;
+
+        SceneSnapshot& snapshot = _snapshots.back();
+        snapshot.step = _step;
+        snapshot.time = _time;
+        snapshot.meshes = _states;
+        snapshot.hash = Utility::hashBytes(Utility::FNV_OFFSET, _states.data(), _states.size() * sizeof(MeshState));
+        snapshot.publishTime = std::chrono::high_resolution_clock::now();
+
+        bool changed = snapshot.hash != _publishedHash;
+        _publishedHash = snapshot.hash;
+
+        std::chrono::duration<double, std::nano> stepTime = snapshot.publishTime - startTime;
+        _steps.fetch_add(1, std::memory_order_relaxed);
+        _stepNs.fetch_add(static_cast<uint64_t>(stepTime.count()), std::memory_order_relaxed);
+
+        if(_snapshots.publish()){
+            _overwritten.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // The render thread is never waiting while it steps itself
+        if(changed && onThread && _renderIdle.load(std::memory_order_relaxed)){
+            glfwPostEmptyEvent();
+        }
+    }
+};
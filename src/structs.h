@@ -8,6 +8,9 @@ struct SwapChainInfomation{
     std::vector<VkImageView> swapchainImageViews;
     VkExtent2D swapchainExtent;
     VkFormat swapchainImageFormat;
+    VkImageUsageFlags swapchainImageUsage;
+    VkPresentModeKHR presentMode;
+    std::vector<VkPresentModeKHR> availablePresentModes;
 };
 
 struct BootstrapInstance{
@@ -20,6 +23,19 @@ struct BootstrapDevice{
     VkPhysicalDevice physicalDevice;
     VkQueue graphicsQueue;
     uint32_t graphicsQueueFamily;
+
+    // The graphics queue again when there is no transfer-only family
+    VkQueue transferQueue;
+    uint32_t transferQueueFamily;
+
+    // Same for a compute family without graphics
+    VkQueue computeQueue;
+    uint32_t computeQueueFamily;
+
+    bool meshShaderSupported;
+    bool presentWaitSupported;      // VK_KHR_present_id and VK_KHR_present_wait, both enabled
+    bool storageWithoutFormat;      // shaderStorageImageWriteWithoutFormat, enabled when supported
+    bool calibratedTimestampsSupported;     // VK_EXT_calibrated_timestamps, enabled
 };
 
 struct DeletionQueue{
@@ -45,6 +61,7 @@ struct AllocatedImage {
     VmaAllocation allocation;
     VkExtent3D imageExtent;
     VkFormat imageFormat;
+    uint32_t mipLevels{1};
 };
 
 struct ComputeShaderPushConstants{
@@ -52,12 +69,35 @@ struct ComputeShaderPushConstants{
     glm::vec4 color2;
     glm::vec4 color3;
     glm::vec4 color4;
-    glm::mat4 viewMatrix;
+    glm::mat3x4 viewMatrix;     // Columns 0, 1 and 3 of the view matrix, effects only transform points with z = 0
+    glm::ivec2 extent;          // Of the part of the image to fill, it can be larger
+};
+
+// Matches resolve.frag
+struct ResolvePushConstants{
+    glm::vec2 inputScale;       // Input texels per output pixel
+    glm::vec2 inputLimit;       // Centre of the last valid texel
 };
 
+// Read by the mesh shaders through the frameConstants address in their push constants, one buffer per frame in flight.
+// Whatever changes every frame goes here, so commands recorded once stay valid from frame to frame.
+struct FrameConstants{
+    glm::mat4 viewProj;
+};
+
+// First three rows of a transform, the last one of an affine transform is always 0, 0, 0, 1
+inline glm::mat3x4 affineRows(const glm::mat4& transform){
+    return glm::mat3x4(glm::transpose(transform));
+}
+
 struct MeshPushConstants{
-    glm::mat4 worldMatrix;
+    glm::mat3x4 transformRows{affineRows(glm::mat4(1.f))};     // Of the draw, the view projection comes from frameConstants
     VkDeviceAddress vertexBuffer;
+    VkDeviceAddress frameConstants;
+    uint32_t vertexFormat;
+    uint32_t padding[3];
+    glm::vec4 positionMin;      // Dequantization of compact positions
+    glm::vec4 positionExtent;
 };
 
 struct AllocatedBuffer{
@@ -66,6 +106,24 @@ struct AllocatedBuffer{
     VmaAllocationInfo info;
 };
 
+// Bits of MeshletPushConstants::flags
+const uint32_t MESHLET_FLAG_CONE_CULLING = 1;
+const uint32_t MESHLET_FLAG_COMPACT_VERTICES = 2;
+
+struct MeshletPushConstants{
+    glm::mat3x4 transformRows{affineRows(glm::mat4(1.f))};     // Of the draw, the view projection comes from frameConstants
+    VkDeviceAddress vertexBuffer;
+    VkDeviceAddress meshletBuffer;
+    VkDeviceAddress frameConstants;
+    uint32_t meshletCount;
+    uint32_t meshletVertexOffset;
+    uint32_t meshletTriangleOffset;
+    uint32_t flags;
+    uint32_t padding[2];
+    glm::vec4 positionMin;
+    glm::vec4 positionExtent;
+};
+
 struct Vertex {
     glm::vec3 position;
     float uv_x;
@@ -74,6 +132,35 @@ struct Vertex {
     glm::vec4 color;
 };
 
+enum VertexFormat : uint32_t {
+    VERTEX_FORMAT_FULL = 0,
+    VERTEX_FORMAT_COMPACT = 1
+};
+
+// 16 byte opt-in layout of Vertex, see vertexQuantization.h
+struct CompactVertex {
+    uint16_t position[3];   // unorm16, relative to the mesh bounds
+    uint16_t normal;        // octahedral, 2x snorm8
+    uint32_t uv;            // 2x half
+    uint32_t color;         // 4x unorm8
+};
+
+// Matches the Meshlet struct in meshlet.task / meshlet.mesh
+struct Meshlet {
+    glm::vec4 sphere;   // xyz center, w radius
+    glm::vec4 cone;     // xyz axis, w cutoff
+    uint32_t vertexOffset;
+    uint32_t triangleOffset;
+    uint32_t vertexCount;
+    uint32_t triangleCount;
+};
+
+struct MeshletData {
+    std::vector<Meshlet> meshlets;
+    std::vector<uint32_t> meshletVertices;
+    std::vector<uint32_t> meshletTriangles;     // 3 local 8-bit indices packed per triangle
+};
+
 struct ComputeEffect{
     const char* name;
 
@@ -292,10 +379,68 @@ struct DescriptorLayoutBuilder {
     }
 };
 
+struct ResizeStats{
+    uint32_t swapchainRecreations{0};
+    uint32_t drawTargetGrowths{0};      // Only when the swapchain outgrew them
+};
+
+struct IdleStats{
+    uint64_t drawnFrames{0};
+    uint64_t skippedFrames{0};     // Loop iterations that found nothing to draw
+};
+
+// Secondary command buffers one thread records into, handed out again once the pool has been reset
+struct SecondaryCommandPool{
+    VkCommandPool pool;
+    std::vector<VkCommandBuffer> buffers;
+    uint32_t used{0};
+};
+
+// CPU time of recording the geometry pass
+struct RecordingStats{
+    double lastMs{0.0};
+    double totalMs{0.0};
+    uint64_t frames{0};
+    uint32_t lastBatches{0};
+
+    double averageMs() const {
+        return frames == 0 ? 0.0 : totalMs / frames;
+    }
+};
+
+// Static meshes of one frame in flight, recorded once into a secondary that is executed again every frame until key
+// changes. Only touched once the frame's fence has been waited on, so nothing is ever rerecorded while in use.
+struct StaticGeometryCache{
+    VkCommandPool pool;
+    VkCommandBuffer commands{VK_NULL_HANDLE};
+    DescriptorAllocator descriptors;    // Sets of the cached meshes, cleared when they are rerecorded
+    uint64_t key{0};                    // 0 until the first recording
+    uint32_t meshCount{0};
+};
+
+struct StaticGeometryStats{
+    uint64_t recordings{0};
+    uint64_t reusedFrames{0};
+    double recordMs{0.0};       // Summed over the recordings
+};
+
 struct FrameData{
     VkCommandPool commandPool;
     VkCommandBuffer mainCommandBuffer;
 
+    // Indexed by JobSystem::workerIndex, for geometry recorded in parallel
+    std::vector<SecondaryCommandPool> secondaryPools;
+
+    StaticGeometryCache staticGeometry;
+
+    // FrameConstants, written before the geometry pass is recorded
+    AllocatedBuffer frameConstantsBuffer;
+    VkDeviceAddress frameConstantsAddress;
+
+    // On the compute queue, for the async background
+    VkCommandPool computeCommandPool;
+    VkCommandBuffer computeCommandBuffer;
+
     VkSemaphore swapchainSemaphore, renderSemaphore;
     VkFence renderFence;
 
@@ -306,6 +451,8 @@ struct FrameData{
 struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
+    std::optional<uint32_t> transferFamily;     // Only a transfer-only family, the copy engines that run alongside rendering
+    std::optional<uint32_t> computeFamily;      // Only a compute family without graphics, for async compute
 
     bool isComplete() {
         return graphicsFamily.has_value() &&
@@ -324,19 +471,25 @@ struct QueueFamilyIndices {
     int i = 0;
 
     for (const auto& queueFamily: queueFamilies) {
-        if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
+        if ((queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.graphicsFamily.has_value()) {
             indices.graphicsFamily = i;
         }
 
         VkBool32 presentSupport = false;
         vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 
-        if(presentSupport) {
+        if(presentSupport && !indices.presentFamily.has_value()) {
             indices.presentFamily = i;
         }
 
-        if (indices.isComplete()) {
-            break;
+        bool transferOnly = (queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+        if(transferOnly && !indices.transferFamily.has_value()) {
+            indices.transferFamily = i;
+        }
+
+        bool computeOnly = (queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT);
+        if(computeOnly && !indices.computeFamily.has_value()) {
+            indices.computeFamily = i;
         }
 
         i++;
@@ -376,18 +529,70 @@ struct SwapChainSupportDetails {
 }
 };
 
+// Range of a mesh's index buffer drawn with its own transform, e.g. one glTF primitive of one node
+// Coarser index range over the same vertices, see MeshOptimizer::generateLod
+struct SubmeshLod{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    float error;
+
+    // The LOD's own meshlets, laid out like the submesh's
+    uint32_t firstMeshlet{0}, meshletCount{0};
+    uint32_t meshletVertexOffset{0}, meshletTriangleOffset{0};
+};
+
+struct Submesh{
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    glm::mat4 transform;
+
+    // Only filled for cooked scenes, see cookedScene.h
+    glm::vec4 sphere{0.f};          // Bounds in mesh space, xyz center, w radius
+    std::vector<SubmeshLod> lods;   // Coarsest last
+
+    uint32_t firstMeshlet{0}, meshletCount{0};
+    uint32_t meshletVertexOffset{0}, meshletTriangleOffset{0};     // Relative to the submesh's first meshlet, in uint32 units
+};
+
+class Simulation;
+
+// What the simulation hands the renderer for one mesh, see simulation.h
+struct MeshState{
+    glm::mat4 transform{1.f};
+    uint64_t input{0};      // Mesh specific, what the simulation made of the keys it was sent
+};
+
 struct Mesh{
 public:
-    AllocatedBuffer vertexBuffer;
-    AllocatedBuffer indexBuffer;
+    AllocatedBuffer vertexBuffer{};
+    AllocatedBuffer indexBuffer{};
     AllocatedBuffer uniformBuffer;
 
+    // Set once the streamed upload has landed (see AssetStreamer), meshes aren't drawn or updated before that
+    bool resident{false};
+
     uint32_t indexCount, maxVertexCount, maxIndexCount;
 
     bool updateVertexBuffer, updateIndexBuffer;
 
     VkDeviceAddress vertexBufferAddress;
 
+    // Opt-in, set before the mesh is uploaded
+    VertexFormat vertexFormat{VERTEX_FORMAT_FULL};
+    glm::vec4 positionMin{0.f}, positionExtent{1.f};
+
+    // Reorders indices and vertices on upload, glTF imports per primitive. Only for meshes that don't address vertices
+    // by index afterwards, cooked scenes are optimised by AssetCooker already.
+    bool optimizeOnImport{false};
+
+    // 16-bit whenever maxVertexCount allows it, picked on upload
+    VkIndexType indexType{VK_INDEX_TYPE_UINT32};
+
+    // Meshes with an import path (a glTF file or a cooked .scene) go straight into staging memory, vertices and indices stay empty
+    std::string importPath;
+    std::vector<Submesh> submeshes;
+
     std::vector<Vertex> vertices; 
     std::vector<uint32_t> indices;
 
@@ -397,6 +602,18 @@ public:
     VkDescriptorSetLayout setLayout;
     VkDescriptorSet set;
 
+    // Mesh shading path, only used when the device supports VK_EXT_mesh_shader
+    PFN_vkCmdDrawMeshTasksEXT vkCmdDrawMeshTasks{nullptr};
+    bool useMeshShading{false};
+    bool coneCulling{false};
+
+    MeshletData meshletData;
+    AllocatedBuffer meshletBuffer{};
+    VkDeviceAddress meshletBufferAddress;
+
+    VkPipelineLayout meshletPipelineLayout;
+    VkPipeline meshletPipeline;
+
     DeletionQueue pipelineDeletionQueue, uniformDeletionQueue, deletionQueue, bufferDeletionQueue;
     virtual ~Mesh() = default;
 
@@ -408,6 +625,75 @@ public:
     virtual void update(VkDevice _device, VmaAllocator& allocator,  DescriptorAllocator& _descriptorAllocator){};
     virtual void draw(VkCommandBuffer& command, glm::mat4 viewProj){};
 
+    // Draws that can be recorded apart from each other, so a large mesh can be split between recording threads.
+    // drawRange records draws first to last of them, the same commands draw() records for that range. It may run on
+    // several threads at once for disjoint ranges, after update().
+    virtual size_t drawCount(){ return 1; };
+    virtual void drawRange(VkCommandBuffer& command, glm::mat4 viewProj, size_t first, size_t last){ draw(command, viewProj); };
+
+    virtual void drawFeedback(VkCommandBuffer& command, glm::mat4 viewProj){};     // Virtual texture feedback pass, see virtualTexture.h
+
+    // Set by the renderer. Whatever simulate() reads from the render thread has to arrive through its post().
+    Simulation* simulation{nullptr};
+
+    // On the simulation's side, which may be a thread of its own. Advances state by dt seconds.
+    virtual void simulate(double dt, MeshState& state){};
+
+    // On the render thread, with the mesh's state from the newest snapshot
+    virtual void applyState(const MeshState& state){};
+
+    // Posted to the simulation, may only touch what simulate() reads
     virtual void keyUpdate(GLFWwindow* window, int key, int scancode, int action, int mods){};
     virtual void imguiInterface(){};
+
+    // Changes from frame to frame without any input, which keeps the renderer from skipping idle frames
+    virtual bool animated(){ return false; };
+
+    // Of the frame being recorded, draws push it for the view projection instead of baking in the matrix they are given
+    VkDeviceAddress frameConstantsAddress{0};
+
+    // draw() records the same commands and update() writes the same data every frame as long as drawState() and the
+    // buffers and pipelines stay the same. The renderer records such meshes once and reuses the commands, calling
+    // update() only when it records them again.
+    virtual bool staticDraw(){ return !animated(); };
+
+    // Hash of the mesh's own settings that draw() and update() depend on
+    virtual uint64_t drawState(){ return 0; };
+};
+
+// Part of one batch of draws, see splitDraws
+struct DrawRange{
+    Mesh* mesh;
+    size_t first, last;
 };
+
+// The meshes' draws in order, split into batchCount batches of about the same number of draws. A mesh with many
+// draws ends up spread over several batches, a batch of many small meshes gets several ranges.
+inline std::vector<std::vector<DrawRange>> splitDraws(const std::vector<Mesh*>& meshes, size_t batchCount){
+    std::vector<size_t> offsets(meshes.size() + 1, 0);
+    for(size_t i = 0; i < meshes.size(); i++){
+        offsets[i + 1] = offsets[i] + meshes[i]->drawCount();
+    }
+
+    size_t total = offsets.back();
+    std::vector<std::vector<DrawRange>> batches(batchCount);
+
+    size_t mesh = 0;
+    for(size_t batch = 0; batch < batchCount; batch++){
+        size_t first = total * batch / batchCount, last = total * (batch + 1) / batchCount;
+
+        while(mesh < meshes.size() && offsets[mesh] < last){
+            size_t begin = std::max(first, offsets[mesh]), end = std::min(last, offsets[mesh + 1]);
+            if(begin < end){
+                batches[batch].push_back({meshes[mesh], begin - offsets[mesh], end - offsets[mesh]});
+            }
+
+            // The mesh's remaining draws continue in the next batch
+            if(offsets[mesh + 1] > last)
+                break;
+            mesh++;
+        }
+    }
+
+    return batches;
+}
@@ -0,0 +1,638 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "utility.h"
+#include "initializers.h"
+#include "transferQueue.h"
+#include "gpuTasks.h"
+#include "ktx2.h"
+#include "blockCompression.h"
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+struct TextureLoadStats{
+    size_t textureCount{0};
+    size_t sourceBytes{0};      // Compressed files read from disk
+    size_t decodedBytes{0};     // Level 0 as RGBA8, for the pixel rate
+    size_t uploadedBytes{0};    // Including the GPU generated mips
+    size_t compressedTextureCount{0};
+    size_t transcodedTextureCount{0};   // Block compressed files the device can't sample, expanded to RGBA8 on the CPU
+    size_t rgbaEquivalentBytes{0};      // What the uploaded images would take as RGBA8 with the same mips
+    uint32_t threadCount{0};
+
+    double decodeMs{0.0};       // Until the last image finished decoding
+    double totalMs{0.0};        // Until the last upload batch retired on the GPU
+
+    double decodeMegabytesPerSecond() const {
+        return decodeMs == 0.0 ? 0.0 : double(sourceBytes) / (1024.0 * 1024.0) / (decodeMs / 1000.0);
+    }
+
+    double decodeMegapixelsPerSecond() const {
+        return decodeMs == 0.0 ? 0.0 : double(decodedBytes / 4) / 1000000.0 / (decodeMs / 1000.0);
+    }
+
+    double uploadMegabytesPerSecond() const {
+        return totalMs == 0.0 ? 0.0 : double(uploadedBytes) / (1024.0 * 1024.0) / (totalMs / 1000.0);
+    }
+};
+
+// Decodes image files with stb_image on worker threads and uploads them through a persistently mapped staging ring,
+// mips are generated on the GPU with a blit chain.
+// .ktx2 files keep their BCn/ASTC payload and precomputed mips when the device can sample the format (see tools/ktxEncoder.cpp),
+// BC1-BC5 files fall back to RGBA8 decoded on the worker threads otherwise.
+// The ring is split into slots that are each submitted with their own fence, so decoding, filling one slot and the GPU
+// draining another overlap. Images that don't fit in a slot get a staging buffer of their own.
+// With a dedicated transfer queue a slot is two submissions: the copies on the transfer queue, then the mip blits and
+// layout transitions on the graphics queue, which only waits for the copies on the GPU.
+// load() blocks until everything is resident, which is what startup wants. Textures that arrive while the render loop
+// runs are staged on any thread with stageKtx2 and uploaded through the GpuScheduler with uploadStaged instead.
+class TextureLoader{
+public:
+    static const uint32_t RING_SLOTS = 2;
+
+    // Decoded, created and written into staging memory of its own, everything but the upload
+    struct StagedTexture{
+        AllocatedImage image{};
+        AllocatedBuffer staging{};
+        std::vector<VkBufferImageCopy> regions;
+        bool transcoded{false};
+        size_t sourceBytes{0};
+        std::string error;
+    };
+
+    TextureLoadStats stats;
+
+    void setup(VkDevice device, VkPhysicalDevice physicalDevice, VmaAllocator allocator, VkQueue queue, uint32_t queueFamily, TransferQueue* transfer, GpuScheduler* gpu, size_t ringSize = 64 * 1024 * 1024){
+        _device = device;
+        _physicalDevice = physicalDevice;
+        _allocator = allocator;
+        _queue = queue;
+        _transfer = transfer;
+        _gpu = gpu;
+
+        _slotSize = ringSize / RING_SLOTS;
+        _ring = Utility::createBuffer(allocator, _slotSize * RING_SLOTS, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        _ringData = (char*)_ring.allocation->GetMappedData();
+
+        VkCommandPoolCreateInfo poolInfo = Initializers::commandPoolCreateInfo(queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+        VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &_commandPool));
+
+        VkFenceCreateInfo fenceInfo = Initializers::fenceCreateInfo(VK_FENCE_CREATE_SIGNALED_BIT);
+
+        for(uint32_t i = 0; i < RING_SLOTS; i++){
+            VkCommandBufferAllocateInfo allocInfo = Initializers::commandBufferAllocateInfo(_commandPool, 1);
+            VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &_slots[i].command));
+
+            VK_CHECK(vkCreateFence(device, &fenceInfo, nullptr, &_slots[i].fence));
+        }
+    }
+
+    void cleanup(){
+        for(uint32_t i = 0; i < RING_SLOTS; i++){
+            retireSlot(_slots[i]);
+            vkDestroyFence(_device, _slots[i].fence, nullptr);
+        }
+
+        vkDestroyCommandPool(_device, _commandPool, nullptr);
+        Utility::destroyBuffer(_allocator, _ring);
+    }
+
+    // Returns one image per path, in order. Images that failed to load have a null VkImage.
+    // srgb only applies to stb_image sources, KTX2 files carry their own format.
+    std::vector<AllocatedImage> load(const std::vector<std::string>& paths, bool srgb = true, uint32_t threadCount = 0){
+        VkFormat format = srgb ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+
+        return loadImages(paths.size(), format, threadCount, [&](size_t i, DecodedImage& image){
+            std::error_code error;
+            size_t fileSize = std::filesystem::file_size(paths[i], error);
+            if(!error){
+                image.sourceBytes = fileSize;
+            }
+
+            if(std::filesystem::path(paths[i]).extension() == ".ktx2"){
+                decodeKtx2(paths[i], image);
+            } else {
+                decodeStb(paths[i], format, image);
+            }
+        }, [&](size_t i){
+            return paths[i];
+        });
+    }
+
+    // A KTX2 file that is already in memory, like a texture chunk of a mapped cooked scene. Safe on any thread, only
+    // touches the device and allocator. The file can go once this returns, a texture with an error holds nothing.
+    StagedTexture stageKtx2(std::span<const char> file){
+        StagedTexture staged{};
+        staged.sourceBytes = file.size();
+
+        DecodedImage decoded{};
+        parseKtx2(file.data(), file.size(), decoded);
+        if(!decoded.error.empty()){
+            staged.error = decoded.error;
+            return staged;
+        }
+
+        staged.image = createImage(decoded, static_cast<uint32_t>(decoded.levels.size()));
+        staged.staging = Utility::createBuffer(_allocator, stagingSize(decoded), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        staged.regions = writeLevels(decoded, (char*)staged.staging.allocation->GetMappedData(), 0);
+        staged.transcoded = decoded.transcoded;
+
+        return staged;
+    }
+
+    // Render thread. One submission for all of them, the images are sampleable once the wait yields true. Textures
+    // that failed to stage are skipped, on false the caller destroys the images.
+    GpuWait uploadStaged(std::vector<StagedTexture>& textures){
+        std::vector<GpuImage> images;
+        for(const StagedTexture& texture: textures){
+            if(texture.image.image == VK_NULL_HANDLE)
+                continue;
+
+            const VkExtent3D& extent = texture.image.imageExtent;
+            images.push_back({texture.image.image, {extent.width, extent.height}, texture.image.mipLevels, texture.image.mipLevels});
+        }
+
+        GpuWait wait = _gpu->submit([&](VkCommandBuffer command){
+            for(const StagedTexture& texture: textures){
+                if(texture.image.image == VK_NULL_HANDLE)
+                    continue;
+
+                vkCmdCopyBufferToImage(command, texture.staging.buffer, texture.image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                    static_cast<uint32_t>(texture.regions.size()), texture.regions.data());
+            }
+        }, {}, images);
+
+        for(StagedTexture& texture: textures){
+            stats.sourceBytes += texture.sourceBytes;
+
+            if(texture.image.image == VK_NULL_HANDLE)
+                continue;
+
+            wait.adoptStaging(texture.staging);
+            texture.staging = {};
+            countUpload(texture.image, texture.transcoded);
+        }
+
+        return wait;
+    }
+
+    // For textures that never get uploaded
+    void destroyStaged(StagedTexture& texture){
+        if(texture.staging.buffer != VK_NULL_HANDLE){
+            Utility::destroyBuffer(_allocator, texture.staging);
+            texture.staging = {};
+        }
+        destroyImage(texture.image);
+        texture.image = {};
+    }
+
+    void destroyImage(const AllocatedImage& image){
+        if(image.image == VK_NULL_HANDLE)
+            return;
+
+        vkDestroyImageView(_device, image.imageView, nullptr);
+        vmaDestroyImage(_allocator, image.image, image.allocation);
+    }
+
+    void printStats(){
+        fmt::println("Texture loading: {} textures, {:.2f}MB read, {:.2f}MB uploaded on {} threads", stats.textureCount, double(stats.sourceBytes) / (1024.0 * 1024.0), double(stats.uploadedBytes) / (1024.0 * 1024.0), stats.threadCount);
+        fmt::println("    decode {:.2f}ms, {:.1f}MB/s, {:.1f}Mpixels/s", stats.decodeMs, stats.decodeMegabytesPerSecond(), stats.decodeMegapixelsPerSecond());
+        fmt::println("    total {:.2f}ms, upload {:.1f}MB/s", stats.totalMs, stats.uploadMegabytesPerSecond());
+
+        if(stats.compressedTextureCount > 0 || stats.transcodedTextureCount > 0){
+            // Sampling reads whole blocks, so texture bandwidth shrinks by the same ratio as the memory
+            double ratio = stats.uploadedBytes == 0 ? 1.0 : double(stats.rgbaEquivalentBytes) / double(stats.uploadedBytes);
+
+            fmt::println("    {} block compressed, {} transcoded to RGBA8", stats.compressedTextureCount, stats.transcodedTextureCount);
+            fmt::println("    VRAM {:.2f}MB instead of {:.2f}MB as RGBA8, {:.1f}x less memory and sampling bandwidth", double(stats.uploadedBytes) / (1024.0 * 1024.0),
+                double(stats.rgbaEquivalentBytes) / (1024.0 * 1024.0), ratio);
+        }
+    }
+
+private:
+    struct DecodedImage{
+        size_t index;
+        VkFormat format;
+        uint32_t width, height;
+
+        // Level data lives in stbPixels (a single level), in fileData, or in memory owned by the caller
+        std::vector<Ktx2::Level> levels;
+        stbi_uc* stbPixels{nullptr};
+        std::vector<char> fileData;
+        const char* externalData{nullptr};
+        bool generateMips{false};
+        bool transcoded{false};         // Block compressed in the file, expanded to RGBA8 because the device can't sample it
+
+        size_t sourceBytes{0};
+        std::string error;
+
+        const char* levelData(uint32_t level) const {
+            const char* base = stbPixels ? (const char*)stbPixels : fileData.empty() ? externalData : fileData.data();
+            return base + levels[level].byteOffset;
+        }
+    };
+
+    struct RingSlot{
+        VkCommandBuffer command;
+        VkCommandBuffer copyCommand;    // From the transfer queue, or command again without a dedicated one
+        VkFence fence;
+        size_t used{0};
+        bool recording{false};
+
+        // Staging for images larger than a slot, destroyed once the slot retires
+        std::vector<AllocatedBuffer> overflowBuffers;
+    };
+
+    VkDevice _device;
+    VkPhysicalDevice _physicalDevice;
+    VmaAllocator _allocator;
+    VkQueue _queue;
+    TransferQueue* _transfer;
+    GpuScheduler* _gpu;
+
+    VkCommandPool _commandPool;
+
+    AllocatedBuffer _ring;
+    char* _ringData;
+    size_t _slotSize;
+
+    RingSlot _slots[RING_SLOTS];
+    uint32_t _currentSlot{0};
+
+    // Decodes count images with decode(index, image) on worker threads while this thread uploads them in order of completion.
+    // format is the RGBA8 format mips are generated in. name(index) identifies an image in error messages.
+    std::vector<AllocatedImage> loadImages(size_t count, VkFormat format, uint32_t threadCount, const std::function<void(size_t, DecodedImage&)>& decode, const std::function<std::string(size_t)>& name){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        std::vector<AllocatedImage> images(count);
+        if(count == 0)
+            return images;
+
+        if(threadCount == 0){
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        threadCount = static_cast<uint32_t>(std::min<size_t>(threadCount, count));
+
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, format, &formatProperties);
+
+        const VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT;
+        bool canBlit = (formatProperties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+        VkFilter filter = (formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT) ? VK_FILTER_LINEAR : VK_FILTER_NEAREST;
+
+        if(!canBlit){
+            fmt::println("Format {} can't be blitted, textures get a single mip level", string_VkFormat(format));
+        }
+
+        // Decoded images wait here for the upload thread, workers stall when it runs too far behind
+        std::mutex mutex;
+        std::condition_variable decodedReady, queueDrained;
+        std::deque<DecodedImage> decoded;
+        const size_t maxQueued = threadCount * 2;
+
+        std::atomic<size_t> nextImage{0};
+        std::atomic<size_t> sourceBytes{0};
+
+        auto worker = [&](){
+            for(size_t i = nextImage++; i < count; i = nextImage++){
+                DecodedImage image{};
+                image.index = i;
+
+                decode(i, image);
+                sourceBytes += image.sourceBytes;
+
+                std::unique_lock<std::mutex> lock(mutex);
+                queueDrained.wait(lock, [&]{ return decoded.size() < maxQueued; });
+
+                decoded.push_back(std::move(image));
+                decodedReady.notify_one();
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(uint32_t i = 0; i < threadCount; i++){
+            threads.emplace_back(worker);
+        }
+
+        beginSlot(_slots[_currentSlot]);
+
+        for(size_t received = 0; received < count; received++){
+            DecodedImage image;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                decodedReady.wait(lock, [&]{ return !decoded.empty(); });
+
+                image = std::move(decoded.front());
+                decoded.pop_front();
+                queueDrained.notify_one();
+            }
+
+            if(received + 1 == count){
+                std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+                stats.decodeMs += elapsed.count();
+            }
+
+            if(!image.error.empty()){
+                fmt::println("Failed to load texture {}: {}", name(image.index), image.error);
+                images[image.index] = {};
+                continue;
+            }
+
+            images[image.index] = upload(image, canBlit, filter);
+
+            if(image.stbPixels){
+                stbi_image_free(image.stbPixels);
+            }
+        }
+
+        for(std::thread& thread: threads){
+            thread.join();
+        }
+
+        submitSlot(_slots[_currentSlot]);
+
+        for(uint32_t i = 0; i < RING_SLOTS; i++){
+            retireSlot(_slots[i]);
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        stats.totalMs += elapsed.count();
+        stats.sourceBytes += sourceBytes;
+        stats.threadCount = threadCount;
+
+        return images;
+    }
+
+    // Waits until the GPU is done with the slot's staging memory
+    void retireSlot(RingSlot& slot){
+        VK_CHECK(vkWaitForFences(_device, 1, &slot.fence, VK_TRUE, UINT64_MAX));
+
+        for(AllocatedBuffer& buffer: slot.overflowBuffers){
+            Utility::destroyBuffer(_allocator, buffer);
+        }
+        slot.overflowBuffers.clear();
+        slot.used = 0;
+    }
+
+    void beginSlot(RingSlot& slot){
+        retireSlot(slot);
+
+        VK_CHECK(vkResetFences(_device, 1, &slot.fence));
+        VK_CHECK(vkResetCommandBuffer(slot.command, 0));
+
+        VkCommandBufferBeginInfo beginInfo = Initializers::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        VK_CHECK(vkBeginCommandBuffer(slot.command, &beginInfo));
+
+        slot.copyCommand = _transfer->dedicated() ? _transfer->begin() : slot.command;
+        slot.recording = true;
+    }
+
+    void submitSlot(RingSlot& slot){
+        if(!slot.recording)
+            return;
+
+        VK_CHECK(vkEndCommandBuffer(slot.command));
+
+        VkCommandBufferSubmitInfo commandInfo = Initializers::commandBufferSubmitInfo(slot.command);
+        VkSemaphoreSubmitInfo waitInfo = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _transfer->timeline());
+
+        // The fence covers both halves, the graphics one can't finish before the copies it waits for
+        bool split = slot.copyCommand != slot.command;
+        if(split){
+            waitInfo.value = _transfer->submit(slot.copyCommand);
+        }
+
+        VkSubmitInfo2 submit = Initializers::submitInfo(&commandInfo, nullptr, split ? &waitInfo : nullptr);
+
+        VK_CHECK(vkQueueSubmit2(_queue, 1, &submit, slot.fence));
+
+        slot.recording = false;
+    }
+
+    void decodeStb(const std::string& path, VkFormat format, DecodedImage& image){
+        int width, height, channels;
+        image.stbPixels = stbi_load(path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+
+        if(!image.stbPixels){
+            image.error = stbi_failure_reason();
+            return;
+        }
+
+        image.format = format;
+        image.width = static_cast<uint32_t>(width);
+        image.height = static_cast<uint32_t>(height);
+        image.levels.push_back({0, uint64_t(width) * height * 4, image.width, image.height});
+        image.generateMips = true;
+    }
+
+    // Picks the file's own format when the device can sample it, and otherwise transcodes to RGBA8 if possible
+    void decodeKtx2(const std::string& path, DecodedImage& image){
+        std::vector<char> file;
+        try {
+            file = Utility::readFile(path);
+        } catch(const std::exception& e){
+            image.error = e.what();
+            return;
+        }
+
+        parseKtx2(file.data(), file.size(), image);
+
+        // Only keep the file when the levels point into it, a transcoded image already owns its pixels
+        if(image.externalData){
+            image.fileData = std::move(file);
+            image.externalData = nullptr;
+        }
+    }
+
+    // data stays owned by the caller, transcoding leaves the RGBA8 result in fileData
+    void parseKtx2(const char* data, size_t size, DecodedImage& image){
+        Ktx2::Texture texture;
+        if(!Ktx2::parse(data, size, texture, image.error))
+            return;
+
+        image.externalData = data;
+
+        image.format = texture.format;
+        image.width = texture.width;
+        image.height = texture.height;
+        image.levels = texture.levels;
+
+        VkFormatProperties formatProperties;
+        vkGetPhysicalDeviceFormatProperties(_physicalDevice, texture.format, &formatProperties);
+
+        if(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT)
+            return;
+
+        if(!BlockCompression::canDecode(texture.format)){
+            image.error = fmt::format("device can't sample {} and there is no CPU fallback for it", string_VkFormat(texture.format));
+            return;
+        }
+
+        std::vector<char> rgba;
+        for(Ktx2::Level& level: image.levels){
+            size_t offset = rgba.size();
+            rgba.resize(offset + size_t(level.width) * level.height * 4);
+
+            BlockCompression::decode(texture.format, (const uint8_t*)data + level.byteOffset, level.width, level.height, (uint8_t*)rgba.data() + offset);
+
+            level.byteOffset = offset;
+            level.byteLength = rgba.size() - offset;
+        }
+
+        image.format = BlockCompression::isSrgb(texture.format) ? VK_FORMAT_R8G8B8A8_SRGB : VK_FORMAT_R8G8B8A8_UNORM;
+        image.fileData = std::move(rgba);
+        image.externalData = nullptr;
+        image.transcoded = true;
+    }
+
+    AllocatedImage upload(const DecodedImage& decoded, bool canBlit, VkFilter filter){
+        uint32_t width = decoded.width, height = decoded.height;
+        uint32_t mipLevels = decoded.generateMips ? (canBlit ? Utility::mipLevelCount(width, height) : 1) : static_cast<uint32_t>(decoded.levels.size());
+
+        AllocatedImage image = createImage(decoded, mipLevels);
+        size_t size = stagingSize(decoded);
+
+        // Find room for the levels, moving on to the next slot when this one is full
+        VkBuffer stagingBuffer = _ring.buffer;
+        size_t stagingOffset = 0;
+        char* stagingData = nullptr;
+
+        if(size > _slotSize){
+            AllocatedBuffer overflow = Utility::createBuffer(_allocator, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+            _slots[_currentSlot].overflowBuffers.push_back(overflow);
+
+            stagingBuffer = overflow.buffer;
+            stagingData = (char*)overflow.allocation->GetMappedData();
+        } else {
+            if(_slots[_currentSlot].used + size > _slotSize){
+                submitSlot(_slots[_currentSlot]);
+
+                _currentSlot = (_currentSlot + 1) % RING_SLOTS;
+                beginSlot(_slots[_currentSlot]);
+            }
+
+            RingSlot& slot = _slots[_currentSlot];
+            stagingOffset = _currentSlot * _slotSize + slot.used;
+            stagingData = _ringData + stagingOffset;
+
+            slot.used += size;
+        }
+
+        std::vector<VkBufferImageCopy> copyRegions = writeLevels(decoded, stagingData, stagingOffset);
+
+        VkCommandBuffer command = _slots[_currentSlot].command;
+        VkCommandBuffer copyCommand = _slots[_currentSlot].copyCommand;
+
+        Utility::transitionMips(copyCommand, image.image, 0, image.mipLevels, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+        vkCmdCopyBufferToImage(copyCommand, stagingBuffer, image.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(copyRegions.size()), copyRegions.data());
+
+        // Whole levels only, so the transfer family's image granularity never gets in the way
+        _transfer->releaseImage(copyCommand, image.image, image.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+        _transfer->acquireImage(command, image.image, image.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+        if(decoded.generateMips){
+            Utility::generateMipmaps(command, image.image, {width, height}, image.mipLevels, filter);
+        } else {
+            Utility::transitionMips(command, image.image, 0, image.mipLevels, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+        }
+
+        countUpload(image, decoded.transcoded);
+        return image;
+    }
+
+    // Device local with a view of all mipLevels, nothing recorded yet
+    AllocatedImage createImage(const DecodedImage& decoded, uint32_t mipLevels){
+        AllocatedImage image{};
+        image.imageFormat = decoded.format;
+        image.imageExtent = {decoded.width, decoded.height, 1};
+        image.mipLevels = mipLevels;
+
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        if(decoded.generateMips){
+            usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        }
+
+        VkImageCreateInfo imageInfo = Initializers::imageCreateInfo(decoded.format, usage, image.imageExtent);
+        imageInfo.mipLevels = image.mipLevels;
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VK_CHECK(vmaCreateImage(_allocator, &imageInfo, &allocInfo, &image.image, &image.allocation, nullptr));
+
+        VkImageViewCreateInfo viewInfo = Initializers::imageViewCreateInfo(decoded.format, image.image, VK_IMAGE_ASPECT_COLOR_BIT);
+        viewInfo.subresourceRange.levelCount = image.mipLevels;
+
+        VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &image.imageView));
+
+        return image;
+    }
+
+    // Buffer to image copies need offsets aligned to the texel block size, which is at most 16 bytes
+    static size_t stagingSize(const DecodedImage& decoded){
+        size_t size = 0;
+        for(const Ktx2::Level& level: decoded.levels){
+            size += (level.byteLength + 15) & ~size_t(15);
+        }
+        return size;
+    }
+
+    // Copies every level to staging, which sits at stagingOffset of the buffer the returned regions copy from
+    static std::vector<VkBufferImageCopy> writeLevels(const DecodedImage& decoded, char* staging, size_t stagingOffset){
+        std::vector<VkBufferImageCopy> copyRegions;
+        size_t levelOffset = 0;
+
+        for(uint32_t level = 0; level < decoded.levels.size(); level++){
+            memcpy(staging + levelOffset, decoded.levelData(level), decoded.levels[level].byteLength);
+
+            VkBufferImageCopy copyRegion{};
+            copyRegion.bufferOffset = stagingOffset + levelOffset;
+            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copyRegion.imageSubresource.mipLevel = level;
+            copyRegion.imageSubresource.layerCount = 1;
+            copyRegion.imageExtent = {decoded.levels[level].width, decoded.levels[level].height, 1};
+            copyRegions.push_back(copyRegion);
+
+            levelOffset += (decoded.levels[level].byteLength + 15) & ~size_t(15);
+        }
+
+        return copyRegions;
+    }
+
+    void countUpload(const AllocatedImage& image, bool transcoded){
+        uint32_t width = image.imageExtent.width, height = image.imageExtent.height;
+
+        stats.textureCount++;
+        stats.decodedBytes += size_t(width) * height * 4;
+
+        Ktx2::FormatFamily family = Ktx2::formatInfo(image.imageFormat).family;
+        if(family == Ktx2::FormatFamily::BC || family == Ktx2::FormatFamily::ASTC){
+            stats.compressedTextureCount++;
+        } else if(transcoded){
+            stats.transcodedTextureCount++;
+        }
+
+        // A full mip chain adds about a third
+        uint32_t w = width, h = height;
+        for(uint32_t mip = 0; mip < image.mipLevels; mip++){
+            stats.uploadedBytes += Ktx2::levelSize(image.imageFormat, w, h);
+            stats.rgbaEquivalentBytes += size_t(w) * h * 4;
+            w = std::max(w / 2, 1u);
+            h = std::max(h / 2, 1u);
+        }
+    }
+};
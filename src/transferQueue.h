@@ -0,0 +1,213 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "initializers.h"
+
+#include <span>
+
+// Submissions on the dedicated transfer queue, so uploads run on the copy engines alongside rendering instead of
+// between frames on the graphics queue. Every submit signals the next value of one timeline semaphore, graphics work
+// that reads the results waits for that value.
+// Resources stay exclusive to one family: the copy releases them to the graphics family at the end of its submission,
+// the graphics side records the matching acquire before the first use.
+// Without a transfer-only family the queue is the graphics queue, submissions run in order with the frames and the
+// ownership transfers are skipped. Only used from the render thread.
+class TransferQueue{
+public:
+    void setup(VkDevice device, VkQueue queue, uint32_t queueFamily, uint32_t graphicsQueueFamily){
+        _device = device;
+        _queue = queue;
+        _queueFamily = queueFamily;
+        _graphicsQueueFamily = graphicsQueueFamily;
+
+        VkCommandPoolCreateInfo poolInfo = Initializers::commandPoolCreateInfo(queueFamily, VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT);
+        VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &_commandPool));
+
+        VkSemaphoreTypeCreateInfo typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
+
+        VkSemaphoreCreateInfo semaphoreInfo = Initializers::semaphoreCreateInfo();
+        semaphoreInfo.pNext = &typeInfo;
+        VK_CHECK(vkCreateSemaphore(device, &semaphoreInfo, nullptr, &_timeline));
+    }
+
+    void cleanup(){
+        wait(_submittedValue);
+
+        vkDestroySemaphore(_device, _timeline, nullptr);
+        vkDestroyCommandPool(_device, _commandPool, nullptr);
+    }
+
+    bool dedicated() const {
+        return _queueFamily != _graphicsQueueFamily;
+    }
+
+    uint32_t family() const {
+        return _queueFamily;
+    }
+
+    VkSemaphore timeline() const {
+        return _timeline;
+    }
+
+    uint64_t submittedValue() const {
+        return _submittedValue;
+    }
+
+    uint64_t completedValue(){
+        uint64_t value;
+        VK_CHECK(vkGetSemaphoreCounterValue(_device, _timeline, &value));
+        return value;
+    }
+
+    void wait(uint64_t value){
+        if(value == 0)
+            return;
+
+        VkSemaphoreWaitInfo waitInfo{};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &_timeline;
+        waitInfo.pValues = &value;
+
+        VK_CHECK(vkWaitSemaphores(_device, &waitInfo, UINT64_MAX));
+    }
+
+    // A command buffer for the transfer family in the recording state, recycled once its submission has completed
+    VkCommandBuffer begin(){
+        uint64_t completed = completedValue();
+
+        while(!_inFlight.empty() && _inFlight.front().value <= completed){
+            _freeCommands.push_back(_inFlight.front().command);
+            _inFlight.pop_front();
+        }
+
+        VkCommandBuffer command;
+        if(_freeCommands.empty()){
+            VkCommandBufferAllocateInfo allocInfo = Initializers::commandBufferAllocateInfo(_commandPool, 1);
+            VK_CHECK(vkAllocateCommandBuffers(_device, &allocInfo, &command));
+        } else {
+            command = _freeCommands.back();
+            _freeCommands.pop_back();
+            VK_CHECK(vkResetCommandBuffer(command, 0));
+        }
+
+        VkCommandBufferBeginInfo beginInfo = Initializers::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT);
+        VK_CHECK(vkBeginCommandBuffer(command, &beginInfo));
+
+        return command;
+    }
+
+    // Ends and submits a command buffer from begin(), returns the timeline value it signals when done
+    uint64_t submit(VkCommandBuffer command){
+        VK_CHECK(vkEndCommandBuffer(command));
+
+        uint64_t value = ++_submittedValue;
+
+        VkCommandBufferSubmitInfo commandInfo = Initializers::commandBufferSubmitInfo(command);
+        VkSemaphoreSubmitInfo signalInfo = Initializers::semaphoreSubmitInfo(VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, _timeline);
+        signalInfo.value = value;
+
+        VkSubmitInfo2 submit = Initializers::submitInfo(&commandInfo, &signalInfo, nullptr);
+        VK_CHECK(vkQueueSubmit2(_queue, 1, &submit, VK_NULL_HANDLE));
+
+        _inFlight.push_back({command, value});
+        return value;
+    }
+
+    // The release half, at the end of the copies. Both halves have to describe the same transfer,
+    // only the stages and accesses on their own side differ.
+    void releaseBuffers(VkCommandBuffer command, std::span<const VkBuffer> buffers){
+        recordBufferTransfer(command, buffers, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE);
+    }
+
+    // The acquire half, on the graphics queue in a submission that waits for the release's timeline value
+    void acquireBuffers(VkCommandBuffer command, std::span<const VkBuffer> buffers, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess){
+        recordBufferTransfer(command, buffers, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, dstStage, dstAccess);
+    }
+
+    // Same for all mips of an image, which keeps its layout through the transfer
+    void releaseImage(VkCommandBuffer command, VkImage image, uint32_t mipLevels, VkImageLayout layout){
+        recordImageTransfer(command, image, mipLevels, layout, VK_PIPELINE_STAGE_2_COPY_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE);
+    }
+
+    void acquireImage(VkCommandBuffer command, VkImage image, uint32_t mipLevels, VkImageLayout layout, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess){
+        recordImageTransfer(command, image, mipLevels, layout, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, dstStage, dstAccess);
+    }
+
+private:
+    struct Submission{
+        VkCommandBuffer command;
+        uint64_t value;
+    };
+
+    VkDevice _device;
+    VkQueue _queue;
+    uint32_t _queueFamily, _graphicsQueueFamily;
+
+    VkCommandPool _commandPool;
+    std::vector<VkCommandBuffer> _freeCommands;
+    std::deque<Submission> _inFlight;     // In signal order
+
+    VkSemaphore _timeline;
+    uint64_t _submittedValue{0};
+
+    void recordBufferTransfer(VkCommandBuffer command, std::span<const VkBuffer> buffers, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess){
+        if(!dedicated() || buffers.empty())
+            return;
+
+        std::vector<VkBufferMemoryBarrier2> barriers;
+
+        for(VkBuffer buffer: buffers){
+            VkBufferMemoryBarrier2 barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+            barrier.srcStageMask = srcStage;
+            barrier.srcAccessMask = srcAccess;
+            barrier.dstStageMask = dstStage;
+            barrier.dstAccessMask = dstAccess;
+            barrier.srcQueueFamilyIndex = _queueFamily;
+            barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+            barrier.buffer = buffer;
+            barrier.offset = 0;
+            barrier.size = VK_WHOLE_SIZE;
+
+            barriers.push_back(barrier);
+        }
+
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.bufferMemoryBarrierCount = static_cast<uint32_t>(barriers.size());
+        dependencyInfo.pBufferMemoryBarriers = barriers.data();
+
+        vkCmdPipelineBarrier2(command, &dependencyInfo);
+    }
+
+    void recordImageTransfer(VkCommandBuffer command, VkImage image, uint32_t mipLevels, VkImageLayout layout, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess){
+        if(!dedicated())
+            return;
+
+        VkImageMemoryBarrier2 barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+        barrier.srcStageMask = srcStage;
+        barrier.srcAccessMask = srcAccess;
+        barrier.dstStageMask = dstStage;
+        barrier.dstAccessMask = dstAccess;
+        barrier.oldLayout = layout;
+        barrier.newLayout = layout;
+        barrier.srcQueueFamilyIndex = _queueFamily;
+        barrier.dstQueueFamilyIndex = _graphicsQueueFamily;
+        barrier.image = image;
+        barrier.subresourceRange = Initializers::imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+        barrier.subresourceRange.levelCount = mipLevels;
+
+        VkDependencyInfo dependencyInfo{};
+        dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        dependencyInfo.imageMemoryBarrierCount = 1;
+        dependencyInfo.pImageMemoryBarriers = &barrier;
+
+        vkCmdPipelineBarrier2(command, &dependencyInfo);
+    }
+};
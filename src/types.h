@@ -49,6 +49,14 @@ const std::vector<const char*> deviceExtensions = {
     // VK_EXT_BUFFER_DEVICE_ADDRESS_EXTENSION_NAME
 };
 
+// Enabled only when the device supports them
+const std::vector<const char*> optionalDeviceExtensions = {
+    VK_EXT_MESH_SHADER_EXTENSION_NAME,
+    VK_KHR_PRESENT_ID_EXTENSION_NAME,
+    VK_KHR_PRESENT_WAIT_EXTENSION_NAME,
+    VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME
+};
+
 #define VK_CHECK(x)                                                     \
     do {                                                                \
         VkResult err = x;                                               \
@@ -0,0 +1,176 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "utility.h"
+#include "initializers.h"
+
+// Matches the push constants of upscale.comp
+struct UpscalerPushConstants{
+    glm::ivec2 inputExtent;
+    glm::ivec2 outputExtent;
+    float sharpness;
+};
+
+// Edge adaptive spatial upscaling, one compute pass modelled on FSR1: a 12 tap Lanczos kernel that is stretched along
+// the local edge direction and clamped to the nearest texels, plus an RCAS style sharpening lobe applied before the store.
+// Reads the rendered corner of the input with texelFetch, so the input can be larger than what was drawn into it.
+class Upscaler{
+public:
+    float sharpness{0.25f};
+
+    // typedStorage loads the build that can only write RGBA16F, for devices without formatless storage writes
+    void setup(VkDevice device, bool typedStorage = false){
+        _device = device;
+
+        DescriptorLayoutBuilder builder;
+        builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        builder.addBinding(1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        _setLayout = builder.build(device, VK_SHADER_STAGE_COMPUTE_BIT);
+
+        VkPushConstantRange pushConstant{};
+        pushConstant.offset = 0;
+        pushConstant.size = sizeof(UpscalerPushConstants);
+        pushConstant.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkPipelineLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &_setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstant;
+
+        VK_CHECK(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &_pipelineLayout));
+
+        VkShaderModule shader;
+        if(!Utility::loadShaderModule(typedStorage ? "shaders\\upscale.comp.typed.spv" : "shaders\\upscale.comp.spv", device, &shader)){
+            throw std::runtime_error("Failed to load upscale Shader!");
+        }
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.layout = _pipelineLayout;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = shader;
+        pipelineInfo.stage.pName = "main";
+
+        VK_CHECK(vkCreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &_pipeline));
+
+        vkDestroyShaderModule(device, shader, nullptr);
+
+        // Never filters, but the descriptor needs one
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        VK_CHECK(vkCreateSampler(device, &samplerInfo, nullptr, &_sampler));
+    }
+
+    void cleanup(){
+        vkDestroySampler(_device, _sampler, nullptr);
+        vkDestroyPipeline(_device, _pipeline, nullptr);
+        vkDestroyPipelineLayout(_device, _pipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(_device, _setLayout, nullptr);
+    }
+
+    // input in SHADER_READ_ONLY_OPTIMAL, output in GENERAL. The set comes from the frame's allocator.
+    void record(VkCommandBuffer command, DescriptorAllocator& frameDescriptors, VkImageView input, VkExtent2D inputExtent, VkImageView output, VkExtent2D outputExtent){
+        VkDescriptorSet set = frameDescriptors.allocate(_device, _setLayout);
+
+        DescriptorWriter writer;
+        writer.writeImage(0, input, _sampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.writeImage(1, output, VK_NULL_HANDLE, VK_IMAGE_LAYOUT_GENERAL, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE);
+        writer.updateSet(_device, set);
+
+        UpscalerPushConstants constants{};
+        constants.inputExtent = glm::ivec2(inputExtent.width, inputExtent.height);
+        constants.outputExtent = glm::ivec2(outputExtent.width, outputExtent.height);
+        constants.sharpness = sharpness;
+
+        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_COMPUTE, _pipeline);
+        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_COMPUTE, _pipelineLayout, 0, 1, &set, 0, nullptr);
+        vkCmdPushConstants(command, _pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(UpscalerPushConstants), &constants);
+        vkCmdDispatch(command, (outputExtent.width + 15) / 16, (outputExtent.height + 15) / 16, 1);
+    }
+
+private:
+    VkDevice _device;
+
+    VkDescriptorSetLayout _setLayout;
+    VkPipelineLayout _pipelineLayout;
+    VkPipeline _pipeline;
+    VkSampler _sampler;
+};
+
+struct DynamicResolutionStats{
+    uint32_t changes{0};
+    double scaleSum{0.0};
+    uint64_t frames{0};
+
+    double averageScale() const {
+        return frames == 0 ? 1.0 : scaleSum / frames;
+    }
+};
+
+// Closed loop control of the render resolution from the measured GPU frame time. GPU time goes roughly with the pixel
+// count, so the scale per axis that would hit the target is scale * sqrt(target / measured). Each new measurement moves
+// part of the way there, and errors inside the deadband are left alone, so the GPU time readback FRAME_OVERLAP frames
+// behind doesn't make it oscillate.
+class DynamicResolution{
+public:
+    static constexpr float MIN_SCALE = 0.5f;
+    static constexpr float MAX_SCALE = 1.f;
+    static constexpr float GAIN = 0.3f;
+    static constexpr double DEADBAND = 0.05;
+    static const uint32_t EXTENT_GRANULARITY = 8;   // Small steps would change the extent nearly every measurement
+
+    bool enabled{false};
+    float targetMs{1000.f / 60.f};
+    float scale{1.f};       // Of the output extent per axis, set by hand while not enabled
+
+    DynamicResolutionStats stats;
+
+    // Once per new GPU frame time
+    void update(double gpuMs){
+        if(!enabled || gpuMs <= 0.0)
+            return;
+
+        double ratio = targetMs / gpuMs;
+        if(std::abs(ratio - 1.0) < DEADBAND)
+            return;
+
+        float wanted = scale * static_cast<float>(std::sqrt(ratio));
+        scale = std::clamp(scale + GAIN * (wanted - scale), MIN_SCALE, MAX_SCALE);
+    }
+
+    // The output extent at full scale, otherwise rounded down to the granularity
+    VkExtent2D extent(VkExtent2D output) const {
+        if(scale >= MAX_SCALE)
+            return output;
+
+        auto scaled = [&](uint32_t size){
+            uint32_t value = static_cast<uint32_t>(size * scale) / EXTENT_GRANULARITY * EXTENT_GRANULARITY;
+            return std::clamp(value, std::min(EXTENT_GRANULARITY, size), size);
+        };
+
+        return {scaled(output.width), scaled(output.height)};
+    }
+
+    void recordFrame(bool extentChanged){
+        stats.frames++;
+        stats.scaleSum += scale;
+        if(extentChanged){
+            stats.changes++;
+        }
+    }
+
+    void printStats(){
+        fmt::println("Dynamic resolution {}: average scale {:.2f}, {} render extent changes over {} frames", enabled ? "on" : "off",
+            stats.averageScale(), stats.changes, stats.frames);
+    }
+};
@@ -35,7 +35,7 @@ namespace Utility{
         imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
         imageBarrier.pNext = nullptr;
 
-        imageBarrier.srcStageMask - VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+        imageBarrier.srcStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
         imageBarrier.srcAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT;
         imageBarrier.dstStageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
         imageBarrier.dstAccessMask = VK_ACCESS_2_MEMORY_WRITE_BIT | VK_ACCESS_2_MEMORY_READ_BIT;
@@ -97,6 +97,100 @@ namespace Utility{
         vkCmdBlitImage2(command, &blitInfo);
     }
 
+    // Barrier on a range of mip levels, for when stages and accesses matter more than in transitionImage
+    void transitionMips(VkCommandBuffer command, VkImage image, uint32_t baseMip, uint32_t mipCount, VkImageLayout currentLayout, VkImageLayout newLayout, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess, VkPipelineStageFlags2 dstStage, VkAccessFlags2 dstAccess){
+        VkImageMemoryBarrier2 imageBarrier{};
+        imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2;
+
+        imageBarrier.srcStageMask = srcStage;
+        imageBarrier.srcAccessMask = srcAccess;
+        imageBarrier.dstStageMask = dstStage;
+        imageBarrier.dstAccessMask = dstAccess;
+
+        imageBarrier.oldLayout = currentLayout;
+        imageBarrier.newLayout = newLayout;
+
+        imageBarrier.subresourceRange = Initializers::imageSubresourceRange(VK_IMAGE_ASPECT_COLOR_BIT);
+        imageBarrier.subresourceRange.baseMipLevel = baseMip;
+        imageBarrier.subresourceRange.levelCount = mipCount;
+        imageBarrier.image = image;
+
+        VkDependencyInfo depInfo{};
+        depInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        depInfo.imageMemoryBarrierCount = 1;
+        depInfo.pImageMemoryBarriers = &imageBarrier;
+
+        vkCmdPipelineBarrier2(command, &depInfo);
+    }
+
+    // Expects every level in TRANSFER_DST_OPTIMAL with level 0 filled, leaves all of them in SHADER_READ_ONLY_OPTIMAL.
+    // Each level is blitted from the one above it.
+    void generateMipmaps(VkCommandBuffer command, VkImage image, VkExtent2D size, uint32_t mipLevels, VkFilter filter = VK_FILTER_LINEAR){
+        int32_t width = static_cast<int32_t>(size.width), height = static_cast<int32_t>(size.height);
+
+        for(uint32_t mip = 1; mip < mipLevels; mip++){
+            transitionMips(command, image, mip - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT);
+
+            int32_t nextWidth = std::max(width / 2, 1), nextHeight = std::max(height / 2, 1);
+
+            VkImageBlit2 blitRegion{};
+            blitRegion.sType = VK_STRUCTURE_TYPE_IMAGE_BLIT_2;
+
+            blitRegion.srcOffsets[1] = {width, height, 1};
+            blitRegion.dstOffsets[1] = {nextWidth, nextHeight, 1};
+
+            blitRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blitRegion.srcSubresource.layerCount = 1;
+            blitRegion.srcSubresource.mipLevel = mip - 1;
+
+            blitRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            blitRegion.dstSubresource.layerCount = 1;
+            blitRegion.dstSubresource.mipLevel = mip;
+
+            VkBlitImageInfo2 blitInfo{};
+            blitInfo.sType = VK_STRUCTURE_TYPE_BLIT_IMAGE_INFO_2;
+            blitInfo.srcImage = image;
+            blitInfo.srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            blitInfo.dstImage = image;
+            blitInfo.dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            blitInfo.filter = filter;
+            blitInfo.regionCount = 1;
+            blitInfo.pRegions = &blitRegion;
+
+            vkCmdBlitImage2(command, &blitInfo);
+
+            width = nextWidth;
+            height = nextHeight;
+        }
+
+        const VkPipelineStageFlags2 shaderStages = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+
+        if(mipLevels > 1){
+            transitionMips(command, image, 0, mipLevels - 1, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_2_BLIT_BIT, VK_ACCESS_2_TRANSFER_READ_BIT, shaderStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+        }
+
+        // The last level was only ever written to
+        transitionMips(command, image, mipLevels - 1, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, shaderStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+    }
+
+    // FNV-1a, for telling apart states that are compared from frame to frame
+    constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+
+    uint64_t hashBytes(uint64_t hash, const void* data, size_t size){
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        for(size_t i = 0; i < size; i++){
+            hash = (hash ^ bytes[i]) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint32_t mipLevelCount(uint32_t width, uint32_t height){
+        return static_cast<uint32_t>(std::floor(std::log2(std::max(width, height)))) + 1;
+    }
+
     std::vector<char> readFile(const std::string& filename){
         std::ifstream file(filename, std::ios::ate | std::ios::binary);
 
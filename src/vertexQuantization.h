@@ -0,0 +1,80 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+
+#include <glm/packing.hpp>
+#include <glm/gtc/packing.hpp>
+
+// Encoding of Vertex into CompactVertex, decoded again in shader.vert / meshlet.mesh
+namespace VertexQuantization{
+    struct EncodedVertices{
+        std::vector<CompactVertex> vertices;
+        glm::vec4 positionMin;
+        glm::vec4 positionExtent;
+    };
+
+    glm::vec2 octahedralEncode(glm::vec3 n){
+        float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+        if(l1 == 0.f)
+            return glm::vec2(0.f);
+
+        n /= l1;
+
+        glm::vec2 p{n.x, n.y};
+        if(n.z < 0.f){
+            glm::vec2 signs{p.x >= 0.f ? 1.f : -1.f, p.y >= 0.f ? 1.f : -1.f};
+            p = (1.f - glm::abs(glm::vec2(p.y, p.x))) * signs;
+        }
+
+        return p;
+    }
+
+    void computeBounds(const std::vector<Vertex>& vertices, glm::vec4& positionMin, glm::vec4& positionExtent){
+        glm::vec3 minPos{0.f}, maxPos{0.f};
+
+        if(!vertices.empty()){
+            minPos = maxPos = vertices[0].position;
+        }
+
+        for(const Vertex& v: vertices){
+            minPos = glm::min(minPos, v.position);
+            maxPos = glm::max(maxPos, v.position);
+        }
+
+        positionMin = glm::vec4(minPos, 0.f);
+        positionExtent = glm::vec4(maxPos - minPos, 0.f);
+    }
+
+    CompactVertex encodeVertex(const Vertex& v, glm::vec4 positionMin, glm::vec4 positionExtent){
+        CompactVertex out;
+
+        for(int i = 0; i < 3; i++){
+            // Flat axes have no extent, everything sits on the minimum
+            float t = positionExtent[i] > 0.f ? (v.position[i] - positionMin[i]) / positionExtent[i] : 0.f;
+            out.position[i] = static_cast<uint16_t>(std::round(std::clamp(t, 0.f, 1.f) * 65535.f));
+        }
+
+        out.normal = glm::packSnorm2x8(octahedralEncode(v.normal));
+        out.uv = glm::packHalf2x16(glm::vec2(v.uv_x, v.uv_y));
+        out.color = glm::packUnorm4x8(v.color);
+
+        return out;
+    }
+
+    EncodedVertices encode(const std::vector<Vertex>& vertices){
+        EncodedVertices encoded;
+        computeBounds(vertices, encoded.positionMin, encoded.positionExtent);
+
+        encoded.vertices.resize(vertices.size());
+        for(size_t i = 0; i < vertices.size(); i++){
+            encoded.vertices[i] = encodeVertex(vertices[i], encoded.positionMin, encoded.positionExtent);
+        }
+
+        return encoded;
+    }
+
+    size_t vertexStride(VertexFormat format){
+        return format == VERTEX_FORMAT_COMPACT ? sizeof(CompactVertex) : sizeof(Vertex);
+    }
+};
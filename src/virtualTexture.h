@@ -0,0 +1,785 @@
+#pragma once
+
+#include "types.h"
+#include "structs.h"
+#include "utility.h"
+#include "initializers.h"
+#include "blockCompression.h"
+#include "textureLoader.h"      // stb_image
+
+#include <bit>
+#include <condition_variable>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+
+// Matches VirtualTextureParams in virtualTexture.frag and virtualTextureFeedback.frag
+struct VirtualTextureParams{
+    glm::vec4 virtualSize;      // xy mip 0 size in texels, zw maps mesh uvs onto the source image inside the padded page grid
+    glm::uvec4 pageGrid;        // xy pages at mip 0, z mip count, w page size without borders
+    glm::vec4 cache;            // x page stride, y border, z 1 / cache size, w lod bias of the feedback pass
+};
+
+struct VirtualTextureStats{
+    uint64_t pagesRequested{0};
+    uint64_t pagesUploaded{0};
+    uint64_t pagesEvicted{0};
+    uint64_t uploadsDropped{0};     // Cache full of pages that were visible in the last frames
+    uint32_t feedbackRequests{0};   // Unique pages in the last readback
+    uint32_t residentPages{0};
+    uint32_t pendingPages{0};
+};
+
+// Sparse virtual texture. A large image is cooked once into a file of bordered pages per mip, only the pages the camera
+// needs live in a fixed size page cache texture, and an indirection texture (one texel per page per mip) points every
+// virtual page at its cache slot or at the closest resident ancestor.
+//
+// Each frame the meshes that use it are drawn into a small R32_UINT feedback target that stores the (page, mip) every
+// pixel wants, the caller provides it and its depth buffer. The target is copied to a per frame readback buffer and read FRAME_OVERLAP frames later, after that
+// frame's fence, so the CPU never waits on the GPU. Missing pages are queued for a loader thread, finished pages are
+// copied into the cache at the start of a frame, evicting the least recently requested ones once the budget is used up.
+// The coarsest mip is a single page that never gets evicted, so there is always something to sample.
+class VirtualTexture{
+public:
+    static const uint32_t PAGE_SIZE = 128;
+    static const uint32_t PAGE_BORDER = 4;      // Enough for bilinear and a bit of anisotropy at the page edges
+    static const uint32_t PAGE_STRIDE = PAGE_SIZE + 2 * PAGE_BORDER;
+    static const uint32_t PAGE_BYTES = PAGE_STRIDE * PAGE_STRIDE * 4;
+
+    static const uint32_t FEEDBACK_DIVISOR = 8;
+    static const uint32_t MAX_UPLOADS_PER_FRAME = 16;
+    static const uint32_t MAX_PENDING_PAGES = 64;
+
+    static constexpr VkFormat CACHE_FORMAT = VK_FORMAT_R8G8B8A8_SRGB;
+    static constexpr VkFormat FEEDBACK_FORMAT = VK_FORMAT_R32_UINT;
+    static constexpr VkFormat FEEDBACK_DEPTH_FORMAT = VK_FORMAT_D32_SFLOAT;
+
+    // Binding 0 indirection, 1 page cache, 2 VirtualTextureParams. Meshes put it in set 1.
+    VkDescriptorSetLayout setLayout{VK_NULL_HANDLE};
+    VkDescriptorSet set{VK_NULL_HANDLE};
+
+    VirtualTextureStats stats;
+
+    bool enabled() const {
+        return _enabled;
+    }
+
+    // Cooks sourcePath into sourcePath + ".vtpages" when that is missing or older than the source
+    void setup(VkDevice device, VmaAllocator allocator, const std::string& sourcePath, VkExtent2D drawExtent, size_t cacheBudget = 64 * 1024 * 1024){
+        _device = device;
+        _allocator = allocator;
+
+        _pagePath = sourcePath + ".vtpages";
+
+        std::error_code error;
+        if(!std::filesystem::exists(_pagePath) || std::filesystem::last_write_time(_pagePath, error) < std::filesystem::last_write_time(sourcePath, error)){
+            if(!cookPageFile(sourcePath, _pagePath)){
+                throw std::runtime_error("Failed to cook virtual texture " + sourcePath);
+            }
+        }
+
+        readPageFileHeader();
+
+        // Square cache within the budget, slot coordinates are packed into 8 bits each and the side stays under 16k texels
+        uint32_t slotsPerSide = static_cast<uint32_t>(std::sqrt(double(cacheBudget) / PAGE_BYTES));
+        slotsPerSide = std::clamp(slotsPerSide, 2u, std::min(255u, 16384u / PAGE_STRIDE));
+
+        _slotsPerSide = slotsPerSide;
+        _slots.resize(slotsPerSide * slotsPerSide);
+        for(uint32_t i = 0; i < _slots.size(); i++){
+            _freeSlots.push_back(static_cast<uint32_t>(_slots.size()) - 1 - i);
+        }
+
+        _pageSlot.assign(_pageCount, -1);
+        _pagePending.assign(_pageCount, false);
+        _indirection.assign(_pageCount, 0);
+
+        createImages();
+        _feedbackExtent = feedbackExtent(drawExtent);
+        createReadbacks(drawExtent);
+        createDescriptors();
+
+        for(uint32_t i = 0; i < FRAME_OVERLAP; i++){
+            _frames[i].staging = Utility::createBuffer(_allocator, MAX_UPLOADS_PER_FRAME * PAGE_BYTES + _pageCount * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VMA_MEMORY_USAGE_CPU_ONLY);
+        }
+
+        // The coarsest mip is the fallback for everything, load it before the first frame
+        uint32_t rootPage = _mipPageOffset[_mipCount - 1];
+        _pagePending[rootPage] = true;
+        _loadedPages.push_back({rootPage, readPage(_pageFile, rootPage)});
+        _pendingCount = 1;
+        _pageFile.close();
+
+        _loader = std::thread([this]{ loaderThread(); });
+
+        _enabled = true;
+
+        fmt::println("Virtual texture {}: {}x{} pages, {} mips, {} pages in the cache ({:.1f}MB)", sourcePath, _pagesX, _pagesY, _mipCount,
+            _slots.size(), double(_slots.size()) * PAGE_BYTES / (1024.0 * 1024.0));
+    }
+
+    void cleanup(){
+        if(!_enabled)
+            return;
+
+        {
+            std::lock_guard<std::mutex> lock(_loaderMutex);
+            _stopLoader = true;
+        }
+        _loaderWake.notify_all();
+        _loader.join();
+
+        destroyReadbacks();
+
+        for(uint32_t i = 0; i < FRAME_OVERLAP; i++){
+            Utility::destroyBuffer(_allocator, _frames[i].staging);
+        }
+
+        _descriptorAllocator.destroyPool(_device);
+        vkDestroyDescriptorSetLayout(_device, setLayout, nullptr);
+        Utility::destroyBuffer(_allocator, _paramsBuffer);
+
+        vkDestroySampler(_device, _cacheSampler, nullptr);
+        vkDestroySampler(_device, _indirectionSampler, nullptr);
+
+        vkDestroyImageView(_device, _cache.imageView, nullptr);
+        vmaDestroyImage(_allocator, _cache.image, _cache.allocation);
+        vkDestroyImageView(_device, _indirectionImage.imageView, nullptr);
+        vmaDestroyImage(_allocator, _indirectionImage.image, _indirectionImage.allocation);
+
+        _enabled = false;
+    }
+
+    // The feedback target follows drawExtent, the readback buffers are sized for drawCapacity and only replaced when
+    // that changes. The old ones go into retired with whatever they still have in flight, their readbacks are dropped.
+    void resize(VkExtent2D drawExtent, VkExtent2D drawCapacity, DeletionQueue& retired){
+        if(!_enabled)
+            return;
+
+        _feedbackExtent = feedbackExtent(drawExtent);
+
+        VkExtent2D readbackCapacity = feedbackExtent(drawCapacity);
+        if(readbackCapacity.width == _readbackCapacity.width && readbackCapacity.height == _readbackCapacity.height)
+            return;
+
+        std::vector<AllocatedBuffer> readbacks;
+        for(uint32_t i = 0; i < FRAME_OVERLAP; i++){
+            readbacks.push_back(_frames[i].readback);
+        }
+
+        retired.pushFunction([this, readbacks](){
+            for(AllocatedBuffer buffer: readbacks){
+                Utility::destroyBuffer(_allocator, buffer);
+            }
+        });
+
+        createReadbacks(drawCapacity);
+    }
+
+    // Call after the frame's fence was waited on and before anything samples the texture.
+    // Consumes the feedback this frame slot recorded FRAME_OVERLAP frames ago and uploads pages the loader finished.
+    void beginFrame(VkCommandBuffer command, uint32_t frameIndex){
+        if(!_enabled)
+            return;
+
+        _frameNumber++;
+
+        FrameResources& frame = _frames[frameIndex];
+        if(frame.readbackValid){
+            processFeedback(frame);
+        }
+
+        uploadPages(command, frame);
+
+        stats.residentPages = static_cast<uint32_t>(_slots.size() - _freeSlots.size());
+        stats.pendingPages = _pendingCount;
+    }
+
+    // Meshes draw with their feedback pipelines between beginFeedback and endFeedback. The targets are feedbackExtent()
+    // sized FEEDBACK_FORMAT and FEEDBACK_DEPTH_FORMAT images the caller owns, in attachment layouts.
+    void beginFeedback(VkCommandBuffer command, VkImageView feedbackView, VkImageView depthView, VkAttachmentStoreOp depthStoreOp = VK_ATTACHMENT_STORE_OP_STORE){
+        VkClearValue clear{};
+        clear.color.uint32[0] = UINT32_MAX;
+
+        VkRenderingAttachmentInfo colorAttachment = Initializers::attachmentInfo(feedbackView, &clear, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL);
+        VkRenderingAttachmentInfo depthAttachment = Initializers::depthAttachmentInfo(depthView, VK_IMAGE_LAYOUT_DEPTH_ATTACHMENT_OPTIMAL);
+        depthAttachment.storeOp = depthStoreOp;
+
+        VkRenderingInfo renderInfo = Initializers::renderingInfo(_feedbackExtent, &colorAttachment, &depthAttachment);
+
+        VkViewport viewport{};
+        viewport.width = _feedbackExtent.width;
+        viewport.height = _feedbackExtent.height;
+        viewport.minDepth = 0.f;
+        viewport.maxDepth = 1.f;
+
+        VkRect2D scissor{};
+        scissor.extent = _feedbackExtent;
+
+        vkCmdBeginRendering(command, &renderInfo);
+        vkCmdSetViewport(command, 0, 1, &viewport);
+        vkCmdSetScissor(command, 0, 1, &scissor);
+    }
+
+    void endFeedback(VkCommandBuffer command){
+        vkCmdEndRendering(command);
+    }
+
+    // Copies the feedback target, in TRANSFER_SRC_OPTIMAL by now, into this frame slot's readback buffer
+    void readbackFeedback(VkCommandBuffer command, VkImage feedbackImage, uint32_t frameIndex){
+        FrameResources& frame = _frames[frameIndex];
+
+        VkBufferImageCopy copyRegion{};
+        copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        copyRegion.imageSubresource.layerCount = 1;
+        copyRegion.imageExtent = {_feedbackExtent.width, _feedbackExtent.height, 1};
+
+        vkCmdCopyImageToBuffer(command, feedbackImage, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, frame.readback.buffer, 1, &copyRegion);
+        frame.readbackExtent = _feedbackExtent;
+
+        VkBufferMemoryBarrier2 hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2;
+        hostBarrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        hostBarrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        hostBarrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+        hostBarrier.buffer = frame.readback.buffer;
+        hostBarrier.size = VK_WHOLE_SIZE;
+
+        VkDependencyInfo depInfo{};
+        depInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+        depInfo.bufferMemoryBarrierCount = 1;
+        depInfo.pBufferMemoryBarriers = &hostBarrier;
+
+        vkCmdPipelineBarrier2(command, &depInfo);
+
+        frame.readbackValid = true;
+    }
+
+    VkExtent2D feedbackExtent() const {
+        return _feedbackExtent;
+    }
+
+    static VkExtent2D feedbackExtent(VkExtent2D drawExtent){
+        return {std::max(drawExtent.width / FEEDBACK_DIVISOR, 1u), std::max(drawExtent.height / FEEDBACK_DIVISOR, 1u)};
+    }
+
+    void imguiInterface(){
+        if(!_enabled)
+            return;
+
+        if(ImGui::Begin("Virtual Texture")){
+            ImGui::Text("%ux%u pages, %u mips", _pagesX, _pagesY, _mipCount);
+            ImGui::Text("Cache %u / %zu pages", stats.residentPages, _slots.size());
+            ImGui::Text("Visible pages %u, loading %u", stats.feedbackRequests, stats.pendingPages);
+            ImGui::Text("Requested %llu, uploaded %llu, evicted %llu, dropped %llu", (unsigned long long)stats.pagesRequested,
+                (unsigned long long)stats.pagesUploaded, (unsigned long long)stats.pagesEvicted, (unsigned long long)stats.uploadsDropped);
+        }
+        ImGui::End();
+    }
+
+    // Mip chain of the source, padded to a power of two grid of pages by repeating the edges, then cut into bordered pages.
+    // Pages are stored mip by mip in row order, so a page's offset follows from its index.
+    static bool cookPageFile(const std::string& sourcePath, const std::string& pagePath){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        int width, height, channels;
+        stbi_uc* pixels = stbi_load(sourcePath.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+        if(!pixels){
+            fmt::println("Failed to load {}: {}", sourcePath, stbi_failure_reason());
+            return false;
+        }
+
+        PageFileHeader header{};
+        memcpy(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic));
+        header.version = PAGE_FILE_VERSION;
+        header.sourceWidth = static_cast<uint32_t>(width);
+        header.sourceHeight = static_cast<uint32_t>(height);
+        header.pagesX = std::bit_ceil((header.sourceWidth + PAGE_SIZE - 1) / PAGE_SIZE);
+        header.pagesY = std::bit_ceil((header.sourceHeight + PAGE_SIZE - 1) / PAGE_SIZE);
+        header.mipCount = std::bit_width(std::max(header.pagesX, header.pagesY));
+        header.pageSize = PAGE_SIZE;
+        header.border = PAGE_BORDER;
+
+        uint32_t mipWidth = header.pagesX * PAGE_SIZE, mipHeight = header.pagesY * PAGE_SIZE;
+
+        std::vector<uint8_t> mip(size_t(mipWidth) * mipHeight * 4);
+        for(uint32_t y = 0; y < mipHeight; y++){
+            for(uint32_t x = 0; x < mipWidth; x++){
+                uint32_t sx = std::min<uint32_t>(x, width - 1), sy = std::min<uint32_t>(y, height - 1);
+                memcpy(&mip[(size_t(y) * mipWidth + x) * 4], pixels + (size_t(sy) * width + sx) * 4, 4);
+            }
+        }
+        stbi_image_free(pixels);
+
+        std::ofstream file(pagePath, std::ios::binary);
+        file.write((const char*)&header, sizeof(header));
+
+        std::vector<uint8_t> page(PAGE_BYTES);
+
+        for(uint32_t level = 0; level < header.mipCount; level++){
+            uint32_t pagesX = std::max(header.pagesX >> level, 1u), pagesY = std::max(header.pagesY >> level, 1u);
+
+            for(uint32_t py = 0; py < pagesY; py++){
+                for(uint32_t px = 0; px < pagesX; px++){
+                    for(uint32_t y = 0; y < PAGE_STRIDE; y++){
+                        for(uint32_t x = 0; x < PAGE_STRIDE; x++){
+                            int64_t sx = std::clamp<int64_t>(int64_t(px * PAGE_SIZE + x) - PAGE_BORDER, 0, mipWidth - 1);
+                            int64_t sy = std::clamp<int64_t>(int64_t(py * PAGE_SIZE + y) - PAGE_BORDER, 0, mipHeight - 1);
+                            memcpy(&page[(size_t(y) * PAGE_STRIDE + x) * 4], &mip[(size_t(sy) * mipWidth + sx) * 4], 4);
+                        }
+                    }
+
+                    file.write((const char*)page.data(), page.size());
+                }
+            }
+
+            mip = BlockCompression::downsample(mip, mipWidth, mipHeight, true);
+            mipWidth = std::max(mipWidth / 2, 1u);
+            mipHeight = std::max(mipHeight / 2, 1u);
+        }
+
+        if(!file){
+            fmt::println("Failed to write {}", pagePath);
+            return false;
+        }
+
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+        fmt::println("Cooked {} into {} ({}x{} pages, {} mips) in {:.2f}ms", sourcePath, pagePath, header.pagesX, header.pagesY, header.mipCount, elapsed.count());
+
+        return true;
+    }
+
+private:
+    static constexpr char PAGE_FILE_MAGIC[4] = {'V', 'T', 'P', 'G'};
+    static const uint32_t PAGE_FILE_VERSION = 1;
+
+    struct PageFileHeader{
+        char magic[4];
+        uint32_t version;
+        uint32_t sourceWidth, sourceHeight;
+        uint32_t pagesX, pagesY;
+        uint32_t mipCount;
+        uint32_t pageSize, border;
+    };
+
+    struct CacheSlot{
+        int32_t page{-1};
+        uint64_t lastUsed{0};
+    };
+
+    struct LoadedPage{
+        uint32_t page;
+        std::vector<uint8_t> pixels;
+    };
+
+    struct FrameResources{
+        AllocatedBuffer staging;        // Pages, then the whole indirection table
+        AllocatedBuffer readback;
+        VkExtent2D readbackExtent;
+        bool readbackValid{false};
+    };
+
+    bool _enabled{false};
+
+    VkDevice _device;
+    VmaAllocator _allocator;
+
+    std::string _pagePath;
+    std::ifstream _pageFile;    // Closed once the loader thread opens its own
+
+    uint32_t _sourceWidth, _sourceHeight;
+    uint32_t _pagesX, _pagesY, _mipCount;
+    uint32_t _pageCount;
+    std::vector<uint32_t> _mipPageOffset;
+
+    AllocatedImage _cache, _indirectionImage;
+    VkSampler _cacheSampler, _indirectionSampler;
+    AllocatedBuffer _paramsBuffer;
+    DescriptorAllocator _descriptorAllocator;
+    bool _imagesInitialized{false};
+
+    VkExtent2D _feedbackExtent;
+    VkExtent2D _readbackCapacity;
+
+    FrameResources _frames[FRAME_OVERLAP];
+    uint64_t _frameNumber{0};
+
+    uint32_t _slotsPerSide;
+    std::vector<CacheSlot> _slots;
+    std::vector<uint32_t> _freeSlots;
+    std::vector<int32_t> _pageSlot;     // Cache slot of every page, -1 when not resident
+    std::vector<bool> _pagePending;
+    uint32_t _pendingCount{0};
+
+    // One entry per page, laid out like the page ids, so it uploads mip by mip as is
+    std::vector<uint32_t> _indirection;
+    bool _indirectionDirty{true};
+
+    std::thread _loader;
+    std::mutex _loaderMutex;
+    std::condition_variable _loaderWake;
+    std::deque<uint32_t> _loadRequests;
+    std::deque<LoadedPage> _loadedPages;
+    bool _stopLoader{false};
+
+    uint32_t pagesAtMip(uint32_t pages, uint32_t mip) const {
+        return std::max(pages >> mip, 1u);
+    }
+
+    uint32_t pageId(uint32_t mip, uint32_t x, uint32_t y) const {
+        return _mipPageOffset[mip] + y * pagesAtMip(_pagesX, mip) + x;
+    }
+
+    void readPageFileHeader(){
+        _pageFile.open(_pagePath, std::ios::binary);
+
+        PageFileHeader header{};
+        _pageFile.read((char*)&header, sizeof(header));
+
+        if(!_pageFile || memcmp(header.magic, PAGE_FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != PAGE_FILE_VERSION || header.pageSize != PAGE_SIZE || header.border != PAGE_BORDER){
+            throw std::runtime_error("Invalid virtual texture page file " + _pagePath);
+        }
+
+        _sourceWidth = header.sourceWidth;
+        _sourceHeight = header.sourceHeight;
+        _pagesX = header.pagesX;
+        _pagesY = header.pagesY;
+        _mipCount = header.mipCount;
+
+        _pageCount = 0;
+        for(uint32_t mip = 0; mip < _mipCount; mip++){
+            _mipPageOffset.push_back(_pageCount);
+            _pageCount += pagesAtMip(_pagesX, mip) * pagesAtMip(_pagesY, mip);
+        }
+    }
+
+    static std::vector<uint8_t> readPage(std::ifstream& file, uint32_t page){
+        std::vector<uint8_t> pixels(PAGE_BYTES);
+
+        file.seekg(sizeof(PageFileHeader) + uint64_t(page) * PAGE_BYTES);
+        file.read((char*)pixels.data(), PAGE_BYTES);
+
+        return pixels;
+    }
+
+    void loaderThread(){
+        std::ifstream file(_pagePath, std::ios::binary);
+
+        while(true){
+            uint32_t page;
+            {
+                std::unique_lock<std::mutex> lock(_loaderMutex);
+                _loaderWake.wait(lock, [this]{ return _stopLoader || !_loadRequests.empty(); });
+
+                if(_stopLoader)
+                    return;
+
+                page = _loadRequests.front();
+                _loadRequests.pop_front();
+            }
+
+            std::vector<uint8_t> pixels = readPage(file, page);
+
+            std::lock_guard<std::mutex> lock(_loaderMutex);
+            _loadedPages.push_back({page, std::move(pixels)});
+        }
+    }
+
+    void processFeedback(FrameResources& frame){
+        VK_CHECK(vmaInvalidateAllocation(_allocator, frame.readback.allocation, 0, VK_WHOLE_SIZE));
+
+        const uint32_t* texels = (const uint32_t*)frame.readback.allocation->GetMappedData();
+        size_t texelCount = size_t(frame.readbackExtent.width) * frame.readbackExtent.height;
+
+        std::unordered_set<uint32_t> requests;
+        for(size_t i = 0; i < texelCount; i++){
+            if(texels[i] != UINT32_MAX){
+                requests.insert(texels[i]);
+            }
+        }
+
+        stats.feedbackRequests = static_cast<uint32_t>(requests.size());
+
+        // Ancestors are needed as fallbacks while a page loads, so they are requested and kept alive too
+        std::vector<std::pair<uint32_t, uint32_t>> missing;     // mip, page
+
+        for(uint32_t request: requests){
+            uint32_t x = request & 0xfff, y = (request >> 12) & 0xfff, mip = std::min(request >> 24, _mipCount - 1);
+
+            for(; mip < _mipCount; mip++){
+                x = std::min(x, pagesAtMip(_pagesX, mip) - 1);
+                y = std::min(y, pagesAtMip(_pagesY, mip) - 1);
+
+                uint32_t page = pageId(mip, x, y);
+
+                if(_pageSlot[page] >= 0){
+                    _slots[_pageSlot[page]].lastUsed = _frameNumber;
+                } else if(!_pagePending[page] && _pendingCount + missing.size() < MAX_PENDING_PAGES){
+                    _pagePending[page] = true;
+                    missing.push_back({mip, page});
+                }
+
+                x >>= 1;
+                y >>= 1;
+            }
+        }
+
+        if(missing.empty())
+            return;
+
+        // Coarse pages first, they cover the most screen area
+        std::sort(missing.begin(), missing.end(), [](const auto& a, const auto& b){ return a.first > b.first; });
+
+        {
+            std::lock_guard<std::mutex> lock(_loaderMutex);
+            for(auto& [mip, page]: missing){
+                _loadRequests.push_back(page);
+            }
+        }
+        _loaderWake.notify_one();
+
+        _pendingCount += static_cast<uint32_t>(missing.size());
+        stats.pagesRequested += missing.size();
+    }
+
+    // Free slot, or the least recently requested page that wasn't visible in the frames still in flight
+    int32_t allocateSlot(){
+        if(!_freeSlots.empty()){
+            uint32_t slot = _freeSlots.back();
+            _freeSlots.pop_back();
+            return static_cast<int32_t>(slot);
+        }
+
+        uint32_t rootPage = _mipPageOffset[_mipCount - 1];
+        int32_t oldest = -1;
+
+        for(uint32_t i = 0; i < _slots.size(); i++){
+            const CacheSlot& slot = _slots[i];
+
+            if(slot.page == int32_t(rootPage) || slot.lastUsed + FRAME_OVERLAP >= _frameNumber)
+                continue;
+
+            if(oldest < 0 || slot.lastUsed < _slots[oldest].lastUsed){
+                oldest = static_cast<int32_t>(i);
+            }
+        }
+
+        if(oldest >= 0){
+            _pageSlot[_slots[oldest].page] = -1;
+            _slots[oldest].page = -1;
+            _indirectionDirty = true;
+            stats.pagesEvicted++;
+        }
+
+        return oldest;
+    }
+
+    void uploadPages(VkCommandBuffer command, FrameResources& frame){
+        std::vector<LoadedPage> pages;
+        {
+            std::lock_guard<std::mutex> lock(_loaderMutex);
+
+            while(!_loadedPages.empty() && pages.size() < MAX_UPLOADS_PER_FRAME){
+                pages.push_back(std::move(_loadedPages.front()));
+                _loadedPages.pop_front();
+            }
+        }
+
+        char* staging = (char*)frame.staging.allocation->GetMappedData();
+        std::vector<VkBufferImageCopy> pageCopies;
+
+        for(LoadedPage& loaded: pages){
+            _pagePending[loaded.page] = false;
+            _pendingCount = _pendingCount > 0 ? _pendingCount - 1 : 0;
+
+            int32_t slot = allocateSlot();
+            if(slot < 0){
+                // Everything resident is in view, the page is requested again if it still is
+                stats.uploadsDropped++;
+                continue;
+            }
+
+            size_t offset = pageCopies.size() * PAGE_BYTES;
+            memcpy(staging + offset, loaded.pixels.data(), PAGE_BYTES);
+
+            VkBufferImageCopy copyRegion{};
+            copyRegion.bufferOffset = offset;
+            copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            copyRegion.imageSubresource.layerCount = 1;
+            copyRegion.imageOffset = {int32_t((slot % _slotsPerSide) * PAGE_STRIDE), int32_t((slot / _slotsPerSide) * PAGE_STRIDE), 0};
+            copyRegion.imageExtent = {PAGE_STRIDE, PAGE_STRIDE, 1};
+            pageCopies.push_back(copyRegion);
+
+            _slots[slot].page = static_cast<int32_t>(loaded.page);
+            _slots[slot].lastUsed = _frameNumber;
+            _pageSlot[loaded.page] = slot;
+            _indirectionDirty = true;
+            stats.pagesUploaded++;
+        }
+
+        const VkPipelineStageFlags2 samplingStages = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+        VkImageLayout oldLayout = _imagesInitialized ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_UNDEFINED;
+
+        if(!pageCopies.empty() || !_imagesInitialized){
+            Utility::transitionMips(command, _cache.image, 0, 1, oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                samplingStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+            if(!pageCopies.empty()){
+                vkCmdCopyBufferToImage(command, frame.staging.buffer, _cache.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(pageCopies.size()), pageCopies.data());
+            }
+
+            Utility::transitionMips(command, _cache.image, 0, 1, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, samplingStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+        }
+
+        if(_indirectionDirty){
+            rebuildIndirection();
+
+            size_t indirectionOffset = MAX_UPLOADS_PER_FRAME * PAGE_BYTES;
+            memcpy(staging + indirectionOffset, _indirection.data(), _indirection.size() * sizeof(uint32_t));
+
+            std::vector<VkBufferImageCopy> indirectionCopies;
+            for(uint32_t mip = 0; mip < _mipCount; mip++){
+                VkBufferImageCopy copyRegion{};
+                copyRegion.bufferOffset = indirectionOffset + _mipPageOffset[mip] * sizeof(uint32_t);
+                copyRegion.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                copyRegion.imageSubresource.mipLevel = mip;
+                copyRegion.imageSubresource.layerCount = 1;
+                copyRegion.imageExtent = {pagesAtMip(_pagesX, mip), pagesAtMip(_pagesY, mip), 1};
+                indirectionCopies.push_back(copyRegion);
+            }
+
+            Utility::transitionMips(command, _indirectionImage.image, 0, _mipCount, oldLayout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                samplingStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT);
+
+            vkCmdCopyBufferToImage(command, frame.staging.buffer, _indirectionImage.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, static_cast<uint32_t>(indirectionCopies.size()), indirectionCopies.data());
+
+            Utility::transitionMips(command, _indirectionImage.image, 0, _mipCount, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+                VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, samplingStages, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT);
+
+            _indirectionDirty = false;
+        }
+
+        _imagesInitialized = true;
+    }
+
+    // Entries are slot x | slot y << 8 | mip of the resident page << 16, pages that aren't resident inherit their parent's
+    void rebuildIndirection(){
+        for(uint32_t mip = _mipCount; mip-- > 0;){
+            uint32_t pagesX = pagesAtMip(_pagesX, mip), pagesY = pagesAtMip(_pagesY, mip);
+
+            for(uint32_t y = 0; y < pagesY; y++){
+                for(uint32_t x = 0; x < pagesX; x++){
+                    uint32_t page = pageId(mip, x, y);
+                    int32_t slot = _pageSlot[page];
+
+                    if(slot >= 0){
+                        _indirection[page] = (slot % _slotsPerSide) | ((slot / _slotsPerSide) << 8) | (mip << 16);
+                    } else if(mip + 1 < _mipCount){
+                        uint32_t parentX = std::min(x >> 1, pagesAtMip(_pagesX, mip + 1) - 1);
+                        uint32_t parentY = std::min(y >> 1, pagesAtMip(_pagesY, mip + 1) - 1);
+                        _indirection[page] = _indirection[pageId(mip + 1, parentX, parentY)];
+                    } else {
+                        _indirection[page] = mip << 16;
+                    }
+                }
+            }
+        }
+    }
+
+    AllocatedImage createImage(VkFormat format, VkImageUsageFlags usage, VkExtent3D extent, uint32_t mipLevels, VkImageAspectFlags aspect){
+        AllocatedImage image{};
+        image.imageFormat = format;
+        image.imageExtent = extent;
+        image.mipLevels = mipLevels;
+
+        VkImageCreateInfo imageInfo = Initializers::imageCreateInfo(format, usage, extent);
+        imageInfo.mipLevels = mipLevels;
+
+        VmaAllocationCreateInfo allocInfo{};
+        allocInfo.usage = VMA_MEMORY_USAGE_GPU_ONLY;
+        allocInfo.requiredFlags = VkMemoryPropertyFlags(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+        VK_CHECK(vmaCreateImage(_allocator, &imageInfo, &allocInfo, &image.image, &image.allocation, nullptr));
+
+        VkImageViewCreateInfo viewInfo = Initializers::imageViewCreateInfo(format, image.image, aspect);
+        viewInfo.subresourceRange.levelCount = mipLevels;
+
+        VK_CHECK(vkCreateImageView(_device, &viewInfo, nullptr, &image.imageView));
+
+        return image;
+    }
+
+    void createImages(){
+        uint32_t cacheSize = _slotsPerSide * PAGE_STRIDE;
+        _cache = createImage(CACHE_FORMAT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, {cacheSize, cacheSize, 1}, 1, VK_IMAGE_ASPECT_COLOR_BIT);
+        _indirectionImage = createImage(VK_FORMAT_R32_UINT, VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, {_pagesX, _pagesY, 1}, _mipCount, VK_IMAGE_ASPECT_COLOR_BIT);
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+
+        VK_CHECK(vkCreateSampler(_device, &samplerInfo, nullptr, &_cacheSampler));
+
+        // Integer textures can't be filtered, the shader uses texelFetch anyway
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+        VK_CHECK(vkCreateSampler(_device, &samplerInfo, nullptr, &_indirectionSampler));
+    }
+
+    void createDescriptors(){
+        _paramsBuffer = Utility::createBuffer(_allocator, sizeof(VirtualTextureParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+        VirtualTextureParams* params = (VirtualTextureParams*)_paramsBuffer.allocation->GetMappedData();
+        params->virtualSize = glm::vec4(_pagesX * PAGE_SIZE, _pagesY * PAGE_SIZE, float(_sourceWidth) / (_pagesX * PAGE_SIZE), float(_sourceHeight) / (_pagesY * PAGE_SIZE));
+        params->pageGrid = glm::uvec4(_pagesX, _pagesY, _mipCount, PAGE_SIZE);
+        params->cache = glm::vec4(PAGE_STRIDE, PAGE_BORDER, 1.f / (_slotsPerSide * PAGE_STRIDE), -std::log2(float(FEEDBACK_DIVISOR)));
+
+        std::vector<DescriptorAllocator::PoolSizeRatio> sizeRatios = {
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 2},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1},
+        };
+        _descriptorAllocator.setupPool(_device, 1, sizeRatios);
+
+        DescriptorLayoutBuilder builder;
+        builder.addBinding(0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        builder.addBinding(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        builder.addBinding(2, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        setLayout = builder.build(_device, VK_SHADER_STAGE_FRAGMENT_BIT);
+
+        set = _descriptorAllocator.allocate(_device, setLayout);
+
+        DescriptorWriter writer;
+        writer.writeImage(0, _indirectionImage.imageView, _indirectionSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.writeImage(1, _cache.imageView, _cacheSampler, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
+        writer.writeBuffer(2, _paramsBuffer.buffer, sizeof(VirtualTextureParams), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        writer.updateSet(_device, set);
+    }
+
+    // Tightly packed at whatever the feedback extent is when the copy is recorded
+    void createReadbacks(VkExtent2D drawCapacity){
+        _readbackCapacity = feedbackExtent(drawCapacity);
+
+        for(uint32_t i = 0; i < FRAME_OVERLAP; i++){
+            _frames[i].readback = Utility::createBuffer(_allocator, size_t(_readbackCapacity.width) * _readbackCapacity.height * sizeof(uint32_t), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VMA_MEMORY_USAGE_GPU_TO_CPU);
+            _frames[i].readbackExtent = _feedbackExtent;
+            _frames[i].readbackValid = false;
+        }
+    }
+
+    void destroyReadbacks(){
+        for(uint32_t i = 0; i < FRAME_OVERLAP; i++){
+            Utility::destroyBuffer(_allocator, _frames[i].readback);
+        }
+    }
+};
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "types.h"
+#include "utility.h"
+#include "initializers.h"
+#include "structs.h"
+#include "meshPipelines.h"
+#include "virtualTexture.h"
+
+struct VirtualTexturedUniform {
+    glm::mat4 modelMatrix;
+};
+
+// Large quad showing a VirtualTexture, e.g. a terrain or a map. Besides the regular draw it renders into the
+// virtual texture's feedback target, which is what drives page streaming.
+struct VirtualTexturedPlane: public Mesh {
+public:
+    std::string vertexShaderFile = "shaders\\shader.vert.spv", fragShaderFile = "shaders\\virtualTexture.frag.spv";
+    std::string feedbackShaderFile = "shaders\\virtualTextureFeedback.frag.spv";
+
+    float size = 20.f;
+    float depth = -1.f;
+
+    VirtualTexturedPlane(VirtualTexture& virtualTexture): _virtualTexture(virtualTexture){
+        updateVertexBuffer = false;
+        updateIndexBuffer = false;
+    }
+
+    void setup(VkDevice _device, VmaAllocator& _allocator, VkFormat drawImageFormat, VkFormat depthImageFormat) override {
+        createDescriptorSetLayout(_device);
+        createPipeline(_device, drawImageFormat, depthImageFormat);
+        setupData();
+        setupUniformBuffer(_device, _allocator);
+    }
+
+    void remakePipeline(VkDevice _device, VkFormat drawImageFormat, VkFormat depthImageFormat) override {
+        pipelineDeletionQueue.flush();
+        createPipeline(_device, drawImageFormat, depthImageFormat);
+    }
+
+    void imguiInterface() override {
+        _virtualTexture.imguiInterface();
+    }
+
+    // The feedback pass binds the set update() allocated for the frame, so update() has to run every frame
+    bool staticDraw() override {
+        return false;
+    }
+
+    void update(VkDevice _device, VmaAllocator& allocator, DescriptorAllocator& _descriptorAllocator) override {
+        VirtualTexturedUniform* data = (VirtualTexturedUniform*)uniformBuffer.allocation->GetMappedData();
+        *data = {
+            glm::mat4(1.f)
+        };
+
+        set = _descriptorAllocator.allocate(_device, setLayout);
+
+        DescriptorWriter writer;
+        writer.writeBuffer(0, uniformBuffer.buffer, sizeof(VirtualTexturedUniform), 0, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+        writer.updateSet(_device, set);
+    }
+
+    void draw(VkCommandBuffer& command, glm::mat4 viewProj) override {
+        drawWithPipeline(command, viewProj, pipeline);
+    }
+
+    void drawFeedback(VkCommandBuffer& command, glm::mat4 viewProj) override {
+        drawWithPipeline(command, viewProj, feedbackPipeline);
+    }
+
+    void setVertexBufferAddress(VkDeviceAddress address) override {
+        vertexBufferAddress = address;
+    }
+
+private:
+    VirtualTexture& _virtualTexture;
+    VkPipeline feedbackPipeline;
+
+    void drawWithPipeline(VkCommandBuffer& command, glm::mat4 viewProj, VkPipeline boundPipeline){
+        vkCmdBindPipeline(command, VK_PIPELINE_BIND_POINT_GRAPHICS, boundPipeline);
+
+        MeshPushConstants pushConstants{};
+        pushConstants.frameConstants = frameConstantsAddress;
+        pushConstants.vertexBuffer = vertexBufferAddress;
+        pushConstants.vertexFormat = vertexFormat;
+        pushConstants.positionMin = positionMin;
+        pushConstants.positionExtent = positionExtent;
+
+        vkCmdPushConstants(command, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(MeshPushConstants), &pushConstants);
+
+        VkDescriptorSet sets[2] = {set, _virtualTexture.set};
+
+        vkCmdBindIndexBuffer(command, indexBuffer.buffer, 0, indexType);
+        vkCmdBindDescriptorSets(command, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 2, sets, 0, nullptr);
+
+        vkCmdDrawIndexed(command, indexCount, 1, 0, 0, 0);
+    }
+
+    void setupUniformBuffer(VkDevice device, VmaAllocator& allocator){
+        uniformBuffer = Utility::createBuffer(allocator, sizeof(VirtualTexturedUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VMA_MEMORY_USAGE_CPU_TO_GPU);
+
+        uniformDeletionQueue.pushFunction([this, allocator]{
+            Utility::destroyBuffer(allocator, uniformBuffer);
+        });
+    }
+
+    void createPipeline(VkDevice _device, VkFormat drawImageFormat, VkFormat depthImageFormat){
+        VkShaderModule vertexShader = MeshPipelines::loadShader(_device, vertexShaderFile, "vertex");
+        VkShaderModule fragShader = MeshPipelines::loadShader(_device, fragShaderFile, "frag");
+        VkShaderModule feedbackShader = MeshPipelines::loadShader(_device, feedbackShaderFile, "virtual texture feedback");
+
+        pipelineLayout = MeshPipelines::createLayout(_device, {setLayout, _virtualTexture.setLayout}, VK_SHADER_STAGE_VERTEX_BIT, sizeof(MeshPushConstants));
+
+        PipelineBuilder pipelineBuilder = MeshPipelines::builder(pipelineLayout, {}, drawImageFormat, depthImageFormat);
+        pipelineBuilder.setShaders(vertexShader, fragShader);
+
+        pipeline = pipelineBuilder.buildPipeline(_device);
+
+        // Same geometry into the feedback target, integer attachments can't blend
+        pipelineBuilder.setShaders(vertexShader, feedbackShader);
+        pipelineBuilder.setColorAttachmentFormat(VirtualTexture::FEEDBACK_FORMAT);
+        pipelineBuilder.setDepthFormat(VirtualTexture::FEEDBACK_DEPTH_FORMAT);
+
+        feedbackPipeline = pipelineBuilder.buildPipeline(_device);
+
+        vkDestroyShaderModule(_device, vertexShader, nullptr);
+        vkDestroyShaderModule(_device, fragShader, nullptr);
+        vkDestroyShaderModule(_device, feedbackShader, nullptr);
+
+        pipelineDeletionQueue.pushFunction([this, _device](){
+            vkDestroyPipelineLayout(_device, pipelineLayout, nullptr);
+            vkDestroyPipeline(_device, pipeline, nullptr);
+            vkDestroyPipeline(_device, feedbackPipeline, nullptr);
+        });
+    }
+
+    void createDescriptorSetLayout(VkDevice _device){
+        setLayout = MeshPipelines::createUniformSetLayout(_device, false);
+    }
+
+    void setupData(){
+        maxVertexCount = 4;
+        maxIndexCount = 6;
+        indexCount = 6;
+
+        vertices.resize(4);
+
+        float half = size / 2.f;
+        vertices[0].position = {-half, -half, depth};
+        vertices[1].position = { half, -half, depth};
+        vertices[2].position = {-half,  half, depth};
+        vertices[3].position = { half,  half, depth};
+
+        for(uint32_t i = 0; i < 4; i++){
+            vertices[i].uv_x = float(i & 1);
+            vertices[i].uv_y = float(1 - (i >> 1));
+            vertices[i].normal = {0.f, 0.f, 1.f};
+            vertices[i].color = {1.f, 1.f, 1.f, 1.f};
+        }
+
+        indices = {0, 1, 2, 2, 1, 3};
+    }
+};
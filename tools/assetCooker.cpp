@@ -0,0 +1,679 @@
+// Offline content build: cooks glTF scenes into .scene files (see cookedScene.h) and images into BCn .ktx2 files.
+//
+//     AssetCooker [--output dir] [--threads N] [--lods N] [--compact] [--no-meshlets] [--linear] [--force] sources...
+//
+// Every primitive goes through MeshOptimizer's vertex cache, overdraw and vertex fetch passes and gets up to --lods
+// coarser index lists, each level with meshlets of its own. --compact stores 16 byte quantized vertices. Images get a full mip chain in
+// BC1, or BC3 when they have alpha. Loading, every primitive, every texture level and writing are jobs of their own,
+// spread over all threads.
+// A source is skipped when the hash of its contents, the files it references and the cook settings matches the
+// manifest in the output directory and its output still exists.
+
+#include "types.h"
+#include "gltfLoader.h"
+#include "meshOptimizer.h"
+#include "meshlet.h"
+#include "vertexQuantization.h"
+#include "cookedScene.h"
+#include "ktx2.h"
+#include "blockCompression.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <atomic>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include <unordered_map>
+
+// Part of every content hash, bump it when the output of a pass changes
+const char COOKER_VERSION[] = "AssetCooker 2";
+const char MANIFEST_NAME[] = "cooker.manifest";
+
+struct Settings{
+    uint32_t threadCount{std::max(1u, std::thread::hardware_concurrency())};
+    uint32_t lodCount{3};
+    bool compact{false};
+    bool meshlets{true};
+    bool linear{false};
+    bool force{false};
+    std::filesystem::path outputDirectory;
+
+    std::string key() const {
+        return fmt::format("{} lods={} compact={} meshlets={} linear={}", COOKER_VERSION, lodCount, compact, meshlets, linear);
+    }
+};
+
+// One unique index range of the import, shared by every submesh that instances it
+struct Primitive{
+    uint32_t importFirstVertex, importVertexCount;
+    uint32_t importFirstIndex, importIndexCount;
+
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;      // Full detail first, then every LOD
+    uint32_t lod0IndexCount{0};
+    std::vector<CookedScene::LodRecord> lods;   // firstIndex relative to this primitive
+    std::vector<MeshletData> meshlets;  // Full detail first, then every LOD
+    glm::vec4 sphere{0.f};
+};
+
+struct Asset{
+    enum Type{ SCENE, TEXTURE } type;
+    std::filesystem::path source, output;
+
+    uint64_t hash{0};
+    bool stale{false};
+    std::string error;
+    size_t outputBytes{0};
+
+    // Scenes
+    std::vector<Vertex> importedVertices;
+    std::vector<uint32_t> importedIndices;
+    std::vector<Submesh> submeshes;
+    std::vector<uint32_t> submeshPrimitive;
+    std::vector<Primitive> primitives;
+
+    // Textures
+    VkFormat format{VK_FORMAT_UNDEFINED};
+    uint32_t width{0}, height{0};
+    std::vector<std::vector<uint8_t>> mips;
+    std::vector<std::vector<uint8_t>> compressed;
+};
+
+struct Job{
+    size_t asset;
+    uint32_t item;      // Primitive or mip level
+    uint64_t cost;
+};
+
+static void printUsage(){
+    fmt::println("usage: AssetCooker [--output dir] [--threads N] [--lods N] [--compact] [--no-meshlets] [--linear] [--force] sources...");
+}
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point startTime){
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    return elapsed.count();
+}
+
+static bool isImage(const std::filesystem::path& path){
+    std::string extension = path.extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c){ return std::tolower(c); });
+
+    return extension == ".png" || extension == ".jpg" || extension == ".jpeg" || extension == ".tga" || extension == ".bmp";
+}
+
+// Files named by "uri" properties of the glTF JSON, external buffers and images. Data URIs are part of the JSON already.
+static std::vector<std::filesystem::path> referencedFiles(const std::filesystem::path& source, const CookedScene::MappedFile& file){
+    std::string_view json(file.data(), file.size());
+
+    // The JSON of a GLB is its first chunk
+    if(json.size() >= 20 && json.substr(0, 4) == "glTF"){
+        uint32_t length;
+        memcpy(&length, file.data() + 12, sizeof(uint32_t));
+        json = json.substr(20, std::min<size_t>(length, json.size() - 20));
+    }
+
+    std::vector<std::filesystem::path> files;
+
+    for(size_t at = json.find("\"uri\""); at != std::string_view::npos; at = json.find("\"uri\"", at + 5)){
+        size_t start = json.find('"', json.find(':', at + 5));
+        size_t end = start == std::string_view::npos ? start : json.find('"', start + 1);
+        if(end == std::string_view::npos)
+            break;
+
+        std::string_view uri = json.substr(start + 1, end - start - 1);
+        if(!uri.starts_with("data:")){
+            files.push_back(source.parent_path() / std::filesystem::path(std::string(uri)));
+        }
+    }
+
+    return files;
+}
+
+static bool hashAsset(Asset& asset, uint64_t settingsHash){
+    CookedScene::MappedFile file;
+    if(!file.open(asset.source)){
+        asset.error = "can't read source";
+        return false;
+    }
+
+    asset.hash = CookedScene::checksum(file.data(), file.size(), settingsHash);
+
+    if(asset.type == Asset::SCENE){
+        for(const std::filesystem::path& path: referencedFiles(asset.source, file)){
+            CookedScene::MappedFile dependency;
+            uint64_t pathHash = CookedScene::checksum(path.string().data(), path.string().size(), asset.hash);
+
+            // A missing dependency still changes the hash, the import reports the error
+            asset.hash = dependency.open(path) ? CookedScene::checksum(dependency.data(), dependency.size(), pathHash) : pathHash;
+        }
+    }
+
+    return true;
+}
+
+static bool loadScene(Asset& asset){
+    GltfImporter importer;
+    if(!importer.open(asset.source)){
+        asset.error = "import failed";
+        return false;
+    }
+
+    asset.importedVertices.resize(importer.vertexCount());
+    asset.importedIndices.resize(importer.indexCount());
+
+    if(importer.indexType() == VK_INDEX_TYPE_UINT16){
+        std::vector<uint16_t> indices(importer.indexCount());
+        importer.decode(asset.importedVertices.data(), indices.data());
+        std::copy(indices.begin(), indices.end(), asset.importedIndices.begin());
+    } else {
+        importer.decode(asset.importedVertices.data(), asset.importedIndices.data());
+    }
+
+    asset.submeshes = std::move(importer.submeshes);
+
+    // Node instances of the same glTF primitive share its index range
+    std::unordered_map<uint32_t, uint32_t> primitiveOfRange;
+
+    for(const Submesh& submesh: asset.submeshes){
+        auto [it, inserted] = primitiveOfRange.try_emplace(submesh.firstIndex, static_cast<uint32_t>(asset.primitives.size()));
+        asset.submeshPrimitive.push_back(it->second);
+
+        if(!inserted)
+            continue;
+
+        Primitive primitive{};
+        primitive.importFirstVertex = static_cast<uint32_t>(submesh.vertexOffset);
+        primitive.importFirstIndex = submesh.firstIndex;
+        primitive.importIndexCount = submesh.indexCount;
+
+        // Vertices past the last referenced one can't be drawn, they are dropped
+        for(uint32_t i = 0; i < submesh.indexCount; i++){
+            primitive.importVertexCount = std::max(primitive.importVertexCount, asset.importedIndices[submesh.firstIndex + i] + 1);
+        }
+
+        asset.primitives.push_back(std::move(primitive));
+    }
+
+    return true;
+}
+
+static bool loadTexture(Asset& asset, const Settings& settings){
+    int width, height, channels;
+    stbi_uc* pixels = stbi_load(asset.source.string().c_str(), &width, &height, &channels, STBI_rgb_alpha);
+    if(!pixels){
+        asset.error = stbi_failure_reason();
+        return false;
+    }
+
+    std::vector<uint8_t> base(pixels, pixels + size_t(width) * height * 4);
+    stbi_image_free(pixels);
+
+    asset.width = static_cast<uint32_t>(width);
+    asset.height = static_cast<uint32_t>(height);
+    asset.format = BlockCompression::chooseFormat(base, settings.linear);
+    asset.mips = BlockCompression::buildMips(std::move(base), asset.width, asset.height, BlockCompression::isSrgb(asset.format));
+
+    asset.compressed.resize(asset.mips.size());
+    for(uint32_t level = 0; level < asset.mips.size(); level++){
+        asset.compressed[level].resize(Ktx2::levelSize(asset.format, std::max(asset.width >> level, 1u), std::max(asset.height >> level, 1u)));
+    }
+
+    return true;
+}
+
+static void cookPrimitive(Asset& asset, Primitive& primitive, const Settings& settings){
+    auto first = asset.importedVertices.begin() + primitive.importFirstVertex;
+    primitive.vertices.assign(first, first + primitive.importVertexCount);
+
+    primitive.indices.resize(primitive.importIndexCount);
+    for(uint32_t i = 0; i < primitive.importIndexCount; i++){
+        primitive.indices[i] = asset.importedIndices[primitive.importFirstIndex + i];
+    }
+
+    primitive.indices = MeshOptimizer::optimizeVertexCache(primitive.indices, primitive.vertices.size());
+    primitive.indices = MeshOptimizer::optimizeOverdraw(primitive.indices, primitive.vertices);
+    MeshOptimizer::optimizeVertexFetch(primitive.vertices, primitive.indices);
+
+    primitive.lod0IndexCount = static_cast<uint32_t>(primitive.indices.size());
+
+    if(!primitive.vertices.empty()){
+        glm::vec3 minPos = primitive.vertices[0].position, maxPos = minPos;
+        for(const Vertex& v: primitive.vertices){
+            minPos = glm::min(minPos, v.position);
+            maxPos = glm::max(maxPos, v.position);
+        }
+
+        glm::vec3 center = (minPos + maxPos) * 0.5f;
+        float radius = 0.f;
+        for(const Vertex& v: primitive.vertices){
+            radius = std::max(radius, glm::distance(center, v.position));
+        }
+
+        primitive.sphere = glm::vec4(center, radius);
+    }
+
+    if(settings.meshlets){
+        primitive.meshlets.push_back(Meshlets::buildMeshlets(primitive.vertices, primitive.indices, primitive.lod0IndexCount));
+    }
+
+    // Every LOD halves the previous one's triangles, all simplified from the full detail mesh
+    std::vector<uint32_t> lod0(primitive.indices.begin(), primitive.indices.end());
+    size_t previousCount = lod0.size();
+
+    for(uint32_t l = 0; l < settings.lodCount; l++){
+        size_t target = previousCount / 6 * 3;
+        if(target < 3)
+            break;
+
+        MeshOptimizer::Lod lod = MeshOptimizer::generateLod(lod0, primitive.vertices, target);
+        if(lod.indices.empty() || lod.indices.size() >= previousCount)
+            break;
+
+        primitive.lods.push_back({static_cast<uint32_t>(primitive.indices.size()), static_cast<uint32_t>(lod.indices.size()), lod.error, 0});
+        primitive.indices.insert(primitive.indices.end(), lod.indices.begin(), lod.indices.end());
+
+        if(settings.meshlets){
+            primitive.meshlets.push_back(Meshlets::buildMeshlets(primitive.vertices, lod.indices, static_cast<uint32_t>(lod.indices.size())));
+        }
+
+        previousCount = lod.indices.size();
+    }
+}
+
+static bool writeScene(Asset& asset, const Settings& settings){
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> firstVertex(asset.primitives.size()), firstIndex(asset.primitives.size());
+    size_t maxPrimitiveVertices = 0, triangleCount = 0;
+
+    for(size_t p = 0; p < asset.primitives.size(); p++){
+        const Primitive& primitive = asset.primitives[p];
+
+        firstVertex[p] = static_cast<uint32_t>(vertices.size());
+        firstIndex[p] = static_cast<uint32_t>(indices.size());
+        maxPrimitiveVertices = std::max(maxPrimitiveVertices, primitive.vertices.size());
+        triangleCount += primitive.lod0IndexCount / 3;
+
+        vertices.insert(vertices.end(), primitive.vertices.begin(), primitive.vertices.end());
+        indices.insert(indices.end(), primitive.indices.begin(), primitive.indices.end());
+    }
+
+    CookedScene::Writer writer;
+
+    // Indices stay local to their primitive, so 16 bits are enough as long as every primitive fits
+    VkIndexType indexType = MeshOptimizer::chooseIndexType(maxPrimitiveVertices);
+    std::vector<char> indexData = MeshOptimizer::packIndices(indices, indexType);
+
+    VertexQuantization::EncodedVertices encoded;
+    if(settings.compact){
+        encoded = VertexQuantization::encode(vertices);
+
+        memcpy(writer.header.positionMin, glm::value_ptr(encoded.positionMin), sizeof(writer.header.positionMin));
+        memcpy(writer.header.positionExtent, glm::value_ptr(encoded.positionExtent), sizeof(writer.header.positionExtent));
+        writer.addChunk(CookedScene::CHUNK_VERTICES, encoded.vertices.data(), encoded.vertices.size() * sizeof(CompactVertex));
+    } else {
+        writer.addChunk(CookedScene::CHUNK_VERTICES, vertices.data(), vertices.size() * sizeof(Vertex));
+    }
+
+    writer.header.vertexFormat = settings.compact ? VERTEX_FORMAT_COMPACT : VERTEX_FORMAT_FULL;
+    writer.header.indexType = indexType;
+    writer.header.vertexCount = vertices.size();
+    writer.header.indexCount = indices.size();
+
+    writer.addChunk(CookedScene::CHUNK_INDICES, indexData.data(), indexData.size());
+
+    std::vector<CookedScene::SubmeshRecord> submeshes;
+    std::vector<glm::vec4> bounds;
+    std::vector<CookedScene::LodRecord> lods;
+
+    for(size_t s = 0; s < asset.submeshes.size(); s++){
+        uint32_t p = asset.submeshPrimitive[s];
+        const Primitive& primitive = asset.primitives[p];
+
+        CookedScene::SubmeshRecord record{firstIndex[p], primitive.lod0IndexCount, static_cast<int32_t>(firstVertex[p]), static_cast<uint32_t>(primitive.lods.size()), {}};
+        memcpy(record.transform, glm::value_ptr(asset.submeshes[s].transform), sizeof(record.transform));
+
+        submeshes.push_back(record);
+        bounds.push_back(primitive.sphere);
+
+        for(CookedScene::LodRecord lod: primitive.lods){
+            lod.firstIndex += firstIndex[p];
+            lods.push_back(lod);
+        }
+    }
+
+    writer.addChunk(CookedScene::CHUNK_SUBMESHES, submeshes.data(), submeshes.size() * sizeof(CookedScene::SubmeshRecord));
+    writer.addChunk(CookedScene::CHUNK_BOUNDS, bounds.data(), bounds.size() * sizeof(glm::vec4));
+
+    if(!lods.empty()){
+        writer.addChunk(CookedScene::CHUNK_LODS, lods.data(), lods.size() * sizeof(CookedScene::LodRecord));
+    }
+
+    // All meshlets, then all their vertex indices, then all triangles, each primitive's levels in order
+    MeshletData meshlets;
+    std::vector<CookedScene::MeshletRange> ranges, lodRanges;
+    std::vector<char> meshletData;
+
+    if(settings.meshlets){
+        struct LevelStart{
+            uint32_t meshlet, vertex, triangle, count;
+        };
+        std::vector<std::vector<LevelStart>> levels(asset.primitives.size());
+
+        for(size_t p = 0; p < asset.primitives.size(); p++){
+            for(const MeshletData& data: asset.primitives[p].meshlets){
+                levels[p].push_back({static_cast<uint32_t>(meshlets.meshlets.size()), static_cast<uint32_t>(meshlets.meshletVertices.size()),
+                    static_cast<uint32_t>(meshlets.meshletTriangles.size()), static_cast<uint32_t>(data.meshlets.size())});
+
+                meshlets.meshlets.insert(meshlets.meshlets.end(), data.meshlets.begin(), data.meshlets.end());
+                meshlets.meshletTriangles.insert(meshlets.meshletTriangles.end(), data.meshletTriangles.begin(), data.meshletTriangles.end());
+
+                // Vertex indices become absolute, meshlet offsets stay relative to the level's arrays
+                for(uint32_t v: data.meshletVertices){
+                    meshlets.meshletVertices.push_back(v + firstVertex[p]);
+                }
+            }
+        }
+
+        const uint32_t meshletWords = sizeof(Meshlet) / sizeof(uint32_t);
+
+        auto range = [&](const LevelStart& level){
+            uint32_t shift = level.meshlet * meshletWords;
+            return CookedScene::MeshletRange{level.meshlet, level.count, Meshlets::gpuVertexOffset(meshlets) + level.vertex - shift,
+                Meshlets::gpuTriangleOffset(meshlets) + level.triangle - shift};
+        };
+
+        // Same order as the submesh and LOD records
+        for(size_t s = 0; s < asset.submeshes.size(); s++){
+            const std::vector<LevelStart>& primitiveLevels = levels[asset.submeshPrimitive[s]];
+
+            ranges.push_back(range(primitiveLevels[0]));
+            for(size_t l = 1; l < primitiveLevels.size(); l++){
+                lodRanges.push_back(range(primitiveLevels[l]));
+            }
+        }
+
+        meshletData.resize(Meshlets::gpuSize(meshlets));
+        Meshlets::writeGpuData(meshlets, meshletData.data());
+
+        writer.addChunk(CookedScene::CHUNK_MESHLETS, meshletData.data(), meshletData.size());
+        writer.addChunk(CookedScene::CHUNK_MESHLET_RANGES, ranges.data(), ranges.size() * sizeof(CookedScene::MeshletRange));
+
+        if(!lodRanges.empty()){
+            writer.addChunk(CookedScene::CHUNK_LOD_MESHLET_RANGES, lodRanges.data(), lodRanges.size() * sizeof(CookedScene::MeshletRange));
+        }
+    }
+
+    if(!writer.write(asset.output, asset.error))
+        return false;
+
+    std::error_code error;
+    asset.outputBytes = std::filesystem::file_size(asset.output, error);
+
+    fmt::println("{} -> {}: {} primitives, {} submeshes, {} triangles, {} LODs, {} meshlets, {:.2f}MB", asset.source.string(), asset.output.string(),
+        asset.primitives.size(), asset.submeshes.size(), triangleCount, lods.size(), meshlets.meshlets.size(), double(asset.outputBytes) / (1024.0 * 1024.0));
+
+    return true;
+}
+
+static bool writeTexture(Asset& asset){
+    std::vector<char> file = Ktx2::write(asset.format, asset.width, asset.height, asset.compressed);
+
+    std::ofstream stream(asset.output, std::ios::binary);
+    stream.write(file.data(), file.size());
+    if(!stream){
+        asset.error = "can't write " + asset.output.string();
+        return false;
+    }
+
+    asset.outputBytes = file.size();
+
+    fmt::println("{} -> {} ({}x{}, {} mips, {}): {:.2f}MB", asset.source.string(), asset.output.string(), asset.width, asset.height,
+        asset.mips.size(), string_VkFormat(asset.format), double(asset.outputBytes) / (1024.0 * 1024.0));
+
+    return true;
+}
+
+// Output path to content hash, one "hash path" line each
+static std::unordered_map<std::string, uint64_t> readManifest(const std::filesystem::path& path){
+    std::unordered_map<std::string, uint64_t> manifest;
+
+    std::ifstream stream(path);
+    std::string line;
+
+    while(std::getline(stream, line)){
+        size_t space = line.find(' ');
+        if(space == std::string::npos)
+            continue;
+
+        manifest[line.substr(space + 1)] = std::strtoull(line.substr(0, space).c_str(), nullptr, 16);
+    }
+
+    return manifest;
+}
+
+static bool writeManifest(const std::filesystem::path& path, const std::unordered_map<std::string, uint64_t>& manifest){
+    std::filesystem::path temporaryPath = path;
+    temporaryPath += ".tmp";
+
+    {
+        std::ofstream stream(temporaryPath, std::ios::trunc);
+        for(const auto& [output, hash]: manifest){
+            stream << fmt::format("{:016x} {}\n", hash, output);
+        }
+
+        if(!stream)
+            return false;
+    }
+
+    std::error_code error;
+    std::filesystem::rename(temporaryPath, path, error);
+    return !error;
+}
+
+int main(int argc, char** argv){
+    Settings settings;
+    std::vector<Asset> assets;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+
+        if(arg == "--output" && i + 1 < argc){
+            settings.outputDirectory = argv[++i];
+        } else if(arg == "--threads" && i + 1 < argc){
+            settings.threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if(arg == "--lods" && i + 1 < argc){
+            settings.lodCount = std::max(0, std::atoi(argv[++i]));
+        } else if(arg == "--compact"){
+            settings.compact = true;
+        } else if(arg == "--no-meshlets"){
+            settings.meshlets = false;
+        } else if(arg == "--linear"){
+            settings.linear = true;
+        } else if(arg == "--force"){
+            settings.force = true;
+        } else if(arg.starts_with("--")){
+            printUsage();
+            return EXIT_FAILURE;
+        } else {
+            Asset asset{};
+            asset.source = arg;
+
+            std::filesystem::path extension = asset.source.extension();
+            if(extension == ".gltf" || extension == ".glb"){
+                asset.type = Asset::SCENE;
+                asset.output = asset.source;
+                asset.output.replace_extension(CookedScene::EXTENSION);
+            } else if(isImage(asset.source)){
+                asset.type = Asset::TEXTURE;
+                asset.output = asset.source;
+                asset.output.replace_extension(".ktx2");
+            } else {
+                fmt::println("Don't know how to cook {}", arg);
+                return EXIT_FAILURE;
+            }
+
+            assets.push_back(std::move(asset));
+        }
+    }
+
+    if(assets.empty()){
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    std::filesystem::path manifestDirectory = settings.outputDirectory.empty() ? assets[0].output.parent_path() : settings.outputDirectory;
+
+    if(!settings.outputDirectory.empty()){
+        std::filesystem::create_directories(settings.outputDirectory);
+        for(Asset& asset: assets){
+            asset.output = settings.outputDirectory / asset.output.filename();
+        }
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    auto runJobs = [&](size_t count, auto&& work){
+        std::atomic<size_t> next{0};
+
+        auto worker = [&](){
+            for(size_t i = next++; i < count; i = next++){
+                work(i);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(uint32_t i = 1; i < std::min<size_t>(settings.threadCount, count); i++){
+            threads.emplace_back(worker);
+        }
+
+        worker();
+
+        for(std::thread& thread: threads){
+            thread.join();
+        }
+    };
+
+    // Hash every source and find the ones the last run didn't cook
+    std::filesystem::path manifestPath = manifestDirectory / MANIFEST_NAME;
+    std::unordered_map<std::string, uint64_t> manifest = readManifest(manifestPath);
+
+    std::string settingsKey = settings.key();
+    uint64_t settingsHash = CookedScene::checksum(settingsKey.data(), settingsKey.size());
+
+    runJobs(assets.size(), [&](size_t i){
+        Asset& asset = assets[i];
+        if(!hashAsset(asset, settingsHash))
+            return;
+
+        auto previous = manifest.find(asset.output.string());
+        asset.stale = settings.force || previous == manifest.end() || previous->second != asset.hash || !std::filesystem::exists(asset.output);
+    });
+
+    double hashMs = elapsedMs(startTime);
+
+    std::vector<size_t> stale;
+    for(size_t i = 0; i < assets.size(); i++){
+        if(assets[i].error.empty() && assets[i].stale){
+            stale.push_back(i);
+        }
+    }
+
+    // Import scenes and decode images, one source per job
+    auto phaseStart = std::chrono::high_resolution_clock::now();
+
+    runJobs(stale.size(), [&](size_t i){
+        Asset& asset = assets[stale[i]];
+        if(asset.type == Asset::SCENE){
+            loadScene(asset);
+        } else {
+            loadTexture(asset, settings);
+        }
+    });
+
+    double loadMs = elapsedMs(phaseStart);
+
+    // Every primitive and every texture level on its own, biggest first so the tail stays short
+    std::vector<Job> jobs;
+    for(size_t i: stale){
+        Asset& asset = assets[i];
+        if(!asset.error.empty())
+            continue;
+
+        if(asset.type == Asset::SCENE){
+            for(uint32_t p = 0; p < asset.primitives.size(); p++){
+                jobs.push_back({i, p, uint64_t(asset.primitives[p].importIndexCount) * (settings.lodCount + 2)});
+            }
+        } else {
+            for(uint32_t level = 0; level < asset.mips.size(); level++){
+                jobs.push_back({i, level, asset.mips[level].size() / 4});
+            }
+        }
+    }
+
+    std::sort(jobs.begin(), jobs.end(), [](const Job& l, const Job& r){ return l.cost > r.cost; });
+
+    phaseStart = std::chrono::high_resolution_clock::now();
+
+    runJobs(jobs.size(), [&](size_t j){
+        Asset& asset = assets[jobs[j].asset];
+
+        if(asset.type == Asset::SCENE){
+            cookPrimitive(asset, asset.primitives[jobs[j].item], settings);
+        } else {
+            uint32_t level = jobs[j].item;
+            uint32_t width = std::max(asset.width >> level, 1u), height = std::max(asset.height >> level, 1u);
+
+            BlockCompression::encodeRows(asset.format, asset.mips[level].data(), width, height, 0, (height + 3) / 4, asset.compressed[level].data());
+        }
+    });
+
+    double processMs = elapsedMs(phaseStart);
+    phaseStart = std::chrono::high_resolution_clock::now();
+
+    runJobs(stale.size(), [&](size_t i){
+        Asset& asset = assets[stale[i]];
+        if(!asset.error.empty())
+            return;
+
+        if(asset.type == Asset::SCENE){
+            writeScene(asset, settings);
+        } else {
+            writeTexture(asset);
+        }
+    });
+
+    double writeMs = elapsedMs(phaseStart);
+
+    // Failed sources are dropped from the manifest, so the next run tries them again
+    size_t cookedCount = 0, skippedCount = 0, failedCount = 0, outputBytes = 0;
+
+    for(Asset& asset: assets){
+        if(!asset.error.empty()){
+            fmt::println("Failed to cook {}: {}", asset.source.string(), asset.error);
+            manifest.erase(asset.output.string());
+            failedCount++;
+        } else if(asset.stale){
+            manifest[asset.output.string()] = asset.hash;
+            outputBytes += asset.outputBytes;
+            cookedCount++;
+        } else {
+            skippedCount++;
+        }
+    }
+
+    if(!writeManifest(manifestPath, manifest)){
+        fmt::println("Failed to write {}", manifestPath.string());
+        failedCount++;
+    }
+
+    fmt::println("{} cooked, {} up to date, {} failed in {:.2f}ms on {} threads, {:.2f}MB written", cookedCount, skippedCount, failedCount,
+        elapsedMs(startTime), settings.threadCount, double(outputBytes) / (1024.0 * 1024.0));
+    fmt::println("    hash {:.2f}ms, load {:.2f}ms, process {:.2f}ms ({} jobs), write {:.2f}ms", hashMs, loadMs, processMs, jobs.size(), writeMs);
+
+    return failedCount == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
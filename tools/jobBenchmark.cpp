@@ -0,0 +1,171 @@
+// Task throughput and scheduling latency of the job system.
+//
+//     JobBenchmark [--threads N] [--jobs N] [--samples N]
+//
+// Throughput: empty jobs submitted from the main thread, jobs that spawn more jobs on the workers, and a parallel
+// for over tiny ranges, each against the time the same work takes on one thread.
+// Latency: the time from run() until the job starts on another thread, once with the workers spinning on other
+// work and once after they have gone to sleep.
+
+#include "types.h"
+#include "jobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+
+static void printUsage(){
+    fmt::println("usage: JobBenchmark [--threads N] [--jobs N] [--samples N]");
+}
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point startTime){
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    return elapsed.count();
+}
+
+// Keeps the compiler from dropping the work
+static std::atomic<uint64_t> sink{0};
+
+static uint64_t work(uint64_t seed){
+    uint64_t value = seed;
+    for(int i = 0; i < 64; i++){
+        value = value * 6364136223846793005ull + 1442695040888963407ull;
+    }
+    return value;
+}
+
+static void printLatency(const char* name, std::vector<double>& samples){
+    std::sort(samples.begin(), samples.end());
+    auto percentile = [&](double p){
+        return samples[std::min(static_cast<size_t>(p * samples.size()), samples.size() - 1)];
+    };
+
+    fmt::println("{}: p50 {:.1f}us, p90 {:.1f}us, p99 {:.1f}us, max {:.1f}us", name, percentile(0.5), percentile(0.9), percentile(0.99), samples.back());
+}
+
+// Time from submission to the start of a job on a worker, one at a time
+static std::vector<double> measureLatency(JobSystem& jobs, uint32_t samples, std::chrono::microseconds pause){
+    std::vector<double> latencies;
+
+    for(uint32_t i = 0; i < samples; i++){
+        std::this_thread::sleep_for(pause);
+
+        std::atomic<bool> started{false};
+        double latencyUs = 0.0;
+        JobCounter counter;
+
+        auto submitTime = std::chrono::high_resolution_clock::now();
+        jobs.run([&](){
+            std::chrono::duration<double, std::micro> elapsed = std::chrono::high_resolution_clock::now() - submitTime;
+            latencyUs = elapsed.count();
+            started = true;
+        }, &counter);
+
+        // Spin instead of wait(), which would run the job on this thread
+        while(!started){
+            std::this_thread::yield();
+        }
+        while(!counter.done()){}
+
+        latencies.push_back(latencyUs);
+    }
+
+    return latencies;
+}
+
+int main(int argc, char** argv){
+    uint32_t threadCount = 0;
+    uint32_t jobCount = 1000000;
+    uint32_t samples = 2000;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+
+        if(arg == "--threads" && i + 1 < argc){
+            threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if(arg == "--jobs" && i + 1 < argc){
+            jobCount = std::max(1, std::atoi(argv[++i]));
+        } else if(arg == "--samples" && i + 1 < argc){
+            samples = std::max(1, std::atoi(argv[++i]));
+        } else {
+            printUsage();
+            return EXIT_FAILURE;
+        }
+    }
+
+    JobSystem jobs;
+    jobs.setup(threadCount == 0 ? 0 : threadCount - 1);
+    fmt::println("{} threads", jobs.threadCount());
+
+    // Baseline: the same work without any scheduling
+    auto startTime = std::chrono::high_resolution_clock::now();
+    uint64_t serial = 0;
+    for(uint32_t i = 0; i < jobCount; i++){
+        serial += work(i);
+    }
+    sink += serial;
+    double serialMs = elapsedMs(startTime);
+    fmt::println("Serial: {} work items in {:.2f}ms", jobCount, serialMs);
+
+    // Every job from the main thread's deque, the workers steal all but what the main thread pops while waiting
+    {
+        startTime = std::chrono::high_resolution_clock::now();
+
+        JobCounter counter;
+        for(uint32_t i = 0; i < jobCount; i++){
+            jobs.run([i](){ sink += work(i); }, &counter);
+        }
+        jobs.wait(counter);
+
+        double ms = elapsedMs(startTime);
+        fmt::println("Submitted from one thread: {:.2f}ms, {:.2f}M jobs/s, {:.2f}x serial", ms, jobCount / ms / 1000.0, serialMs / ms);
+    }
+
+    // A tree of jobs, so submission is spread over the workers as well
+    {
+        startTime = std::chrono::high_resolution_clock::now();
+
+        const uint32_t fanOut = 64;
+        uint32_t parents = (jobCount + fanOut - 1) / fanOut;
+
+        JobCounter counter;
+        for(uint32_t p = 0; p < parents; p++){
+            jobs.run([&jobs, &counter, p, fanOut, jobCount](){
+                for(uint32_t i = p * fanOut; i < std::min((p + 1) * fanOut, jobCount); i++){
+                    jobs.run([i](){ sink += work(i); }, &counter);
+                }
+            }, &counter);
+        }
+        jobs.wait(counter);
+
+        double ms = elapsedMs(startTime);
+        fmt::println("Spawned by {} jobs: {:.2f}ms, {:.2f}M jobs/s, {:.2f}x serial", parents, ms, (jobCount + parents) / ms / 1000.0, serialMs / ms);
+    }
+
+    {
+        startTime = std::chrono::high_resolution_clock::now();
+
+        jobs.parallelFor(jobCount, [](size_t begin, size_t end){
+            uint64_t sum = 0;
+            for(size_t i = begin; i < end; i++){
+                sum += work(i);
+            }
+            sink += sum;
+        });
+
+        double ms = elapsedMs(startTime);
+        fmt::println("parallelFor: {:.2f}ms, {:.2f}x serial", ms, serialMs / ms);
+    }
+
+    // Workers still spinning from the submission before
+    std::vector<double> awake = measureLatency(jobs, samples, std::chrono::microseconds(0));
+    printLatency("Latency, workers awake", awake);
+
+    // Long enough for every worker to give up spinning and sleep
+    std::vector<double> asleep = measureLatency(jobs, std::min(samples, 500u), std::chrono::microseconds(2000));
+    printLatency("Latency, workers asleep", asleep);
+
+    jobs.printStats();
+    jobs.cleanup();
+
+    return sink == 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
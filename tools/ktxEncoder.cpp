@@ -0,0 +1,213 @@
+// Offline texture compressor, converts PNG/JPEG/TGA sources into KTX2 files with a full BCn mip chain.
+//
+//     KtxEncoder [--format auto|bc1|bc3|bc4|bc5] [--linear] [--threads N] [--output dir] images...
+//
+// auto picks BC3 for images with alpha and BC1 otherwise, use bc5 for tangent space normal maps.
+// Sources are colour data (sRGB) unless --linear is given. Images are decoded in parallel, then every
+// level is split into rows of blocks that are encoded by all threads.
+
+#include "ktx2.h"
+#include "blockCompression.h"
+
+#include <vulkan/vk_enum_string_helper.h>
+#include <fmt/format.h>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include <stb_image.h>
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SourceImage{
+    std::string path;
+    std::filesystem::path outputPath;
+    size_t sourceBytes{0};
+
+    VkFormat format{VK_FORMAT_UNDEFINED};
+    uint32_t width{0}, height{0};
+
+    std::vector<std::vector<uint8_t>> mips;         // RGBA8
+    std::vector<std::vector<uint8_t>> compressed;
+};
+
+struct EncodeJob{
+    size_t image;
+    uint32_t level;
+    uint32_t firstRow, rowCount;
+};
+
+static void printUsage(){
+    fmt::println("usage: KtxEncoder [--format auto|bc1|bc3|bc4|bc5] [--linear] [--threads N] [--output dir] images...");
+}
+
+static double megabytes(size_t bytes){
+    return double(bytes) / (1024.0 * 1024.0);
+}
+
+int main(int argc, char** argv){
+    std::string formatName = "auto";
+    bool linear = false;
+    uint32_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    std::filesystem::path outputDirectory;
+    std::vector<SourceImage> images;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+
+        if(arg == "--format" && i + 1 < argc){
+            formatName = argv[++i];
+        } else if(arg == "--linear"){
+            linear = true;
+        } else if(arg == "--threads" && i + 1 < argc){
+            threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if(arg == "--output" && i + 1 < argc){
+            outputDirectory = argv[++i];
+        } else if(arg.starts_with("--")){
+            printUsage();
+            return EXIT_FAILURE;
+        } else {
+            images.push_back({arg});
+        }
+    }
+
+    if(images.empty() || (formatName != "auto" && formatName != "bc1" && formatName != "bc3" && formatName != "bc4" && formatName != "bc5")){
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+
+    auto runThreads = [threadCount](auto&& work){
+        std::vector<std::thread> threads;
+        for(uint32_t i = 0; i < threadCount; i++){
+            threads.emplace_back(work);
+        }
+        for(std::thread& thread: threads){
+            thread.join();
+        }
+    };
+
+    // Decode and build the mip chains, one image per task
+    std::atomic<size_t> nextImage{0};
+    std::atomic<bool> failed{false};
+
+    runThreads([&](){
+        for(size_t i = nextImage++; i < images.size(); i = nextImage++){
+            SourceImage& image = images[i];
+
+            int width, height, channels;
+            stbi_uc* pixels = stbi_load(image.path.c_str(), &width, &height, &channels, STBI_rgb_alpha);
+            if(!pixels){
+                fmt::println("Failed to load {}: {}", image.path, stbi_failure_reason());
+                failed = true;
+                continue;
+            }
+
+            std::error_code error;
+            image.sourceBytes = std::filesystem::file_size(image.path, error);
+            image.width = static_cast<uint32_t>(width);
+            image.height = static_cast<uint32_t>(height);
+
+            image.mips.emplace_back(pixels, pixels + size_t(width) * height * 4);
+            stbi_image_free(pixels);
+
+            if(formatName == "auto"){
+                image.format = BlockCompression::chooseFormat(image.mips[0], linear);
+            } else if(formatName == "bc1"){
+                image.format = linear ? VK_FORMAT_BC1_RGB_UNORM_BLOCK : VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+            } else if(formatName == "bc3"){
+                image.format = linear ? VK_FORMAT_BC3_UNORM_BLOCK : VK_FORMAT_BC3_SRGB_BLOCK;
+            } else if(formatName == "bc4"){
+                image.format = VK_FORMAT_BC4_UNORM_BLOCK;
+            } else {
+                image.format = VK_FORMAT_BC5_UNORM_BLOCK;
+            }
+
+            image.mips = BlockCompression::buildMips(std::move(image.mips[0]), image.width, image.height, BlockCompression::isSrgb(image.format));
+
+            image.compressed.resize(image.mips.size());
+            for(uint32_t level = 0; level < image.mips.size(); level++){
+                image.compressed[level].resize(Ktx2::levelSize(image.format, std::max(image.width >> level, 1u), std::max(image.height >> level, 1u)));
+            }
+
+            std::filesystem::path output = image.path;
+            output.replace_extension(".ktx2");
+            image.outputPath = outputDirectory.empty() ? output : outputDirectory / output.filename();
+        }
+    });
+
+    // Split every level into rows of blocks so a single large texture still uses all threads
+    const uint32_t ROWS_PER_JOB = 16;
+    std::vector<EncodeJob> jobs;
+
+    for(size_t i = 0; i < images.size(); i++){
+        for(uint32_t level = 0; level < images[i].mips.size(); level++){
+            uint32_t blockRows = (std::max(images[i].height >> level, 1u) + 3) / 4;
+
+            for(uint32_t row = 0; row < blockRows; row += ROWS_PER_JOB){
+                jobs.push_back({i, level, row, std::min(ROWS_PER_JOB, blockRows - row)});
+            }
+        }
+    }
+
+    std::atomic<size_t> nextJob{0};
+
+    runThreads([&](){
+        for(size_t j = nextJob++; j < jobs.size(); j = nextJob++){
+            const EncodeJob& job = jobs[j];
+            SourceImage& image = images[job.image];
+
+            uint32_t width = std::max(image.width >> job.level, 1u), height = std::max(image.height >> job.level, 1u);
+            BlockCompression::encodeRows(image.format, image.mips[job.level].data(), width, height, job.firstRow, job.rowCount, image.compressed[job.level].data());
+        }
+    });
+
+    size_t writtenCount = 0, sourceBytes = 0, rgbaBytes = 0, compressedBytes = 0;
+
+    for(SourceImage& image: images){
+        if(image.mips.empty())
+            continue;
+
+        std::vector<char> file = Ktx2::write(image.format, image.width, image.height, image.compressed);
+
+        std::ofstream stream(image.outputPath, std::ios::binary);
+        stream.write(file.data(), file.size());
+        if(!stream){
+            fmt::println("Failed to write {}", image.outputPath.string());
+            failed = true;
+            continue;
+        }
+
+        size_t imageRgbaBytes = 0, imageCompressedBytes = 0;
+        for(size_t level = 0; level < image.mips.size(); level++){
+            imageRgbaBytes += image.mips[level].size();
+            imageCompressedBytes += image.compressed[level].size();
+        }
+
+        fmt::println("{} -> {} ({}x{}, {} mips, {}): {:.2f}MB -> {:.2f}MB", image.path, image.outputPath.string(), image.width, image.height,
+            image.mips.size(), string_VkFormat(image.format), megabytes(imageRgbaBytes), megabytes(imageCompressedBytes));
+
+        writtenCount++;
+        sourceBytes += image.sourceBytes;
+        rgbaBytes += imageRgbaBytes;
+        compressedBytes += imageCompressedBytes;
+    }
+
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+
+    if(compressedBytes > 0){
+        // Texture fetches read whole blocks, so the sampling bandwidth shrinks by the same ratio as the memory
+        fmt::println("{} images in {:.2f}ms on {} threads", writtenCount, elapsed.count(), threadCount);
+        fmt::println("    files on disk {:.2f}MB", megabytes(sourceBytes));
+        fmt::println("    VRAM as RGBA8 {:.2f}MB, compressed {:.2f}MB, {:.1f}x smaller ({:.2f}MB saved)", megabytes(rgbaBytes), megabytes(compressedBytes),
+            double(rgbaBytes) / double(compressedBytes), megabytes(rgbaBytes - compressedBytes));
+        fmt::println("    sampling bandwidth {:.1f} bits per texel instead of 32", 32.0 * double(compressedBytes) / double(rgbaBytes));
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
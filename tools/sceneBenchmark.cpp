@@ -0,0 +1,370 @@
+// Compares loading a scene from glTF against loading its cooked form, both into memory standing in for a staging buffer.
+//
+//     SceneBenchmark [--iterations N] [--threads N] [--output file.scene] scene.gltf|scene.glb
+//
+// The glTF file is imported once and written out as a cooked scene next to it, as is, then both are loaded
+// repeatedly. Every run after the first reads from a warm page cache, so this compares parsing and conversion
+// against copying rather than disk speed.
+//
+// Afterwards the scene's draws are recorded into secondary command buffers the way Renderer::recordGeometryBatches
+// does, split with splitDraws into 1, 2, 4 ... batches on as many threads. That needs a Vulkan 1.3 device and the
+// compiled shaders, without them it's skipped.
+
+#include "types.h"
+#include "gltfLoader.h"
+#include "cookedScene.h"
+#include "gltfMesh.h"
+#include "jobSystem.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cfloat>
+#include <filesystem>
+
+struct Timing{
+    double bestMs{DBL_MAX};
+    double totalMs{0.0};
+    uint32_t runs{0};
+
+    void add(double ms){
+        bestMs = std::min(bestMs, ms);
+        totalMs += ms;
+        runs++;
+    }
+
+    double averageMs() const {
+        return runs == 0 ? 0.0 : totalMs / runs;
+    }
+};
+
+static void printUsage(){
+    fmt::println("usage: SceneBenchmark [--iterations N] [--threads N] [--output file.scene] scene.gltf|scene.glb");
+}
+
+static double elapsedMs(std::chrono::high_resolution_clock::time_point startTime){
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - startTime;
+    return elapsed.count();
+}
+
+// Recording only, nothing is ever submitted, so the buffers behind the draws can stay empty
+static void benchmarkRecording(const std::filesystem::path& inputPath, const std::vector<Submesh>& submeshes, VkIndexType indexType, uint32_t iterations, uint32_t threadCount,
+    JobSystem& jobs){
+    vkb::InstanceBuilder instanceBuilder;
+    auto instanceResult = instanceBuilder.set_app_name("SceneBenchmark").require_api_version(1, 3, 0).set_headless().build();
+    if(!instanceResult){
+        fmt::println("    recording skipped, no Vulkan 1.3 instance: {}", instanceResult.error().message());
+        return;
+    }
+    vkb::Instance instance = instanceResult.value();
+
+    VkPhysicalDeviceVulkan13Features features13{};
+    features13.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_3_FEATURES;
+    features13.dynamicRendering = VK_TRUE;
+
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.bufferDeviceAddress = VK_TRUE;
+
+    vkb::PhysicalDeviceSelector selector{instance};
+    auto physicalResult = selector.set_minimum_version(1, 3).set_required_features_13(features13).set_required_features_12(features12).require_present(false).select();
+    if(!physicalResult){
+        fmt::println("    recording skipped, no suitable device: {}", physicalResult.error().message());
+        vkb::destroy_instance(instance);
+        return;
+    }
+
+    vkb::DeviceBuilder deviceBuilder{physicalResult.value()};
+    auto deviceResult = deviceBuilder.build();
+    if(!deviceResult){
+        fmt::println("    recording skipped, device creation failed: {}", deviceResult.error().message());
+        vkb::destroy_instance(instance);
+        return;
+    }
+    vkb::Device vkbDevice = deviceResult.value();
+    VkDevice device = vkbDevice.device;
+    uint32_t queueFamily = vkbDevice.get_queue_index(vkb::QueueType::graphics).value();
+
+    VmaAllocatorCreateInfo allocatorInfo{};
+    allocatorInfo.physicalDevice = physicalResult.value().physical_device;
+    allocatorInfo.device = device;
+    allocatorInfo.instance = instance.instance;
+    allocatorInfo.flags = VMA_ALLOCATOR_CREATE_BUFFER_DEVICE_ADDRESS_BIT;
+
+    VmaAllocator allocator;
+    vmaCreateAllocator(&allocatorInfo, &allocator);
+
+    const VkFormat colorFormat = VK_FORMAT_R16G16B16A16_SFLOAT, depthFormat = VK_FORMAT_D32_SFLOAT;
+
+    GltfMesh mesh(inputPath.string());
+    mesh.submeshes = submeshes;
+    mesh.indexType = indexType;
+    mesh.indexBuffer = Utility::createBuffer(allocator, sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VMA_MEMORY_USAGE_GPU_ONLY);
+
+    std::vector<DescriptorAllocator::PoolSizeRatio> ratios = {{VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 1}};
+    DescriptorAllocator descriptors{};
+    descriptors.setupPool(device, 1, ratios);
+
+    bool ready = true;
+    try {
+        mesh.setup(device, allocator, colorFormat, depthFormat);
+        mesh.update(device, allocator, descriptors);
+    } catch(const std::exception& e){
+        fmt::println("    recording skipped: {}", e.what());
+        ready = false;
+    }
+
+    if(ready){
+        // One pool per worker, like the frames' secondary pools
+        std::vector<VkCommandPool> pools(jobs.threadCount());
+        std::vector<VkCommandBuffer> secondaries(jobs.threadCount() * threadCount);
+
+        for(uint32_t i = 0; i < pools.size(); i++){
+            VkCommandPoolCreateInfo poolInfo = Initializers::commandPoolCreateInfo(queueFamily, 0);
+            VK_CHECK(vkCreateCommandPool(device, &poolInfo, nullptr, &pools[i]));
+
+            VkCommandBufferAllocateInfo allocInfo = Initializers::commandBufferAllocateInfo(pools[i], threadCount);
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            VK_CHECK(vkAllocateCommandBuffers(device, &allocInfo, &secondaries[i * threadCount]));
+        }
+
+        VkCommandBufferInheritanceRenderingInfo renderingInheritance{};
+        renderingInheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+        renderingInheritance.colorAttachmentCount = 1;
+        renderingInheritance.pColorAttachmentFormats = &colorFormat;
+        renderingInheritance.depthAttachmentFormat = depthFormat;
+        renderingInheritance.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkCommandBufferInheritanceInfo inheritance{};
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritance.pNext = &renderingInheritance;
+
+        glm::mat4 viewProj = glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 1000.f) * glm::lookAt(initialEye, initialCenter, initialUp);
+        std::vector<Mesh*> meshes = {&mesh};
+
+        fmt::println("    recording {} draws into secondaries, {} iterations:", mesh.drawCount(), iterations);
+
+        double singleMs = 0.0;
+        for(uint32_t batchCount = 1; batchCount <= threadCount; batchCount *= 2){
+            std::vector<std::vector<DrawRange>> ranges = splitDraws(meshes, batchCount);
+            Timing timing;
+
+            for(uint32_t i = 0; i < iterations; i++){
+                for(VkCommandPool pool: pools){
+                    VK_CHECK(vkResetCommandPool(device, pool, 0));
+                }
+                std::vector<uint32_t> used(pools.size(), 0);
+
+                auto startTime = std::chrono::high_resolution_clock::now();
+
+                jobs.parallelFor(batchCount, 1, [&](size_t begin, size_t end){
+                    for(size_t batch = begin; batch < end; batch++){
+                        uint32_t worker = JobSystem::workerIndex();
+                        VkCommandBuffer secondary = secondaries[worker * threadCount + used[worker]++];
+
+                        VkCommandBufferBeginInfo beginInfo = Initializers::commandBufferBeginInfo(VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT);
+                        beginInfo.pInheritanceInfo = &inheritance;
+                        VK_CHECK(vkBeginCommandBuffer(secondary, &beginInfo));
+
+                        for(const DrawRange& range: ranges[batch]){
+                            range.mesh->drawRange(secondary, viewProj, range.first, range.last);
+                        }
+
+                        VK_CHECK(vkEndCommandBuffer(secondary));
+                    }
+                });
+
+                timing.add(elapsedMs(startTime));
+            }
+
+            if(batchCount == 1){
+                singleMs = timing.bestMs;
+            }
+
+            fmt::println("    {:>2} batches  best {:8.3f}ms, average {:8.3f}ms, {:5.2f}x", batchCount, timing.bestMs, timing.averageMs(),
+                timing.bestMs == 0.0 ? 0.0 : singleMs / timing.bestMs);
+        }
+
+        for(VkCommandPool pool: pools){
+            vkDestroyCommandPool(device, pool, nullptr);
+        }
+    }
+
+    mesh.pipelineDeletionQueue.flush();
+    mesh.uniformDeletionQueue.flush();
+    mesh.deletionQueue.flush();
+    Utility::destroyBuffer(allocator, mesh.indexBuffer);
+    descriptors.destroyPool(device);
+
+    vmaDestroyAllocator(allocator);
+    vkb::destroy_device(vkbDevice);
+    vkb::destroy_instance(instance);
+}
+
+static int benchmarkScene(const std::filesystem::path& inputPath, std::filesystem::path outputPath, uint32_t iterations, uint32_t threadCount, JobSystem& jobs){
+    // A single thread decodes on the caller, not on the job system's minimum of two
+    JobSystem* decodeJobs = threadCount > 1 ? &jobs : nullptr;
+
+    if(outputPath.empty()){
+        outputPath = inputPath;
+        outputPath.replace_extension(CookedScene::EXTENSION);
+    }
+
+    // Cook the scene without any processing, so both paths produce the same bytes
+    std::vector<char> vertices, indices;
+    std::vector<CookedScene::SubmeshRecord> submeshes;
+    std::vector<Submesh> sceneSubmeshes;
+    VkIndexType sceneIndexType;
+    {
+        GltfImporter importer;
+        if(!importer.open(inputPath)){
+            return EXIT_FAILURE;
+        }
+
+        VkIndexType indexType = importer.indexType();
+        vertices.resize(importer.vertexCount() * sizeof(Vertex));
+        indices.resize(importer.indexCount() * MeshOptimizer::indexSize(indexType));
+
+        importer.decode((Vertex*)vertices.data(), indices.data(), decodeJobs);
+
+        for(const Submesh& submesh: importer.submeshes){
+            CookedScene::SubmeshRecord record{submesh.firstIndex, submesh.indexCount, submesh.vertexOffset, 0, {}};
+            memcpy(record.transform, glm::value_ptr(submesh.transform), sizeof(record.transform));
+            submeshes.push_back(record);
+        }
+
+        sceneSubmeshes = importer.submeshes;
+        sceneIndexType = indexType;
+
+        CookedScene::Writer writer;
+        writer.header.vertexFormat = VERTEX_FORMAT_FULL;
+        writer.header.indexType = indexType;
+        writer.header.vertexCount = importer.vertexCount();
+        writer.header.indexCount = importer.indexCount();
+
+        writer.addChunk(CookedScene::CHUNK_VERTICES, vertices.data(), vertices.size());
+        writer.addChunk(CookedScene::CHUNK_INDICES, indices.data(), indices.size());
+        writer.addChunk(CookedScene::CHUNK_SUBMESHES, submeshes.data(), submeshes.size() * sizeof(CookedScene::SubmeshRecord));
+
+        std::string error;
+        if(!writer.write(outputPath, error)){
+            fmt::println("Failed to write {}: {}", outputPath.string(), error);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const size_t geometryBytes = vertices.size() + indices.size();
+
+    // Touched once up front, so page faults on the destination don't count towards either loader
+    std::vector<char> staging(std::max<size_t>(geometryBytes, 1), 0);
+
+    Timing gltfTiming, cookedTiming, verifiedTiming;
+    GltfImportStats lastImport;
+
+    for(uint32_t i = 0; i < iterations; i++){
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        GltfImporter importer;
+        if(!importer.open(inputPath)){
+            return EXIT_FAILURE;
+        }
+        importer.decode((Vertex*)staging.data(), staging.data() + vertices.size(), decodeJobs);
+
+        gltfTiming.add(elapsedMs(startTime));
+        lastImport = importer.stats;
+    }
+
+    if(memcmp(staging.data(), vertices.data(), vertices.size()) != 0 || memcmp(staging.data() + vertices.size(), indices.data(), indices.size()) != 0){
+        fmt::println("glTF import isn't deterministic, results differ between runs");
+        return EXIT_FAILURE;
+    }
+
+    for(uint32_t i = 0; i < iterations * 2; i++){
+        bool verify = i % 2 == 1;
+        auto startTime = std::chrono::high_resolution_clock::now();
+
+        CookedScene::Scene scene;
+        std::string error;
+        if(!scene.open(outputPath, error, verify)){
+            fmt::println("Failed to load {}: {}", outputPath.string(), error);
+            return EXIT_FAILURE;
+        }
+
+        std::span<const char> vertexChunk = scene.chunk(CookedScene::CHUNK_VERTICES);
+        std::span<const char> indexChunk = scene.chunk(CookedScene::CHUNK_INDICES);
+
+        memcpy(staging.data(), vertexChunk.data(), vertexChunk.size());
+        memcpy(staging.data() + vertexChunk.size(), indexChunk.data(), indexChunk.size());
+
+        (verify ? verifiedTiming : cookedTiming).add(elapsedMs(startTime));
+    }
+
+    if(memcmp(staging.data(), vertices.data(), vertices.size()) != 0 || memcmp(staging.data() + vertices.size(), indices.data(), indices.size()) != 0){
+        fmt::println("Cooked scene doesn't match the glTF import");
+        return EXIT_FAILURE;
+    }
+
+    std::error_code sizeError;
+    double cookedMegabytes = double(std::filesystem::file_size(outputPath, sizeError)) / (1024.0 * 1024.0);
+    double geometryMegabytes = double(geometryBytes) / (1024.0 * 1024.0);
+
+    auto report = [&](const char* name, const Timing& timing){
+        double throughput = timing.bestMs == 0.0 ? 0.0 : geometryMegabytes / (timing.bestMs / 1000.0);
+        fmt::println("    {:<18} best {:8.3f}ms, average {:8.3f}ms, {:8.1f}MB/s", name, timing.bestMs, timing.averageMs(), throughput);
+    };
+
+    fmt::println("{}: {} submeshes, {} vertices, {:.2f}MB of geometry", inputPath.string(), submeshes.size(), lastImport.vertexCount, geometryMegabytes);
+    fmt::println("    glTF {:.2f}MB on disk, cooked {:.2f}MB ({}), {} iterations", double(lastImport.sourceBytes) / (1024.0 * 1024.0), cookedMegabytes, outputPath.string(), iterations);
+
+    report("glTF import", gltfTiming);
+    report("cooked", cookedTiming);
+    report("cooked + verify", verifiedTiming);
+
+    if(cookedTiming.bestMs > 0.0){
+        fmt::println("    cooked loads {:.1f}x faster ({:.1f}x with checksums)", gltfTiming.bestMs / cookedTiming.bestMs, gltfTiming.bestMs / verifiedTiming.bestMs);
+    }
+
+    benchmarkRecording(inputPath, sceneSubmeshes, sceneIndexType, iterations, threadCount, jobs);
+
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv){
+    uint32_t iterations = 10;
+    uint32_t threadCount = 0;
+    std::filesystem::path inputPath, outputPath;
+
+    for(int i = 1; i < argc; i++){
+        std::string arg = argv[i];
+
+        if(arg == "--iterations" && i + 1 < argc){
+            iterations = std::max(1, std::atoi(argv[++i]));
+        } else if(arg == "--threads" && i + 1 < argc){
+            threadCount = std::max(1, std::atoi(argv[++i]));
+        } else if(arg == "--output" && i + 1 < argc){
+            outputPath = argv[++i];
+        } else if(arg.starts_with("--") || !inputPath.empty()){
+            printUsage();
+            return EXIT_FAILURE;
+        } else {
+            inputPath = arg;
+        }
+    }
+
+    if(inputPath.empty()){
+        printUsage();
+        return EXIT_FAILURE;
+    }
+
+    if(threadCount == 0){
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Shared by the glTF decode and the recording benchmark, the job system has at least one worker thread
+    JobSystem jobs;
+    jobs.setup(std::max(threadCount, 2u) - 1);
+
+    int result = benchmarkScene(inputPath, outputPath, iterations, threadCount, jobs);
+
+    jobs.cleanup();
+    return result;
+}